@@ -19,6 +19,7 @@
  */
 
 #include "system.h"
+#include "job.h"
 #include "calc.h"
 #include "util.h"
 #include "keyframe.h"
@@ -30,6 +31,64 @@
 
 IK_FLOOR_FUNC g_ik_floor_func = NULL;
 
+ANM_LOD_POLICY g_anm_lod_policy = {
+	{0.25f, 0.12f, 0.05f},
+	{1, 1, 2, 4, 8},
+	{
+		E_ANMLODFLG_IK | E_ANMLODFLG_BLEND,
+		E_ANMLODFLG_BLEND | E_ANMLODFLG_CACHE,
+		E_ANMLODFLG_CACHE,
+		E_ANMLODFLG_SUBSET | E_ANMLODFLG_CACHE,
+		E_ANMLODFLG_SUBSET | E_ANMLODFLG_CACHE
+	},
+	3
+};
+
+ANM_LOD_STATS g_anm_lod_stats;
+
+ANM_SYS g_anm_sys;
+
+void ANM_sys_init(int cache_size, int max_jnt) {
+	ANM_CACHE* pCache = &g_anm_sys.cache;
+	int size = 1;
+
+	memset(pCache, 0, sizeof(ANM_CACHE));
+	if (cache_size <= 0) return;
+	while (size < cache_size) size <<= 1;
+	pCache->size = size;
+	pCache->max_slot = D_ALIGN(max_jnt + E_ANMPOSEXT_MAX, 4);
+	pCache->frame_div = 1.0f;
+	pCache->pKey = (ANM_CACHE_KEY*)SYS_malloc(size * sizeof(ANM_CACHE_KEY));
+	pCache->pState = (sys_i32*)SYS_malloc(size * sizeof(sys_i32));
+	pCache->pPose = (float*)SYS_malloc(size * pCache->max_slot * E_ANMPOSECH_MAX * sizeof(float));
+	ANM_cache_reset();
+}
+
+void ANM_sys_reset() {
+	ANM_CACHE* pCache = &g_anm_sys.cache;
+
+	if (pCache->pKey) {
+		SYS_free(pCache->pKey);
+		SYS_free(pCache->pState);
+		SYS_free(pCache->pPose);
+	}
+	memset(pCache, 0, sizeof(ANM_CACHE));
+	if (g_anm_sys.pClip_dict) {
+		DICT_destroy(g_anm_sys.pClip_dict);
+		g_anm_sys.pClip_dict = NULL;
+	}
+}
+
+void ANM_cache_reset() {
+	ANM_CACHE* pCache = &g_anm_sys.cache;
+
+	if (pCache->pState) {
+		memset(pCache->pState, 0, pCache->size * sizeof(sys_i32));
+	}
+	pCache->nb_hit = 0;
+	pCache->nb_miss = 0;
+}
+
 static void KC_init(ANIMATION* pAnm, KIN_CHAIN* pKC, JOINT* pJnt_top, JOINT* pJnt_rot, JOINT* pJnt_end) {
 	memset(pKC, 0, sizeof(KIN_CHAIN));
 	pKC->pJnt_top = pJnt_top;
@@ -40,22 +99,269 @@ static void KC_init(ANIMATION* pAnm, KIN_CHAIN* pKC, JOINT* pJnt_top, JOINT* pJn
 	pKC->attr = E_KCATTR_FLOORADJ;
 }
 
+static void Pose_init(ANM_POSE* pPose, float* pMem, int nb_slot) {
+	int i;
+	for (i = 0; i < E_ANMPOSECH_MAX; ++i) {
+		pPose->pCh[i] = pMem + i*nb_slot;
+	}
+	pPose->nb_slot = nb_slot;
+}
+
+static void Pose_cpy(ANM_POSE* pDst, ANM_POSE* pSrc) {
+	memcpy(pDst->pCh[0], pSrc->pCh[0], E_ANMPOSECH_MAX*pSrc->nb_slot*sizeof(float));
+}
+
+static void Pose_set_pos(ANM_POSE* pPose, int slot, QVEC pos) {
+	UVEC tpos;
+	tpos.qv = pos;
+	pPose->pCh[E_ANMPOSECH_TX][slot] = tpos.x;
+	pPose->pCh[E_ANMPOSECH_TY][slot] = tpos.y;
+	pPose->pCh[E_ANMPOSECH_TZ][slot] = tpos.z;
+}
+
+/* same rotation as MTX_rot_xyz */
+static void Pose_set_rot(ANM_POSE* pPose, int slot, UVEC3* pRot) {
+	float sx = sinf(pRot->x*0.5f);
+	float cx = cosf(pRot->x*0.5f);
+	float sy = sinf(pRot->y*0.5f);
+	float cy = cosf(pRot->y*0.5f);
+	float sz = sinf(pRot->z*0.5f);
+	float cz = cosf(pRot->z*0.5f);
+	pPose->pCh[E_ANMPOSECH_QX][slot] = cz*cy*sx - sz*sy*cx;
+	pPose->pCh[E_ANMPOSECH_QY][slot] = cz*sy*cx + sz*cy*sx;
+	pPose->pCh[E_ANMPOSECH_QZ][slot] = sz*cy*cx - cz*sy*sx;
+	pPose->pCh[E_ANMPOSECH_QW][slot] = cz*cy*cx + sz*sy*sx;
+}
+
+#define _D_POSE_LD(_pPose, _ch, _i) _mm_load_ps(&(_pPose)->pCh[E_ANMPOSECH_##_ch][_i])
+#define _D_POSE_ST(_pPose, _ch, _i, _v) _mm_store_ps(&(_pPose)->pCh[E_ANMPOSECH_##_ch][_i], _v)
+
+static D_FORCE_INLINE QVEC Soa_dot4(QVEC ax, QVEC ay, QVEC az, QVEC aw, QVEC bx, QVEC by, QVEC bz, QVEC bw) {
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+}
+
+/* a*b for 4 quaternions at once, same product as QUAT_mul */
+static D_FORCE_INLINE void Soa_qmul(QVEC* pRes, QVEC ax, QVEC ay, QVEC az, QVEC aw, QVEC bx, QVEC by, QVEC bz, QVEC bw) {
+	pRes[0] = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(aw, bx), _mm_mul_ps(ax, bw)), _mm_mul_ps(ay, bz)), _mm_mul_ps(az, by));
+	pRes[1] = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(aw, by), _mm_mul_ps(ay, bw)), _mm_mul_ps(az, bx)), _mm_mul_ps(ax, bz));
+	pRes[2] = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(aw, bz), _mm_mul_ps(az, bw)), _mm_mul_ps(ax, by)), _mm_mul_ps(ay, bx));
+	pRes[3] = _mm_sub_ps(_mm_mul_ps(aw, bw), _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz)));
+}
+
+static D_FORCE_INLINE QVEC Soa_sign_mask() {
+	return D_M128(_mm_set1_epi32(0x80000000));
+}
+
+static void Pose_accum(ANM_POSE* pAcc, ANM_POSE* pSrc, float weight, float* pMask, int first) {
+	int i;
+	QVEC w, ws, d, sgn;
+	QVEC qx, qy, qz, qw;
+	QVEC wgt = _mm_set1_ps(weight);
+	QVEC wmin = _mm_set1_ps(1e-6f);
+	QVEC smask = Soa_sign_mask();
+	QVEC zero = _mm_setzero_ps();
+
+	for (i = 0; i < pAcc->nb_slot; i += 4) {
+		w = pMask ? _mm_mul_ps(wgt, _mm_load_ps(&pMask[i])) : wgt;
+		qx = _D_POSE_LD(pSrc, QX, i);
+		qy = _D_POSE_LD(pSrc, QY, i);
+		qz = _D_POSE_LD(pSrc, QZ, i);
+		qw = _D_POSE_LD(pSrc, QW, i);
+		if (first) {
+			/* the first input stays in place where all weights are masked out */
+			w = _mm_max_ps(w, wmin);
+			_D_POSE_ST(pAcc, QX, i, _mm_mul_ps(qx, w));
+			_D_POSE_ST(pAcc, QY, i, _mm_mul_ps(qy, w));
+			_D_POSE_ST(pAcc, QZ, i, _mm_mul_ps(qz, w));
+			_D_POSE_ST(pAcc, QW, i, _mm_mul_ps(qw, w));
+			_D_POSE_ST(pAcc, TX, i, _mm_mul_ps(_D_POSE_LD(pSrc, TX, i), w));
+			_D_POSE_ST(pAcc, TY, i, _mm_mul_ps(_D_POSE_LD(pSrc, TY, i), w));
+			_D_POSE_ST(pAcc, TZ, i, _mm_mul_ps(_D_POSE_LD(pSrc, TZ, i), w));
+			_D_POSE_ST(pAcc, WGT, i, w);
+		} else {
+			d = Soa_dot4(_D_POSE_LD(pAcc, QX, i), _D_POSE_LD(pAcc, QY, i), _D_POSE_LD(pAcc, QZ, i), _D_POSE_LD(pAcc, QW, i), qx, qy, qz, qw);
+			sgn = _mm_and_ps(_mm_cmplt_ps(d, zero), smask);
+			ws = _mm_xor_ps(w, sgn);
+			_D_POSE_ST(pAcc, QX, i, _mm_add_ps(_D_POSE_LD(pAcc, QX, i), _mm_mul_ps(qx, ws)));
+			_D_POSE_ST(pAcc, QY, i, _mm_add_ps(_D_POSE_LD(pAcc, QY, i), _mm_mul_ps(qy, ws)));
+			_D_POSE_ST(pAcc, QZ, i, _mm_add_ps(_D_POSE_LD(pAcc, QZ, i), _mm_mul_ps(qz, ws)));
+			_D_POSE_ST(pAcc, QW, i, _mm_add_ps(_D_POSE_LD(pAcc, QW, i), _mm_mul_ps(qw, ws)));
+			_D_POSE_ST(pAcc, TX, i, _mm_add_ps(_D_POSE_LD(pAcc, TX, i), _mm_mul_ps(_D_POSE_LD(pSrc, TX, i), w)));
+			_D_POSE_ST(pAcc, TY, i, _mm_add_ps(_D_POSE_LD(pAcc, TY, i), _mm_mul_ps(_D_POSE_LD(pSrc, TY, i), w)));
+			_D_POSE_ST(pAcc, TZ, i, _mm_add_ps(_D_POSE_LD(pAcc, TZ, i), _mm_mul_ps(_D_POSE_LD(pSrc, TZ, i), w)));
+			_D_POSE_ST(pAcc, WGT, i, _mm_add_ps(_D_POSE_LD(pAcc, WGT, i), w));
+		}
+	}
+}
+
+static void Pose_normalize(ANM_POSE* pPose) {
+	int i;
+	QVEC qx, qy, qz, qw, s, iw;
+
+	for (i = 0; i < pPose->nb_slot; i += 4) {
+		qx = _D_POSE_LD(pPose, QX, i);
+		qy = _D_POSE_LD(pPose, QY, i);
+		qz = _D_POSE_LD(pPose, QZ, i);
+		qw = _D_POSE_LD(pPose, QW, i);
+		s = _mm_sqrt_ps(Soa_dot4(qx, qy, qz, qw, qx, qy, qz, qw));
+		_D_POSE_ST(pPose, QX, i, _mm_div_ps(qx, s));
+		_D_POSE_ST(pPose, QY, i, _mm_div_ps(qy, s));
+		_D_POSE_ST(pPose, QZ, i, _mm_div_ps(qz, s));
+		_D_POSE_ST(pPose, QW, i, _mm_div_ps(qw, s));
+		iw = _mm_div_ps(_mm_set1_ps(1.0f), _D_POSE_LD(pPose, WGT, i));
+		_D_POSE_ST(pPose, TX, i, _mm_mul_ps(_D_POSE_LD(pPose, TX, i), iw));
+		_D_POSE_ST(pPose, TY, i, _mm_mul_ps(_D_POSE_LD(pPose, TY, i), iw));
+		_D_POSE_ST(pPose, TZ, i, _mm_mul_ps(_D_POSE_LD(pPose, TZ, i), iw));
+	}
+}
+
+/* pose relative to the reference: q = conj(ref)*q, t = t - ref */
+static void Pose_delta(ANM_POSE* pPose, ANM_POSE* pRef) {
+	int i;
+	QVEC q[4];
+	QVEC smask = Soa_sign_mask();
+
+	for (i = 0; i < pPose->nb_slot; i += 4) {
+		Soa_qmul(q,
+		         _mm_xor_ps(_D_POSE_LD(pRef, QX, i), smask),
+		         _mm_xor_ps(_D_POSE_LD(pRef, QY, i), smask),
+		         _mm_xor_ps(_D_POSE_LD(pRef, QZ, i), smask),
+		         _D_POSE_LD(pRef, QW, i),
+		         _D_POSE_LD(pPose, QX, i), _D_POSE_LD(pPose, QY, i), _D_POSE_LD(pPose, QZ, i), _D_POSE_LD(pPose, QW, i));
+		_D_POSE_ST(pPose, QX, i, q[0]);
+		_D_POSE_ST(pPose, QY, i, q[1]);
+		_D_POSE_ST(pPose, QZ, i, q[2]);
+		_D_POSE_ST(pPose, QW, i, q[3]);
+		_D_POSE_ST(pPose, TX, i, _mm_sub_ps(_D_POSE_LD(pPose, TX, i), _D_POSE_LD(pRef, TX, i)));
+		_D_POSE_ST(pPose, TY, i, _mm_sub_ps(_D_POSE_LD(pPose, TY, i), _D_POSE_LD(pRef, TY, i)));
+		_D_POSE_ST(pPose, TZ, i, _mm_sub_ps(_D_POSE_LD(pPose, TZ, i), _D_POSE_LD(pRef, TZ, i)));
+	}
+}
+
+static void Pose_add(ANM_POSE* pBase, ANM_POSE* pDelta, float weight, float* pMask) {
+	int i;
+	QVEC w, sgn, s;
+	QVEC dx, dy, dz, dw;
+	QVEC q[4];
+	QVEC wgt = _mm_set1_ps(weight);
+	QVEC one = _mm_set1_ps(1.0f);
+	QVEC smask = Soa_sign_mask();
+
+	for (i = 0; i < pBase->nb_slot; i += 4) {
+		w = pMask ? _mm_mul_ps(wgt, _mm_load_ps(&pMask[i])) : wgt;
+		dw = _D_POSE_LD(pDelta, QW, i);
+		sgn = _mm_and_ps(_mm_cmplt_ps(dw, _mm_setzero_ps()), smask);
+		dx = _mm_mul_ps(_mm_xor_ps(_D_POSE_LD(pDelta, QX, i), sgn), w);
+		dy = _mm_mul_ps(_mm_xor_ps(_D_POSE_LD(pDelta, QY, i), sgn), w);
+		dz = _mm_mul_ps(_mm_xor_ps(_D_POSE_LD(pDelta, QZ, i), sgn), w);
+		dw = _mm_add_ps(_mm_sub_ps(one, w), _mm_mul_ps(_mm_xor_ps(dw, sgn), w));
+		s = _mm_sqrt_ps(Soa_dot4(dx, dy, dz, dw, dx, dy, dz, dw));
+		dx = _mm_div_ps(dx, s);
+		dy = _mm_div_ps(dy, s);
+		dz = _mm_div_ps(dz, s);
+		dw = _mm_div_ps(dw, s);
+		Soa_qmul(q, _D_POSE_LD(pBase, QX, i), _D_POSE_LD(pBase, QY, i), _D_POSE_LD(pBase, QZ, i), _D_POSE_LD(pBase, QW, i), dx, dy, dz, dw);
+		_D_POSE_ST(pBase, QX, i, q[0]);
+		_D_POSE_ST(pBase, QY, i, q[1]);
+		_D_POSE_ST(pBase, QZ, i, q[2]);
+		_D_POSE_ST(pBase, QW, i, q[3]);
+		_D_POSE_ST(pBase, TX, i, _mm_add_ps(_D_POSE_LD(pBase, TX, i), _mm_mul_ps(_D_POSE_LD(pDelta, TX, i), w)));
+		_D_POSE_ST(pBase, TY, i, _mm_add_ps(_D_POSE_LD(pBase, TY, i), _mm_mul_ps(_D_POSE_LD(pDelta, TY, i), w)));
+		_D_POSE_ST(pBase, TZ, i, _mm_add_ps(_D_POSE_LD(pBase, TZ, i), _mm_mul_ps(_D_POSE_LD(pDelta, TZ, i), w)));
+	}
+}
+
+static void Rest_init(ANIMATION* pAnm) {
+	int i;
+	ANM_POSE* pRest = &pAnm->rest;
+	JOINT* pJnt = pAnm->pMdl->pJnt;
+	for (i = 0; i < pRest->nb_slot; ++i) {
+		pRest->pCh[E_ANMPOSECH_QX][i] = 0.0f;
+		pRest->pCh[E_ANMPOSECH_QY][i] = 0.0f;
+		pRest->pCh[E_ANMPOSECH_QZ][i] = 0.0f;
+		pRest->pCh[E_ANMPOSECH_QW][i] = 1.0f;
+		pRest->pCh[E_ANMPOSECH_TX][i] = 0.0f;
+		pRest->pCh[E_ANMPOSECH_TY][i] = 0.0f;
+		pRest->pCh[E_ANMPOSECH_TZ][i] = 0.0f;
+		pRest->pCh[E_ANMPOSECH_WGT][i] = 0.0f;
+	}
+	for (i = 0; i < pAnm->nb_jnt; ++i) {
+		Pose_set_pos(pRest, i, pJnt->pInfo->offs_len.qv);
+		++pJnt;
+	}
+	Pose_set_pos(pRest, pAnm->nb_jnt + E_ANMPOSEXT_KCEND_L, pAnm->kc_leg_l.end_pos.qv);
+	Pose_set_pos(pRest, pAnm->nb_jnt + E_ANMPOSEXT_KCEND_R, pAnm->kc_leg_r.end_pos.qv);
+	pAnm->kc_leg_l.top_quat.qv = QUAT_unit();
+	pAnm->kc_leg_r.top_quat.qv = QUAT_unit();
+}
+
+static void Bound_init(ANIMATION* pAnm) {
+	int i, parent_id;
+	QMTX m;
+	QVEC pos;
+	QVEC center;
+	GEOM_AABB box;
+	float r = 0.0f;
+	OMD* pOmd = pAnm->pMdl->pOmd;
+
+	GEOM_aabb_init(&box);
+	for (i = 0; i < pAnm->nb_jnt; ++i) {
+		MTX_invert(m, pOmd->pJnt_inv[i]);
+		pos = V4_load(m[3]);
+		box.min.qv = V4_min(box.min.qv, pos);
+		box.max.qv = V4_max(box.max.qv, pos);
+		parent_id = pOmd->pJnt_info[i].parent_id;
+		pAnm->pJnt_depth[i] = parent_id < 0 ? 0 : (sys_byte)D_MIN(pAnm->pJnt_depth[parent_id] + 1, 0xFF);
+	}
+	center = GEOM_aabb_center(&box);
+	for (i = 0; i < pAnm->nb_jnt; ++i) {
+		MTX_invert(m, pOmd->pJnt_inv[i]);
+		r = F_max(r, V4_dist(center, V4_load(m[3])));
+	}
+	/* joints only, leave some room for the skin */
+	pAnm->bound.qv = center;
+	pAnm->bound.r = r + 0.25f;
+}
+
 ANIMATION* ANM_create(MODEL* pMdl) {
+	int i;
+	float* pPose_mem;
 	ANIMATION* pAnm = NULL;
 	if (pMdl) {
 		int nb_jnt = pMdl->pOmd->nb_jnt;
-		int mem_size = D_ALIGN(sizeof(ANIMATION), 16) + D_ALIGN(sizeof(ANM_BLEND), 16) + nb_jnt*sizeof(JNT_BLEND_POSE);
+		int nb_slot = (int)D_ALIGN(nb_jnt + E_ANMPOSEXT_MAX, 4);
+		int pose_size = E_ANMPOSECH_MAX*nb_slot*sizeof(float);
+		int nb_pose = 2 + D_ANM_TREE_MAX_DEPTH + 2;
+		int mem_size = (int)(D_ALIGN(sizeof(ANIMATION), 16) + D_ALIGN(sizeof(ANM_BLEND), 16) + D_ALIGN(sizeof(ANM_TREE), 16) + nb_pose*pose_size + nb_jnt);
 		pAnm = (ANIMATION*)SYS_malloc(mem_size);
 		memset(pAnm, 0, mem_size);
 		pAnm->pMdl = pMdl;
+		pAnm->nb_jnt = nb_jnt;
 		pAnm->pBlend = (ANM_BLEND*)D_INCR_PTR(pAnm, D_ALIGN(sizeof(ANIMATION), 16));
-		pAnm->pBlend->pPose = (JNT_BLEND_POSE*)D_INCR_PTR(pAnm->pBlend, D_ALIGN(sizeof(ANM_BLEND), 16));
+		pAnm->pTree = (ANM_TREE*)D_INCR_PTR(pAnm->pBlend, D_ALIGN(sizeof(ANM_BLEND), 16));
+		pPose_mem = (float*)D_INCR_PTR(pAnm->pTree, D_ALIGN(sizeof(ANM_TREE), 16));
+		Pose_init(&pAnm->pose, pPose_mem, nb_slot);
+		pPose_mem += E_ANMPOSECH_MAX*nb_slot;
+		Pose_init(&pAnm->rest, pPose_mem, nb_slot);
+		pPose_mem += E_ANMPOSECH_MAX*nb_slot;
+		for (i = 0; i < D_ANM_TREE_MAX_DEPTH; ++i) {
+			Pose_init(&pAnm->stk[i], pPose_mem, nb_slot);
+			pPose_mem += E_ANMPOSECH_MAX*nb_slot;
+		}
+		for (i = 0; i < 2; ++i) {
+			Pose_init(&pAnm->lod_pose[i], pPose_mem, nb_slot);
+			pPose_mem += E_ANMPOSECH_MAX*nb_slot;
+		}
+		pAnm->pJnt_depth = (sys_byte*)pPose_mem;
 		pAnm->pData = NULL;
 		pAnm->ankle_height = 0.1f;
 		pAnm->frame = 0.0f;
 		pAnm->frame_step = 1.0f;
 		KC_init(pAnm, &pAnm->kc_leg_l, MDL_get_jnt(pMdl, "jnt_uprLeg_L"), MDL_get_jnt(pMdl, "jnt_lwrLeg_L"), MDL_get_jnt(pMdl, "jnt_ankle_L"));
 		KC_init(pAnm, &pAnm->kc_leg_r, MDL_get_jnt(pMdl, "jnt_uprLeg_R"), MDL_get_jnt(pMdl, "jnt_lwrLeg_R"), MDL_get_jnt(pMdl, "jnt_ankle_R"));
+		Rest_init(pAnm);
+		Bound_init(pAnm);
+		Pose_cpy(&pAnm->pose, &pAnm->rest);
 		ANM_blend_init(pAnm, 0);
 	}
 	return pAnm;
@@ -65,47 +371,271 @@ void ANM_destroy(ANIMATION* pAnm) {
 	SYS_free(pAnm);
 }
 
-ANM_DATA* ANM_data_create(ANIMATION* pAnm, KFR_HEAD* pKfr) {
+static ANM_CLIP* Clip_get(KFR_HEAD* pKfr) {
+	static const char* ctl_name[] = {"root", "center", "ctl_legRot_L", "ctl_legEff_L", "ctl_legRot_R", "ctl_legEff_R"};
+	static const sys_byte ctl_type[] = {
+		E_ANMGRPTYPE_ROOT, E_ANMGRPTYPE_CENTER,
+		E_ANMGRPTYPE_KCTOP_L, E_ANMGRPTYPE_KCEND_L, E_ANMGRPTYPE_KCTOP_R, E_ANMGRPTYPE_KCEND_R
+	};
+	int i, j, n;
+	int nb_ctl = (int)D_ARRAY_LENGTH(ctl_name);
+	sys_i32 ctl_id[D_ARRAY_LENGTH(ctl_name)];
+	ANM_SYS* pSys = &g_anm_sys;
+	ANM_CLIP* pClip;
+
+	if (!pSys->pClip_dict) {
+		pSys->pClip_dict = DICT_new();
+		DICT_set_hash_addr(pSys->pClip_dict, 1);
+	}
+	pClip = (ANM_CLIP*)DICT_get_p(pSys->pClip_dict, (const char*)pKfr);
+	if (pClip) return pClip;
+
+	n = pKfr->nb_grp;
+	pClip = (ANM_CLIP*)SYS_malloc(sizeof(ANM_CLIP) + n*sizeof(sys_i32) + n);
+	pClip->pKfr = pKfr;
+	pClip->pName_id = (sys_i32*)(pClip + 1);
+	pClip->pType = (sys_byte*)(pClip->pName_id + n);
+	pClip->pBind = NULL;
+	pClip->id = pSys->clip_count++;
+	pClip->ref = 0;
+	for (i = 0; i < nb_ctl; ++i) {
+		ctl_id[i] = NAME_get_id(ctl_name[i]);
+	}
+	for (i = 0; i < n; ++i) {
+		sys_i32 name_id = NAME_get_id(KFR_get_grp_name(pKfr, KFR_get_grp(pKfr, i)));
+		pClip->pName_id[i] = name_id;
+		pClip->pType[i] = E_ANMGRPTYPE_JNT;
+		for (j = 0; j < nb_ctl; ++j) {
+			if (name_id == ctl_id[j]) {
+				pClip->pType[i] = ctl_type[j];
+				break;
+			}
+		}
+	}
+	DICT_put_p(pSys->pClip_dict, (const char*)pKfr, pClip);
+	return pClip;
+}
+
+static ANM_DATA* Clip_bind(ANM_CLIP* pClip, OMD* pOmd) {
 	int i, n;
 	ANM_GRP_INFO* pInfo;
-	ANM_DATA* pData = NULL;
-	n = pKfr->nb_grp;
+	ANM_DATA* pData;
+
+	n = pClip->pKfr->nb_grp;
 	pData = (ANM_DATA*)SYS_malloc(sizeof(ANM_DATA) + n*sizeof(ANM_GRP_INFO));
-	pData->pKfr = pKfr;
+	pData->pKfr = pClip->pKfr;
 	pData->pInfo = (ANM_GRP_INFO*)(pData + 1);
+	pData->pClip = pClip;
+	pData->skel_id = pOmd->id;
+	pData->ref = 0;
 	pInfo = pData->pInfo;
 	for (i = 0; i < n; ++i) {
-		KFR_GROUP* pGrp = KFR_get_grp(pKfr, i);
-		const char* name = KFR_get_grp_name(pKfr, pGrp);
-		pInfo->pJnt = NULL;
-		pInfo->type = E_ANMGRPTYPE_INVALID;
-		if (0 == strcmp(name, "root")) {
-			pInfo->type = E_ANMGRPTYPE_ROOT;
-		} else if (0 == strcmp(name, "center")) {
-			pInfo->type = E_ANMGRPTYPE_CENTER;
-			pInfo->pJnt = MDL_get_jnt(pAnm->pMdl, name);
-		} else if (0 == strcmp(name, "ctl_legRot_L")) {
-			pInfo->type = E_ANMGRPTYPE_KCTOP_L;
-		} else if (0 == strcmp(name, "ctl_legEff_L")) {
-			pInfo->type = E_ANMGRPTYPE_KCEND_L;
-		} else if (0 == strcmp(name, "ctl_legRot_R")) {
-			pInfo->type = E_ANMGRPTYPE_KCTOP_R;
-		} else if (0 == strcmp(name, "ctl_legEff_R")) {
-			pInfo->type = E_ANMGRPTYPE_KCEND_R;
-		} else {
-			pInfo->type = E_ANMGRPTYPE_JNT;
-			pInfo->pJnt = MDL_get_jnt(pAnm->pMdl, name);
-			//SYS_log("%s -> %s\n", name, pInfo->pJnt->pInfo->pName);
+		pInfo->type = pClip->pType[i];
+		pInfo->jnt_id = -1;
+		if (pInfo->type == E_ANMGRPTYPE_JNT || pInfo->type == E_ANMGRPTYPE_CENTER) {
+			pInfo->jnt_id = (sys_i16)OMD_get_jnt_idx_by_name_id(pOmd, pClip->pName_id[i]);
 		}
 		++pInfo;
 	}
+	pData->pNext = pClip->pBind;
+	pClip->pBind = pData;
+	return pData;
+}
+
+/* returns the number of references left to the clip */
+static int Data_release(ANM_DATA* pData) {
+	ANM_DATA** ppLink;
+	ANM_CLIP* pClip = pData->pClip;
+
+	--pClip->ref;
+	if (--pData->ref == 0) {
+		ppLink = &pClip->pBind;
+		while (*ppLink != pData) {
+			ppLink = &(*ppLink)->pNext;
+		}
+		*ppLink = pData->pNext;
+		SYS_free(pData);
+	}
+	if (pClip->ref == 0) {
+		DICT_remove(g_anm_sys.pClip_dict, (const char*)pClip->pKfr);
+		SYS_free(pClip);
+		return 0;
+	}
+	return pClip->ref;
+}
+
+ANM_DATA* ANM_data_create(ANIMATION* pAnm, KFR_HEAD* pKfr) {
+	OMD* pOmd = pAnm->pMdl->pOmd;
+	ANM_CLIP* pClip = Clip_get(pKfr);
+	ANM_DATA* pData;
+
+	for (pData = pClip->pBind; pData; pData = pData->pNext) {
+		if (pData->skel_id == pOmd->id) break;
+	}
+	if (!pData) {
+		pData = Clip_bind(pClip, pOmd);
+	}
+	++pData->ref;
+	++pClip->ref;
 	return pData;
 }
 
+void ANM_data_release(ANM_DATA* pData) {
+	if (pData) {
+		Data_release(pData);
+	}
+}
+
 void ANM_data_destroy(ANM_DATA* pData) {
 	if (pData) {
-		KFR_free(pData->pKfr);
-		SYS_free(pData);
+		KFR_HEAD* pKfr = pData->pKfr;
+		if (!Data_release(pData)) {
+			KFR_free(pKfr);
+		}
+	}
+}
+
+static void Anm_sample_root(ANIMATION* pAnm, ANM_DATA* pData, float frame) {
+	int i, j, n;
+	KFR_HEAD* pKfr = pData->pKfr;
+	ANM_GRP_INFO* pInfo = pData->pInfo;
+
+	n = pKfr->nb_grp;
+	for (i = 0; i < n; ++i) {
+		if (pInfo->type == E_ANMGRPTYPE_ROOT) {
+			KFR_GROUP* pGrp = KFR_get_grp(pKfr, i);
+			UVEC3* pRot = &pAnm->root_rot;
+			UVEC* pPos = &pAnm->root_pos;
+			for (j = 0; j < pGrp->nb_chan; ++j) {
+				KFR_CHANNEL* pCh = KFR_get_chan(pKfr, pGrp, j);
+				float val = KFR_eval(pKfr, pCh, frame, NULL);
+				if (pCh->attr & E_KFRATTR_RX) {
+					pRot->x = val;
+				} else if (pCh->attr & E_KFRATTR_RY) {
+					pRot->y = val;
+				} else if (pCh->attr & E_KFRATTR_RZ) {
+					pRot->z = val;
+				} else if (pCh->attr & E_KFRATTR_TX) {
+					pPos->x = val;
+				} else if (pCh->attr & E_KFRATTR_TY) {
+					pPos->y = val;
+				} else if (pCh->attr & E_KFRATTR_TZ) {
+					pPos->z = val;
+				}
+			}
+		}
+		++pInfo;
+	}
+}
+
+static float Anm_next_frame(ANM_DATA* pData, float frame, float step) {
+	frame += step;
+	if (frame > pData->pKfr->max_frame) {
+		frame = 0.0f;
+	}
+	return frame;
+}
+
+static int Tree_eval(ANIMATION* pAnm, ANM_TREE* pTree, int idx, ANM_POSE* pDst, int lvl) {
+	int i;
+	ANM_NODE* pSrc;
+	ANM_NODE* pNode = &pTree->node[idx++];
+
+	if (pNode->type != E_ANMNODE_CLIP && lvl >= D_ANM_TREE_MAX_DEPTH) {
+		SYS_log("Animation tree is too deep\n");
+		Pose_cpy(pDst, &pAnm->rest);
+		return pTree->nb_node;
+	}
+	switch (pNode->type) {
+		case E_ANMNODE_CLIP:
+			ANM_pose_sample(pAnm, pDst, pNode->pData, pNode->frame);
+			break;
+		case E_ANMNODE_DELTA:
+			ANM_pose_sample(pAnm, pDst, pNode->pData, pNode->frame);
+			ANM_pose_sample(pAnm, &pAnm->stk[lvl], pNode->pData, 0.0f);
+			Pose_delta(pDst, &pAnm->stk[lvl]);
+			break;
+		case E_ANMNODE_BLEND:
+			for (i = 0; i < pNode->nb_src && idx < pTree->nb_node; ++i) {
+				pSrc = &pTree->node[idx];
+				idx = Tree_eval(pAnm, pTree, idx, &pAnm->stk[lvl], lvl + 1);
+				Pose_accum(pDst, &pAnm->stk[lvl], pSrc->weight, pSrc->pMask, i == 0);
+			}
+			if (i > 0) {
+				Pose_normalize(pDst);
+			} else {
+				Pose_cpy(pDst, &pAnm->rest);
+			}
+			break;
+		case E_ANMNODE_ADD:
+			if (idx + 1 < pTree->nb_node) {
+				idx = Tree_eval(pAnm, pTree, idx, pDst, lvl);
+				pSrc = &pTree->node[idx];
+				idx = Tree_eval(pAnm, pTree, idx, &pAnm->stk[lvl], lvl + 1);
+				Pose_add(pDst, &pAnm->stk[lvl], pSrc->weight, pSrc->pMask);
+			} else {
+				Pose_cpy(pDst, &pAnm->rest);
+				idx = pTree->nb_node;
+			}
+			break;
+		default:
+			break;
+	}
+	return idx;
+}
+
+static void Anm_eval(ANIMATION* pAnm, int ahead, ANM_POSE* pDst) {
+	int i;
+	float frame;
+	float blend_frame;
+	ANM_TREE* pTree = pAnm->pTree;
+	ANM_BLEND* pBlend = pAnm->pBlend;
+
+	frame = pAnm->frame;
+	for (i = 0; i < ahead; ++i) {
+		frame = Anm_next_frame(pAnm->pData, frame, pAnm->frame_step);
+	}
+	ANM_tree_reset(pTree);
+	if (pBlend->count > 0.0f) {
+		float t = (pBlend->duration - pBlend->count) / pBlend->duration;
+		blend_frame = pBlend->frame;
+		for (i = 0; i < ahead; ++i) {
+			blend_frame = Anm_next_frame(pBlend->pData, blend_frame, pBlend->frame_step);
+		}
+		ANM_tree_blend(pTree, 2, 1.0f, NULL);
+		ANM_tree_clip(pTree, pBlend->pData, blend_frame, 1.0f - t, NULL);
+		ANM_tree_clip(pTree, pAnm->pData, frame, t, NULL);
+	} else {
+		ANM_tree_clip(pTree, pAnm->pData, frame, 1.0f, NULL);
+	}
+	Tree_eval(pAnm, pTree, 0, pDst, 0);
+	SYNC_inc(&g_anm_lod_stats.nb_eval);
+}
+
+/* reduced rate: sample the pose the clip reaches at the next update and interpolate towards it */
+static void Anm_eval_lod(ANIMATION* pAnm) {
+	int rate = g_anm_lod_policy.rate[pAnm->lod];
+	if (rate <= 1) {
+		pAnm->lod_phase = 0;
+		if (g_anm_lod_policy.flg[pAnm->lod] & E_ANMLODFLG_SUBSET) {
+			Pose_cpy(&pAnm->lod_pose[0], &pAnm->pose);
+		}
+		Anm_eval(pAnm, 0, &pAnm->pose);
+		return;
+	}
+	if (pAnm->lod_phase == 0) {
+		Pose_cpy(&pAnm->lod_pose[0], &pAnm->pose);
+		Anm_eval(pAnm, rate - 1, &pAnm->lod_pose[1]);
+	}
+	++pAnm->lod_phase;
+	if (pAnm->lod_phase >= rate) {
+		pAnm->lod_phase = 0;
+		Pose_cpy(&pAnm->pose, &pAnm->lod_pose[1]);
+	} else {
+		float t = (float)pAnm->lod_phase / (float)rate;
+		Pose_accum(&pAnm->pose, &pAnm->lod_pose[0], 1.0f - t, NULL, 1);
+		Pose_accum(&pAnm->pose, &pAnm->lod_pose[1], t, NULL, 0);
+		Pose_normalize(&pAnm->pose);
 	}
 }
 
@@ -114,87 +644,33 @@ void ANM_set(ANIMATION* pAnm, ANM_DATA* pData, int start_frame) {
 	if (start_frame > pData->pKfr->max_frame) {
 		start_frame = 0;
 	}
-	pAnm->status = 0;
-	pAnm->frame = 0.0f;
-	pAnm->frame_step = 0.0f;
-	ANM_play(pAnm);
+	Anm_sample_root(pAnm, pData, 0.0f);
 	pAnm->move.prev.qv = pAnm->root_pos.qv;
-	pAnm->frame = pData->pKfr->max_frame;
-	ANM_play(pAnm);
+	Anm_sample_root(pAnm, pData, pData->pKfr->max_frame);
 	pAnm->move.end.qv = pAnm->root_pos.qv;
 
 	pAnm->status = 0;
-	pAnm->frame = (float)start_frame;
-	ANM_play(pAnm);
-
 	pAnm->frame = (float)start_frame;
 	pAnm->frame_step = 1.0f;
+	Anm_sample_root(pAnm, pData, pAnm->frame);
+	pAnm->lod_phase = 0;
+	Anm_eval(pAnm, 0, &pAnm->pose);
 }
 
 void ANM_play(ANIMATION* pAnm) {
-	int i, j, n;
-	UVEC dummy_pos;
-	UVEC3 dummy_rot;
-	ANM_DATA* pData;
-	KFR_HEAD* pKfr;
-	ANM_GRP_INFO* pInfo;
-	float frame = pAnm->frame;
-
-	pData = pAnm->pData;
-	if (!pData) return;
-	pKfr = pData->pKfr;
-	pInfo = pData->pInfo;
-	n = pKfr->nb_grp;
-	for (i = 0; i < n; ++i) {
-		UVEC3* pRot = &dummy_rot;
-		UVEC* pPos = &dummy_pos;
-		KFR_GROUP* pGrp = KFR_get_grp(pKfr, i);
+	ANM_BLEND* pBlend = pAnm->pBlend;
 
-		if (pInfo->pJnt) {
-			pRot = &pInfo->pJnt->rot;
-			pPos = &pInfo->pJnt->pos;
-		} else {
-			switch (pInfo->type) {
-				case E_ANMGRPTYPE_ROOT:
-					pRot = &pAnm->root_rot;
-					pPos = &pAnm->root_pos;
-					break;
-				case E_ANMGRPTYPE_KCTOP_L:
-					pRot = &pAnm->kc_leg_l.top_rot;
-					break;
-				case E_ANMGRPTYPE_KCEND_L:
-					pPos = &pAnm->kc_leg_l.end_pos;
-					break;
-				case E_ANMGRPTYPE_KCTOP_R:
-					pRot = &pAnm->kc_leg_r.top_rot;
-					break;
-				case E_ANMGRPTYPE_KCEND_R:
-					pPos = &pAnm->kc_leg_r.end_pos;
-					break;
-				default:
-					break;
-			}
-		}
-		for (j = 0; j < pGrp->nb_chan; ++j) {
-			KFR_CHANNEL* pCh = KFR_get_chan(pKfr, pGrp, j);
-			float val = KFR_eval(pKfr, pCh, frame, NULL);
-			if (pCh->attr & E_KFRATTR_RX) {
-				pRot->x = val;
-			} else if (pCh->attr & E_KFRATTR_RY) {
-				pRot->y = val;
-			} else if (pCh->attr & E_KFRATTR_RZ) {
-				pRot->z = val;
-			} else if (pCh->attr & E_KFRATTR_TX) {
-				pPos->x = val;
-			} else if (pCh->attr & E_KFRATTR_TY) {
-				pPos->y = val;
-			} else if (pCh->attr & E_KFRATTR_TZ) {
-				pPos->z = val;
-			}
-		}
-		++pInfo;
+	if (!pAnm->pData) return;
+	if (!(g_anm_lod_policy.flg[pAnm->lod] & E_ANMLODFLG_BLEND)) {
+		pBlend->count = 0.0f;
 	}
+	Anm_sample_root(pAnm, pAnm->pData, pAnm->frame);
+	Anm_eval_lod(pAnm);
 
+	if (pBlend->count > 0.0f) {
+		pBlend->frame = Anm_next_frame(pBlend->pData, pBlend->frame, pBlend->frame_step);
+		--pBlend->count;
+	}
 	if (pAnm->status & E_ANMSTATUS_LOOP) {
 		pAnm->status &= ~E_ANMSTATUS_LOOP;
 		pAnm->status |= E_ANMSTATUS_SHIFT;
@@ -232,112 +708,170 @@ void ANM_move(ANIMATION* pAnm) {
 	pMdl->rot.y = pAnm->move.heading;
 }
 
-static void KC_calc(ANIMATION* pAnm, KIN_CHAIN* pKC) {
-	QMTX parent_mtx;
-	QMTX top_mtx;
+#define D_KC_BATCH (4)
+
+typedef struct _KC_LANE {
+	KIN_CHAIN* pKC;
+	UVEC floor_nml;
+	int foot_adj;
+} KC_LANE;
+
+/* chains are gathered in SoA form and solved 4 at a time */
+typedef struct _KC_BATCH {
+	float top[3][D_KC_BATCH];
+	float end[3][D_KC_BATCH];
+	float ax[3][D_KC_BATCH];
+	float offs[3][D_KC_BATCH];
+	float len0[D_KC_BATCH];
+	float len1[D_KC_BATCH];
+	QMTX top_mtx[D_KC_BATCH];
+	QMTX rot_mtx[D_KC_BATCH];
+	KC_LANE lane[D_KC_BATCH];
+	int count;
+} KC_BATCH;
+
+static D_FORCE_INLINE QVEC Soa_select(QVEC mask, QVEC a, QVEC b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static D_FORCE_INLINE void Soa_normalize3(QVEC* pX, QVEC* pY, QVEC* pZ) {
+	QVEC s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(*pX, *pX), _mm_mul_ps(*pY, *pY)), _mm_mul_ps(*pZ, *pZ));
+	s = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(s));
+	*pX = _mm_mul_ps(*pX, s);
+	*pY = _mm_mul_ps(*pY, s);
+	*pZ = _mm_mul_ps(*pZ, s);
+}
+
+static D_FORCE_INLINE void Soa_cross3(QVEC* pRes, QVEC ax, QVEC ay, QVEC az, QVEC bx, QVEC by, QVEC bz) {
+	pRes[0] = _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by));
+	pRes[1] = _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz));
+	pRes[2] = _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+}
+
+/* a*ca + b*cb per component */
+static D_FORCE_INLINE void Soa_combine3(QVEC* pRes, QVEC* pA, QVEC ca, QVEC* pB, QVEC cb) {
+	pRes[0] = _mm_add_ps(_mm_mul_ps(pA[0], ca), _mm_mul_ps(pB[0], cb));
+	pRes[1] = _mm_add_ps(_mm_mul_ps(pA[1], ca), _mm_mul_ps(pB[1], cb));
+	pRes[2] = _mm_add_ps(_mm_mul_ps(pA[2], ca), _mm_mul_ps(pB[2], cb));
+}
+
+static void Soa_store_mtx(QMTX* pMtx, QVEC* pR0, QVEC* pR1, QVEC* pR2, QVEC* pPos) {
+	QVEC a, b, c, d;
+	int i;
+	QVEC* pRow[3];
+	pRow[0] = pR0;
+	pRow[1] = pR1;
+	pRow[2] = pR2;
+	for (i = 0; i < 3; ++i) {
+		a = pRow[i][0];
+		b = pRow[i][1];
+		c = pRow[i][2];
+		d = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		V4_store(pMtx[0][i], a);
+		V4_store(pMtx[1][i], b);
+		V4_store(pMtx[2][i], c);
+		V4_store(pMtx[3][i], d);
+	}
+	a = pPos[0];
+	b = pPos[1];
+	c = pPos[2];
+	d = _mm_set1_ps(1.0f);
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+	V4_store(pMtx[0][3], a);
+	V4_store(pMtx[1][3], b);
+	V4_store(pMtx[2][3], c);
+	V4_store(pMtx[3][3], d);
+}
+
+static void Kc_solve(KC_BATCH* pBatch) {
+	QVEC one = _mm_set1_ps(1.0f);
+	QVEC smask = Soa_sign_mask();
+	QVEC t[3];
+	QVEC ax[3];
+	QVEC ay[3];
+	QVEC az[3];
+	QVEC naz[3];
+	QVEC r1[3];
+	QVEC r2[3];
+	QVEC q1[3];
+	QVEC q2[3];
+	QVEC pos[3];
+	QVEC d2, dist, len0, len1, l00, l11, c0, s0, c1, s1, reach;
+	int i;
+
+	for (i = 0; i < 3; ++i) {
+		t[i] = _mm_load_ps(pBatch->top[i]);
+		az[i] = _mm_sub_ps(_mm_load_ps(pBatch->end[i]), t[i]);
+		ax[i] = _mm_load_ps(pBatch->ax[i]);
+	}
+	len0 = _mm_load_ps(pBatch->len0);
+	len1 = _mm_load_ps(pBatch->len1);
+	d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(az[0], az[0]), _mm_mul_ps(az[1], az[1])), _mm_mul_ps(az[2], az[2]));
+	dist = _mm_sqrt_ps(d2);
+	l00 = _mm_mul_ps(len0, len0);
+	l11 = _mm_mul_ps(len1, len1);
+	c0 = _mm_div_ps(_mm_add_ps(_mm_sub_ps(l00, l11), d2), _mm_mul_ps(_mm_add_ps(len0, len0), dist));
+	c1 = _mm_div_ps(_mm_sub_ps(_mm_add_ps(l00, l11), d2), _mm_mul_ps(_mm_add_ps(len0, len0), len1));
+	c0 = _mm_max_ps(_mm_min_ps(c0, one), _mm_xor_ps(one, smask));
+	c1 = _mm_max_ps(_mm_min_ps(c1, one), _mm_xor_ps(one, smask));
+	/* top: rot = -acos(c0), bend: rot = PI - acos(c1) */
+	s0 = _mm_xor_ps(_mm_sqrt_ps(_mm_sub_ps(one, _mm_mul_ps(c0, c0))), smask);
+	s1 = _mm_sqrt_ps(_mm_sub_ps(one, _mm_mul_ps(c1, c1)));
+	c1 = _mm_xor_ps(c1, smask);
+	reach = _mm_cmplt_ps(dist, _mm_add_ps(len0, len1));
+	c0 = Soa_select(reach, c0, one);
+	s0 = _mm_and_ps(reach, s0);
+	c1 = Soa_select(reach, c1, one);
+	s1 = _mm_and_ps(reach, s1);
+
+	Soa_normalize3(&ax[0], &ax[1], &ax[2]);
+	Soa_normalize3(&az[0], &az[1], &az[2]);
+	Soa_cross3(ay, az[0], az[1], az[2], ax[0], ax[1], ax[2]);
+	Soa_normalize3(&ay[0], &ay[1], &ay[2]);
+	Soa_cross3(ax, ay[0], ay[1], ay[2], az[0], az[1], az[2]);
+	Soa_normalize3(&ax[0], &ax[1], &ax[2]);
+
+	/* IK frame rows are (ax, -az, ay), rotated about its x axis */
+	for (i = 0; i < 3; ++i) {
+		naz[i] = _mm_xor_ps(az[i], smask);
+	}
+	Soa_combine3(r1, naz, c0, ay, s0);
+	Soa_combine3(r2, naz, _mm_xor_ps(s0, smask), ay, c0);
+	for (i = 0; i < 3; ++i) {
+		pos[i] = _mm_add_ps(t[i], _mm_mul_ps(ax[i], _mm_load_ps(pBatch->offs[0])));
+		pos[i] = _mm_add_ps(pos[i], _mm_mul_ps(r1[i], _mm_load_ps(pBatch->offs[1])));
+		pos[i] = _mm_add_ps(pos[i], _mm_mul_ps(r2[i], _mm_load_ps(pBatch->offs[2])));
+	}
+	Soa_store_mtx(pBatch->top_mtx, ax, r1, r2, t);
+
+	Soa_combine3(q1, r1, c1, r2, s1);
+	Soa_combine3(q2, r1, _mm_xor_ps(s1, smask), r2, c1);
+	Soa_store_mtx(pBatch->rot_mtx, ax, q1, q2, pos);
+}
+
+static void Kc_store(KC_BATCH* pBatch, int idx) {
+	QMTX imtx;
 	QMTX ik_mtx;
-	QMTX rot_mtx;
 	QMTX mx;
 	QMTX my;
-	QMTX imtx;
-	QVEC top_pos;
-	QVEC rot_pos;
 	QVEC end_pos;
-	QVEC ax;
-	QVEC ay;
-	QVEC az;
-	UVEC floor_pos;
-	UVEC floor_nml;
-	JOINT* pJnt;
-	MODEL* pMdl = pAnm->pMdl;
-	float dist, len0, len1, rot0, rot1;
-	int foot_adj = 0;
+	KC_LANE* pLane = &pBatch->lane[idx];
+	KIN_CHAIN* pKC = pLane->pKC;
 	float frx = 0.0f;
 	float frz = 0.0f;
 
-	MTX_rot_xyz(top_mtx, pKC->top_rot.x, pKC->top_rot.y, pKC->top_rot.z);
-	V4_store(top_mtx[3], V4_set_w1(pKC->pJnt_top->pInfo->offs_len.qv));
+	MTX_invert_fast(imtx, *pKC->pJnt_top->pParent_mtx);
+	MTX_mul(pKC->pJnt_top->mtx, pBatch->top_mtx[idx], imtx);
 
-	MTX_unit(parent_mtx);
-	pJnt = &pMdl->pJnt[pKC->pJnt_top->pInfo->parent_id];
-	while (pJnt->pInfo->parent_id >= 0) {
-		MTX_mul(parent_mtx, parent_mtx, pJnt->mtx);
-		pJnt = &pMdl->pJnt[pJnt->pInfo->parent_id];
-	}
-	MTX_mul(parent_mtx, parent_mtx, pJnt->mtx);
-	MTX_mul(parent_mtx, parent_mtx, pMdl->root_mtx);
-	MTX_mul(top_mtx, top_mtx, parent_mtx);
+	MTX_invert_fast(imtx, pBatch->top_mtx[idx]);
+	MTX_mul(pKC->pJnt_rot->mtx, pBatch->rot_mtx[idx], imtx);
 
-	end_pos = MTX_calc_qpnt(pMdl->root_mtx, pKC->end_pos.qv);
-	if (g_ik_floor_func && (pKC->attr & E_KCATTR_FLOORADJ)) {
-		if (g_ik_floor_func(end_pos, 1.0f, &floor_pos, &floor_nml)) {
-			UVEC tpos;
-			float ankle_h = pAnm->ankle_height;
-			tpos.qv = end_pos;
-			if (tpos.y - ankle_h < floor_pos.y) {
-				tpos.y = floor_pos.y + ankle_h;
-				end_pos = tpos.qv;
-				if (pKC->attr & E_KCATTR_FOOTROT) {
-					foot_adj = 1;
-				}
-			}
-		}
-	}
-	top_pos = V4_load(top_mtx[3]);
-	len0 = pKC->pJnt_rot->pInfo->offs_len.w;
-	len1 = pKC->pJnt_end->pInfo->offs_len.w;
-	az = V4_sub(end_pos, top_pos);
-	dist = V4_mag(az);
-	if (dist < len0 + len1) {
-		float c0 = ( (len0*len0) - (len1*len1) + (dist*dist) ) / (2*len0*dist);
-		float c1 = ( (len0*len0) + (len1*len1) - (dist*dist) ) / (2*len0*len1);
-		c0 = D_CLAMP(c0, -1, 1);
-		c1 = D_CLAMP(c1, -1, 1);
-		rot0 = -acosf(c0);
-		rot1 = D_PI - acosf(c1);
-	} else {
-		rot0 = 0.0f;
-		rot1 = 0.0f;
-	}
-	ax = MTX_calc_qvec(top_mtx, V4_load(g_identity[0]));
-	ax = V4_normalize(ax);
-	az = V4_normalize(az);
-	ay = V4_normalize(V4_cross(az, ax));
-	ax = V4_normalize(V4_cross(ay, az));
-	V4_store(mx[0], ax);
-	V4_store(mx[1], ay);
-	V4_store(mx[2], az);
-	V4_store(mx[3], V4_load(g_identity[3]));
-
-	az = V4_set_vec(0.0f, -1.0f, 0.0f);
-	ay = V4_set_vec(0.0f, 0.0f, 1.0f);
-	ax = V4_normalize(V4_cross(ay, az));
-	V4_store(my[0], ax);
-	V4_store(my[1], ay);
-	V4_store(my[2], az);
-	V4_store(my[3], V4_load(g_identity[3]));
-	MTX_transpose(my, my);
-
-	MTX_mul(ik_mtx, my, mx);
-	MTX_rot_axis(rot_mtx, V4_load(g_identity[0]), rot0);
-	MTX_mul(top_mtx, rot_mtx, ik_mtx);
-	V4_store(top_mtx[3], V4_set_w1(top_pos));
-
-	rot_pos = MTX_calc_qpnt(top_mtx, pKC->pJnt_rot->pInfo->offs_len.qv);
-	MTX_rot_axis(rot_mtx, V4_load(g_identity[0]), rot1);
-	MTX_mul(rot_mtx, rot_mtx, top_mtx);
-	V4_store(rot_mtx[3], V4_set_w1(rot_pos));
-
-	MTX_invert_fast(imtx, parent_mtx);
-	MTX_mul(pKC->pJnt_top->mtx, top_mtx, imtx);
-
-	MTX_invert_fast(imtx, top_mtx);
-	MTX_mul(pKC->pJnt_rot->mtx, rot_mtx, imtx);
-
-	if (foot_adj) {
-		MTX_mul(ik_mtx, pKC->pJnt_end->mtx, rot_mtx);
+	if (pLane->foot_adj) {
+		UVEC floor_nml;
+		MTX_mul(ik_mtx, pKC->pJnt_end->mtx, pBatch->rot_mtx[idx]);
 		MTX_invert_fast(imtx, ik_mtx);
-		floor_nml.qv = MTX_calc_qvec(imtx, floor_nml.qv);
+		floor_nml.qv = MTX_calc_qvec(imtx, pLane->floor_nml.qv);
 		frx = atan2f(floor_nml.z, floor_nml.y);
 		frz = atan2f(-floor_nml.x, F_max(floor_nml.y, floor_nml.z));
 		frz *= pKC->foot_rz_factor;
@@ -354,49 +888,501 @@ static void KC_calc(ANIMATION* pAnm, KIN_CHAIN* pKC) {
 	}
 }
 
-void ANM_calc_ik(ANIMATION* pAnm) {
-	KC_calc(pAnm, &pAnm->kc_leg_l);
-	KC_calc(pAnm, &pAnm->kc_leg_r);
+static void Kc_flush(KC_BATCH* pBatch) {
+	int i, j, k;
+	int n = pBatch->count;
+	if (!n) return;
+	for (i = n; i < D_KC_BATCH; ++i) {
+		for (k = 0; k < 3; ++k) {
+			pBatch->top[k][i] = pBatch->top[k][0];
+			pBatch->end[k][i] = pBatch->end[k][0];
+			pBatch->ax[k][i] = pBatch->ax[k][0];
+			pBatch->offs[k][i] = pBatch->offs[k][0];
+		}
+		pBatch->len0[i] = pBatch->len0[0];
+		pBatch->len1[i] = pBatch->len1[0];
+	}
+	Kc_solve(pBatch);
+	for (j = 0; j < n; ++j) {
+		Kc_store(pBatch, j);
+	}
+	pBatch->count = 0;
 }
 
-void ANM_blend_init(ANIMATION* pAnm, int duration) {
-	int i, n;
+static void Kc_gather(KC_BATCH* pBatch, ANIMATION* pAnm, KIN_CHAIN* pKC) {
+	QMTX top_mtx;
+	UVEC end_pos;
+	UVEC floor_pos;
 	MODEL* pMdl = pAnm->pMdl;
-	JOINT* pJnt = pMdl->pJnt;
-	JNT_BLEND_POSE* pPose = pAnm->pBlend->pPose;
-	n = pMdl->pOmd->nb_jnt;
+	int idx = pBatch->count;
+	KC_LANE* pLane = &pBatch->lane[idx];
+	int k;
+
+	pLane->pKC = pKC;
+	pLane->foot_adj = 0;
+
+	QUAT_get_mtx(pKC->top_quat.qv, top_mtx);
+	V4_store(top_mtx[3], V4_set_w1(pKC->pJnt_top->pInfo->offs_len.qv));
+	MTX_mul(top_mtx, top_mtx, *pKC->pJnt_top->pParent_mtx);
+
+	end_pos.qv = MTX_calc_qpnt(pMdl->root_mtx, pKC->end_pos.qv);
+	if (g_ik_floor_func && (pKC->attr & E_KCATTR_FLOORADJ)) {
+		if (g_ik_floor_func(end_pos.qv, 1.0f, &floor_pos, &pLane->floor_nml)) {
+			float ankle_h = pAnm->ankle_height;
+			if (end_pos.y - ankle_h < floor_pos.y) {
+				end_pos.y = floor_pos.y + ankle_h;
+				if (pKC->attr & E_KCATTR_FOOTROT) {
+					pLane->foot_adj = 1;
+				}
+			}
+		}
+	}
+	for (k = 0; k < 3; ++k) {
+		pBatch->top[k][idx] = top_mtx[3][k];
+		pBatch->end[k][idx] = end_pos.f[k];
+		pBatch->ax[k][idx] = top_mtx[0][k];
+		pBatch->offs[k][idx] = pKC->pJnt_rot->pInfo->offs_len.f[k];
+	}
+	pBatch->len0[idx] = pKC->pJnt_rot->pInfo->offs_len.w;
+	pBatch->len1[idx] = pKC->pJnt_end->pInfo->offs_len.w;
+	if (++pBatch->count == D_KC_BATCH) {
+		Kc_flush(pBatch);
+	}
+}
+
+/* first joint whose world matrix depends on the IK result */
+static int Anm_ik_start(ANIMATION* pAnm) {
+	int l, r;
+	if (!(g_anm_lod_policy.flg[pAnm->lod] & E_ANMLODFLG_IK)) return pAnm->nb_jnt;
+	l = pAnm->kc_leg_l.pJnt_top->pInfo->id;
+	r = pAnm->kc_leg_r.pJnt_top->pInfo->id;
+	return D_MIN(l, r);
+}
+
+void ANM_calc_world_batch(ANIMATION** ppAnm, int n) {
+	int i, start;
+	ANIMATION* pAnm;
+	KC_BATCH batch;
+
+	batch.count = 0;
 	for (i = 0; i < n; ++i) {
-		pPose->quat.qv = QUAT_from_mtx(pJnt->mtx);
-		pPose->pos.qv = pJnt->pos.qv;
-		++pJnt;
-		++pPose;
+		pAnm = ppAnm[i];
+		start = Anm_ik_start(pAnm);
+		MDL_calc_world_range(pAnm->pMdl, 0, start);
+		if (start < pAnm->nb_jnt) {
+			SYNC_inc(&g_anm_lod_stats.nb_ik);
+			Kc_gather(&batch, pAnm, &pAnm->kc_leg_l);
+			Kc_gather(&batch, pAnm, &pAnm->kc_leg_r);
+		}
+	}
+	Kc_flush(&batch);
+	for (i = 0; i < n; ++i) {
+		pAnm = ppAnm[i];
+		start = Anm_ik_start(pAnm);
+		if (start < pAnm->nb_jnt) {
+			MDL_calc_world_range(pAnm->pMdl, start, pAnm->nb_jnt);
+		}
 	}
-	pAnm->pBlend->duration = (float)duration;
-	pAnm->pBlend->count = (float)duration;
 }
 
-void ANM_blend_calc(ANIMATION* pAnm) {
-	QVEC quat;
-	QVEC pos;
-	int i, n;
-	float t;
-	MODEL* pMdl = pAnm->pMdl;
-	JOINT* pJnt = pMdl->pJnt;
+void ANM_calc_world(ANIMATION* pAnm) {
+	ANM_calc_world_batch(&pAnm, 1);
+}
+
+void ANM_blend_init(ANIMATION* pAnm, int duration) {
 	ANM_BLEND* pBlend = pAnm->pBlend;
-	JNT_BLEND_POSE* pPose = pBlend->pPose;
+	pBlend->pData = pAnm->pData;
+	pBlend->frame = pAnm->frame;
+	pBlend->frame_step = pAnm->frame_step;
+	pBlend->duration = (float)duration;
+	pBlend->count = pAnm->pData ? (float)duration : 0.0f;
+}
+
+void ANM_calc_local(ANIMATION* pAnm) {
+	MDL_calc_root(pAnm->pMdl);
+	ANM_pose_get_mtx(pAnm, &pAnm->pose);
+}
 
-	if (pBlend->count <= 0.0f) return;
-	t = (pBlend->duration - pBlend->count) / pBlend->duration;
-	n = pMdl->pOmd->nb_jnt;
+static void Pose_sample(ANIMATION* pAnm, ANM_POSE* pPose, ANM_DATA* pData, float frame, int max_depth) {
+	int i, j, n;
+	int rot_slot, pos_slot;
+	int rot_flg, pos_flg;
+	UVEC3 rot;
+	UVEC pos;
+	KFR_HEAD* pKfr;
+	ANM_GRP_INFO* pInfo;
+
+	Pose_cpy(pPose, &pAnm->rest);
+	pKfr = pData->pKfr;
+	pInfo = pData->pInfo;
+	n = pKfr->nb_grp;
 	for (i = 0; i < n; ++i) {
-		quat = QUAT_from_mtx(pJnt->mtx);
-		quat = QUAT_slerp(pPose->quat.qv, quat, t);
-		pos = V4_lerp(pPose->pos.qv, pJnt->pos.qv, t);
-		QUAT_get_mtx(quat, pJnt->mtx);
-		pJnt->pos.qv = V4_set_w1(pos);
-		++pJnt;
-		++pPose;
+		KFR_GROUP* pGrp = KFR_get_grp(pKfr, i);
+		rot_slot = -1;
+		pos_slot = -1;
+		if (pInfo->jnt_id >= 0) {
+			if (pAnm->pJnt_depth[pInfo->jnt_id] <= max_depth) {
+				rot_slot = pInfo->jnt_id;
+				pos_slot = rot_slot;
+			}
+		} else {
+			switch (pInfo->type) {
+				case E_ANMGRPTYPE_KCTOP_L:
+					rot_slot = pAnm->nb_jnt + E_ANMPOSEXT_KCTOP_L;
+					break;
+				case E_ANMGRPTYPE_KCEND_L:
+					pos_slot = pAnm->nb_jnt + E_ANMPOSEXT_KCEND_L;
+					break;
+				case E_ANMGRPTYPE_KCTOP_R:
+					rot_slot = pAnm->nb_jnt + E_ANMPOSEXT_KCTOP_R;
+					break;
+				case E_ANMGRPTYPE_KCEND_R:
+					pos_slot = pAnm->nb_jnt + E_ANMPOSEXT_KCEND_R;
+					break;
+				default:
+					break;
+			}
+		}
+		if (rot_slot >= 0 || pos_slot >= 0) {
+			rot.x = 0.0f;
+			rot.y = 0.0f;
+			rot.z = 0.0f;
+			pos.qv = V4_zero();
+			if (pos_slot >= 0) {
+				pos.x = pPose->pCh[E_ANMPOSECH_TX][pos_slot];
+				pos.y = pPose->pCh[E_ANMPOSECH_TY][pos_slot];
+				pos.z = pPose->pCh[E_ANMPOSECH_TZ][pos_slot];
+			}
+			rot_flg = 0;
+			pos_flg = 0;
+			for (j = 0; j < pGrp->nb_chan; ++j) {
+				KFR_CHANNEL* pCh = KFR_get_chan(pKfr, pGrp, j);
+				float val = KFR_eval(pKfr, pCh, frame, NULL);
+				if (pCh->attr & E_KFRATTR_RX) {
+					rot.x = val;
+					rot_flg = 1;
+				} else if (pCh->attr & E_KFRATTR_RY) {
+					rot.y = val;
+					rot_flg = 1;
+				} else if (pCh->attr & E_KFRATTR_RZ) {
+					rot.z = val;
+					rot_flg = 1;
+				} else if (pCh->attr & E_KFRATTR_TX) {
+					pos.x = val;
+					pos_flg = 1;
+				} else if (pCh->attr & E_KFRATTR_TY) {
+					pos.y = val;
+					pos_flg = 1;
+				} else if (pCh->attr & E_KFRATTR_TZ) {
+					pos.z = val;
+					pos_flg = 1;
+				}
+			}
+			if (rot_flg && rot_slot >= 0) {
+				Pose_set_rot(pPose, rot_slot, &rot);
+			}
+			if (pos_flg && pos_slot >= 0) {
+				pPose->pCh[E_ANMPOSECH_TX][pos_slot] = pos.x;
+				pPose->pCh[E_ANMPOSECH_TY][pos_slot] = pos.y;
+				pPose->pCh[E_ANMPOSECH_TZ][pos_slot] = pos.z;
+			}
+		}
+		++pInfo;
 	}
-	--pBlend->count;
 }
 
+/* joints below the subset depth keep the previous pose, which Anm_eval_lod leaves in lod_pose[0] */
+static void Pose_keep(ANIMATION* pAnm, ANM_POSE* pPose, int max_depth) {
+	int i, j;
+	ANM_POSE* pPrev = &pAnm->lod_pose[0];
+
+	for (i = 0; i < pAnm->nb_jnt; ++i) {
+		if (pAnm->pJnt_depth[i] > max_depth) {
+			for (j = 0; j < E_ANMPOSECH_MAX; ++j) {
+				pPose->pCh[j][i] = pPrev->pCh[j][i];
+			}
+		}
+	}
+}
+
+static sys_ui32 Cache_hash(ANM_CACHE_KEY* pKey) {
+	sys_ui32 h = (sys_ui32)((sys_intptr)pKey->pKfr >> 4) * 0x9E3779B1;
+	h ^= (sys_ui32)((sys_intptr)pKey->pOmd >> 4) * 0x85EBCA6B;
+	h ^= (sys_ui32)pKey->frame * 0xC2B2AE35;
+	h ^= (sys_ui32)pKey->depth;
+	return h ^ (h >> 16);
+}
+
+static void Cache_get_pose(ANM_CACHE* pCache, int idx, ANM_POSE* pPose, int nb_slot) {
+	Pose_init(pPose, pCache->pPose + idx*pCache->max_slot*E_ANMPOSECH_MAX, nb_slot);
+}
+
+static void Cache_sample(ANIMATION* pAnm, ANM_POSE* pPose, ANM_DATA* pData, float frame, int max_depth) {
+	int i, idx, mask;
+	sys_i32 state;
+	ANM_POSE entry;
+	ANM_CACHE_KEY key;
+	ANM_CACHE_KEY* pKey;
+	ANM_CACHE* pCache = &g_anm_sys.cache;
+
+	key.pOmd = pAnm->pMdl->pOmd;
+	key.pKfr = pData->pKfr;
+	key.frame = (sys_i32)(frame * pCache->frame_div);
+	key.depth = max_depth;
+	frame = (float)key.frame / pCache->frame_div;
+	mask = pCache->size - 1;
+	idx = Cache_hash(&key) & mask;
+	for (i = 0; i < D_ANM_CACHE_PROBE; ++i) {
+		state = *(volatile sys_i32*)&pCache->pState[idx];
+		if (state == E_ANMCACHE_EMPTY) {
+			if (SYNC_cas(&pCache->pState[idx], E_ANMCACHE_BUSY, E_ANMCACHE_EMPTY) == E_ANMCACHE_EMPTY) {
+				Pose_sample(pAnm, pPose, pData, frame, max_depth);
+				pCache->pKey[idx] = key;
+				Cache_get_pose(pCache, idx, &entry, pPose->nb_slot);
+				Pose_cpy(&entry, pPose);
+				SYNC_xchg(&pCache->pState[idx], E_ANMCACHE_READY);
+				SYNC_inc(&pCache->nb_miss);
+				return;
+			}
+			state = *(volatile sys_i32*)&pCache->pState[idx];
+		}
+		if (state == E_ANMCACHE_READY) {
+			pKey = &pCache->pKey[idx];
+			if (pKey->pKfr == key.pKfr && pKey->pOmd == key.pOmd && pKey->frame == key.frame && pKey->depth == key.depth) {
+				Cache_get_pose(pCache, idx, &entry, pPose->nb_slot);
+				Pose_cpy(pPose, &entry);
+				SYNC_inc(&pCache->nb_hit);
+				return;
+			}
+		}
+		idx = (idx + 1) & mask;
+	}
+	SYNC_inc(&pCache->nb_miss);
+	Pose_sample(pAnm, pPose, pData, frame, max_depth);
+}
+
+void ANM_pose_sample(ANIMATION* pAnm, ANM_POSE* pPose, ANM_DATA* pData, float frame) {
+	int flg = g_anm_lod_policy.flg[pAnm->lod];
+	int max_depth = (flg & E_ANMLODFLG_SUBSET) ? g_anm_lod_policy.subset_depth : 0xFF;
+
+	if (!pData) {
+		Pose_cpy(pPose, &pAnm->rest);
+	} else if ((flg & E_ANMLODFLG_CACHE) && g_anm_sys.cache.size && pPose->nb_slot <= g_anm_sys.cache.max_slot) {
+		Cache_sample(pAnm, pPose, pData, frame, max_depth);
+	} else {
+		Pose_sample(pAnm, pPose, pData, frame, max_depth);
+	}
+	if (pData && (flg & E_ANMLODFLG_SUBSET)) {
+		Pose_keep(pAnm, pPose, max_depth);
+	}
+}
+
+void ANM_pose_get_mtx(ANIMATION* pAnm, ANM_POSE* pPose) {
+	int i, j, n;
+	QMTX m[4];
+	QVEC qx, qy, qz, qw;
+	QVEC x2, y2, z2;
+	QVEC xx, yy, zz, xy, xz, yz, wx, wy, wz;
+	QVEC r0, r1, r2, r3;
+	QVEC one = _mm_set1_ps(1.0f);
+	QVEC zero = _mm_setzero_ps();
+	JOINT* pJnt = pAnm->pMdl->pJnt;
+	int nb_jnt = pAnm->nb_jnt;
+	int slot;
+
+	for (i = 0; i < nb_jnt; i += 4) {
+		qx = _D_POSE_LD(pPose, QX, i);
+		qy = _D_POSE_LD(pPose, QY, i);
+		qz = _D_POSE_LD(pPose, QZ, i);
+		qw = _D_POSE_LD(pPose, QW, i);
+		x2 = _mm_add_ps(qx, qx);
+		y2 = _mm_add_ps(qy, qy);
+		z2 = _mm_add_ps(qz, qz);
+		xx = _mm_mul_ps(qx, x2);
+		yy = _mm_mul_ps(qy, y2);
+		zz = _mm_mul_ps(qz, z2);
+		xy = _mm_mul_ps(qx, y2);
+		xz = _mm_mul_ps(qx, z2);
+		yz = _mm_mul_ps(qy, z2);
+		wx = _mm_mul_ps(qw, x2);
+		wy = _mm_mul_ps(qw, y2);
+		wz = _mm_mul_ps(qw, z2);
+
+		r0 = _mm_sub_ps(one, _mm_add_ps(yy, zz));
+		r1 = _mm_add_ps(xy, wz);
+		r2 = _mm_sub_ps(xz, wy);
+		r3 = zero;
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_store_ps(m[0][0], r0);
+		_mm_store_ps(m[1][0], r1);
+		_mm_store_ps(m[2][0], r2);
+		_mm_store_ps(m[3][0], r3);
+
+		r0 = _mm_sub_ps(xy, wz);
+		r1 = _mm_sub_ps(one, _mm_add_ps(xx, zz));
+		r2 = _mm_add_ps(yz, wx);
+		r3 = zero;
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_store_ps(m[0][1], r0);
+		_mm_store_ps(m[1][1], r1);
+		_mm_store_ps(m[2][1], r2);
+		_mm_store_ps(m[3][1], r3);
+
+		r0 = _mm_add_ps(xz, wy);
+		r1 = _mm_sub_ps(yz, wx);
+		r2 = _mm_sub_ps(one, _mm_add_ps(xx, yy));
+		r3 = zero;
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_store_ps(m[0][2], r0);
+		_mm_store_ps(m[1][2], r1);
+		_mm_store_ps(m[2][2], r2);
+		_mm_store_ps(m[3][2], r3);
+
+		r0 = _D_POSE_LD(pPose, TX, i);
+		r1 = _D_POSE_LD(pPose, TY, i);
+		r2 = _D_POSE_LD(pPose, TZ, i);
+		r3 = one;
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_store_ps(m[0][3], r0);
+		_mm_store_ps(m[1][3], r1);
+		_mm_store_ps(m[2][3], r2);
+		_mm_store_ps(m[3][3], r3);
+
+		n = D_MIN(4, nb_jnt - i);
+		for (j = 0; j < n; ++j) {
+			MTX_cpy(pJnt->mtx, m[j]);
+			++pJnt;
+		}
+	}
+
+	slot = nb_jnt + E_ANMPOSEXT_KCTOP_L;
+	pAnm->kc_leg_l.top_quat.qv = V4_set(pPose->pCh[E_ANMPOSECH_QX][slot], pPose->pCh[E_ANMPOSECH_QY][slot], pPose->pCh[E_ANMPOSECH_QZ][slot], pPose->pCh[E_ANMPOSECH_QW][slot]);
+	slot = nb_jnt + E_ANMPOSEXT_KCTOP_R;
+	pAnm->kc_leg_r.top_quat.qv = V4_set(pPose->pCh[E_ANMPOSECH_QX][slot], pPose->pCh[E_ANMPOSECH_QY][slot], pPose->pCh[E_ANMPOSECH_QZ][slot], pPose->pCh[E_ANMPOSECH_QW][slot]);
+	slot = nb_jnt + E_ANMPOSEXT_KCEND_L;
+	pAnm->kc_leg_l.end_pos.qv = V4_set_pnt(pPose->pCh[E_ANMPOSECH_TX][slot], pPose->pCh[E_ANMPOSECH_TY][slot], pPose->pCh[E_ANMPOSECH_TZ][slot]);
+	slot = nb_jnt + E_ANMPOSEXT_KCEND_R;
+	pAnm->kc_leg_r.end_pos.qv = V4_set_pnt(pPose->pCh[E_ANMPOSECH_TX][slot], pPose->pCh[E_ANMPOSECH_TY][slot], pPose->pCh[E_ANMPOSECH_TZ][slot]);
+}
+
+float* ANM_mask_create(ANIMATION* pAnm, float val) {
+	int i;
+	int n = pAnm->rest.nb_slot;
+	float* pMask = (float*)SYS_malloc(n*sizeof(float));
+	for (i = 0; i < n; ++i) {
+		pMask[i] = val;
+	}
+	return pMask;
+}
+
+void ANM_mask_destroy(float* pMask) {
+	SYS_free(pMask);
+}
+
+void ANM_mask_set_branch(ANIMATION* pAnm, float* pMask, const char* jnt_name, float val) {
+	int i, top;
+	int nb_jnt = pAnm->nb_jnt;
+	JOINT* pJnt = pAnm->pMdl->pJnt;
+	D_BIT_ARY(flg, 256);
+
+	top = OMD_get_jnt_idx(pAnm->pMdl->pOmd, jnt_name);
+	if (top < 0 || nb_jnt > 256) return;
+	memset(flg, 0, sizeof(flg));
+	D_BIT_ST(flg, top);
+	pMask[top] = val;
+	/* parents are stored before their children */
+	for (i = top + 1; i < nb_jnt; ++i) {
+		int parent_id = pJnt[i].pInfo->parent_id;
+		if (parent_id >= 0 && D_BIT_CK(flg, parent_id)) {
+			D_BIT_ST(flg, i);
+			pMask[i] = val;
+		}
+	}
+	if (D_BIT_CK(flg, pAnm->kc_leg_l.pJnt_top->pInfo->id)) {
+		pMask[nb_jnt + E_ANMPOSEXT_KCTOP_L] = val;
+		pMask[nb_jnt + E_ANMPOSEXT_KCEND_L] = val;
+	}
+	if (D_BIT_CK(flg, pAnm->kc_leg_r.pJnt_top->pInfo->id)) {
+		pMask[nb_jnt + E_ANMPOSEXT_KCTOP_R] = val;
+		pMask[nb_jnt + E_ANMPOSEXT_KCEND_R] = val;
+	}
+}
+
+void ANM_tree_reset(ANM_TREE* pTree) {
+	pTree->nb_node = 0;
+}
+
+static ANM_NODE* Tree_add_node(ANM_TREE* pTree, int type, ANM_DATA* pData, float frame, float weight, float* pMask, int nb_src) {
+	ANM_NODE* pNode = NULL;
+	if (pTree->nb_node < D_ANM_TREE_MAX_NODE) {
+		pNode = &pTree->node[pTree->nb_node++];
+		pNode->pData = pData;
+		pNode->pMask = pMask;
+		pNode->frame = frame;
+		pNode->weight = weight;
+		pNode->type = (sys_byte)type;
+		pNode->nb_src = (sys_byte)nb_src;
+	} else {
+		SYS_log("Animation tree overflow\n");
+	}
+	return pNode;
+}
+
+ANM_NODE* ANM_tree_clip(ANM_TREE* pTree, ANM_DATA* pData, float frame, float weight, float* pMask) {
+	return Tree_add_node(pTree, E_ANMNODE_CLIP, pData, frame, weight, pMask, 0);
+}
+
+ANM_NODE* ANM_tree_delta(ANM_TREE* pTree, ANM_DATA* pData, float frame, float weight, float* pMask) {
+	return Tree_add_node(pTree, E_ANMNODE_DELTA, pData, frame, weight, pMask, 0);
+}
+
+ANM_NODE* ANM_tree_blend(ANM_TREE* pTree, int nb_src, float weight, float* pMask) {
+	return Tree_add_node(pTree, E_ANMNODE_BLEND, NULL, 0.0f, weight, pMask, nb_src);
+}
+
+/* followed by the base and the additive input, the latter's weight and mask scale the layer */
+ANM_NODE* ANM_tree_add(ANM_TREE* pTree, float weight, float* pMask) {
+	return Tree_add_node(pTree, E_ANMNODE_ADD, NULL, 0.0f, weight, pMask, 2);
+}
+
+void ANM_lod_calc(ANIMATION* pAnm, CAMERA* pCam) {
+	int lod, rate;
+	float dist, size;
+	QVEC dir;
+	GEOM_SPHERE sph;
+	ANM_LOD_POLICY* pPolicy = &g_anm_lod_policy;
+
+	sph.qv = MTX_calc_qpnt(pAnm->pMdl->root_mtx, V4_set_w1(pAnm->bound.qv));
+	sph.r = pAnm->bound.r;
+	if (GEOM_frustum_sph_cull(&pCam->frustum, &sph)) {
+		lod = E_ANMLOD_HIDDEN;
+	} else {
+		dir = V4_normalize(V4_sub(pCam->tgt.qv, pCam->pos.qv));
+		dist = V4_dot(V4_sub(sph.qv, pCam->pos.qv), dir);
+		lod = E_ANMLOD_FULL;
+		if (dist > pCam->znear) {
+			size = sph.r / (dist * tanf(pCam->fovy * 0.5f));
+			while (lod < E_ANMLOD_SUBSET && size < pPolicy->size[lod]) {
+				++lod;
+			}
+		}
+	}
+	rate = pPolicy->rate[lod];
+	if (rate != pPolicy->rate[pAnm->lod] || pAnm->lod_phase >= rate) {
+		pAnm->lod_phase = 0;
+	}
+	pAnm->lod = lod;
+	SYNC_inc(&g_anm_lod_stats.count[lod]);
+}
+
+void ANM_lod_stats_reset() {
+	memset(&g_anm_lod_stats, 0, sizeof(ANM_LOD_STATS));
+}
+
+void ANM_tree_eval(ANIMATION* pAnm, ANM_TREE* pTree) {
+	if (pTree->nb_node > 0) {
+		Tree_eval(pAnm, pTree, 0, &pAnm->pose, 0);
+	} else {
+		Pose_cpy(&pAnm->pose, &pAnm->rest);
+	}
+}
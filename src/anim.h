@@ -19,6 +19,9 @@
  */
 
 #define D_MAX_ANIM_NODE (64)
+#define D_ANM_TREE_MAX_NODE (32)
+#define D_ANM_TREE_MAX_DEPTH (6)
+#define D_ANM_CACHE_PROBE (8)
 
 typedef enum _E_ANMGRPTYPE {
 	E_ANMGRPTYPE_INVALID,
@@ -36,6 +39,56 @@ typedef enum _E_ANMSTATUS {
 	E_ANMSTATUS_SHIFT = 2
 } E_ANMSTATUS;
 
+typedef enum _E_ANMPOSECH {
+	E_ANMPOSECH_QX,
+	E_ANMPOSECH_QY,
+	E_ANMPOSECH_QZ,
+	E_ANMPOSECH_QW,
+	E_ANMPOSECH_TX,
+	E_ANMPOSECH_TY,
+	E_ANMPOSECH_TZ,
+	E_ANMPOSECH_WGT,
+	E_ANMPOSECH_MAX
+} E_ANMPOSECH;
+
+/* IK controls are carried in the pose after the skeleton joints */
+typedef enum _E_ANMPOSEXT {
+	E_ANMPOSEXT_KCTOP_L,
+	E_ANMPOSEXT_KCEND_L,
+	E_ANMPOSEXT_KCTOP_R,
+	E_ANMPOSEXT_KCEND_R,
+	E_ANMPOSEXT_MAX
+} E_ANMPOSEXT;
+
+typedef enum _E_ANMNODE {
+	E_ANMNODE_CLIP,
+	E_ANMNODE_DELTA, /* clip relative to its first frame */
+	E_ANMNODE_BLEND,
+	E_ANMNODE_ADD
+} E_ANMNODE;
+
+typedef enum _E_ANMLOD {
+	E_ANMLOD_FULL,
+	E_ANMLOD_NOIK,
+	E_ANMLOD_REDUCED,
+	E_ANMLOD_SUBSET,
+	E_ANMLOD_HIDDEN,
+	E_ANMLOD_MAX
+} E_ANMLOD;
+
+typedef enum _E_ANMLODFLG {
+	E_ANMLODFLG_IK     = 1,
+	E_ANMLODFLG_BLEND  = 2,
+	E_ANMLODFLG_SUBSET = 4,
+	E_ANMLODFLG_CACHE  = 8
+} E_ANMLODFLG;
+
+typedef enum _E_ANMCACHE {
+	E_ANMCACHE_EMPTY,
+	E_ANMCACHE_BUSY,
+	E_ANMCACHE_READY
+} E_ANMCACHE;
+
 typedef enum _E_KCATTR {
 	E_KCATTR_FLOORADJ = 1,
 	E_KCATTR_FOOTROT  = 2
@@ -43,20 +96,39 @@ typedef enum _E_KCATTR {
 
 typedef struct _JOINT JOINT;
 typedef struct _MODEL MODEL;
+typedef struct _CAMERA CAMERA;
+typedef struct _OMD OMD;
 
 typedef struct _ANM_GRP_INFO {
-	JOINT* pJnt;
+	sys_i16 jnt_id; /* -1 if the group does not drive a joint */
 	sys_byte type; /* E_ANMGRPTYPE */
 } ANM_GRP_INFO;
 
-typedef struct _ANM_DATA {
+typedef struct _ANM_DATA ANM_DATA;
+
+/* per clip group names resolved once, shared by all skeletons */
+typedef struct _ANM_CLIP {
+	KFR_HEAD* pKfr;
+	sys_i32* pName_id;
+	sys_byte* pType; /* E_ANMGRPTYPE */
+	ANM_DATA* pBind;
+	sys_i32 id;
+	sys_i32 ref;
+} ANM_CLIP;
+
+/* clip to skeleton binding, shared by all instances of the skeleton */
+struct _ANM_DATA {
 	KFR_HEAD* pKfr;
 	ANM_GRP_INFO* pInfo;
-} ANM_DATA;
+	ANM_CLIP* pClip;
+	ANM_DATA* pNext;
+	sys_i32 skel_id;
+	sys_i32 ref;
+};
 
 typedef struct _KIN_CHAIN {
 	UVEC end_pos;
-	UVEC3 top_rot;
+	UVEC top_quat;
 	JOINT* pJnt_top;
 	JOINT* pJnt_rot;
 	JOINT* pJnt_end;
@@ -74,17 +146,78 @@ typedef struct _ANM_MOVE {
 	float heading;
 } ANM_MOVE;
 
-typedef struct _JNT_BLEND_POSE {
-	UVEC quat;
-	UVEC pos;
-} JNT_BLEND_POSE;
+/* SoA joint transforms, channels are padded to a multiple of 4 slots */
+typedef struct _ANM_POSE {
+	float* pCh[E_ANMPOSECH_MAX];
+	int nb_slot;
+} ANM_POSE;
+
+typedef struct _ANM_NODE {
+	ANM_DATA* pData;
+	float* pMask;
+	float frame;
+	float weight;
+	sys_byte type; /* E_ANMNODE */
+	sys_byte nb_src;
+} ANM_NODE;
+
+/* nodes are stored in pre-order, each node is followed by its inputs */
+typedef struct _ANM_TREE {
+	ANM_NODE node[D_ANM_TREE_MAX_NODE];
+	int nb_node;
+} ANM_TREE;
 
 typedef struct _ANM_BLEND {
+	ANM_DATA* pData;
+	float frame;
+	float frame_step;
 	float duration;
 	float count;
-	JNT_BLEND_POSE* pPose;
 } ANM_BLEND;
 
+/* size: min projected bound radius for each visible level, in units of half the screen height */
+typedef struct _ANM_LOD_POLICY {
+	float size[E_ANMLOD_SUBSET];
+	sys_byte rate[E_ANMLOD_MAX];
+	sys_byte flg[E_ANMLOD_MAX]; /* E_ANMLODFLG */
+	sys_byte subset_depth;
+} ANM_LOD_POLICY;
+
+typedef struct _ANM_LOD_STATS {
+	sys_i32 count[E_ANMLOD_MAX];
+	sys_i32 nb_eval;
+	sys_i32 nb_ik;
+} ANM_LOD_STATS;
+
+typedef struct _ANM_CACHE_KEY {
+	OMD* pOmd;
+	KFR_HEAD* pKfr;
+	sys_i32 frame; /* quantized */
+	sys_i32 depth;
+} ANM_CACHE_KEY;
+
+/*
+ * Sampled poses shared by all instances during a frame.
+ * Entries are claimed with CAS and published by setting the state to READY,
+ * readers never lock. The table is cleared between frames by ANM_cache_reset.
+ */
+typedef struct _ANM_CACHE {
+	ANM_CACHE_KEY* pKey;
+	sys_i32* pState; /* E_ANMCACHE */
+	float* pPose;
+	int size; /* power of 2 */
+	int max_slot;
+	float frame_div;
+	sys_i32 nb_hit;
+	sys_i32 nb_miss;
+} ANM_CACHE;
+
+typedef struct _ANM_SYS {
+	ANM_CACHE cache;
+	DICT* pClip_dict; /* KFR_HEAD* -> ANM_CLIP* */
+	sys_i32 clip_count;
+} ANM_SYS;
+
 typedef struct _ANIMATION {
 	ANM_MOVE move;
 	UVEC3 root_rot;
@@ -92,26 +225,58 @@ typedef struct _ANIMATION {
 	MODEL* pMdl;
 	ANM_DATA* pData;
 	ANM_BLEND* pBlend;
+	ANM_TREE* pTree;
+	ANM_POSE pose;
+	ANM_POSE rest;
+	ANM_POSE stk[D_ANM_TREE_MAX_DEPTH];
+	ANM_POSE lod_pose[2];
+	GEOM_SPHERE bound;
+	sys_byte* pJnt_depth;
 	KIN_CHAIN kc_leg_l;
 	KIN_CHAIN kc_leg_r;
 	float ankle_height;
 	float frame;
 	float frame_step;
 	sys_ui32 status;
+	int nb_jnt;
+	int lod;
+	int lod_phase;
 } ANIMATION;
 
 typedef int (*IK_FLOOR_FUNC)(QVEC pos, float range, UVEC* pFloor_pos, UVEC* pFloor_nml);
 
 D_EXTERN_DATA IK_FLOOR_FUNC g_ik_floor_func;
+D_EXTERN_DATA ANM_LOD_POLICY g_anm_lod_policy;
+D_EXTERN_DATA ANM_LOD_STATS g_anm_lod_stats;
+D_EXTERN_DATA ANM_SYS g_anm_sys;
+
+D_EXTERN_FUNC void ANM_sys_init(int cache_size, int max_jnt);
+D_EXTERN_FUNC void ANM_sys_reset(void);
+D_EXTERN_FUNC void ANM_cache_reset(void);
 
 D_EXTERN_FUNC ANIMATION* ANM_create(MODEL* pMdl);
 D_EXTERN_FUNC void ANM_destroy(ANIMATION* pAnm);
 D_EXTERN_FUNC ANM_DATA* ANM_data_create(ANIMATION* pAnm, KFR_HEAD* pKfr);
+D_EXTERN_FUNC void ANM_data_release(ANM_DATA* pData);
 D_EXTERN_FUNC void ANM_data_destroy(ANM_DATA* pData);
 D_EXTERN_FUNC void ANM_set(ANIMATION* pAnm, ANM_DATA* pData, int start_frame);
 D_EXTERN_FUNC void ANM_play(ANIMATION* pAnm);
 D_EXTERN_FUNC void ANM_move(ANIMATION* pAnm);
-D_EXTERN_FUNC void ANM_calc_ik(ANIMATION* pAnm);
+D_EXTERN_FUNC void ANM_calc_world(ANIMATION* pAnm);
+D_EXTERN_FUNC void ANM_calc_world_batch(ANIMATION** ppAnm, int n);
 D_EXTERN_FUNC void ANM_blend_init(ANIMATION* pAnm, int duration);
-D_EXTERN_FUNC void ANM_blend_calc(ANIMATION* pAnm);
+D_EXTERN_FUNC void ANM_calc_local(ANIMATION* pAnm);
+D_EXTERN_FUNC void ANM_pose_sample(ANIMATION* pAnm, ANM_POSE* pPose, ANM_DATA* pData, float frame);
+D_EXTERN_FUNC void ANM_pose_get_mtx(ANIMATION* pAnm, ANM_POSE* pPose);
+D_EXTERN_FUNC float* ANM_mask_create(ANIMATION* pAnm, float val);
+D_EXTERN_FUNC void ANM_mask_destroy(float* pMask);
+D_EXTERN_FUNC void ANM_mask_set_branch(ANIMATION* pAnm, float* pMask, const char* jnt_name, float val);
+D_EXTERN_FUNC void ANM_tree_reset(ANM_TREE* pTree);
+D_EXTERN_FUNC ANM_NODE* ANM_tree_clip(ANM_TREE* pTree, ANM_DATA* pData, float frame, float weight, float* pMask);
+D_EXTERN_FUNC ANM_NODE* ANM_tree_delta(ANM_TREE* pTree, ANM_DATA* pData, float frame, float weight, float* pMask);
+D_EXTERN_FUNC ANM_NODE* ANM_tree_blend(ANM_TREE* pTree, int nb_src, float weight, float* pMask);
+D_EXTERN_FUNC ANM_NODE* ANM_tree_add(ANM_TREE* pTree, float weight, float* pMask);
+D_EXTERN_FUNC void ANM_tree_eval(ANIMATION* pAnm, ANM_TREE* pTree);
+D_EXTERN_FUNC void ANM_lod_calc(ANIMATION* pAnm, CAMERA* pCam);
+D_EXTERN_FUNC void ANM_lod_stats_reset(void);
 
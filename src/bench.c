@@ -0,0 +1,670 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "job.h"
+#include "calc.h"
+#include "util.h"
+#include "keyframe.h"
+#include "anim.h"
+#include "render.h"
+#include "material.h"
+#include "camera.h"
+#include "obstacle.h"
+#include "room.h"
+#include "model.h"
+#include "player.h"
+#include "bench.h"
+
+#define D_BENCH_ANM_ITER (2000)
+#define D_BENCH_BLEND_CLIPS (8)
+#define D_BENCH_CROWD_SIZE (1000)
+#define D_BENCH_CROWD_FRAMES (60)
+#define D_BENCH_CACHE_CROWD_SIZE (5000)
+#define D_BENCH_CACHE_CLIPS (8)
+#define D_BENCH_CACHE_MT_JOB (256)
+#define D_BENCH_CACHE_MT_FRAMES (8)
+#define D_BENCH_CACHE_MT_ROUNDS (20)
+#define D_BENCH_BIND_CLIPS (500)
+#define D_BENCH_BIND_SKELS (20)
+#define D_BENCH_RDR_SORT_MAX (32768)
+#define D_BENCH_RDR_EMIT (3072)
+#define D_BENCH_RDR_EMIT_JOB (64)
+#define D_BENCH_RDR_EMIT_FRAME (100)
+
+typedef struct _BENCH_CHAR {
+	MODEL* pMdl;
+	ANIMATION* pAnm;
+	ANM_DATA* pData[2];
+} BENCH_CHAR;
+
+static sys_i64 s_cache_hit;
+static sys_i64 s_cache_miss;
+static int s_nb_fail;
+
+/* for the counts that have to be zero, the benchmark log is the only test this tree has */
+static void Bench_fail(const char* pName, int nb_bad) {
+	if (nb_bad) {
+		SYS_log("%s: FAILED, %d bad results\n", pName, nb_bad);
+		++s_nb_fail;
+	}
+}
+
+static KFR_HEAD** Bench_player_clips() {
+	static KFR_HEAD* clips[2];
+	clips[0] = g_pl.pAnm_data[0]->pKfr;
+	clips[1] = g_pl.pAnm_data[1]->pKfr;
+	return clips;
+}
+
+/* every clip is a copy of its own, so the blend reads nb_clip separate sets of keys */
+static void Bench_anm_blend(int nb_clip) {
+	int i;
+	sys_i64 t0, t1;
+	ANM_TREE tree;
+	ANIMATION* pAnm = g_pl.pAnm;
+	KFR_HEAD* clips[D_BENCH_BLEND_CLIPS];
+	ANM_DATA* pData[D_BENCH_BLEND_CLIPS];
+
+	nb_clip = D_MIN(nb_clip, D_BENCH_BLEND_CLIPS);
+	ANM_tree_reset(&tree);
+	ANM_tree_blend(&tree, nb_clip, 1.0f, NULL);
+	for (i = 0; i < nb_clip; ++i) {
+		clips[i] = KFR_load((i & 1) ? "char/walk.kfr" : "char/idle.kfr");
+		pData[i] = ANM_data_create(pAnm, clips[i]);
+		ANM_tree_clip(&tree, pData[i], (float)((i * 7) % (clips[i]->max_frame + 1)), 1.0f / nb_clip, NULL);
+	}
+	t0 = SYS_get_timestamp();
+	for (i = 0; i < D_BENCH_ANM_ITER; ++i) {
+		ANM_tree_eval(pAnm, &tree);
+		ANM_pose_get_mtx(pAnm, &pAnm->pose);
+	}
+	t1 = SYS_get_timestamp();
+	SYS_log("anm blend x%d: %d ticks/eval\n", nb_clip, (int)((t1 - t0) / D_BENCH_ANM_ITER));
+	for (i = 0; i < nb_clip; ++i) {
+		ANM_data_release(pData[i]);
+		KFR_free(clips[i]);
+	}
+}
+
+static BENCH_CHAR* Bench_crowd_create(int n, KFR_HEAD** ppKfr, int nb_kfr) {
+	int i, x, z;
+	int side = 32;
+	BENCH_CHAR* pChr;
+	OMD* pOmd = g_pl.pOmd;
+
+	pChr = (BENCH_CHAR*)SYS_malloc(n * sizeof(BENCH_CHAR));
+	for (i = 0; i < n; ++i) {
+		x = i % side;
+		z = i / side;
+		pChr[i].pMdl = MDL_create(pOmd);
+		pChr[i].pMdl->pos.qv = V4_set_pnt((float)(x - side/2) * 2.0f, 0.0f, (float)z * 2.0f);
+		MDL_calc_root(pChr[i].pMdl);
+		pChr[i].pAnm = ANM_create(pChr[i].pMdl);
+		pChr[i].pData[0] = ANM_data_create(pChr[i].pAnm, ppKfr[(i*2) % nb_kfr]);
+		pChr[i].pData[1] = ANM_data_create(pChr[i].pAnm, ppKfr[(i*2 + 1) % nb_kfr]);
+		ANM_set(pChr[i].pAnm, pChr[i].pData[0], i % 20);
+	}
+	return pChr;
+}
+
+static void Bench_crowd_destroy(BENCH_CHAR* pChr, int n) {
+	int i;
+	for (i = 0; i < n; ++i) {
+		/* clips are owned by the caller, only release the bindings */
+		ANM_data_release(pChr[i].pData[0]);
+		ANM_data_release(pChr[i].pData[1]);
+		ANM_destroy(pChr[i].pAnm);
+		MDL_destroy(pChr[i].pMdl);
+	}
+	SYS_free(pChr);
+}
+
+static sys_i64 Bench_crowd_exec(BENCH_CHAR* pChr, ANIMATION** ppAnm, int n, CAMERA* pCam) {
+	int i, frame;
+	sys_i64 t0, t1;
+
+	t0 = SYS_get_timestamp();
+	for (frame = 0; frame < D_BENCH_CROWD_FRAMES; ++frame) {
+		ANM_lod_stats_reset();
+		ANM_cache_reset();
+		for (i = 0; i < n; ++i) {
+			ANM_lod_calc(pChr[i].pAnm, pCam);
+			if (frame == D_BENCH_CROWD_FRAMES / 2) {
+				ANM_blend_init(pChr[i].pAnm, 10);
+				ANM_set(pChr[i].pAnm, pChr[i].pData[1], 0);
+			}
+			ANM_play(pChr[i].pAnm);
+			ANM_calc_local(pChr[i].pAnm);
+		}
+		ANM_calc_world_batch(ppAnm, n);
+		s_cache_hit += g_anm_sys.cache.nb_hit;
+		s_cache_miss += g_anm_sys.cache.nb_miss;
+	}
+	t1 = SYS_get_timestamp();
+	return (t1 - t0) / D_BENCH_CROWD_FRAMES;
+}
+
+static void Bench_anm_lod() {
+	int i;
+	sys_i64 t_full, t_lod;
+	CAMERA cam;
+	ANM_LOD_POLICY policy;
+	BENCH_CHAR* pChr;
+	ANIMATION** ppAnm;
+
+	CAM_init(&cam);
+	CAM_set_view(&cam, V4_set_pnt(0.0f, 1.6f, -2.0f), V4_set_pnt(0.0f, 1.0f, 10.0f), V4_set_vec(0.0f, 1.0f, 0.0f));
+	CAM_update(&cam);
+	pChr = Bench_crowd_create(D_BENCH_CROWD_SIZE, Bench_player_clips(), 2);
+	ppAnm = (ANIMATION**)SYS_malloc(D_BENCH_CROWD_SIZE * sizeof(ANIMATION*));
+	for (i = 0; i < D_BENCH_CROWD_SIZE; ++i) {
+		ppAnm[i] = pChr[i].pAnm;
+	}
+
+	policy = g_anm_lod_policy;
+	memset(g_anm_lod_policy.size, 0, sizeof(g_anm_lod_policy.size));
+	g_anm_lod_policy.flg[E_ANMLOD_HIDDEN] = g_anm_lod_policy.flg[E_ANMLOD_FULL];
+	g_anm_lod_policy.rate[E_ANMLOD_HIDDEN] = 1;
+	t_full = Bench_crowd_exec(pChr, ppAnm, D_BENCH_CROWD_SIZE, &cam);
+	g_anm_lod_policy = policy;
+	for (i = 0; i < D_BENCH_CROWD_SIZE; ++i) {
+		ANM_set(pChr[i].pAnm, pChr[i].pData[0], i % 20);
+	}
+	t_lod = Bench_crowd_exec(pChr, ppAnm, D_BENCH_CROWD_SIZE, &cam);
+	SYS_log("anm crowd x%d: full %d ticks/frame, lod %d ticks/frame\n", D_BENCH_CROWD_SIZE, (int)t_full, (int)t_lod);
+	SYS_log("  lod count: %d %d %d %d %d, eval %d, ik %d\n",
+	        g_anm_lod_stats.count[E_ANMLOD_FULL], g_anm_lod_stats.count[E_ANMLOD_NOIK], g_anm_lod_stats.count[E_ANMLOD_REDUCED],
+	        g_anm_lod_stats.count[E_ANMLOD_SUBSET], g_anm_lod_stats.count[E_ANMLOD_HIDDEN],
+	        g_anm_lod_stats.nb_eval, g_anm_lod_stats.nb_ik);
+
+	SYS_free(ppAnm);
+	Bench_crowd_destroy(pChr, D_BENCH_CROWD_SIZE);
+}
+
+static void Bench_anm_ik() {
+	int i, frame;
+	sys_i64 t0, t1, t_single, t_batch;
+	BENCH_CHAR* pChr;
+	ANIMATION** ppAnm;
+
+	pChr = Bench_crowd_create(D_BENCH_CROWD_SIZE, Bench_player_clips(), 2);
+	ppAnm = (ANIMATION**)SYS_malloc(D_BENCH_CROWD_SIZE * sizeof(ANIMATION*));
+	for (i = 0; i < D_BENCH_CROWD_SIZE; ++i) {
+		ppAnm[i] = pChr[i].pAnm;
+		ANM_play(pChr[i].pAnm);
+	}
+
+	t0 = SYS_get_timestamp();
+	for (frame = 0; frame < D_BENCH_CROWD_FRAMES; ++frame) {
+		for (i = 0; i < D_BENCH_CROWD_SIZE; ++i) {
+			ANM_calc_local(ppAnm[i]);
+			ANM_calc_world(ppAnm[i]);
+		}
+	}
+	t1 = SYS_get_timestamp();
+	t_single = (t1 - t0) / D_BENCH_CROWD_FRAMES;
+
+	t0 = SYS_get_timestamp();
+	for (frame = 0; frame < D_BENCH_CROWD_FRAMES; ++frame) {
+		for (i = 0; i < D_BENCH_CROWD_SIZE; ++i) {
+			ANM_calc_local(ppAnm[i]);
+		}
+		ANM_calc_world_batch(ppAnm, D_BENCH_CROWD_SIZE);
+	}
+	t1 = SYS_get_timestamp();
+	t_batch = (t1 - t0) / D_BENCH_CROWD_FRAMES;
+	SYS_log("anm ik x%d: single %d ticks/frame, batch %d ticks/frame\n", D_BENCH_CROWD_SIZE, (int)t_single, (int)t_batch);
+
+	SYS_free(ppAnm);
+	Bench_crowd_destroy(pChr, D_BENCH_CROWD_SIZE);
+}
+
+static void Bench_anm_cache() {
+	int i, lod;
+	sys_i64 t_off, t_on;
+	CAMERA cam;
+	ANM_LOD_POLICY policy;
+	BENCH_CHAR* pChr;
+	ANIMATION** ppAnm;
+	KFR_HEAD* clips[D_BENCH_CACHE_CLIPS];
+
+	for (i = 0; i < D_BENCH_CACHE_CLIPS; ++i) {
+		clips[i] = KFR_load((i & 1) ? "char/walk.kfr" : "char/idle.kfr");
+	}
+	CAM_init(&cam);
+	CAM_set_view(&cam, V4_set_pnt(0.0f, 1.6f, -2.0f), V4_set_pnt(0.0f, 1.0f, 10.0f), V4_set_vec(0.0f, 1.0f, 0.0f));
+	CAM_update(&cam);
+	pChr = Bench_crowd_create(D_BENCH_CACHE_CROWD_SIZE, clips, D_BENCH_CACHE_CLIPS);
+	ppAnm = (ANIMATION**)SYS_malloc(D_BENCH_CACHE_CROWD_SIZE * sizeof(ANIMATION*));
+	for (i = 0; i < D_BENCH_CACHE_CROWD_SIZE; ++i) {
+		ppAnm[i] = pChr[i].pAnm;
+	}
+
+	/* same work for every character, only the sampling path differs */
+	policy = g_anm_lod_policy;
+	memset(g_anm_lod_policy.size, 0, sizeof(g_anm_lod_policy.size));
+	for (lod = 0; lod < E_ANMLOD_MAX; ++lod) {
+		g_anm_lod_policy.rate[lod] = 1;
+		g_anm_lod_policy.flg[lod] = E_ANMLODFLG_BLEND;
+	}
+	t_off = Bench_crowd_exec(pChr, ppAnm, D_BENCH_CACHE_CROWD_SIZE, &cam);
+	for (lod = 0; lod < E_ANMLOD_MAX; ++lod) {
+		g_anm_lod_policy.flg[lod] |= E_ANMLODFLG_CACHE;
+	}
+	for (i = 0; i < D_BENCH_CACHE_CROWD_SIZE; ++i) {
+		ANM_set(pChr[i].pAnm, pChr[i].pData[0], i % 20);
+	}
+	s_cache_hit = 0;
+	s_cache_miss = 0;
+	t_on = Bench_crowd_exec(pChr, ppAnm, D_BENCH_CACHE_CROWD_SIZE, &cam);
+	g_anm_lod_policy = policy;
+	ANM_cache_reset();
+	SYS_log("anm cache x%d, %d clips: off %d ticks/frame, on %d ticks/frame, saved %d\n",
+	        D_BENCH_CACHE_CROWD_SIZE, D_BENCH_CACHE_CLIPS, (int)t_off, (int)t_on, (int)(t_off - t_on));
+	SYS_log("  hit %d, miss %d, rate %.1f%%\n", (int)s_cache_hit, (int)s_cache_miss,
+	        s_cache_hit + s_cache_miss ? (double)s_cache_hit * 100.0 / (double)(s_cache_hit + s_cache_miss) : 0.0);
+
+	SYS_free(ppAnm);
+	Bench_crowd_destroy(pChr, D_BENCH_CACHE_CROWD_SIZE);
+	for (i = 0; i < D_BENCH_CACHE_CLIPS; ++i) {
+		KFR_free(clips[i]);
+	}
+}
+
+typedef struct _BENCH_CACHE_JOB {
+	BENCH_CHAR* pChr;
+	float* pOut; /* D_BENCH_CACHE_MT_FRAMES poses */
+	int nb_slot;
+} BENCH_CACHE_JOB;
+
+static void Bench_cache_pose(ANM_POSE* pPose, float* pMem, int nb_slot) {
+	int i;
+	for (i = 0; i < E_ANMPOSECH_MAX; ++i) {
+		pPose->pCh[i] = pMem + i*nb_slot;
+	}
+	pPose->nb_slot = nb_slot;
+}
+
+static void Bench_cache_job(void* pData) {
+	int i;
+	ANM_POSE pose;
+	BENCH_CACHE_JOB* pJob = (BENCH_CACHE_JOB*)pData;
+	int size = E_ANMPOSECH_MAX*pJob->nb_slot;
+
+	for (i = 0; i < D_BENCH_CACHE_MT_FRAMES; ++i) {
+		Bench_cache_pose(&pose, pJob->pOut + i*size, pJob->nb_slot);
+		ANM_pose_sample(pJob->pChr->pAnm, &pose, pJob->pChr->pData[0], (float)i);
+	}
+}
+
+/* every job samples the same frames of a few clips, so the workers race to claim and read the same entries */
+static void Bench_anm_cache_mt() {
+	int i, lod, round, size, nb_diff;
+	ANM_LOD_POLICY policy;
+	BENCH_CHAR* pChr;
+	float* pRef;
+	float* pOut;
+	JOB job;
+	JOB_QUEUE* pQue;
+	BENCH_CACHE_JOB* pJob;
+	KFR_HEAD* clips[D_BENCH_CACHE_CLIPS];
+
+	pQue = JOB_que_alloc(D_BENCH_CACHE_MT_JOB);
+	if (!pQue) return;
+	for (i = 0; i < D_BENCH_CACHE_CLIPS; ++i) {
+		clips[i] = KFR_load((i & 1) ? "char/walk.kfr" : "char/idle.kfr");
+	}
+	pChr = Bench_crowd_create(D_BENCH_CACHE_MT_JOB, clips, D_BENCH_CACHE_CLIPS);
+	size = E_ANMPOSECH_MAX*pChr[0].pAnm->pose.nb_slot*D_BENCH_CACHE_MT_FRAMES;
+	pRef = (float*)SYS_malloc(D_BENCH_CACHE_MT_JOB*size*sizeof(float));
+	pOut = (float*)SYS_malloc(D_BENCH_CACHE_MT_JOB*size*sizeof(float));
+	pJob = (BENCH_CACHE_JOB*)SYS_malloc(D_BENCH_CACHE_MT_JOB*sizeof(BENCH_CACHE_JOB));
+	for (i = 0; i < D_BENCH_CACHE_MT_JOB; ++i) {
+		pJob[i].pChr = &pChr[i];
+		pJob[i].nb_slot = pChr[i].pAnm->pose.nb_slot;
+	}
+
+	policy = g_anm_lod_policy;
+	for (lod = 0; lod < E_ANMLOD_MAX; ++lod) {
+		g_anm_lod_policy.flg[lod] = 0;
+	}
+	for (i = 0; i < D_BENCH_CACHE_MT_JOB; ++i) {
+		pJob[i].pOut = pRef + i*size;
+		Bench_cache_job(&pJob[i]);
+		pJob[i].pOut = pOut + i*size;
+	}
+	for (lod = 0; lod < E_ANMLOD_MAX; ++lod) {
+		g_anm_lod_policy.flg[lod] = E_ANMLODFLG_CACHE;
+	}
+	nb_diff = 0;
+	s_cache_hit = 0;
+	s_cache_miss = 0;
+	for (round = 0; round < D_BENCH_CACHE_MT_ROUNDS; ++round) {
+		ANM_cache_reset();
+		memset(pOut, 0, D_BENCH_CACHE_MT_JOB*size*sizeof(float));
+		for (i = 0; i < D_BENCH_CACHE_MT_JOB; ++i) {
+			job.pData = &pJob[i];
+			job.func = Bench_cache_job;
+			JOB_put(pQue, &job);
+		}
+		JOB_schedule(pQue, D_MAX_WORKERS);
+		s_cache_hit += g_anm_sys.cache.nb_hit;
+		s_cache_miss += g_anm_sys.cache.nb_miss;
+		for (i = 0; i < D_BENCH_CACHE_MT_JOB; ++i) {
+			if (memcmp(pRef + i*size, pOut + i*size, size*sizeof(float)) != 0) ++nb_diff;
+		}
+	}
+	g_anm_lod_policy = policy;
+	ANM_cache_reset();
+	SYS_log("anm cache mt %d jobs x %d frames, %d workers: hit %d, miss %d, %d poses differ\n",
+	        D_BENCH_CACHE_MT_JOB, D_BENCH_CACHE_MT_FRAMES, D_MAX_WORKERS, (int)s_cache_hit, (int)s_cache_miss, nb_diff);
+	Bench_fail("anm cache mt", nb_diff);
+
+	SYS_free(pJob);
+	SYS_free(pOut);
+	SYS_free(pRef);
+	Bench_crowd_destroy(pChr, D_BENCH_CACHE_MT_JOB);
+	for (i = 0; i < D_BENCH_CACHE_CLIPS; ++i) {
+		KFR_free(clips[i]);
+	}
+	JOB_que_free(pQue);
+}
+
+/* per pair name matching, as done before clips and skeletons shared interned names */
+static ANM_DATA* Bench_bind_by_name(MODEL* pMdl, KFR_HEAD* pKfr) {
+	int i, n;
+	ANM_GRP_INFO* pInfo;
+	ANM_DATA* pData;
+
+	n = pKfr->nb_grp;
+	pData = (ANM_DATA*)SYS_malloc(sizeof(ANM_DATA) + n*sizeof(ANM_GRP_INFO));
+	pData->pKfr = pKfr;
+	pData->pInfo = (ANM_GRP_INFO*)(pData + 1);
+	pInfo = pData->pInfo;
+	for (i = 0; i < n; ++i) {
+		const char* name = KFR_get_grp_name(pKfr, KFR_get_grp(pKfr, i));
+		JOINT* pJnt = NULL;
+		if (0 == strcmp(name, "root")) {
+			pInfo->type = E_ANMGRPTYPE_ROOT;
+		} else if (0 == strcmp(name, "center")) {
+			pInfo->type = E_ANMGRPTYPE_CENTER;
+			pJnt = MDL_get_jnt(pMdl, name);
+		} else if (0 == strcmp(name, "ctl_legRot_L")) {
+			pInfo->type = E_ANMGRPTYPE_KCTOP_L;
+		} else if (0 == strcmp(name, "ctl_legEff_L")) {
+			pInfo->type = E_ANMGRPTYPE_KCEND_L;
+		} else if (0 == strcmp(name, "ctl_legRot_R")) {
+			pInfo->type = E_ANMGRPTYPE_KCTOP_R;
+		} else if (0 == strcmp(name, "ctl_legEff_R")) {
+			pInfo->type = E_ANMGRPTYPE_KCEND_R;
+		} else {
+			pInfo->type = E_ANMGRPTYPE_JNT;
+			pJnt = MDL_get_jnt(pMdl, name);
+		}
+		pInfo->jnt_id = pJnt ? pJnt->pInfo->id : -1;
+		++pInfo;
+	}
+	return pData;
+}
+
+static void Bench_anm_bind() {
+	int i, j;
+	sys_i64 t0, t1, t_name, t_cold, t_warm;
+	OMD* pOmd[D_BENCH_BIND_SKELS];
+	MODEL* pMdl[D_BENCH_BIND_SKELS];
+	ANIMATION* pAnm[D_BENCH_BIND_SKELS];
+	KFR_HEAD** ppKfr;
+	ANM_DATA** ppData;
+	int nb_bind = D_BENCH_BIND_CLIPS * D_BENCH_BIND_SKELS;
+
+	for (i = 0; i < D_BENCH_BIND_SKELS; ++i) {
+		pOmd[i] = OMD_load("char/char.omd");
+		pMdl[i] = MDL_create(pOmd[i]);
+		pAnm[i] = ANM_create(pMdl[i]);
+	}
+	ppKfr = (KFR_HEAD**)SYS_malloc(D_BENCH_BIND_CLIPS * sizeof(KFR_HEAD*));
+	for (i = 0; i < D_BENCH_BIND_CLIPS; ++i) {
+		ppKfr[i] = KFR_load((i & 1) ? "char/walk.kfr" : "char/idle.kfr");
+	}
+	ppData = (ANM_DATA**)SYS_malloc(nb_bind * sizeof(ANM_DATA*));
+
+	t0 = SYS_get_timestamp();
+	for (i = 0; i < D_BENCH_BIND_CLIPS; ++i) {
+		for (j = 0; j < D_BENCH_BIND_SKELS; ++j) {
+			ppData[i*D_BENCH_BIND_SKELS + j] = Bench_bind_by_name(pMdl[j], ppKfr[i]);
+		}
+	}
+	t1 = SYS_get_timestamp();
+	t_name = t1 - t0;
+	for (i = 0; i < nb_bind; ++i) {
+		SYS_free(ppData[i]);
+	}
+
+	t0 = SYS_get_timestamp();
+	for (i = 0; i < D_BENCH_BIND_CLIPS; ++i) {
+		for (j = 0; j < D_BENCH_BIND_SKELS; ++j) {
+			ppData[i*D_BENCH_BIND_SKELS + j] = ANM_data_create(pAnm[j], ppKfr[i]);
+		}
+	}
+	t1 = SYS_get_timestamp();
+	t_cold = t1 - t0;
+
+	/* every further instance finds the binding built above */
+	t0 = SYS_get_timestamp();
+	for (i = 0; i < D_BENCH_BIND_CLIPS; ++i) {
+		for (j = 0; j < D_BENCH_BIND_SKELS; ++j) {
+			ANM_data_release(ANM_data_create(pAnm[j], ppKfr[i]));
+		}
+	}
+	t1 = SYS_get_timestamp();
+	t_warm = t1 - t0;
+	SYS_log("anm bind %d clips x %d skeletons: by name %d ticks, cold %d ticks, cached %d ticks\n",
+	        D_BENCH_BIND_CLIPS, D_BENCH_BIND_SKELS, (int)t_name, (int)t_cold, (int)t_warm);
+
+	for (i = 0; i < nb_bind; ++i) {
+		ANM_data_release(ppData[i]);
+	}
+	SYS_free(ppData);
+	for (i = 0; i < D_BENCH_BIND_CLIPS; ++i) {
+		KFR_free(ppKfr[i]);
+	}
+	SYS_free(ppKfr);
+	for (i = 0; i < D_BENCH_BIND_SKELS; ++i) {
+		ANM_destroy(pAnm[i]);
+		MDL_destroy(pMdl[i]);
+		OMD_free(pOmd[i]);
+	}
+}
+
+static double Bench_rate(int n, sys_i64 ticks) {
+	return ticks > 0 ? (double)n * (double)SYS_get_timestamp_freq() / (double)ticks : 0.0;
+}
+
+static double Bench_usec(sys_i64 ticks) {
+	return (double)ticks * 1e6 / (double)SYS_get_timestamp_freq();
+}
+
+static int Bench_sort_cmp(const void* p1, const void* p2) {
+	const UTL_SORT_PAIR* pA = (const UTL_SORT_PAIR*)p1;
+	const UTL_SORT_PAIR* pB = (const UTL_SORT_PAIR*)p2;
+	if (pA->key != pB->key) return pA->key < pB->key ? -1 : 1;
+	return 0;
+}
+
+static sys_ui32 Bench_rand16() {
+	return (sys_ui32)(UTL_frand01() * 0xFFFF);
+}
+
+static void Bench_rdr_sort() {
+	static const char* kind_name[] = {"random", "sorted", "equal", "state"};
+	int i, n, kind, iter, nb_iter, nb_bad;
+	sys_i64 t0, t_qs, t_rs, t_mt;
+	UTL_SORT_PAIR* pKey;
+	UTL_SORT_PAIR* pSrc;
+	UTL_SORT_PAIR* pRes;
+
+	pKey = (UTL_SORT_PAIR*)SYS_malloc(3 * D_BENCH_RDR_SORT_MAX * sizeof(UTL_SORT_PAIR));
+	if (!pKey) return;
+	pSrc = pKey + D_BENCH_RDR_SORT_MAX;
+	for (n = 1024; n <= D_BENCH_RDR_SORT_MAX; n <<= 1) {
+		nb_iter = D_BENCH_RDR_SORT_MAX * 16 / n;
+		for (kind = 0; kind < D_ARRAY_LENGTH(kind_name); ++kind) {
+			for (i = 0; i < n; ++i) {
+				switch (kind) {
+					case 0: pKey[i].key = ((sys_ui64)Bench_rand16() << 48) | ((sys_ui64)Bench_rand16() << 32) | (Bench_rand16() << 16) | Bench_rand16(); break;
+					case 1: pKey[i].key = (sys_ui64)i; break;
+					case 2: pKey[i].key = 0x12345678; break;
+					/* a few programs and VBs, many materials, depth in the low bits, as E_RDR_SORT_STATE builds them */
+					default: pKey[i].key = ((sys_ui64)(Bench_rand16() & 7) << 54) | ((sys_ui64)(Bench_rand16() & 3) << 44) | ((sys_ui64)(Bench_rand16() & 0x1F) << 32) | ((sys_ui64)(Bench_rand16() & 0xFF) << 16) | Bench_rand16(); break;
+				}
+				pKey[i].idx = (sys_ui32)i;
+			}
+			t0 = SYS_get_timestamp();
+			for (iter = 0; iter < nb_iter; ++iter) {
+				memcpy(pSrc, pKey, n * sizeof(UTL_SORT_PAIR));
+				qsort(pSrc, n, sizeof(UTL_SORT_PAIR), Bench_sort_cmp);
+			}
+			t_qs = SYS_get_timestamp() - t0;
+			t0 = SYS_get_timestamp();
+			for (iter = 0; iter < nb_iter; ++iter) {
+				memcpy(pSrc, pKey, n * sizeof(UTL_SORT_PAIR));
+				UTL_radix_sort(pSrc, pSrc + n, n);
+			}
+			t_rs = SYS_get_timestamp() - t0;
+			t0 = SYS_get_timestamp();
+			for (iter = 0; iter < nb_iter; ++iter) {
+				memcpy(pSrc, pKey, n * sizeof(UTL_SORT_PAIR));
+				pRes = UTL_radix_sort_mt(pSrc, pSrc + n, n, D_MAX_WORKERS);
+			}
+			t_mt = SYS_get_timestamp() - t0;
+			/* keys ascending, equal keys in put order */
+			nb_bad = 0;
+			for (i = 1; i < n; ++i) {
+				if (pRes[i - 1].key > pRes[i].key || (pRes[i - 1].key == pRes[i].key && pRes[i - 1].idx > pRes[i].idx)) {
+					++nb_bad;
+				}
+			}
+			SYS_log("rdr sort %d %s: qsort %.1f us, radix %.1f us, radix mt %.1f us, %d out of order\n",
+			        n, kind_name[kind], Bench_usec(t_qs) / nb_iter, Bench_usec(t_rs) / nb_iter, Bench_usec(t_mt) / nb_iter, nb_bad);
+		}
+	}
+	SYS_free(pKey);
+}
+
+typedef struct _BENCH_EMIT {
+	int start;
+	int count;
+} BENCH_EMIT;
+
+/* what a model draw job does per batch: state, one param block with its values, two layers */
+static void Bench_emit_job(void* pData) {
+	int i;
+	BENCH_EMIT* pEmit = (BENCH_EMIT*)pData;
+	RDR_BATCH* pBatch;
+	RDR_BATCH_PARAM* pParam;
+
+	for (i = 0; i < pEmit->count; ++i) {
+		pBatch = RDR_get_batch();
+		if (!pBatch) return;
+		pBatch->vtx_prog = D_RDRPROG_vtx_skin_zbuf;
+		pBatch->pix_prog = D_RDRPROG_pix_zbuf;
+		pBatch->pVtx = NULL;
+		pBatch->pIdx = NULL;
+		pBatch->type = E_RDR_PRIMTYPE_TRILIST;
+		pBatch->start = 0;
+		pBatch->count = 1;
+		pBatch->mtl_id = (sys_ui16)((pEmit->start + i) & 0xFF);
+		pBatch->depth = (float)(pEmit->start + i);
+		pBatch->nb_param = 1;
+		pParam = RDR_get_param(pBatch->nb_param);
+		if (!pParam) return;
+		pParam->count = 2;
+		pParam->id.type = E_RDR_PARAMTYPE_FVEC;
+		pParam->id.offs = D_RDR_GP_skin;
+		pParam->pVec = RDR_get_val_v(2);
+		if (!pParam->pVec) return;
+		pParam->pVec[0].qv = V4_fill(1.0f);
+		pParam->pVec[1].qv = V4_fill(0.0f);
+		pBatch->pParam = pParam;
+		RDR_put_batch(pBatch, 0, E_RDR_LAYER_ZBUF);
+		RDR_put_batch(pBatch, 0, E_RDR_LAYER_MTL0);
+	}
+}
+
+static void Bench_rdr_emit() {
+	static int wrk[] = {1, D_MAX_WORKERS};
+	int i, j, w, nb_ent, nb_bad;
+	sys_i64 t0, t_emit, t_merge;
+	JOB job;
+	JOB_QUEUE* pQue;
+	BENCH_EMIT emit[D_BENCH_RDR_EMIT_JOB];
+
+	pQue = JOB_que_alloc(D_BENCH_RDR_EMIT_JOB);
+	if (!pQue) return;
+	for (i = 0; i < D_BENCH_RDR_EMIT_JOB; ++i) {
+		emit[i].start = i * (D_BENCH_RDR_EMIT / D_BENCH_RDR_EMIT_JOB);
+		emit[i].count = D_BENCH_RDR_EMIT / D_BENCH_RDR_EMIT_JOB;
+	}
+	RDR_discard();
+	for (w = 0; w < D_ARRAY_LENGTH(wrk); ++w) {
+		t_emit = 0;
+		t_merge = 0;
+		nb_bad = 0;
+		for (i = 0; i < D_BENCH_RDR_EMIT_FRAME; ++i) {
+			t0 = SYS_get_timestamp();
+			for (j = 0; j < D_BENCH_RDR_EMIT_JOB; ++j) {
+				job.pData = &emit[j];
+				job.func = Bench_emit_job;
+				JOB_put(pQue, &job);
+			}
+			JOB_schedule(pQue, wrk[w]);
+			t_emit += SYS_get_timestamp() - t0;
+			t0 = SYS_get_timestamp();
+			nb_ent = RDR_discard();
+			t_merge += SYS_get_timestamp() - t0;
+			if (nb_ent != D_BENCH_RDR_EMIT*2) ++nb_bad;
+		}
+		SYS_log("rdr emit %d batches, %d workers: %.0f batches/s, merge %.1f us, %d frames lost entries\n",
+		        D_BENCH_RDR_EMIT, wrk[w], Bench_rate(D_BENCH_RDR_EMIT * D_BENCH_RDR_EMIT_FRAME, t_emit),
+		        Bench_usec(t_merge) / D_BENCH_RDR_EMIT_FRAME, nb_bad);
+	}
+	JOB_que_free(pQue);
+}
+
+void BENCH_exec() {
+	Bench_anm_blend(1);
+	Bench_anm_blend(2);
+	Bench_anm_blend(4);
+	Bench_anm_blend(8);
+	Bench_anm_lod();
+	Bench_anm_ik();
+	Bench_anm_cache();
+	Bench_anm_cache_mt();
+	Bench_anm_bind();
+	Bench_rdr_sort();
+	Bench_rdr_emit();
+	if (s_nb_fail) {
+		SYS_log("bench: %d checks FAILED\n", s_nb_fail);
+	}
+}
@@ -2748,7 +2748,7 @@ void GEOM_frustum_init(GEOM_FRUSTUM* pFst, MTX m, float fovy, float aspect, floa
 	Calc_frustum_planes(pFst);
 }
 
-#define _D_MK_AABB_VTX(_px, _py, _pz) V4_set_pnt(pBox->##_px.x, pBox->##_py.y, pBox->##_pz.z)
+#define _D_MK_AABB_VTX(_px, _py, _pz) V4_set_pnt(pBox->_px.x, pBox->_py.y, pBox->_pz.z)
 #define _D_BOX_EDGE_CK(_p0x, _p0y, _p0z, _p1x, _p1y, _p1z) \
 	a = _D_MK_AABB_VTX(_p0x, _p0y, _p0z); \
 	b = _D_MK_AABB_VTX(_p1x, _p1y, _p1z); \
@@ -2874,3 +2874,40 @@ int GEOM_frustum_sph_cull(GEOM_FRUSTUM* pFst, GEOM_SPHERE* pSph) {
 	return 0;
 }
 
+void GEOM_clip_vol_init(GEOM_CLIP_VOL* pVol, MTX m) {
+	int i;
+	QVEC* pDst[4];
+
+	pDst[0] = pVol->nx;
+	pDst[1] = pVol->ny;
+	pDst[2] = pVol->nz;
+	pDst[3] = pVol->d;
+	for (i = 0; i < 4; ++i) {
+		pDst[i][0] = V4_set(m[i][3] + m[i][0], m[i][3] - m[i][0], m[i][3] + m[i][1], m[i][3] - m[i][1]);
+		pDst[i][1] = V4_set(m[i][2], m[i][3] - m[i][2], m[i][2], m[i][3] - m[i][2]);
+	}
+}
+
+/* 1 if the box is entirely outside one of the planes, 4 planes per test */
+int GEOM_clip_vol_aabb_cull(GEOM_CLIP_VOL* pVol, GEOM_AABB* pBox) {
+	QVEC c, e, cx, cy, cz, ex, ey, ez, dist, rad, amask;
+	int i, m;
+
+	amask = D_M128(_mm_set1_epi32(0x7FFFFFFF));
+	c = _mm_mul_ps(_mm_add_ps(pBox->min.qv, pBox->max.qv), _mm_set1_ps(0.5f));
+	e = _mm_mul_ps(_mm_sub_ps(pBox->max.qv, pBox->min.qv), _mm_set1_ps(0.5f));
+	cx = _mm_shuffle_ps(c, c, _MM_SHUFFLE(0, 0, 0, 0));
+	cy = _mm_shuffle_ps(c, c, _MM_SHUFFLE(1, 1, 1, 1));
+	cz = _mm_shuffle_ps(c, c, _MM_SHUFFLE(2, 2, 2, 2));
+	ex = _mm_shuffle_ps(e, e, _MM_SHUFFLE(0, 0, 0, 0));
+	ey = _mm_shuffle_ps(e, e, _MM_SHUFFLE(1, 1, 1, 1));
+	ez = _mm_shuffle_ps(e, e, _MM_SHUFFLE(2, 2, 2, 2));
+	m = 0;
+	for (i = 0; i < 2; ++i) {
+		dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pVol->nx[i], cx), _mm_mul_ps(pVol->ny[i], cy)), _mm_add_ps(_mm_mul_ps(pVol->nz[i], cz), pVol->d[i]));
+		rad = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(pVol->nx[i], amask), ex), _mm_mul_ps(_mm_and_ps(pVol->ny[i], amask), ey)), _mm_mul_ps(_mm_and_ps(pVol->nz[i], amask), ez));
+		m |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, rad), _mm_setzero_ps()));
+	}
+	return m != 0;
+}
+
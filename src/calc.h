@@ -24,7 +24,11 @@
 #include <memory.h>
 #include <xmmintrin.h>
 #include <emmintrin.h>
-#include <intrin.h>
+#ifdef _MSC_VER
+#	include <intrin.h>
+#else
+#	include <pmmintrin.h>
+#endif
 #if defined(__INTEL_COMPILER)
 #	include <smmintrin.h>
 #endif
@@ -180,6 +184,14 @@ typedef struct _GEOM_FRUSTUM {
 	GEOM_PLANE pln[6];
 } GEOM_FRUSTUM;
 
+/* clip volume of a view-projection (0 <= z <= w), planes by component: x+w, w-x, y+w, w-y | z, w-z, z, w-z */
+typedef struct _GEOM_CLIP_VOL {
+	QVEC nx[2];
+	QVEC ny[2];
+	QVEC nz[2];
+	QVEC d[2];
+} GEOM_CLIP_VOL;
+
 D_EXTERN_DATA QMTX g_identity;
 
 D_EXTERN_DATA QVEC g_axis_qdop8[];
@@ -390,6 +402,8 @@ int GEOM_frustum_aabb_cull(GEOM_FRUSTUM* pFst, GEOM_AABB* pBox);
 int GEOM_frustum_obb_check(GEOM_FRUSTUM* pFst, GEOM_OBB* pBox);
 int GEOM_frustum_obb_cull(GEOM_FRUSTUM* pFst, GEOM_OBB* pBox);
 int GEOM_frustum_sph_cull(GEOM_FRUSTUM* pFst, GEOM_SPHERE* pSph);
+void GEOM_clip_vol_init(GEOM_CLIP_VOL* pVol, MTX m);
+int GEOM_clip_vol_aabb_cull(GEOM_CLIP_VOL* pVol, GEOM_AABB* pBox);
 
 #ifdef __cplusplus
 }
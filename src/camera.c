@@ -132,7 +132,11 @@ void CAM_load_data(CAMERA* pCam, const char* fname_kfr, const char* fname_lane)
 			char buf[64];
 			const char* lane_name = (const char*)D_INCR_PTR(pCam->pLane_data, pCam->pLane_data->tbl[i].offs_name);
 			pCam->pLane_anm[i].pGrp_pos = KFR_search_grp(pCam->pKfr_data, lane_name);
+#ifdef _MSC_VER
 			sprintf_s(buf, sizeof(buf), "%s_tgt", lane_name);
+#else
+			snprintf(buf, sizeof(buf), "%s_tgt", lane_name);
+#endif
 			pCam->pLane_anm[i].pGrp_tgt = KFR_search_grp(pCam->pKfr_data, buf);
 		}
 	}
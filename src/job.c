@@ -27,6 +27,8 @@
 #define D_SYNC_INC(pVal) ((sys_i32)_InterlockedIncrement((sys_long*)(pVal)))
 #define D_SYNC_DEC(pVal) ((sys_i32)_InterlockedDecrement((sys_long*)(pVal)))
 #define D_SYNC_XCHG(pVal, new_val) ((sys_i32)_InterlockedExchange((sys_long*)(pVal), (sys_long)(new_val)))
+#define D_SYNC_CAS(pVal, new_val, cmp_val) ((sys_i32)_InterlockedCompareExchange((sys_long*)(pVal), (sys_long)(new_val), (sys_long)(cmp_val)))
+#define D_SYNC_ADD(pVal, add_val) ((sys_i32)_InterlockedExchangeAdd((sys_long*)(pVal), (sys_long)(add_val)))
 
 JOB_SYS g_job_sys = {NULL};
 static JOB_WRK_INIT_FUNC s_job_wrk_init_func = NULL;
@@ -236,3 +238,15 @@ sys_i32 SYNC_dec(sys_i32* pVal) {
 	return D_SYNC_DEC(pVal);
 }
 
+sys_i32 SYNC_xchg(sys_i32* pVal, sys_i32 new_val) {
+	return D_SYNC_XCHG(pVal, new_val);
+}
+
+sys_i32 SYNC_cas(sys_i32* pVal, sys_i32 new_val, sys_i32 cmp_val) {
+	return D_SYNC_CAS(pVal, new_val, cmp_val);
+}
+
+sys_i32 SYNC_add(sys_i32* pVal, sys_i32 add_val) {
+	return D_SYNC_ADD(pVal, add_val);
+}
+
@@ -73,4 +73,7 @@ D_EXTERN_FUNC sys_int JOB_get_worker_id(void);
 
 D_EXTERN_FUNC sys_i32 SYNC_inc(sys_i32* pVal);
 D_EXTERN_FUNC sys_i32 SYNC_dec(sys_i32* pVal);
+D_EXTERN_FUNC sys_i32 SYNC_xchg(sys_i32* pVal, sys_i32 new_val);
+D_EXTERN_FUNC sys_i32 SYNC_cas(sys_i32* pVal, sys_i32 new_val, sys_i32 cmp_val);
+D_EXTERN_FUNC sys_i32 SYNC_add(sys_i32* pVal, sys_i32 add_val); /* returns the old value */
 
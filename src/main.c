@@ -38,6 +38,7 @@ struct _GLOBAL_WORK {
 } g_wk;
 
 static const TCHAR* s_build_date = _T(__DATE__);
+static int s_cap_frame = -1;
 
 static DWORD APIENTRY Remote_exec(void* pData) {
 	SYS_mutex_enter(&g_wk.gate_lock);
@@ -147,8 +148,13 @@ static void Init() {
 			JOB_sys_init(Wrk_init_func);
 			MTL_sys_init();
 			MDL_sys_init();
+			ANM_sys_init(CFG_get_i("anm_cache", 512), 128);
 
 			Data_init();
+			s_cap_frame = CFG_get_i("rdr_capture", -1);
+			if (CFG_get_i("bench", 0)) {
+				BENCH_exec();
+			}
 		}
 	}
 
@@ -156,12 +162,18 @@ static void Init() {
 
 static void Draw() {
 	static int ftime = 1000/60;
+	static int frame_no = 0;
 
 	g_wk.frame_start_time = GetTickCount();
 
 	INP_update();
 
 	RDR_begin();
+	if (frame_no++ == s_cap_frame) {
+		RDR_capture("frame.rcap");
+	}
+	ANM_lod_stats_reset();
+	ANM_cache_reset();
 	PLR_ctrl();
 	CAM_exec(&g_cam, g_pl.pMdl->pos.qv, 0.5f, 0.5f, g_pl.pAnm->move.heading);
 	CAM_update(&g_cam);
@@ -207,7 +219,9 @@ static void Reset() {
 	Remote_reset();
 	Data_free();
 	MTL_sys_reset();
+	ANM_sys_reset();
 	MDL_sys_reset();
+	NAME_reset();
 	JOB_sys_reset();
 	RDR_reset();
 	INP_reset();
@@ -13,4 +13,5 @@
 #include "room.h"
 #include "model.h"
 #include "player.h"
+#include "bench.h"
 
@@ -55,6 +55,8 @@ MTL_LIST* MTL_lst_create(MTL_INFO* pInfo, sys_ui32* pName_offs, void* pData_top,
 		memcpy(pLst->pInfo, pInfo, n*sizeof(MTL_INFO));
 		for (i = 0; i < n; ++i) {
 			pLst->pMtl[i].pInfo = &pLst->pInfo[i];
+			pLst->pMtl[i].sort_id = (sys_ui16)(pSys->sort_count % 0xFFFF + 1);
+			++pSys->sort_count;
 		}
 		for (i = 0; i < n; ++i) {
 			const char* pName = (const char*)D_INCR_PTR(pData_top, pName_offs[i]);
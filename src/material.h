@@ -44,6 +44,7 @@ typedef struct _MTL_INFO {
 typedef struct _MATERIAL {
 	MTL_INFO* pInfo;
 	const char* pName;
+	sys_ui16 sort_id; /* RDR_BATCH mtl_id, never 0 */
 } MATERIAL;
 
 typedef struct _MTL_LIST {
@@ -55,6 +56,7 @@ typedef struct _MTL_LIST {
 
 typedef struct _MTL_SYS {
 	SYM_POOL* pName_pool;
+	sys_ui32 sort_count;
 } MTL_SYS;
 
 D_EXTERN_DATA MTL_SYS g_mtl_sys;
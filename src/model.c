@@ -52,9 +52,32 @@ static void Set_jnt_info(OMD* pOmd, JNT_INFO* pJnt_info, OMD_JNT_INFO* pOmd_jnt,
 	pJnt_info->id = pOmd_jnt->id;
 	pJnt_info->parent_id = pOmd_jnt->parent_id;
 	pJnt_info->pName = DICT_pool_add(pSys->pName_pool, pName);
+	pJnt_info->name_id = NAME_get_id(pName);
 	DICT_put_p(pOmd->pName_dict, pJnt_info->pName, pJnt_info);
 }
 
+static void Name_map_init(OMD* pOmd) {
+	int i, n;
+	int id_min, id_max;
+	JNT_INFO* pJnt_info = pOmd->pJnt_info;
+
+	n = pOmd->nb_jnt;
+	if (!n) return;
+	id_min = pJnt_info[0].name_id;
+	id_max = id_min;
+	for (i = 1; i < n; ++i) {
+		id_min = D_MIN(id_min, pJnt_info[i].name_id);
+		id_max = D_MAX(id_max, pJnt_info[i].name_id);
+	}
+	pOmd->name_base = id_min;
+	pOmd->name_span = id_max - id_min + 1;
+	pOmd->pName_map = (sys_i16*)SYS_malloc(pOmd->name_span * sizeof(sys_i16));
+	memset(pOmd->pName_map, 0xFF, pOmd->name_span * sizeof(sys_i16));
+	for (i = 0; i < n; ++i) {
+		pOmd->pName_map[pJnt_info[i].name_id - id_min] = (sys_i16)i;
+	}
+}
+
 static void Vtx_cpy(RDR_VTX_GENERAL* pDst, OMD_VERTEX* pSrc) {
 	int i;
 	pDst->pos[0] = pSrc->pos.x;
@@ -134,6 +157,8 @@ OMD* OMD_load(const char* name) {
 			++pJnt_info;
 			++pOmd_jnt;
 		}
+		Name_map_init(pOmd);
+		pOmd->id = g_mdl_sys.omd_count++;
 		pJnt_info = pOmd->pJnt_info;
 		for (i = 0; i < n; ++i) {
 			if (pJnt_info->parent_id >= 0) {
@@ -209,6 +234,9 @@ void OMD_free(OMD* pOmd) {
 		RDR_vtx_release(pOmd->pVtx);
 		MTL_lst_destroy(pOmd->pMtl_lst);
 		DICT_destroy(pOmd->pName_dict);
+		if (pOmd->pName_map) {
+			SYS_free(pOmd->pName_map);
+		}
 		SYS_free(pOmd);
 	}
 }
@@ -226,6 +254,12 @@ int OMD_get_jnt_idx(OMD* pOmd, const char* name) {
 	return idx;
 }
 
+int OMD_get_jnt_idx_by_name_id(OMD* pOmd, sys_i32 name_id) {
+	int i = name_id - pOmd->name_base;
+	if ((sys_uint)i >= (sys_uint)pOmd->name_span) return -1;
+	return pOmd->pName_map[i];
+}
+
 MODEL* MDL_create(OMD* pOmd) {
 	int i;
 	int nb_jnt, nb_grp;
@@ -286,11 +320,15 @@ static void Calc_local(MTX* pMtx, UVEC* pPos, UVEC3* pRot) {
 	MTX_cpy(*pMtx, m);
 }
 
+void MDL_calc_root(MODEL* pMdl) {
+	Calc_local(&pMdl->root_mtx, &pMdl->pos, &pMdl->rot);
+}
+
 void MDL_calc_local(MODEL* pMdl) {
 	int i, n;
 	JOINT* pJnt;
 
-	Calc_local(&pMdl->root_mtx, &pMdl->pos, &pMdl->rot);
+	MDL_calc_root(pMdl);
 	n = pMdl->pOmd->nb_jnt;
 	pJnt = pMdl->pJnt;
 	for (i = 0; i < n; ++i) {
@@ -299,21 +337,24 @@ void MDL_calc_local(MODEL* pMdl) {
 	}
 }
 
-void MDL_calc_world(MODEL* pMdl) {
-	int i, n;
+void MDL_calc_world_range(MODEL* pMdl, int start, int end) {
+	int i;
 	JOINT* pJnt;
 	MTX* pWmtx;
 
-	n = pMdl->pOmd->nb_jnt;
-	pJnt = pMdl->pJnt;
-	pWmtx = pMdl->pJnt_wmtx;
-	for (i = 0; i < n; ++i) {
+	pJnt = &pMdl->pJnt[start];
+	pWmtx = &pMdl->pJnt_wmtx[start];
+	for (i = start; i < end; ++i) {
 		MTX_mul(*pWmtx, pJnt->mtx, *pJnt->pParent_mtx);
 		++pJnt;
 		++pWmtx;
 	}
 }
 
+void MDL_calc_world(MODEL* pMdl) {
+	MDL_calc_world_range(pMdl, 0, pMdl->pOmd->nb_jnt);
+}
+
 JOINT* MDL_get_jnt(MODEL* pMdl, const char* name) {
 	JOINT* pJnt = NULL;
 	int idx = OMD_get_jnt_idx(pMdl->pOmd, name);
@@ -331,26 +372,35 @@ static int Omd_cull_box(GEOM_AABB* pBox, CAMERA* pCam) {
 	return flg;
 }
 
-static void Grp_cull(MODEL* pMdl, CAMERA* pCam, int grp_no, GEOM_SPHERE* pSph, int nb_jnt) {
+static void Grp_calc_box(MODEL* pMdl, int grp_no, GEOM_AABB* pBox) {
 	QVEC pos;
 	QVEC rvec;
-	GEOM_AABB box;
-	int i, jnt_id;
+	int i, jnt_id, nb_jnt;
+	GEOM_SPHERE* pSph;
 	sys_byte* pJnt_id;
+	OMD_CULL_HEAD* pCull = pMdl->pOmd->pCull;
 
+	pSph = (GEOM_SPHERE*)D_INCR_PTR(pCull, pCull->list[grp_no].offs);
+	nb_jnt = pCull->list[grp_no].nb_jnt;
 	pJnt_id = (sys_byte*)(pSph + nb_jnt);
-	GEOM_aabb_init(&box);
+	GEOM_aabb_init(pBox);
 	for (i = 0; i < nb_jnt; ++i) {
 		jnt_id = *pJnt_id;
 		pos = MTX_calc_qpnt(pMdl->pJnt_wmtx[jnt_id], pSph->qv);
 		rvec = V4_fill(pSph->r);
-		box.min.qv = V4_min(box.min.qv, V4_sub(pos, rvec));
-		box.max.qv = V4_max(box.max.qv, V4_add(pos, rvec));
+		pBox->min.qv = V4_min(pBox->min.qv, V4_sub(pos, rvec));
+		pBox->max.qv = V4_max(pBox->max.qv, V4_add(pos, rvec));
 		++pSph;
 		++pJnt_id;
 	}
-	box.min.qv = V4_set_w1(box.min.qv);
-	box.max.qv = V4_set_w1(box.max.qv);
+	pBox->min.qv = V4_set_w1(pBox->min.qv);
+	pBox->max.qv = V4_set_w1(pBox->max.qv);
+}
+
+static void Grp_cull(MODEL* pMdl, CAMERA* pCam, int grp_no) {
+	GEOM_AABB box;
+
+	Grp_calc_box(pMdl, grp_no, &box);
 	if (Omd_cull_box(&box, pCam)) {
 		D_BIT_ST(pMdl->pCull, grp_no);
 	} else {
@@ -358,15 +408,21 @@ static void Grp_cull(MODEL* pMdl, CAMERA* pCam, int grp_no, GEOM_SPHERE* pSph, i
 	}
 }
 
+/* the view frustum doesn't apply to shadows, casters are tested against the shadow volume */
+static int Grp_cast_cull(MODEL* pMdl, int grp_no) {
+	GEOM_AABB box;
+
+	if (!pMdl->pOmd->pCull) return RDR_cull_cast(NULL);
+	Grp_calc_box(pMdl, grp_no, &box);
+	return RDR_cull_cast(&box);
+}
+
 void MDL_cull(MODEL* pMdl, CAMERA* pCam) {
 	int i, n;
-	OMD_CULL_HEAD* pCull = pMdl->pOmd->pCull;
-	if (!pCull) return;
+	if (!pMdl->pOmd->pCull) return;
 	n = pMdl->pOmd->nb_grp;
 	for (i = 0; i < n; ++i) {
-		GEOM_SPHERE* pSph = (GEOM_SPHERE*)D_INCR_PTR(pCull, pCull->list[i].offs);
-		int nb_jnt = pCull->list[i].nb_jnt;
-		Grp_cull(pMdl, pCam, i, pSph, nb_jnt);
+		Grp_cull(pMdl, pCam, i);
 	}
 }
 
@@ -377,8 +433,10 @@ void MDL_disp(MODEL* pMdl) {
 	MTX* pJnt_wmtx;
 	MTX* pJnt_inv;
 	PRIM_GROUP* pGrp;
+	MATERIAL* pMtl;
 	RDR_BATCH* pBatch;
 	RDR_BATCH_PARAM* pParam;
+	float depth;
 	int i, n, nb_jnt;
 
 	pOmd = pMdl->pOmd;
@@ -397,6 +455,7 @@ void MDL_disp(MODEL* pMdl) {
 	}
 
 	n = pOmd->nb_grp;
+	depth = RDR_calc_depth(pMdl->pos.qv);
 
 	pGrp = pOmd->pGrp;
 	for (i = 0; i < n; ++i) {
@@ -409,6 +468,7 @@ void MDL_disp(MODEL* pMdl) {
 			pBatch->pIdx = pOmd->pIdx;
 			pBatch->start = pGrp->start;
 			pBatch->count = pGrp->count;
+			pBatch->depth = depth;
 
 			pBatch->blend_state.on = 0;
 			pBatch->draw_state.cull = E_RDR_CULL_CCW;
@@ -431,7 +491,7 @@ void MDL_disp(MODEL* pMdl) {
 
 	pGrp = pOmd->pGrp;
 	for (i = 0; i < n; ++i) {
-		if (!D_BIT_CK(pMdl->pHide, i)) {
+		if (!D_BIT_CK(pMdl->pHide, i) && !Grp_cast_cull(pMdl, i)) {
 			pBatch = RDR_get_batch();
 			pBatch->vtx_prog = D_RDRPROG_vtx_skin_cast;
 			pBatch->pix_prog = D_RDRPROG_pix_cast;
@@ -440,6 +500,7 @@ void MDL_disp(MODEL* pMdl) {
 			pBatch->pIdx = pOmd->pIdx;
 			pBatch->start = pGrp->start;
 			pBatch->count = pGrp->count;
+			pBatch->depth = depth;
 
 			pBatch->blend_state.on = 0;
 			pBatch->draw_state.cull = E_RDR_CULL_CCW;
@@ -471,6 +532,9 @@ void MDL_disp(MODEL* pMdl) {
 			pBatch->pIdx = pOmd->pIdx;
 			pBatch->start = pGrp->start;
 			pBatch->count = pGrp->count;
+			pMtl = &pOmd->pMtl_lst->pMtl[pGrp->mtl_id];
+			pBatch->mtl_id = pMtl->sort_id;
+			pBatch->depth = depth;
 
 			pBatch->draw_state.cull = E_RDR_CULL_CCW;
 			pBatch->draw_state.zwrite = 0;
@@ -491,7 +555,7 @@ void MDL_disp(MODEL* pMdl) {
 			pParam->pVec = &pGrp->base_color;
 			++pParam;
 
-			pParam = MTL_apply(&pOmd->pMtl_lst->pMtl[pGrp->mtl_id], pParam);
+			pParam = MTL_apply(pMtl, pParam);
 
 			RDR_put_batch(pBatch, 0, E_RDR_LAYER_MTL0);
 		}
@@ -73,6 +73,7 @@ struct _JNT_INFO {
 	const char* pName;
 	sys_i16 id;
 	sys_i16 parent_id;
+	sys_i32 name_id;
 };
 
 typedef struct _PRIM_GROUP {
@@ -92,8 +93,12 @@ typedef struct _OMD {
 	OMD_CULL_HEAD* pCull;
 	RDR_VTX_BUFFER* pVtx;
 	RDR_IDX_BUFFER* pIdx;
+	sys_i16* pName_map; /* name id - name_base -> joint index */
 	int nb_jnt;
 	int nb_grp;
+	int name_base;
+	int name_span;
+	sys_i32 id;
 } OMD;
 
 typedef struct _JOINT {
@@ -116,6 +121,7 @@ typedef struct _MODEL {
 
 typedef struct _MDL_SYS {
 	SYM_POOL* pName_pool;
+	sys_i32 omd_count;
 } MDL_SYS;
 
 D_EXTERN_DATA MDL_SYS g_mdl_sys;
@@ -127,12 +133,15 @@ D_EXTERN_FUNC OMD* OMD_load(const char* name);
 D_EXTERN_FUNC void OMD_free(OMD* pOmd);
 D_EXTERN_FUNC JNT_INFO* OMD_get_jnt_info(OMD* pOmd, const char* name);
 D_EXTERN_FUNC int OMD_get_jnt_idx(OMD* pOmd, const char* name);
+D_EXTERN_FUNC int OMD_get_jnt_idx_by_name_id(OMD* pOmd, sys_i32 name_id);
 
 D_EXTERN_FUNC MODEL* MDL_create(OMD* pOmd);
 D_EXTERN_FUNC void MDL_destroy(MODEL* pMdl);
 D_EXTERN_FUNC void MDL_jnt_reset(MODEL* pMdl);
+D_EXTERN_FUNC void MDL_calc_root(MODEL* pMdl);
 D_EXTERN_FUNC void MDL_calc_local(MODEL* pMdl);
 D_EXTERN_FUNC void MDL_calc_world(MODEL* pMdl);
+D_EXTERN_FUNC void MDL_calc_world_range(MODEL* pMdl, int start, int end);
 D_EXTERN_FUNC JOINT* MDL_get_jnt(MODEL* pMdl, const char* name);
 D_EXTERN_FUNC void MDL_cull(MODEL* pMdl, CAMERA* pCam);
 D_EXTERN_FUNC void MDL_disp(MODEL* pMdl);
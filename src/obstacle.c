@@ -19,10 +19,22 @@
  */
 
 #include "system.h"
+#include "job.h"
 #include "calc.h"
 #include "util.h"
 #include "obstacle.h"
 
+#define D_BVH_BIN_NUM (16)
+#define D_BVH_MAX_DEPTH (48)
+#define D_BVH_MAX_TASK (256)
+#define D_BVH_TASK_MIN_PRIM (2048)
+#define D_BVH4_STACK (256)
+#define D_BVH4_EMPTY (-D_MAX_FLOAT)
+#define D_BATCH_TASK_MIN (256)
+#define D_BATCH_MAX_TASK (64)
+#define D_SLIDE_MAX_ITER (4)
+#define D_SLIDE_SKIN (1e-3f)
+
 typedef struct _BVH_WORK {
 	GEOM_AABB bbox;
 	OBST_QUERY* pQry;
@@ -30,24 +42,382 @@ typedef struct _BVH_WORK {
 	int res;
 } BVH_WORK;
 
+typedef struct _OBST_BATCH {
+	OBSTACLE* pObst;
+	OBST_QUERY* pQry;
+	sys_ui32* pKey;
+	sys_ui32* pOrder;
+	int start;
+	int count;
+} OBST_BATCH;
+
+typedef struct _BVH_BUILD BVH_BUILD;
+
+typedef struct _BVH_TASK {
+	BVH_BUILD* pBld;
+	int node;
+	int start;
+	int count;
+	int depth;
+} BVH_TASK;
+
+struct _BVH_BUILD {
+	GEOM_AABB* pNode_box;
+	BVH_NODE* pNode;
+	GEOM_AABB* pPrim_box;
+	sys_i32* pPrim_idx;
+	int task_size;
+	int nb_task;
+	BVH_TASK task[D_BVH_MAX_TASK];
+};
+
+GEOM_AABB* BVH_get_node_bbox(BVH_HEAD* pBVH, int i) {
+	return (GEOM_AABB*)(pBVH + 1) + i;
+}
+
+BVH_NODE* BVH_get_node(BVH_HEAD* pBVH, int i) {
+	return (BVH_NODE*)BVH_get_node_bbox(pBVH, pBVH->nb_node) + i;
+}
+
+BVH_NODE* BVH_get_root(BVH_HEAD* pBVH) {
+	return BVH_get_node(pBVH, 0);
+}
+
+int BVH_get_node_id(BVH_HEAD* pBVH, BVH_NODE* pNode) {
+	return (int)(pNode - BVH_get_root(pBVH));
+}
+
+BVH_HEAD* BVH_alloc(int nb_node) {
+	BVH_HEAD* pBVH = (BVH_HEAD*)SYS_malloc(sizeof(BVH_HEAD) + nb_node*(sizeof(GEOM_AABB) + sizeof(BVH_NODE)));
+	if (pBVH) {
+		memset(pBVH, 0, sizeof(BVH_HEAD));
+		pBVH->magic = D_FOURCC('B','V','H',0);
+		pBVH->nb_node = nb_node;
+	}
+	return pBVH;
+}
+
+static BVH_HEAD* Bvh_from_file(BVH_HEAD* pFile) {
+	int i, n;
+	BVH_FILE_NODE* pSrc;
+	BVH_NODE* pDst;
+	BVH_HEAD* pBVH;
+
+	n = pFile->nb_node;
+	pBVH = BVH_alloc(n);
+	if (pBVH) {
+		memcpy(BVH_get_node_bbox(pBVH, 0), pFile + 1, n*sizeof(GEOM_AABB));
+		pSrc = (BVH_FILE_NODE*)((GEOM_AABB*)(pFile + 1) + n);
+		pDst = BVH_get_root(pBVH);
+		for (i = 0; i < n; ++i) {
+			pDst->left = pSrc->left;
+			pDst->right = pSrc->right;
+			++pSrc;
+			++pDst;
+		}
+	}
+	return pBVH;
+}
+
+D_FORCE_INLINE static float Bvh_area(QVEC vmin, QVEC vmax) {
+	UVEC d;
+	d.qv = V4_sub(vmax, vmin);
+	return d.x*d.y + d.y*d.z + d.z*d.x;
+}
+
+D_FORCE_INLINE static float Bvh_centroid(GEOM_AABB* pBox, int axis) {
+	return pBox->min.f[axis] + pBox->max.f[axis];
+}
+
+static void Bvh_select(BVH_BUILD* pBld, sys_i32* pIdx, int count, int nth, int axis) {
+	int i, j, t;
+	int lo = 0;
+	int hi = count - 1;
+	float pivot;
+	GEOM_AABB* pPrim = pBld->pPrim_box;
+
+	while (lo < hi) {
+		pivot = Bvh_centroid(&pPrim[pIdx[(lo + hi) >> 1]], axis);
+		i = lo;
+		j = hi;
+		while (i <= j) {
+			while (Bvh_centroid(&pPrim[pIdx[i]], axis) < pivot) ++i;
+			while (Bvh_centroid(&pPrim[pIdx[j]], axis) > pivot) --j;
+			if (i <= j) {
+				t = pIdx[i];
+				pIdx[i] = pIdx[j];
+				pIdx[j] = t;
+				++i;
+				--j;
+			}
+		}
+		if (nth <= j) {
+			hi = j;
+		} else if (nth >= i) {
+			lo = i;
+		} else {
+			break;
+		}
+	}
+}
+
+/* binned SAH split of prims [start, start+count), returns the size of the left subtree's prim range or 0 for a leaf */
+static int Bvh_split(BVH_BUILD* pBld, int node, int start, int count, int depth) {
+	GEOM_AABB bin_box[D_BVH_BIN_NUM];
+	int bin_count[D_BVH_BIN_NUM];
+	float right_area[D_BVH_BIN_NUM];
+	int right_count[D_BVH_BIN_NUM];
+	int i, j, t, b, axis, split, nl, nr;
+	float c, scale, cost, best_cost;
+	QVEC vmin, vmax;
+	UVEC cmin, cmax, ext;
+	GEOM_AABB* pPrim = pBld->pPrim_box;
+	GEOM_AABB* pBox;
+	sys_i32* pIdx = &pBld->pPrim_idx[start];
+	BVH_NODE* pNode = &pBld->pNode[node];
+
+	if (count == 1) {
+		pBld->pNode_box[node] = pPrim[pIdx[0]];
+		pNode->prim = pIdx[0];
+		pNode->right = -1;
+		return 0;
+	}
+
+	vmin = pPrim[pIdx[0]].min.qv;
+	vmax = pPrim[pIdx[0]].max.qv;
+	cmin.qv = V4_add(vmin, vmax);
+	cmax.qv = cmin.qv;
+	for (i = 1; i < count; ++i) {
+		pBox = &pPrim[pIdx[i]];
+		vmin = V4_min(vmin, pBox->min.qv);
+		vmax = V4_max(vmax, pBox->max.qv);
+		cmin.qv = V4_min(cmin.qv, V4_add(pBox->min.qv, pBox->max.qv));
+		cmax.qv = V4_max(cmax.qv, V4_add(pBox->min.qv, pBox->max.qv));
+	}
+	pBld->pNode_box[node].min.qv = V4_set_w1(vmin);
+	pBld->pNode_box[node].max.qv = V4_set_w1(vmax);
+
+	ext.qv = V4_sub(cmax.qv, cmin.qv);
+	axis = 0;
+	if (ext.y > ext.f[axis]) axis = 1;
+	if (ext.z > ext.f[axis]) axis = 2;
+
+	nl = count >> 1;
+	if (ext.f[axis] <= 0.0f) {
+		/* coincident centroids, any split will do */
+	} else if (depth >= D_BVH_MAX_DEPTH) {
+		Bvh_select(pBld, pIdx, count, nl, axis);
+	} else {
+		for (b = 0; b < D_BVH_BIN_NUM; ++b) {
+			GEOM_aabb_init(&bin_box[b]);
+			bin_count[b] = 0;
+		}
+		scale = (float)D_BVH_BIN_NUM * 0.9999f / ext.f[axis];
+		for (i = 0; i < count; ++i) {
+			pBox = &pPrim[pIdx[i]];
+			b = (int)((Bvh_centroid(pBox, axis) - cmin.f[axis]) * scale);
+			b = D_MIN(b, D_BVH_BIN_NUM - 1);
+			bin_box[b].min.qv = V4_min(bin_box[b].min.qv, pBox->min.qv);
+			bin_box[b].max.qv = V4_max(bin_box[b].max.qv, pBox->max.qv);
+			++bin_count[b];
+		}
+		vmin = bin_box[D_BVH_BIN_NUM - 1].min.qv;
+		vmax = bin_box[D_BVH_BIN_NUM - 1].max.qv;
+		nr = 0;
+		for (b = D_BVH_BIN_NUM - 1; b > 0; --b) {
+			vmin = V4_min(vmin, bin_box[b].min.qv);
+			vmax = V4_max(vmax, bin_box[b].max.qv);
+			nr += bin_count[b];
+			right_area[b] = nr ? Bvh_area(vmin, vmax) : 0.0f;
+			right_count[b] = nr;
+		}
+		split = -1;
+		best_cost = D_MAX_FLOAT;
+		vmin = bin_box[0].min.qv;
+		vmax = bin_box[0].max.qv;
+		nl = 0;
+		for (b = 0; b < D_BVH_BIN_NUM - 1; ++b) {
+			vmin = V4_min(vmin, bin_box[b].min.qv);
+			vmax = V4_max(vmax, bin_box[b].max.qv);
+			nl += bin_count[b];
+			if (nl && right_count[b + 1]) {
+				cost = Bvh_area(vmin, vmax)*(float)nl + right_area[b + 1]*(float)right_count[b + 1];
+				if (cost < best_cost) {
+					best_cost = cost;
+					split = b;
+				}
+			}
+		}
+		i = 0;
+		j = count - 1;
+		while (i <= j) {
+			c = Bvh_centroid(&pPrim[pIdx[i]], axis);
+			b = D_MIN((int)((c - cmin.f[axis]) * scale), D_BVH_BIN_NUM - 1);
+			if (b <= split) {
+				++i;
+			} else {
+				t = pIdx[i];
+				pIdx[i] = pIdx[j];
+				pIdx[j] = t;
+				--j;
+			}
+		}
+		nl = i;
+	}
+	/* a subtree over n prims takes 2n-1 nodes, so the right child position is known before the left one is built */
+	pNode->left = node + 1;
+	pNode->right = node + 2*nl;
+	return nl;
+}
+
+static void Bvh_build_range(BVH_BUILD* pBld, int node, int start, int count, int depth) {
+	int nl = Bvh_split(pBld, node, start, count, depth);
+	if (nl) {
+		Bvh_build_range(pBld, node + 1, start, nl, depth + 1);
+		Bvh_build_range(pBld, node + 2*nl, start + nl, count - nl, depth + 1);
+	}
+}
+
+static void Bvh_task_func(void* pData) {
+	BVH_TASK* pTask = (BVH_TASK*)pData;
+	Bvh_build_range(pTask->pBld, pTask->node, pTask->start, pTask->count, pTask->depth);
+}
+
+static void Bvh_build_top(BVH_BUILD* pBld, JOB_QUEUE* pQue, int node, int start, int count, int depth) {
+	int nl;
+	JOB job;
+	BVH_TASK* pTask;
+
+	if (count <= pBld->task_size) {
+		if (pBld->nb_task < D_BVH_MAX_TASK) {
+			pTask = &pBld->task[pBld->nb_task++];
+			pTask->pBld = pBld;
+			pTask->node = node;
+			pTask->start = start;
+			pTask->count = count;
+			pTask->depth = depth;
+			job.pData = pTask;
+			job.func = Bvh_task_func;
+			JOB_put(pQue, &job);
+		} else {
+			Bvh_build_range(pBld, node, start, count, depth);
+		}
+		return;
+	}
+	nl = Bvh_split(pBld, node, start, count, depth);
+	Bvh_build_top(pBld, pQue, node + 1, start, nl, depth + 1);
+	Bvh_build_top(pBld, pQue, node + 2*nl, start + nl, count - nl, depth + 1);
+}
+
+void BVH_build(BVH_HEAD* pBVH, GEOM_AABB* pPrim_box, int nb_prim, int nb_wrk) {
+	int i;
+	BVH_BUILD* pBld;
+	JOB_QUEUE* pQue;
+
+	if (!pBVH || nb_prim <= 0 || (int)pBVH->nb_node != 2*nb_prim - 1) return;
+	pBld = (BVH_BUILD*)SYS_malloc(sizeof(BVH_BUILD) + nb_prim*sizeof(sys_i32));
+	if (!pBld) return;
+	pBld->pNode_box = BVH_get_node_bbox(pBVH, 0);
+	pBld->pNode = BVH_get_root(pBVH);
+	pBld->pPrim_box = pPrim_box;
+	pBld->pPrim_idx = (sys_i32*)(pBld + 1);
+	pBld->nb_task = 0;
+	for (i = 0; i < nb_prim; ++i) {
+		pBld->pPrim_idx[i] = i;
+	}
+	pQue = NULL;
+	if (nb_wrk > 1) {
+		pQue = JOB_que_alloc(D_BVH_MAX_TASK);
+	}
+	if (pQue) {
+		pBld->task_size = D_MAX(D_BVH_TASK_MIN_PRIM, nb_prim / (nb_wrk*8));
+		Bvh_build_top(pBld, pQue, 0, 0, nb_prim, 0);
+		JOB_schedule(pQue, nb_wrk);
+		JOB_que_free(pQue);
+	} else {
+		Bvh_build_range(pBld, 0, 0, nb_prim, 0);
+	}
+	SYS_free(pBld);
+}
+
+static void Bvh_refit_node(BVH_HEAD* pBVH, int node, GEOM_AABB* pPrim_box) {
+	BVH_NODE* pNode = BVH_get_node(pBVH, node);
+	GEOM_AABB* pBox = BVH_get_node_bbox(pBVH, node);
+	GEOM_AABB* pLeft;
+	GEOM_AABB* pRight;
+
+	if (pNode->right < 0) {
+		*pBox = pPrim_box[pNode->prim];
+	} else {
+		Bvh_refit_node(pBVH, pNode->left, pPrim_box);
+		Bvh_refit_node(pBVH, pNode->right, pPrim_box);
+		pLeft = BVH_get_node_bbox(pBVH, pNode->left);
+		pRight = BVH_get_node_bbox(pBVH, pNode->right);
+		pBox->min.qv = V4_min(pLeft->min.qv, pRight->min.qv);
+		pBox->max.qv = V4_max(pLeft->max.qv, pRight->max.qv);
+	}
+}
+
+/* children before their parent, following the links, trees from files needn't be in pre-order */
+void BVH_refit(BVH_HEAD* pBVH, GEOM_AABB* pPrim_box) {
+	if (!pBVH || !pBVH->nb_node) return;
+	Bvh_refit_node(pBVH, 0, pPrim_box);
+}
+
+int OBST_init(OBSTACLE* pObst, int nb_pnt, int nb_pol) {
+	OBST_HEAD* pHead;
+
+	memset(pObst, 0, sizeof(OBSTACLE));
+	pHead = (OBST_HEAD*)SYS_malloc(sizeof(OBST_HEAD) + nb_pnt*sizeof(UVEC3) + nb_pol*sizeof(OBST_POLY));
+	if (!pHead) return 0;
+	pHead->magic = D_FOURCC('O','B','S','T');
+	pHead->nb_pnt = nb_pnt;
+	pHead->nb_pol = nb_pol;
+	pObst->pData = pHead;
+	pObst->pPnt = (UVEC3*)(pHead + 1);
+	pObst->pPol = (OBST_POLY*)&pObst->pPnt[nb_pnt];
+	return 1;
+}
+
 void OBST_load(OBSTACLE* pObst, const char* obs_name, const char* bvh_name) {
+	int i, j;
 	OBST_HEAD* pHead;
+	OBST_FILE_POLY* pSrc;
+	OBST_POLY* pDst;
 
+	memset(pObst, 0, sizeof(OBSTACLE));
 	pHead = SYS_load(obs_name);
-	pObst->pData = pHead;
-	pObst->pPnt = NULL;
-	pObst->pPol = NULL;
 	if (pHead && pHead->magic == D_FOURCC('O','B','S','T')) {
-		pObst->pPnt = (UVEC3*)(pHead + 1);
-		pObst->pPol = (OBST_POLY*)&pObst->pPnt[pHead->nb_pnt];
+		if (OBST_init(pObst, pHead->nb_pnt, pHead->nb_pol)) {
+			memcpy(pObst->pPnt, pHead + 1, pHead->nb_pnt*sizeof(UVEC3));
+			pSrc = (OBST_FILE_POLY*)((UVEC3*)(pHead + 1) + pHead->nb_pnt);
+			pDst = pObst->pPol;
+			for (i = 0; i < (int)pHead->nb_pol; ++i) {
+				for (j = 0; j < 4; ++j) {
+					pDst->idx[j] = pSrc->idx[j];
+				}
+				pDst->attr = pSrc->attr;
+				++pSrc;
+				++pDst;
+			}
+		}
 	}
-	pObst->pBVH = NULL;
+	SYS_free(pHead);
+	if (!pObst->pData) return;
 	if (bvh_name) {
-		BVH_HEAD* pBVH = SYS_load(bvh_name);
-		if (pBVH && pBVH->magic == D_FOURCC('B','V','H',0)) {
-			pObst->pBVH = pBVH;
+		BVH_HEAD* pFile = SYS_load(bvh_name);
+		if (pFile && pFile->magic == D_FOURCC('B','V','H',0)) {
+			pObst->pBVH = Bvh_from_file(pFile);
 		}
+		SYS_free(pFile);
+	}
+	if (pObst->pBVH) {
+		OBST_build_flat(pObst);
+		OBST_build_wide(pObst);
+	} else {
+		OBST_build_bvh(pObst, D_MAX_WORKERS);
 	}
+	OBST_build_floor(pObst);
 }
 
 void OBST_free(OBSTACLE* pObst) {
@@ -56,6 +426,12 @@ void OBST_free(OBSTACLE* pObst) {
 		pObst->pData = NULL;
 		SYS_free(pObst->pBVH);
 		pObst->pBVH = NULL;
+		SYS_free(pObst->pFlat);
+		pObst->pFlat = NULL;
+		SYS_free(pObst->pWide);
+		pObst->pWide = NULL;
+		SYS_free(pObst->pFloor);
+		pObst->pFloor = NULL;
 	}
 }
 
@@ -82,149 +458,1747 @@ static int Ck_pol_aabb(QVEC* pVtx, GEOM_AABB* pAABB) {
 	return GEOM_aabb_overlap(&pol_aabb, pAABB);
 }
 
-static int Obst_check_direct(OBSTACLE* pObst, OBST_QUERY* pQry) {
+typedef struct _FLAT_RAY {
+	QVEC org;
+	QVEC inv;
+} FLAT_RAY;
+
+/* w is left undefined, none of the node tests look at it */
+D_FORCE_INLINE static QVEC Flat_decode(BVH_FLAT* pFlat, const sys_ui16* pQ) {
+	__m128i q = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)pQ), _mm_setzero_si128());
+	return _mm_add_ps(pFlat->org.qv, _mm_mul_ps(pFlat->step.qv, _mm_cvtepi32_ps(q)));
+}
+
+D_FORCE_INLINE static void Flat_node_bbox(BVH_FLAT* pFlat, BVH_QNODE* pNode, GEOM_AABB* pBox) {
+	pBox->min.qv = Flat_decode(pFlat, pNode->qmin);
+	pBox->max.qv = Flat_decode(pFlat, pNode->qmax);
+}
+
+static void Flat_ray_init(FLAT_RAY* pRay, QVEC p0, QVEC p1) {
+	int i;
+	UVEC d;
+	UVEC inv;
+
+	d.qv = V4_sub(p1, p0);
+	for (i = 0; i < 3; ++i) {
+		/* a huge finite slope instead of inf keeps 0*inv from turning into NaN on slab planes */
+		inv.f[i] = (d.f[i] > 1e-20f || d.f[i] < -1e-20f) ? 1.0f / d.f[i] : 1e30f;
+	}
+	inv.w = 0.0f;
+	pRay->org = p0;
+	pRay->inv = inv.qv;
+}
+
+/* slab test of segment [0, 1] against the dequantized node box, padded a little in t */
+D_FORCE_INLINE static int Flat_ray_ck(BVH_FLAT* pFlat, BVH_QNODE* pNode, FLAT_RAY* pRay) {
+	__m128 t0 = _mm_mul_ps(_mm_sub_ps(Flat_decode(pFlat, pNode->qmin), pRay->org), pRay->inv);
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(Flat_decode(pFlat, pNode->qmax), pRay->org), pRay->inv);
+	__m128 tmin = _mm_min_ps(t0, t1);
+	__m128 tmax = _mm_max_ps(t0, t1);
+	tmin = _mm_max_ps(tmin, _mm_shuffle_ps(tmin, tmin, 0xC9));
+	tmin = _mm_max_ps(tmin, _mm_shuffle_ps(tmin, tmin, 0xD2));
+	tmax = _mm_min_ps(tmax, _mm_shuffle_ps(tmax, tmax, 0xC9));
+	tmax = _mm_min_ps(tmax, _mm_shuffle_ps(tmax, tmax, 0xD2));
+	tmin = _mm_max_ss(tmin, _mm_set_ss(-1e-4f));
+	tmax = _mm_min_ss(tmax, _mm_set_ss(1.0f + 1e-4f));
+	return _mm_comile_ss(tmin, tmax);
+}
+
+D_FORCE_INLINE static int Flat_range_ck(BVH_FLAT* pFlat, BVH_QNODE* pNode, GEOM_AABB* pRange) {
+	__m128 vmin = Flat_decode(pFlat, pNode->qmin);
+	__m128 vmax = Flat_decode(pFlat, pNode->qmax);
+	int m = _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(vmin, pRange->max.qv), _mm_cmpnlt_ps(vmax, pRange->min.qv)));
+	return ((m & 7) == 7);
+}
+
+static sys_ui16 Flat_quant(float x) {
+	if (x <= 0.0f) return 0;
+	if (x >= 65535.0f) return 0xFFFF;
+	return (sys_ui16)x;
+}
+
+/* rounds outwards, then nudges until the decoded box strictly contains the source one */
+static void Flat_quantize(BVH_FLAT* pFlat, BVH_QNODE* pNode, GEOM_AABB* pBox) {
+	int i;
+	GEOM_AABB qbox;
+
+	for (i = 0; i < 3; ++i) {
+		pNode->qmin[i] = Flat_quant(floorf((pBox->min.f[i] - pFlat->org.f[i]) / pFlat->step.f[i]));
+		pNode->qmax[i] = Flat_quant(ceilf((pBox->max.f[i] - pFlat->org.f[i]) / pFlat->step.f[i]));
+	}
+	Flat_node_bbox(pFlat, pNode, &qbox);
+	for (i = 0; i < 3; ++i) {
+		while (pNode->qmin[i] > 0 && qbox.min.f[i] >= pBox->min.f[i]) {
+			--pNode->qmin[i];
+			qbox.min.qv = Flat_decode(pFlat, pNode->qmin);
+		}
+		while (pNode->qmax[i] < 0xFFFF && qbox.max.f[i] <= pBox->max.f[i]) {
+			++pNode->qmax[i];
+			qbox.max.qv = Flat_decode(pFlat, pNode->qmax);
+		}
+	}
+}
+
+/* strict containment keeps segments lying on a box face from missing it in the slab test */
+static void Flat_frame(BVH_FLAT* pFlat, GEOM_AABB* pRoot) {
+	UVEC pad;
+
+	pad.qv = V4_add(V4_scale(V4_max(V4_abs(pRoot->min.qv), V4_abs(pRoot->max.qv)), 1e-4f), V4_fill(1e-4f));
+	pFlat->org.qv = V4_sub(pRoot->min.qv, pad.qv);
+	pFlat->step.qv = V4_scale(V4_add(V4_sub(pRoot->max.qv, pRoot->min.qv), V4_scale(pad.qv, 2.0f)), 1.0f / 65000.0f);
+}
+
+static sys_ui32 Flat_node(OBSTACLE* pObst, BVH_FLAT* pFlat, int src, int* pCount) {
+	sys_ui32 mask;
+	BVH_NODE* pSrc = BVH_get_node(pObst->pBVH, src);
+	BVH_QNODE* pDst = &pFlat->pNode[(*pCount)++];
+
+	Flat_quantize(pFlat, pDst, BVH_get_node_bbox(pObst->pBVH, src));
+	pDst->reserved[0] = 0;
+	pDst->reserved[1] = 0;
+	if (pSrc->right < 0) {
+		pDst->prim = pSrc->prim;
+		mask = pObst->pPol[pSrc->prim].attr;
+	} else {
+		pDst->prim = -1;
+		mask = Flat_node(pObst, pFlat, pSrc->left, pCount);
+		mask |= Flat_node(pObst, pFlat, pSrc->right, pCount);
+	}
+	pDst->skip = *pCount;
+	pDst->mask = mask;
+	return mask;
+}
+
+void OBST_build_flat(OBSTACLE* pObst) {
+	int count;
+	BVH_FLAT* pFlat;
+
+	SYS_free(pObst->pFlat);
+	pObst->pFlat = NULL;
+	if (!pObst->pBVH) return;
+	pFlat = (BVH_FLAT*)SYS_malloc(sizeof(BVH_FLAT) + 64 + pObst->pBVH->nb_node*sizeof(BVH_QNODE));
+	if (!pFlat) return;
+	pFlat->pNode = (BVH_QNODE*)D_ALIGN(pFlat + 1, 64);
+	Flat_frame(pFlat, BVH_get_node_bbox(pObst->pBVH, 0));
+	count = 0;
+	Flat_node(pObst, pFlat, 0, &count);
+	pFlat->nb_node = count;
+	pObst->pFlat = pFlat;
+}
+
+D_FORCE_INLINE static float Wide_pad(float x, float dir) {
+	return x + dir*(fabsf(x)*1e-6f + 1e-6f);
+}
+
+/* collapses binary levels into up to four children, always opening the child with the largest surface */
+static sys_ui32 Wide_node(OBSTACLE* pObst, BVH4* pWide, int src, int* pCount, int lvl, int* pDepth) {
+	int i, n, best;
+	int slot[4];
+	float area, best_area;
+	sys_ui32 mask, node_mask;
+	GEOM_AABB* pBox;
+	BVH_NODE* pSrc;
+	BVH_HEAD* pBVH = pObst->pBVH;
+	BVH4_NODE* pDst = &pWide->pNode[(*pCount)++];
+
+	*pDepth = D_MAX(*pDepth, lvl + 1);
+	pSrc = BVH_get_node(pBVH, src);
+	if (pSrc->right < 0) {
+		slot[0] = src;
+		n = 1;
+	} else {
+		slot[0] = pSrc->left;
+		slot[1] = pSrc->right;
+		n = 2;
+		while (n < 4) {
+			best = -1;
+			best_area = -1.0f;
+			for (i = 0; i < n; ++i) {
+				if (BVH_get_node(pBVH, slot[i])->right >= 0) {
+					pBox = BVH_get_node_bbox(pBVH, slot[i]);
+					area = Bvh_area(pBox->min.qv, pBox->max.qv);
+					if (area > best_area) {
+						best_area = area;
+						best = i;
+					}
+				}
+			}
+			if (best < 0) break;
+			pSrc = BVH_get_node(pBVH, slot[best]);
+			slot[best] = pSrc->left;
+			slot[n++] = pSrc->right;
+		}
+	}
+	node_mask = 0;
+	for (i = 0; i < 4; ++i) {
+		if (i < n) {
+			pBox = BVH_get_node_bbox(pBVH, slot[i]);
+			pDst->bmin[0].f[i] = Wide_pad(pBox->min.x, -1.0f);
+			pDst->bmin[1].f[i] = Wide_pad(pBox->min.y, -1.0f);
+			pDst->bmin[2].f[i] = Wide_pad(pBox->min.z, -1.0f);
+			pDst->bmax[0].f[i] = Wide_pad(pBox->max.x, 1.0f);
+			pDst->bmax[1].f[i] = Wide_pad(pBox->max.y, 1.0f);
+			pDst->bmax[2].f[i] = Wide_pad(pBox->max.z, 1.0f);
+			pSrc = BVH_get_node(pBVH, slot[i]);
+			if (pSrc->right < 0) {
+				pDst->child[i] = ~pSrc->prim;
+				mask = pObst->pPol[pSrc->prim].attr;
+			} else {
+				pDst->child[i] = *pCount;
+				mask = Wide_node(pObst, pWide, slot[i], pCount, lvl + 1, pDepth);
+			}
+		} else {
+			pDst->bmin[0].f[i] = pDst->bmin[1].f[i] = pDst->bmin[2].f[i] = D_MAX_FLOAT;
+			pDst->bmax[0].f[i] = pDst->bmax[1].f[i] = pDst->bmax[2].f[i] = D_BVH4_EMPTY;
+			pDst->child[i] = 0;
+			mask = 0;
+		}
+		pDst->mask[i] = mask;
+		node_mask |= mask;
+	}
+	return node_mask;
+}
+
+static int Wide_has_leaf(BVH4_NODE* pNode) {
+	int i;
+	for (i = 0; i < 4; ++i) {
+		if (pNode->child[i] < 0 && pNode->mask[i] != 0) return 1;
+	}
+	return 0;
+}
+
+static void Wide_quad(OBSTACLE* pObst, BVH4_NODE* pNode, OBST_QUAD4* pQuad) {
+	int i, j;
 	QVEC vtx[4];
-	QVEC hit_pos;
-	QVEC hit_nml;
-	int i, n, res;
+	UVEC nml;
 	OBST_POLY* pPol;
-	float dist2;
-	float min_dist2 = D_MAX_FLOAT;
 
-	res = 0;
+	memset(pQuad, 0, sizeof(OBST_QUAD4));
+	for (i = 0; i < 4; ++i) {
+		pQuad->prim[i] = -1;
+		if (pNode->child[i] >= 0 || pNode->mask[i] == 0) continue;
+		pQuad->prim[i] = ~pNode->child[i];
+		pPol = &pObst->pPol[pQuad->prim[i]];
+		Get_pol_vtx(pObst, pPol, vtx);
+		/* same arithmetic as GEOM_seg_quad_intersect so the results stay bit exact */
+		nml.qv = V4_normalize(V4_cross(V4_sub(vtx[1], vtx[0]), V4_sub(vtx[2], vtx[0])));
+		for (j = 0; j < 4; ++j) {
+			pQuad->vx[j].f[i] = V4_at(vtx[j], 0);
+			pQuad->vy[j].f[i] = V4_at(vtx[j], 1);
+			pQuad->vz[j].f[i] = V4_at(vtx[j], 2);
+		}
+		pQuad->nx.f[i] = nml.x;
+		pQuad->ny.f[i] = nml.y;
+		pQuad->nz.f[i] = nml.z;
+		pQuad->attr[i] = pPol->attr;
+	}
+}
+
+void OBST_build_wide(OBSTACLE* pObst) {
+	int i, count, depth, nb_quad;
+	BVH4* pTmp;
+	BVH4* pWide;
+
+	SYS_free(pObst->pWide);
+	pObst->pWide = NULL;
+	if (!pObst->pBVH) return;
+	/* every wide node consumes at least one binary inner node */
+	pTmp = (BVH4*)SYS_malloc(sizeof(BVH4) + 64 + (pObst->pBVH->nb_node/2 + 1)*sizeof(BVH4_NODE));
+	if (!pTmp) return;
+	pTmp->pNode = (BVH4_NODE*)D_ALIGN(pTmp + 1, 64);
+	count = 0;
+	depth = 0;
+	Wide_node(pObst, pTmp, 0, &count, 0, &depth);
+	/* traversal keeps at most three pending siblings per level, deeper trees stay on the stackless flat path */
+	if (3*depth + 1 > D_BVH4_STACK) {
+		SYS_log("OBST_build_wide: %d levels do not fit the traversal stack\n", depth);
+		SYS_free(pTmp);
+		return;
+	}
+	nb_quad = 0;
+	for (i = 0; i < count; ++i) {
+		if (Wide_has_leaf(&pTmp->pNode[i])) {
+			++nb_quad;
+		}
+	}
+	/* nodes, quad records in node order and the node to record map in one block */
+	pWide = (BVH4*)SYS_malloc(sizeof(BVH4) + 64 + count*sizeof(BVH4_NODE) + nb_quad*sizeof(OBST_QUAD4) + count*sizeof(sys_i32));
+	if (pWide) {
+		pWide->pNode = (BVH4_NODE*)D_ALIGN(pWide + 1, 64);
+		pWide->pQuad = (OBST_QUAD4*)(pWide->pNode + count);
+		pWide->pNode_quad = (sys_i32*)(pWide->pQuad + nb_quad);
+		pWide->nb_node = count;
+		pWide->nb_quad = 0;
+		memcpy(pWide->pNode, pTmp->pNode, count*sizeof(BVH4_NODE));
+		for (i = 0; i < count; ++i) {
+			pWide->pNode_quad[i] = -1;
+			if (Wide_has_leaf(&pWide->pNode[i])) {
+				Wide_quad(pObst, &pWide->pNode[i], &pWide->pQuad[pWide->nb_quad]);
+				pWide->pNode_quad[i] = pWide->nb_quad++;
+			}
+		}
+		pObst->pWide = pWide;
+	}
+	SYS_free(pTmp);
+}
+
+void OBST_build_bvh(OBSTACLE* pObst, int nb_wrk) {
+	QVEC vtx[4];
+	int i, n;
+	GEOM_AABB* pPrim_box;
+
+	if (!pObst->pData) return;
+	SYS_free(pObst->pBVH);
+	pObst->pBVH = NULL;
+	SYS_free(pObst->pFlat);
+	pObst->pFlat = NULL;
+	SYS_free(pObst->pWide);
+	pObst->pWide = NULL;
 	n = pObst->pData->nb_pol;
-	pPol = pObst->pPol;
+	if (n <= 0) return;
+	pPrim_box = (GEOM_AABB*)SYS_malloc(n*sizeof(GEOM_AABB));
+	pObst->pBVH = BVH_alloc(2*n - 1);
+	if (pPrim_box && pObst->pBVH) {
+		for (i = 0; i < n; ++i) {
+			Get_pol_vtx(pObst, &pObst->pPol[i], vtx);
+			pPrim_box[i].min.qv = V4_min(V4_min(vtx[0], vtx[1]), V4_min(vtx[2], vtx[3]));
+			pPrim_box[i].max.qv = V4_max(V4_max(vtx[0], vtx[1]), V4_max(vtx[2], vtx[3]));
+		}
+		BVH_build(pObst->pBVH, pPrim_box, n, nb_wrk);
+		OBST_build_flat(pObst);
+		OBST_build_wide(pObst);
+	} else {
+		SYS_free(pObst->pBVH);
+		pObst->pBVH = NULL;
+	}
+	SYS_free(pPrim_box);
+}
+
+/* +1/-1 when the rectangle lies strictly on one side of every edge, 0 otherwise */
+static int Floor_cover(QVEC* pVtx, float x0, float z0, float x1, float z1) {
+	int i, j, sgn;
+	float ex, ez, s;
+	UVEC v0, v1;
+	float cx[4];
+	float cz[4];
+
+	cx[0] = x0; cz[0] = z0;
+	cx[1] = x1; cz[1] = z0;
+	cx[2] = x1; cz[2] = z1;
+	cx[3] = x0; cz[3] = z1;
+	sgn = 0;
+	for (i = 0; i < 4; ++i) {
+		v0.qv = pVtx[i];
+		v1.qv = pVtx[(i + 1) & 3];
+		ex = v1.x - v0.x;
+		ez = v1.z - v0.z;
+		for (j = 0; j < 4; ++j) {
+			s = ex*(cz[j] - v0.z) - ez*(cx[j] - v0.x);
+			if (s == 0.0f) return 0;
+			if (!sgn) {
+				sgn = s > 0.0f ? 1 : -1;
+			} else if ((s > 0.0f) != (sgn > 0)) {
+				return 0;
+			}
+		}
+	}
+	return sgn;
+}
+
+/* same arithmetic as GEOM_seg_quad_intersect, bounds padded like the BVH4 leaf boxes */
+static void Floor_plane(QVEC* pVtx, OBST_FLOOR_PLANE* pPlane) {
+	int i;
+	UVEC vmin, vmax;
+
+	pPlane->nml.qv = V4_normalize(V4_cross(V4_sub(pVtx[1], pVtx[0]), V4_sub(pVtx[2], pVtx[0])));
+	pPlane->org.qv = pVtx[0];
+	vmin.qv = V4_min(V4_min(pVtx[0], pVtx[1]), V4_min(pVtx[2], pVtx[3]));
+	vmax.qv = V4_max(V4_max(pVtx[0], pVtx[1]), V4_max(pVtx[2], pVtx[3]));
+	for (i = 0; i < 3; ++i) {
+		pPlane->bmin.f[i] = Wide_pad(vmin.f[i], -1.0f);
+		pPlane->bmax.f[i] = Wide_pad(vmax.f[i], 1.0f);
+	}
+	pPlane->bmin.w = 0.0f;
+	pPlane->bmax.w = 0.0f;
+}
+
+/* cells under the plane's bounds, returns 0 when they had to be clipped to the grid */
+static int Floor_range(OBST_FLOOR* pFloor, OBST_FLOOR_PLANE* pPlane, float margin, int* pRange) {
+	float x0 = (pPlane->bmin.x - margin - pFloor->org_x) * pFloor->inv_cell;
+	float z0 = (pPlane->bmin.z - margin - pFloor->org_z) * pFloor->inv_cell;
+	float x1 = (pPlane->bmax.x + margin - pFloor->org_x) * pFloor->inv_cell;
+	float z1 = (pPlane->bmax.z + margin - pFloor->org_z) * pFloor->inv_cell;
+
+	pRange[0] = D_MAX((int)x0, 0);
+	pRange[1] = D_MAX((int)z0, 0);
+	pRange[2] = D_MIN((int)x1, pFloor->nx - 1);
+	pRange[3] = D_MIN((int)z1, pFloor->nz - 1);
+	return x0 >= 0.0f && z0 >= 0.0f && x1 < (float)pFloor->nx && z1 < (float)pFloor->nz;
+}
+
+static int Floor_cell_cover(OBSTACLE* pObst, OBST_FLOOR* pFloor, int x, int z, float margin) {
+	float cx, cz;
+	QVEC vtx[4];
+	OBST_FLOOR_CELL* pCell = &pFloor->pCell[z*pFloor->nx + x];
+
+	if (pCell->count != 1) return 0;
+	cx = pFloor->org_x + (float)x*pFloor->cell;
+	cz = pFloor->org_z + (float)z*pFloor->cell;
+	Get_pol_vtx(pObst, &pObst->pPol[pFloor->pList[pCell->first]], vtx);
+	return Floor_cover(vtx, cx - margin, cz - margin, cx + pFloor->cell + margin, cz + pFloor->cell + margin);
+}
+
+void OBST_build_floor(OBSTACLE* pObst) {
+	int i, x, z, n, pass, nb_floor, nb_cell, nb_list;
+	int range[4];
+	float margin;
+	QVEC vtx[4];
+	UVEC vmin, vmax;
+	GEOM_AABB box;
+	OBST_FLOOR grid;
+	OBST_FLOOR_PLANE plane;
+	OBST_FLOOR* pFloor;
+	OBST_FLOOR_CELL* pCell;
+	OBST_POLY* pPol;
+
+	SYS_free(pObst->pFloor);
+	pObst->pFloor = NULL;
+	if (!pObst->pData) return;
+	n = pObst->pData->nb_pol;
+	nb_floor = 0;
+	box.min.qv = V4_fill(D_MAX_FLOAT);
+	box.max.qv = V4_fill(-D_MAX_FLOAT);
 	for (i = 0; i < n; ++i) {
-		if (pPol->attr & pQry->mask) {
+		pPol = &pObst->pPol[i];
+		if (!(pPol->attr & E_OBST_POLYATTR_FLOOR)) continue;
+		Get_pol_vtx(pObst, pPol, vtx);
+		vmin.qv = V4_min(V4_min(vtx[0], vtx[1]), V4_min(vtx[2], vtx[3]));
+		vmax.qv = V4_max(V4_max(vtx[0], vtx[1]), V4_max(vtx[2], vtx[3]));
+		box.min.qv = V4_min(box.min.qv, vmin.qv);
+		box.max.qv = V4_max(box.max.qv, vmax.qv);
+		++nb_floor;
+	}
+	if (!nb_floor) return;
+
+	/* about four cells per quad, shifted half a cell so regular floors don't line up with cell edges */
+	memset(&grid, 0, sizeof(OBST_FLOOR));
+	grid.cell = D_MAX(sqrtf((box.max.x - box.min.x)*(box.max.z - box.min.z) / (float)nb_floor) * 0.5f, 1e-3f);
+	grid.inv_cell = 1.0f / grid.cell;
+	grid.org_x = box.min.x - grid.cell*0.5f;
+	grid.org_z = box.min.z - grid.cell*0.5f;
+	grid.nx = (int)((box.max.x - grid.org_x) * grid.inv_cell) + 2;
+	grid.nz = (int)((box.max.z - grid.org_z) * grid.inv_cell) + 2;
+	margin = grid.cell / 16.0f;
+	nb_cell = grid.nx * grid.nz;
+	pCell = (OBST_FLOOR_CELL*)SYS_malloc(nb_cell*sizeof(OBST_FLOOR_CELL));
+	if (!pCell) return;
+	memset(pCell, 0, nb_cell*sizeof(OBST_FLOOR_CELL));
+
+	pFloor = NULL;
+	for (pass = 0; pass < 2; ++pass) {
+		if (pass) {
+			nb_list = 0;
+			for (i = 0; i < nb_cell; ++i) {
+				pCell[i].first = nb_list;
+				nb_list += pCell[i].count;
+				pCell[i].count = 0;
+			}
+			pFloor = (OBST_FLOOR*)SYS_malloc(sizeof(OBST_FLOOR) + 16 + n*sizeof(OBST_FLOOR_PLANE) + nb_cell*sizeof(OBST_FLOOR_CELL) + nb_list*sizeof(sys_i32));
+			if (!pFloor) break;
+			*pFloor = grid;
+			pFloor->nb_list = nb_list;
+			pFloor->pPlane = (OBST_FLOOR_PLANE*)D_ALIGN(pFloor + 1, 16);
+			pFloor->pCell = (OBST_FLOOR_CELL*)(pFloor->pPlane + n);
+			pFloor->pList = (sys_i32*)(pFloor->pCell + nb_cell);
+		}
+		for (i = 0; i < n; ++i) {
+			pPol = &pObst->pPol[i];
+			if (!(pPol->attr & E_OBST_POLYATTR_FLOOR)) continue;
 			Get_pol_vtx(pObst, pPol, vtx);
-			if (GEOM_seg_quad_intersect(pQry->p0.qv, pQry->p1.qv, vtx, &hit_pos, &hit_nml)) {
-				dist2 = V4_dist2(pQry->p0.qv, hit_pos);
-				if (dist2 < min_dist2) {
-					pQry->hit_pos.qv = hit_pos;
-					pQry->hit_nml.qv = hit_nml;
-					pQry->dist2 = dist2;
-					pQry->pol_no = i;
-					min_dist2 = dist2;
+			Floor_plane(vtx, &plane);
+			Floor_range(&grid, &plane, margin, range);
+			for (z = range[1]; z <= range[3]; ++z) {
+				for (x = range[0]; x <= range[2]; ++x) {
+					OBST_FLOOR_CELL* pDst = &pCell[z*grid.nx + x];
+					if (pFloor) {
+						pFloor->pList[pDst->first + pDst->count] = i;
+					}
+					++pDst->count;
+				}
+			}
+			if (pFloor) {
+				pFloor->pPlane[i] = plane;
+			}
+		}
+	}
+	if (pFloor) {
+		memcpy(pFloor->pCell, pCell, nb_cell*sizeof(OBST_FLOOR_CELL));
+		for (z = 0; z < grid.nz; ++z) {
+			for (x = 0; x < grid.nx; ++x) {
+				OBST_FLOOR_CELL* pDst = &pFloor->pCell[z*grid.nx + x];
+				pDst->cover = Floor_cell_cover(pObst, pFloor, x, z, margin);
+				if (pDst->cover) {
+					++pFloor->nb_cover;
+				}
+			}
+		}
+		pObst->pFloor = pFloor;
+	}
+	SYS_free(pCell);
+}
+
+/* OBST_build_wide writes every wide node before its children, a slot's box is the union of the child's slots */
+static void Wide_refit(OBSTACLE* pObst, GEOM_AABB* pPrim_box) {
+	int i, j, k;
+	BVH4* pWide = pObst->pWide;
+	BVH4_NODE* pNode;
+	BVH4_NODE* pChild;
+	GEOM_AABB* pBox;
+
+	for (i = pWide->nb_node - 1; i >= 0; --i) {
+		pNode = &pWide->pNode[i];
+		for (j = 0; j < 4; ++j) {
+			if (pNode->child[j] == 0) continue; /* empty slot, the root is never a child */
+			if (pNode->child[j] < 0) {
+				pBox = &pPrim_box[~pNode->child[j]];
+				for (k = 0; k < 3; ++k) {
+					pNode->bmin[k].f[j] = Wide_pad(pBox->min.f[k], -1.0f);
+					pNode->bmax[k].f[j] = Wide_pad(pBox->max.f[k], 1.0f);
+				}
+			} else {
+				pChild = &pWide->pNode[pNode->child[j]];
+				for (k = 0; k < 3; ++k) {
+					pNode->bmin[k].f[j] = D_MIN(D_MIN(pChild->bmin[k].f[0], pChild->bmin[k].f[1]), D_MIN(pChild->bmin[k].f[2], pChild->bmin[k].f[3]));
+					pNode->bmax[k].f[j] = D_MAX(D_MAX(pChild->bmax[k].f[0], pChild->bmax[k].f[1]), D_MAX(pChild->bmax[k].f[2], pChild->bmax[k].f[3]));
 				}
-				res = 1;
 			}
 		}
-		++pPol;
+		if (pWide->pQuad && pWide->pNode_quad[i] >= 0) {
+			Wide_quad(pObst, pNode, &pWide->pQuad[pWide->pNode_quad[i]]);
+		}
+	}
+}
+
+/* same walk as Flat_node, so each flat node gets the box of the binary node it was made from */
+static void Flat_refit(OBSTACLE* pObst, BVH_FLAT* pFlat, int src, int* pCount) {
+	BVH_NODE* pSrc = BVH_get_node(pObst->pBVH, src);
+
+	Flat_quantize(pFlat, &pFlat->pNode[(*pCount)++], BVH_get_node_bbox(pObst->pBVH, src));
+	if (pSrc->right >= 0) {
+		Flat_refit(pObst, pFlat, pSrc->left, pCount);
+		Flat_refit(pObst, pFlat, pSrc->right, pCount);
+	}
+}
+
+/*
+ * planes and covers of the quads that moved, the candidate lists stay as they are;
+ * returns 0 when a quad left its cells and the grid has to be rebuilt
+ */
+static int Floor_refit(OBSTACLE* pObst) {
+	int i, x, z, n, cover;
+	int range[4];
+	int prev[4];
+	float margin;
+	QVEC vtx[4];
+	OBST_FLOOR_PLANE plane;
+	OBST_FLOOR* pFloor = pObst->pFloor;
+	OBST_FLOOR_CELL* pCell;
+
+	n = pObst->pData->nb_pol;
+	margin = pFloor->cell / 16.0f;
+	for (i = 0; i < n; ++i) {
+		if (!(pObst->pPol[i].attr & E_OBST_POLYATTR_FLOOR)) continue;
+		Get_pol_vtx(pObst, &pObst->pPol[i], vtx);
+		Floor_plane(vtx, &plane);
+		if (!memcmp(&plane, &pFloor->pPlane[i], sizeof(OBST_FLOOR_PLANE))) continue;
+		Floor_range(pFloor, &pFloor->pPlane[i], margin, prev);
+		if (!Floor_range(pFloor, &plane, margin, range) || memcmp(range, prev, sizeof(range))) return 0;
+		pFloor->pPlane[i] = plane;
+		for (z = range[1]; z <= range[3]; ++z) {
+			for (x = range[0]; x <= range[2]; ++x) {
+				pCell = &pFloor->pCell[z*pFloor->nx + x];
+				cover = Floor_cell_cover(pObst, pFloor, x, z, margin);
+				pFloor->nb_cover += (cover != 0) - (pCell->cover != 0);
+				pCell->cover = cover;
+			}
+		}
+	}
+	return 1;
+}
+
+/*
+ * for meshes deforming in place with the same topology, the trees keep
+ * their shape and only the bounds are updated, quality degrades as
+ * the points drift from where the tree was built
+ */
+void OBST_refit(OBSTACLE* pObst) {
+	int i, n, count;
+	QVEC vtx[4];
+	GEOM_AABB* pPrim_box;
+
+	if (!pObst->pData || !pObst->pBVH) return;
+	n = pObst->pData->nb_pol;
+	pPrim_box = (GEOM_AABB*)SYS_malloc(n*sizeof(GEOM_AABB));
+	if (!pPrim_box) return;
+	for (i = 0; i < n; ++i) {
+		Get_pol_vtx(pObst, &pObst->pPol[i], vtx);
+		pPrim_box[i].min.qv = V4_min(V4_min(vtx[0], vtx[1]), V4_min(vtx[2], vtx[3]));
+		pPrim_box[i].max.qv = V4_max(V4_max(vtx[0], vtx[1]), V4_max(vtx[2], vtx[3]));
+	}
+	BVH_refit(pObst->pBVH, pPrim_box);
+	if (pObst->pFlat) {
+		Flat_frame(pObst->pFlat, BVH_get_node_bbox(pObst->pBVH, 0));
+		count = 0;
+		Flat_refit(pObst, pObst->pFlat, 0, &count);
+	}
+	if (pObst->pWide) {
+		Wide_refit(pObst, pPrim_box);
+	}
+	if (pObst->pFloor && !Floor_refit(pObst)) {
+		OBST_build_floor(pObst);
+	}
+	SYS_free(pPrim_box);
+}
+
+/* nearer, or the lower polygon number at the same distance, so every path reports the same polygon */
+D_FORCE_INLINE static int Ray_closer(float dist2, int prim, float min_dist2, int pol_no) {
+	return dist2 < min_dist2 || (dist2 == min_dist2 && prim < pol_no);
+}
+
+static int Obst_check_direct(OBSTACLE* pObst, OBST_QUERY* pQry) {
+	QVEC vtx[4];
+	QVEC hit_pos;
+	QVEC hit_nml;
+	int i, n, res;
+	OBST_POLY* pPol;
+	float dist2;
+	float min_dist2 = D_MAX_FLOAT;
+
+	res = 0;
+	n = pObst->pData->nb_pol;
+	pPol = pObst->pPol;
+	for (i = 0; i < n; ++i) {
+		if (pPol->attr & pQry->mask) {
+			Get_pol_vtx(pObst, pPol, vtx);
+			if (GEOM_seg_quad_intersect(pQry->p0.qv, pQry->p1.qv, vtx, &hit_pos, &hit_nml)) {
+				dist2 = V4_dist2(pQry->p0.qv, hit_pos);
+				if (Ray_closer(dist2, i, min_dist2, pQry->pol_no)) {
+					pQry->hit_pos.qv = hit_pos;
+					pQry->hit_nml.qv = hit_nml;
+					pQry->dist2 = dist2;
+					pQry->pol_no = i;
+					min_dist2 = dist2;
+				}
+				res = 1;
+			}
+		}
+		++pPol;
+	}
+	pQry->res = res;
+	return res;
+}
+
+D_FORCE_INLINE static int Node_hit_ck(OBSTACLE* pObst, BVH_NODE* pNode, BVH_WORK* pWk) {
+	GEOM_AABB* pBox = BVH_get_node_bbox(pObst->pBVH, BVH_get_node_id(pObst->pBVH, pNode));
+	if (GEOM_aabb_overlap(&pWk->bbox, pBox)) {
+		if (GEOM_seg_aabb_check(pWk->pQry->p0.qv, pWk->pQry->p1.qv, pBox)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+D_FORCE_INLINE static int Node_range_ck(OBSTACLE* pObst, BVH_NODE* pNode, GEOM_AABB* pRange) {
+	GEOM_AABB* pBox = BVH_get_node_bbox(pObst->pBVH, BVH_get_node_id(pObst->pBVH, pNode));
+	return GEOM_aabb_overlap(pRange, pBox);
+}
+
+static void Obst_bvh_ck(OBSTACLE* pObst, BVH_NODE* pNode, BVH_WORK* pWk) {
+	QVEC vtx[4];
+	QVEC hit_pos;
+	QVEC hit_nml;
+	float dist2;
+	if (Node_hit_ck(pObst, pNode, pWk)) {
+		if (pNode->right < 0) {
+			OBST_QUERY* pQry = pWk->pQry;
+			OBST_POLY* pPol = &pObst->pPol[pNode->prim];
+			if (pPol->attr & pQry->mask) {
+				Get_pol_vtx(pObst, pPol, vtx);
+				if (GEOM_seg_quad_intersect(pQry->p0.qv, pQry->p1.qv, vtx, &hit_pos, &hit_nml)) {
+					dist2 = V4_dist2(pQry->p0.qv, hit_pos);
+					if (Ray_closer(dist2, pNode->prim, pWk->min_dist2, pQry->pol_no)) {
+						pQry->hit_pos.qv = hit_pos;
+						pQry->hit_nml.qv = hit_nml;
+						pQry->dist2 = dist2;
+						pQry->pol_no = pNode->prim;
+						pWk->min_dist2 = dist2;
+					}
+					pWk->res = 1;
+				}
+			}
+		} else {
+			Obst_bvh_ck(pObst, BVH_get_node(pObst->pBVH, pNode->left), pWk);
+			Obst_bvh_ck(pObst, BVH_get_node(pObst->pBVH, pNode->right), pWk);
+		}
+	}
+}
+
+static int Obst_check_bvh(OBSTACLE* pObst, OBST_QUERY* pQry) {
+	BVH_WORK wk;
+
+	wk.bbox.min.qv = V4_set_w1(V4_min(pQry->p0.qv, pQry->p1.qv));
+	wk.bbox.max.qv = V4_set_w1(V4_max(pQry->p0.qv, pQry->p1.qv));
+	wk.pQry = pQry;
+	wk.res = 0;
+	wk.min_dist2 = D_MAX_FLOAT;
+	Obst_bvh_ck(pObst, BVH_get_root(pObst->pBVH), &wk);
+	pQry->res = wk.res;
+	return wk.res;
+}
+
+static int Obst_check_flat(OBSTACLE* pObst, OBST_QUERY* pQry) {
+	QVEC vtx[4];
+	QVEC hit_pos;
+	QVEC hit_nml;
+	FLAT_RAY ray;
+	BVH_QNODE* pNode;
+	OBST_POLY* pPol;
+	BVH_FLAT* pFlat = pObst->pFlat;
+	float dist2;
+	float min_dist2 = D_MAX_FLOAT;
+	int i = 0;
+	int n = pFlat->nb_node;
+	int res = 0;
+
+	Flat_ray_init(&ray, pQry->p0.qv, pQry->p1.qv);
+	while (i < n) {
+		pNode = &pFlat->pNode[i];
+		if (pNode->mask & pQry->mask) {
+			if (Flat_ray_ck(pFlat, pNode, &ray)) {
+				if (pNode->prim >= 0) {
+					pPol = &pObst->pPol[pNode->prim];
+					Get_pol_vtx(pObst, pPol, vtx);
+					if (GEOM_seg_quad_intersect(pQry->p0.qv, pQry->p1.qv, vtx, &hit_pos, &hit_nml)) {
+						dist2 = V4_dist2(pQry->p0.qv, hit_pos);
+						if (Ray_closer(dist2, pNode->prim, min_dist2, pQry->pol_no)) {
+							pQry->hit_pos.qv = hit_pos;
+							pQry->hit_nml.qv = hit_nml;
+							pQry->dist2 = dist2;
+							pQry->pol_no = pNode->prim;
+							min_dist2 = dist2;
+						}
+						res = 1;
+					}
+				}
+				++i;
+				continue;
+			}
+		}
+		i = pNode->skip;
+	}
+	pQry->res = res;
+	return res;
+}
+
+typedef struct _BVH4_ENTRY {
+	sys_i32 node;
+	sys_i32 rays;
+	float   t;
+} BVH4_ENTRY;
+
+typedef struct _WIDE_RAY {
+	__m128 ox, oy, oz;
+	__m128 ix, iy, iz;
+	__m128 qmask;
+	__m128 ex, ey, ez;
+	__m128 dx, dy, dz;
+	UVEC dir;
+	OBST_QUERY* pQry;
+	float len2;
+	float min_dist2;
+	float t_hit;
+	int res;
+} WIDE_RAY;
+
+static void Wide_ray_init(WIDE_RAY* pRay, OBST_QUERY* pQry) {
+	int i;
+	UVEC inv;
+
+	pRay->dir.qv = V4_sub(pQry->p1.qv, pQry->p0.qv);
+	for (i = 0; i < 3; ++i) {
+		inv.f[i] = (pRay->dir.f[i] > 1e-20f || pRay->dir.f[i] < -1e-20f) ? 1.0f / pRay->dir.f[i] : 1e30f;
+	}
+	pRay->len2 = V4_dot(pRay->dir.qv, pRay->dir.qv);
+	pRay->ox = _mm_set1_ps(pQry->p0.x);
+	pRay->oy = _mm_set1_ps(pQry->p0.y);
+	pRay->oz = _mm_set1_ps(pQry->p0.z);
+	pRay->ix = _mm_set1_ps(inv.x);
+	pRay->iy = _mm_set1_ps(inv.y);
+	pRay->iz = _mm_set1_ps(inv.z);
+	pRay->qmask = _mm_castsi128_ps(_mm_set1_epi32(pQry->mask));
+	pRay->ex = _mm_set1_ps(pQry->p1.x);
+	pRay->ey = _mm_set1_ps(pQry->p1.y);
+	pRay->ez = _mm_set1_ps(pQry->p1.z);
+	pRay->dx = _mm_set1_ps(pRay->dir.x);
+	pRay->dy = _mm_set1_ps(pRay->dir.y);
+	pRay->dz = _mm_set1_ps(pRay->dir.z);
+	pRay->pQry = pQry;
+	pRay->min_dist2 = D_MAX_FLOAT;
+	pRay->t_hit = 1.0f + 1e-4f;
+	pRay->res = 0;
+}
+
+/* slab test against all four children, returns the hit bits and entry distances */
+D_FORCE_INLINE static int Wide_ray_ck(BVH4_NODE* pNode, WIDE_RAY* pRay, __m128* pTmin) {
+	__m128 tmin, tmax, t0, t1, live;
+
+	t0 = _mm_mul_ps(_mm_sub_ps(pNode->bmin[0].qv, pRay->ox), pRay->ix);
+	t1 = _mm_mul_ps(_mm_sub_ps(pNode->bmax[0].qv, pRay->ox), pRay->ix);
+	tmin = _mm_min_ps(t0, t1);
+	tmax = _mm_max_ps(t0, t1);
+	t0 = _mm_mul_ps(_mm_sub_ps(pNode->bmin[1].qv, pRay->oy), pRay->iy);
+	t1 = _mm_mul_ps(_mm_sub_ps(pNode->bmax[1].qv, pRay->oy), pRay->iy);
+	tmin = _mm_max_ps(tmin, _mm_min_ps(t0, t1));
+	tmax = _mm_min_ps(tmax, _mm_max_ps(t0, t1));
+	t0 = _mm_mul_ps(_mm_sub_ps(pNode->bmin[2].qv, pRay->oz), pRay->iz);
+	t1 = _mm_mul_ps(_mm_sub_ps(pNode->bmax[2].qv, pRay->oz), pRay->iz);
+	tmin = _mm_max_ps(_mm_max_ps(tmin, _mm_min_ps(t0, t1)), _mm_set1_ps(-1e-4f));
+	tmax = _mm_min_ps(_mm_min_ps(tmax, _mm_max_ps(t0, t1)), _mm_set1_ps(pRay->t_hit));
+	live = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_castps_si128(_mm_and_ps(_mm_loadu_ps((float*)pNode->mask), pRay->qmask)), _mm_setzero_si128()));
+	*pTmin = tmin;
+	return _mm_movemask_ps(_mm_andnot_ps(live, _mm_cmple_ps(tmin, tmax)));
+}
+
+static void Wide_ray_hit(WIDE_RAY* pRay, int prim, QVEC hit_pos, QVEC hit_nml) {
+	float dist2;
+	OBST_QUERY* pQry = pRay->pQry;
+
+	dist2 = V4_dist2(pQry->p0.qv, hit_pos);
+	if (Ray_closer(dist2, prim, pRay->min_dist2, pQry->pol_no)) {
+		pQry->hit_pos.qv = hit_pos;
+		pQry->hit_nml.qv = hit_nml;
+		pQry->dist2 = dist2;
+		pQry->pol_no = prim;
+		pRay->min_dist2 = dist2;
+		if (pRay->len2 > 0.0f) {
+			pRay->t_hit = V4_dot(V4_sub(hit_pos, pQry->p0.qv), pRay->dir.qv) / pRay->len2 + 1e-4f;
+		}
+	}
+	pRay->res = 1;
+}
+
+static void Wide_ray_leaf(OBSTACLE* pObst, WIDE_RAY* pRay, int prim) {
+	QVEC vtx[4];
+	QVEC hit_pos;
+	QVEC hit_nml;
+	OBST_QUERY* pQry = pRay->pQry;
+	OBST_POLY* pPol = &pObst->pPol[prim];
+
+	if (!(pPol->attr & pQry->mask)) return;
+	Get_pol_vtx(pObst, pPol, vtx);
+	if (GEOM_seg_quad_intersect(pQry->p0.qv, pQry->p1.qv, vtx, &hit_pos, &hit_nml)) {
+		Wide_ray_hit(pRay, prim, hit_pos, hit_nml);
+	}
+}
+
+/*
+ * GEOM_seg_quad_intersect on four quads at once, every lane does the same
+ * operations in the same order as the scalar version.
+ */
+static int Wide_quad_ck(OBST_QUAD4* pQuad, WIDE_RAY* pRay, __m128* pT) {
+	int i, j;
+	__m128 wx, wy, wz, cx, cy, cz, ex, ey, ez, d0, d1, d, t, ok;
+	__m128 zero = _mm_setzero_ps();
+
+	wx = _mm_sub_ps(pRay->ox, pQuad->vx[0].qv);
+	wy = _mm_sub_ps(pRay->oy, pQuad->vy[0].qv);
+	wz = _mm_sub_ps(pRay->oz, pQuad->vz[0].qv);
+	d0 = _mm_add_ps(_mm_mul_ps(wx, pQuad->nx.qv), _mm_add_ps(_mm_mul_ps(wy, pQuad->ny.qv), _mm_mul_ps(wz, pQuad->nz.qv)));
+	cx = _mm_sub_ps(pRay->ex, pQuad->vx[0].qv);
+	cy = _mm_sub_ps(pRay->ey, pQuad->vy[0].qv);
+	cz = _mm_sub_ps(pRay->ez, pQuad->vz[0].qv);
+	d1 = _mm_add_ps(_mm_mul_ps(cx, pQuad->nx.qv), _mm_add_ps(_mm_mul_ps(cy, pQuad->ny.qv), _mm_mul_ps(cz, pQuad->nz.qv)));
+	ok = _mm_cmpngt_ps(_mm_mul_ps(d0, d1), zero);
+	ok = _mm_andnot_ps(_mm_and_ps(_mm_cmpeq_ps(d0, zero), _mm_cmpeq_ps(d1, zero)), ok);
+	if (!_mm_movemask_ps(ok)) return 0;
+	for (i = 0; i < 4; ++i) {
+		if (i > 0) {
+			wx = _mm_sub_ps(pRay->ox, pQuad->vx[i].qv);
+			wy = _mm_sub_ps(pRay->oy, pQuad->vy[i].qv);
+			wz = _mm_sub_ps(pRay->oz, pQuad->vz[i].qv);
+		}
+		j = (i + 1) & 3;
+		ex = _mm_sub_ps(pQuad->vx[j].qv, pQuad->vx[i].qv);
+		ey = _mm_sub_ps(pQuad->vy[j].qv, pQuad->vy[i].qv);
+		ez = _mm_sub_ps(pQuad->vz[j].qv, pQuad->vz[i].qv);
+		cx = _mm_sub_ps(_mm_mul_ps(ey, pRay->dz), _mm_mul_ps(ez, pRay->dy));
+		cy = _mm_sub_ps(_mm_mul_ps(ez, pRay->dx), _mm_mul_ps(ex, pRay->dz));
+		cz = _mm_sub_ps(_mm_mul_ps(ex, pRay->dy), _mm_mul_ps(ey, pRay->dx));
+		t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, wx), _mm_mul_ps(cy, wy)), _mm_mul_ps(cz, wz));
+		ok = _mm_andnot_ps(_mm_cmplt_ps(t, zero), ok);
+	}
+	d = _mm_add_ps(_mm_mul_ps(pRay->dx, pQuad->nx.qv), _mm_add_ps(_mm_mul_ps(pRay->dy, pQuad->ny.qv), _mm_mul_ps(pRay->dz, pQuad->nz.qv)));
+	t = _mm_div_ps(_mm_xor_ps(d0, _mm_set1_ps(-0.0f)), d);
+	t = _mm_andnot_ps(_mm_or_ps(_mm_cmpeq_ps(d, zero), _mm_cmpeq_ps(d0, zero)), t);
+	ok = _mm_andnot_ps(_mm_or_ps(_mm_cmpgt_ps(t, _mm_set1_ps(1.0f)), _mm_cmplt_ps(t, zero)), ok);
+	*pT = t;
+	return _mm_movemask_ps(ok);
+}
+
+/* the leaf children in lanes, through the node's quad record when there is one */
+static void Wide_ray_quads(OBSTACLE* pObst, WIDE_RAY* pRay, int node, int lanes) {
+	int i, bits;
+	UVEC t;
+	OBST_QUAD4* pQuad;
+	BVH4* pWide = pObst->pWide;
+
+	if (!pWide->pQuad || pWide->pNode_quad[node] < 0) {
+		for (i = 0; i < 4; ++i) {
+			if (lanes & (1 << i)) {
+				Wide_ray_leaf(pObst, pRay, ~pWide->pNode[node].child[i]);
+			}
+		}
+		return;
+	}
+	pQuad = &pWide->pQuad[pWide->pNode_quad[node]];
+	for (i = 0; i < 4; ++i) {
+		if (!(pQuad->attr[i] & pRay->pQry->mask)) {
+			lanes &= ~(1 << i);
+		}
+	}
+	if (!lanes) return;
+	bits = Wide_quad_ck(pQuad, pRay, &t.qv) & lanes;
+	for (i = 0; i < 4; ++i) {
+		if (bits & (1 << i)) {
+			Wide_ray_hit(pRay, pQuad->prim[i],
+			             V4_set_w1(V4_add(pRay->pQry->p0.qv, V4_scale(pRay->dir.qv, t.f[i]))),
+			             V4_set_vec(pQuad->nx.f[i], pQuad->ny.f[i], pQuad->nz.f[i]));
+		}
+	}
+}
+
+/* inner children sorted far to near, so the nearest is popped first */
+static int Wide_push(BVH4_ENTRY* pStk, int sp, BVH4_NODE* pNode, int* pInner, int nb_inner, float* pNear, int* pRays) {
+	int i, j, k;
+	for (i = 1; i < nb_inner; ++i) {
+		k = pInner[i];
+		for (j = i; j > 0 && pNear[pInner[j - 1]] < pNear[k]; --j) {
+			pInner[j] = pInner[j - 1];
+		}
+		pInner[j] = k;
+	}
+	for (i = 0; i < nb_inner && sp < D_BVH4_STACK; ++i) {
+		k = pInner[i];
+		pStk[sp].node = pNode->child[k];
+		pStk[sp].rays = pRays ? pRays[k] : 1;
+		pStk[sp].t = pNear[k];
+		++sp;
+	}
+	return sp;
+}
+
+static int Obst_check_wide(OBSTACLE* pObst, OBST_QUERY* pQry) {
+	BVH4_ENTRY stk[D_BVH4_STACK];
+	WIDE_RAY ray;
+	UVEC tnear;
+	BVH4_NODE* pNode;
+	BVH4_ENTRY ent;
+	int i, sp, bits, nb_inner, leaves;
+	int inner[4];
+
+	Wide_ray_init(&ray, pQry);
+	sp = 0;
+	stk[sp].node = 0;
+	stk[sp].t = 0.0f;
+	++sp;
+	while (sp > 0) {
+		ent = stk[--sp];
+		/* early out, something nearer was found after this node was pushed */
+		if (ent.t > ray.t_hit) continue;
+		pNode = &pObst->pWide->pNode[ent.node];
+		bits = Wide_ray_ck(pNode, &ray, &tnear.qv);
+		if (!bits) continue;
+		nb_inner = 0;
+		leaves = 0;
+		for (i = 0; i < 4; ++i) {
+			if (!(bits & (1 << i))) continue;
+			if (pNode->child[i] >= 0) {
+				inner[nb_inner++] = i;
+			} else {
+				leaves |= 1 << i;
+			}
+		}
+		if (leaves) {
+			Wide_ray_quads(pObst, &ray, ent.node, leaves);
+		}
+		sp = Wide_push(stk, sp, pNode, inner, nb_inner, tnear.f, NULL);
+	}
+	pQry->res = ray.res;
+	return ray.res;
+}
+
+/* up to four rays share each node fetch, a child is entered by the rays whose slabs it passes */
+static void Obst_check_packet(OBSTACLE* pObst, OBST_QUERY** ppQry, int nb_ray) {
+	BVH4_ENTRY stk[D_BVH4_STACK];
+	WIDE_RAY ray[4];
+	UVEC tnear;
+	float near[4];
+	int rays[4];
+	int inner[4];
+	BVH4_NODE* pNode;
+	BVH4_ENTRY ent;
+	float t_max;
+	int i, r, sp, bits, nb_inner, leaves;
+
+	for (r = 0; r < nb_ray; ++r) {
+		Wide_ray_init(&ray[r], ppQry[r]);
+	}
+	sp = 0;
+	stk[sp].node = 0;
+	stk[sp].rays = (1 << nb_ray) - 1;
+	stk[sp].t = 0.0f;
+	++sp;
+	while (sp > 0) {
+		ent = stk[--sp];
+		t_max = 0.0f;
+		for (r = 0; r < nb_ray; ++r) {
+			if ((ent.rays & (1 << r)) && ray[r].t_hit > t_max) {
+				t_max = ray[r].t_hit;
+			}
+		}
+		if (ent.t > t_max) continue;
+		pNode = &pObst->pWide->pNode[ent.node];
+		for (i = 0; i < 4; ++i) {
+			rays[i] = 0;
+			near[i] = D_MAX_FLOAT;
+		}
+		for (r = 0; r < nb_ray; ++r) {
+			if (!(ent.rays & (1 << r))) continue;
+			bits = Wide_ray_ck(pNode, &ray[r], &tnear.qv);
+			for (i = 0; i < 4; ++i) {
+				if (bits & (1 << i)) {
+					rays[i] |= 1 << r;
+					near[i] = D_MIN(near[i], tnear.f[i]);
+				}
+			}
+		}
+		nb_inner = 0;
+		for (i = 0; i < 4; ++i) {
+			if (rays[i] && pNode->child[i] >= 0) {
+				inner[nb_inner++] = i;
+			}
+		}
+		for (r = 0; r < nb_ray; ++r) {
+			leaves = 0;
+			for (i = 0; i < 4; ++i) {
+				if ((rays[i] & (1 << r)) && pNode->child[i] < 0) {
+					leaves |= 1 << i;
+				}
+			}
+			if (leaves) {
+				Wide_ray_quads(pObst, &ray[r], ent.node, leaves);
+			}
+		}
+		sp = Wide_push(stk, sp, pNode, inner, nb_inner, near, rays);
+	}
+	for (r = 0; r < nb_ray; ++r) {
+		ppQry[r]->res = ray[r].res;
+	}
+}
+
+/*
+ * GEOM_seg_quad_intersect also reports plane hits just outside warped quads,
+ * the BVH drops those with the leaf box, so does this
+ */
+static int Floor_span(OBST_FLOOR_PLANE* pPlane, OBST_QUERY* pQry, float inv) {
+	float t0, t1;
+
+	if (pQry->p0.x < pPlane->bmin.x || pQry->p0.x > pPlane->bmax.x || pQry->p0.z < pPlane->bmin.z || pQry->p0.z > pPlane->bmax.z) return 0;
+	t0 = (pPlane->bmin.y - pQry->p0.y) * inv;
+	t1 = (pPlane->bmax.y - pQry->p0.y) * inv;
+	return D_MAX(D_MIN(t0, t1), -1e-4f) <= D_MIN(D_MAX(t0, t1), 1.0f + 1e-4f);
+}
+
+/* vertical floor checks through the grid, same results as the BVH paths */
+static int Obst_check_floor(OBSTACLE* pObst, OBST_QUERY* pQry) {
+	int i, x, z, prim;
+	float fx, fz, d, d0, d1, t, dist2, dy, inv;
+	float min_dist2 = D_MAX_FLOAT;
+	QVEC vtx[4];
+	QVEC dir;
+	QVEC hit_pos;
+	QVEC hit_nml;
+	OBST_FLOOR* pFloor = pObst->pFloor;
+	OBST_FLOOR_CELL* pCell;
+	OBST_FLOOR_PLANE* pPlane;
+
+	pQry->res = 0;
+	fx = (pQry->p0.x - pFloor->org_x) * pFloor->inv_cell;
+	fz = (pQry->p0.z - pFloor->org_z) * pFloor->inv_cell;
+	if (!(fx >= 0.0f && fz >= 0.0f && fx < (float)pFloor->nx && fz < (float)pFloor->nz)) return 0;
+	x = (int)fx;
+	z = (int)fz;
+	pCell = &pFloor->pCell[z*pFloor->nx + x];
+	dy = pQry->p1.y - pQry->p0.y;
+	inv = (dy > 1e-20f || dy < -1e-20f) ? 1.0f / dy : 1e30f;
+	if (pCell->cover) {
+		/* inside every edge, only the plane part of GEOM_seg_quad_intersect is left */
+		if (dy * (float)pCell->cover < 0.0f) return 0;
+		prim = pFloor->pList[pCell->first];
+		pPlane = &pFloor->pPlane[prim];
+		if (!Floor_span(pPlane, pQry, inv)) return 0;
+		d0 = V4_dot(V4_sub(pQry->p0.qv, pPlane->org.qv), pPlane->nml.qv);
+		d1 = V4_dot(V4_sub(pQry->p1.qv, pPlane->org.qv), pPlane->nml.qv);
+		if (d0*d1 > 0.0f || (d0 == 0.0f && d1 == 0.0f)) return 0;
+		dir = V4_sub(pQry->p1.qv, pQry->p0.qv);
+		d = V4_dot(dir, pPlane->nml.qv);
+		if (d == 0.0f || d0 == 0.0f) {
+			t = 0.0f;
+		} else {
+			t = -d0 / d;
+		}
+		if (t > 1.0f || t < 0.0f) return 0;
+		pQry->hit_pos.qv = V4_set_w1(V4_add(pQry->p0.qv, V4_scale(dir, t)));
+		pQry->hit_nml.qv = pPlane->nml.qv;
+		pQry->dist2 = V4_dist2(pQry->p0.qv, pQry->hit_pos.qv);
+		pQry->pol_no = prim;
+		pQry->res = 1;
+		return 1;
+	}
+	for (i = 0; i < pCell->count; ++i) {
+		prim = pFloor->pList[pCell->first + i];
+		if (!Floor_span(&pFloor->pPlane[prim], pQry, inv)) continue;
+		Get_pol_vtx(pObst, &pObst->pPol[prim], vtx);
+		if (GEOM_seg_quad_intersect(pQry->p0.qv, pQry->p1.qv, vtx, &hit_pos, &hit_nml)) {
+			dist2 = V4_dist2(pQry->p0.qv, hit_pos);
+			if (Ray_closer(dist2, prim, min_dist2, pQry->pol_no)) {
+				pQry->hit_pos.qv = hit_pos;
+				pQry->hit_nml.qv = hit_nml;
+				pQry->dist2 = dist2;
+				pQry->pol_no = prim;
+				min_dist2 = dist2;
+			}
+			pQry->res = 1;
+		}
+	}
+	return pQry->res;
+}
+
+/* vertical floor probes go through the grid when there is one, single or batched */
+D_FORCE_INLINE static int Floor_query(OBSTACLE* pObst, OBST_QUERY* pQry) {
+	return pObst->pFloor && pQry->mask == E_OBST_POLYATTR_FLOOR && pQry->p0.x == pQry->p1.x && pQry->p0.z == pQry->p1.z;
+}
+
+int OBST_check(OBSTACLE* pObst, OBST_QUERY* pQry) {
+	if (Floor_query(pObst, pQry)) {
+		return Obst_check_floor(pObst, pQry);
+	}
+	if (pObst->pWide) {
+		return Obst_check_wide(pObst, pQry);
+	} else if (pObst->pFlat) {
+		return Obst_check_flat(pObst, pQry);
+	} else if (pObst->pBVH) {
+		return Obst_check_bvh(pObst, pQry);
+	} else {
+		return Obst_check_direct(pObst, pQry);
+	}
+}
+
+static sys_ui32 Batch_part(sys_ui32 x) {
+	x &= 0x3FF;
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+/* direction class in the top bits, so packets only mix rays heading the same way, then Morton order of the start point */
+static sys_ui32 Batch_key(OBST_QUERY* pQry, GEOM_AABB* pBox, QVEC scl) {
+	UVEC d;
+	UVEC p;
+	sys_ui32 cls, morton;
+	int i;
+	sys_ui32 q[3];
+
+	d.qv = V4_sub(pQry->p1.qv, pQry->p0.qv);
+	if (fabsf(d.x) + fabsf(d.z) <= fabsf(d.y) * 1e-3f) {
+		cls = d.y < 0.0f ? 8 : 9;
+	} else {
+		cls = (d.x < 0.0f ? 1 : 0) | (d.y < 0.0f ? 2 : 0) | (d.z < 0.0f ? 4 : 0);
+	}
+	p.qv = V4_mul(V4_sub(pQry->p0.qv, pBox->min.qv), scl);
+	for (i = 0; i < 3; ++i) {
+		q[i] = p.f[i] <= 0.0f ? 0 : p.f[i] >= 1023.0f ? 1023 : (sys_ui32)p.f[i];
+	}
+	morton = Batch_part(q[0]) | (Batch_part(q[1]) << 1) | (Batch_part(q[2]) << 2);
+	return (cls << 28) | (morton >> 2);
+}
+
+static void Batch_sort(sys_ui32* pKey, sys_ui32* pOrder, sys_ui32* pTmp_key, sys_ui32* pTmp_order, int n) {
+	int i, pass;
+	sys_ui32 d;
+	sys_ui32* pSwap;
+	int offs[256];
+
+	for (pass = 0; pass < 32; pass += 8) {
+		memset(offs, 0, sizeof(offs));
+		for (i = 0; i < n; ++i) {
+			++offs[(pKey[i] >> pass) & 0xFF];
+		}
+		for (i = 0, d = 0; i < 256; ++i) {
+			int c = offs[i];
+			offs[i] = d;
+			d += c;
+		}
+		for (i = 0; i < n; ++i) {
+			d = offs[(pKey[i] >> pass) & 0xFF]++;
+			pTmp_key[d] = pKey[i];
+			pTmp_order[d] = pOrder[i];
+		}
+		pSwap = pKey; pKey = pTmp_key; pTmp_key = pSwap;
+		pSwap = pOrder; pOrder = pTmp_order; pTmp_order = pSwap;
+	}
+}
+
+static void Batch_exec(void* pData) {
+	OBST_BATCH* pBatch = (OBST_BATCH*)pData;
+	OBST_QUERY* pPacket[4];
+	OBST_QUERY* pCur;
+	int i, n, end;
+	sys_ui32 cls;
+
+	i = pBatch->start;
+	end = pBatch->start + pBatch->count;
+	while (i < end) {
+		cls = pBatch->pKey[i] >> 28;
+		n = 0;
+		while (i < end && n < 4 && (pBatch->pKey[i] >> 28) == cls) {
+			pCur = &pBatch->pQry[pBatch->pOrder[i++]];
+			if (Floor_query(pBatch->pObst, pCur)) {
+				Obst_check_floor(pBatch->pObst, pCur);
+			} else {
+				pPacket[n++] = pCur;
+			}
+		}
+		if (n == 1) {
+			Obst_check_wide(pBatch->pObst, pPacket[0]);
+		} else if (n > 1) {
+			Obst_check_packet(pBatch->pObst, pPacket, n);
+		}
+	}
+}
+
+int OBST_check_batch(OBSTACLE* pObst, OBST_QUERY* pQry, int n) {
+	int i, nb_task, size, res;
+	GEOM_AABB* pBox;
+	sys_ui32* pKey;
+	OBST_BATCH* pBatch;
+	JOB_QUEUE* pQue;
+	JOB job;
+	QVEC scl;
+
+	res = 0;
+	pKey = NULL;
+	if (pObst->pWide && n > 4) {
+		pKey = (sys_ui32*)SYS_malloc(n*4*sizeof(sys_ui32) + D_BATCH_MAX_TASK*sizeof(OBST_BATCH));
+	}
+	if (!pKey) {
+		for (i = 0; i < n; ++i) {
+			res += OBST_check(pObst, &pQry[i]);
+		}
+		return res;
+	}
+	pBox = BVH_get_node_bbox(pObst->pBVH, 0);
+	scl = V4_div(V4_fill(1023.0f), V4_max(GEOM_aabb_size(pBox), V4_fill(1e-6f)));
+	for (i = 0; i < n; ++i) {
+		pKey[i] = Batch_key(&pQry[i], pBox, scl);
+		pKey[n + i] = i;
+	}
+	/* four passes leave the sorted data back in the first two arrays */
+	Batch_sort(pKey, pKey + n, pKey + n*2, pKey + n*3, n);
+
+	pBatch = (OBST_BATCH*)(pKey + n*4);
+	nb_task = D_MIN(D_BATCH_MAX_TASK, n / D_BATCH_TASK_MIN);
+	pQue = nb_task > 1 ? JOB_que_alloc(nb_task) : NULL;
+	if (!pQue) {
+		nb_task = 1;
+	}
+	/* chunk boundaries on packet multiples */
+	size = ((n + nb_task - 1) / nb_task + 3) & ~3;
+	for (i = 0; i < nb_task; ++i) {
+		pBatch[i].pObst = pObst;
+		pBatch[i].pQry = pQry;
+		pBatch[i].pKey = pKey;
+		pBatch[i].pOrder = pKey + n;
+		pBatch[i].start = D_MIN(i*size, n);
+		pBatch[i].count = D_MIN(size, n - pBatch[i].start);
+	}
+	if (pQue) {
+		for (i = 0; i < nb_task; ++i) {
+			job.pData = &pBatch[i];
+			job.func = Batch_exec;
+			JOB_put(pQue, &job);
+		}
+		JOB_schedule(pQue, D_MAX_WORKERS);
+		JOB_que_free(pQue);
+	} else {
+		Batch_exec(pBatch);
+	}
+	SYS_free(pKey);
+	for (i = 0; i < n; ++i) {
+		res += pQry[i].res;
+	}
+	return res;
+}
+
+int OBST_collide(OBSTACLE* pObst, QVEC cur_pos, QVEC prev_pos, float r, sys_ui32 mask, QVEC* pNew_pos) {
+	QMTX m;
+	QVEC pos;
+	QVEC xz;
+	QVEC dir;
+	QVEC ck_dir;
+	OBST_QUERY qry;
+	int i, flg;
+	static float rot[] = {0.0f, D_DEG2RAD(30), -D_DEG2RAD(30)};
+
+	flg = 0;
+	pos = cur_pos;
+	dir = V4_normalize(V4_sub(pos, prev_pos));
+	qry.mask = mask;
+	for (i = 0; i < (int)D_ARRAY_LENGTH(rot); ++i) {
+		MTX_rot_y(m, rot[i]);
+		ck_dir = MTX_calc_qvec(m, dir);
+		qry.p0.qv = V4_set_w1(pos);
+		qry.p1.qv = V4_set_w1(V4_add(pos, V4_scale(ck_dir, r)));
+		xz = V4_zero();
+		if (OBST_check(pObst, &qry)) {
+			xz = V4_sub(qry.p1.qv, qry.hit_pos.qv);
+			pos = V4_sub(pos, xz);
+			flg = 1;
+		}
+	}
+	*pNew_pos = V4_set(V4_at(pos, 0), V4_at(cur_pos, 1), V4_at(pos, 2), 1.0f);
+	return flg;
+}
+
+typedef struct _SWEEP_WORK {
+	OBST_SWEEP* pSweep;
+	QVEC a0;
+	QVEC a1;
+	QVEC d;
+	float r;
+	int capsule;
+} SWEEP_WORK;
+
+/* moving point against a static sphere, hits only while closing in */
+static int Sweep_pnt_sph(QVEC p, QVEC d, QVEC c, float r, float t_max, float* pT, float* pDepth) {
+	QVEC m = V4_sub(p, c);
+	float a = V4_dot(d, d);
+	float b = V4_dot(m, d);
+	float mm = V4_dot(m, m);
+	float disc, t;
+
+	if (b >= 0.0f || a <= 0.0f) return 0;
+	if (mm <= r*r) {
+		*pT = 0.0f;
+		*pDepth = r - sqrtf(mm);
+		return 1;
+	}
+	disc = b*b - a*(mm - r*r);
+	if (disc < 0.0f) return 0;
+	t = (-b - sqrtf(disc)) / a;
+	if (t >= t_max) return 0;
+	*pT = t;
+	*pDepth = 0.0f;
+	return 1;
+}
+
+/* moving point against the side of a cylinder around a..b, *pU is the axis parameter of the contact */
+static int Sweep_pnt_cyl(QVEC p, QVEC d, QVEC a, QVEC b, float r, float t_max, float* pT, float* pU, float* pDepth) {
+	QVEC e = V4_sub(b, a);
+	QVEC m = V4_sub(p, a);
+	float ee = V4_dot(e, e);
+	float me = V4_dot(m, e);
+	float de = V4_dot(d, e);
+	float mm = V4_dot(m, m);
+	float qa = ee*V4_dot(d, d) - de*de;
+	float qb = ee*V4_dot(m, d) - me*de;
+	float qc = ee*(mm - r*r) - me*me;
+	float disc, t, u;
+
+	if (ee <= 0.0f || qb >= 0.0f) return 0;
+	if (qc <= 0.0f) {
+		u = me / ee;
+		if (u < 0.0f || u > 1.0f) return 0;
+		*pT = 0.0f;
+		*pU = u;
+		*pDepth = r - sqrtf(D_MAX(mm - me*u, 0.0f));
+		return 1;
+	}
+	if (qa <= 1e-12f) return 0;
+	disc = qb*qb - qa*qc;
+	if (disc < 0.0f) return 0;
+	t = (-qb - sqrtf(disc)) / qa;
+	if (t >= t_max) return 0;
+	u = (me + t*de) / ee;
+	if (u < 0.0f || u > 1.0f) return 0;
+	*pT = t;
+	*pU = u;
+	*pDepth = 0.0f;
+	return 1;
+}
+
+static int Sweep_inside(QVEC pos, QVEC* pVtx, QVEC n) {
+	int i;
+	for (i = 0; i < 4; ++i) {
+		if (V4_dot(V4_cross(V4_sub(pVtx[(i + 1) & 3], pVtx[i]), V4_sub(pos, pVtx[i])), n) < 0.0f) return 0;
+	}
+	return 1;
+}
+
+static void Sweep_hit(SWEEP_WORK* pWk, int prim, float t, float depth, QVEC nml, QVEC pos) {
+	OBST_SWEEP* pSweep = pWk->pSweep;
+	if (!pSweep->res || t < pSweep->t || (t == pSweep->t && (depth > pSweep->depth || (depth == pSweep->depth && prim < pSweep->pol_no)))) {
+		pSweep->hit_nml.qv = V4_normalize(nml);
+		pSweep->hit_pos.qv = V4_set_w1(pos);
+		pSweep->t = t;
+		pSweep->depth = depth;
+		pSweep->pol_no = prim;
+		pSweep->res = 1;
+	}
+}
+
+static float Sweep_t_max(SWEEP_WORK* pWk) {
+	return pWk->pSweep->res ? pWk->pSweep->t + 1e-6f : 1.0f;
+}
+
+/* bound for the node tests, padded like the wide traversal's t_hit */
+static float Sweep_t_box(SWEEP_WORK* pWk) {
+	return (pWk->pSweep->res ? pWk->pSweep->t : 1.0f) + 1e-4f;
+}
+
+/* half extent of the swept shape around the middle of its axis */
+static QVEC Sweep_ext(SWEEP_WORK* pWk) {
+	return V4_add(V4_abs(V4_scale(V4_sub(pWk->a1, pWk->a0), 0.5f)), V4_fill(pWk->r));
+}
+
+/* sphere of radius r moving from c by d against the quad face, edges and corners */
+static void Sweep_sph_quad(SWEEP_WORK* pWk, int prim, QVEC c, QVEC* pVtx, QVEC n0) {
+	int i;
+	float s, sd, t, u, depth;
+	QVEC n, pos, axis;
+	QVEC d = pWk->d;
+	float r = pWk->r;
+
+	s = V4_dot(V4_sub(c, pVtx[0]), n0);
+	sd = V4_dot(d, n0);
+	n = n0;
+	if (s < 0.0f) {
+		n = V4_neg(n0);
+		s = -s;
+		sd = -sd;
+	}
+	if (sd < 0.0f) {
+		if (s <= r) {
+			pos = V4_sub(c, V4_scale(n, s));
+			if (Sweep_inside(pos, pVtx, n0)) {
+				Sweep_hit(pWk, prim, 0.0f, r - s, n, pos);
+			}
+		} else {
+			t = (s - r) / -sd;
+			if (t < Sweep_t_max(pWk)) {
+				pos = V4_sub(V4_add(c, V4_scale(d, t)), V4_scale(n, r));
+				if (Sweep_inside(pos, pVtx, n0)) {
+					Sweep_hit(pWk, prim, t, 0.0f, n, pos);
+				}
+			}
+		}
+	}
+	for (i = 0; i < 4; ++i) {
+		axis = V4_sub(pVtx[(i + 1) & 3], pVtx[i]);
+		if (Sweep_pnt_cyl(c, d, pVtx[i], pVtx[(i + 1) & 3], r, Sweep_t_max(pWk), &t, &u, &depth)) {
+			pos = V4_add(pVtx[i], V4_scale(axis, u));
+			Sweep_hit(pWk, prim, t, depth, V4_sub(V4_add(c, V4_scale(d, t)), pos), pos);
+		}
+		if (Sweep_pnt_sph(c, d, pVtx[i], r, Sweep_t_max(pWk), &t, &depth)) {
+			Sweep_hit(pWk, prim, t, depth, V4_sub(V4_add(c, V4_scale(d, t)), pVtx[i]), pVtx[i]);
+		}
+	}
+}
+
+/* capsule axis a0..a1 moving by d against quad edge e0..e1, the side-on contact the end spheres don't cover */
+static void Sweep_axis_edge(SWEEP_WORK* pWk, int prim, QVEC e0, QVEC e1) {
+	QVEC u = V4_sub(pWk->a1, pWk->a0);
+	QVEC e = V4_sub(e1, e0);
+	QVEC n = V4_cross(u, e);
+	QVEC w;
+	float uu = V4_dot(u, u);
+	float ee = V4_dot(e, e);
+	float nn = V4_dot(n, n);
+	float ue, s, sd, t, den, lam, mu, wu, we;
+	float r = pWk->r;
+
+	if (nn <= 1e-10f * uu * ee) return;
+	n = V4_scale(n, 1.0f / sqrtf(nn));
+	s = V4_dot(V4_sub(pWk->a0, e0), n);
+	sd = V4_dot(pWk->d, n);
+	if (s < 0.0f) {
+		n = V4_neg(n);
+		s = -s;
+		sd = -sd;
+	}
+	if (sd >= 0.0f) return;
+	t = s <= r ? 0.0f : (s - r) / -sd;
+	if (t >= Sweep_t_max(pWk)) return;
+	w = V4_sub(V4_add(pWk->a0, V4_scale(pWk->d, t)), e0);
+	ue = V4_dot(u, e);
+	wu = V4_dot(u, w);
+	we = V4_dot(e, w);
+	den = uu*ee - ue*ue;
+	lam = (ue*we - ee*wu) / den;
+	mu = (uu*we - ue*wu) / den;
+	if (lam < 0.0f || lam > 1.0f || mu < 0.0f || mu > 1.0f) return;
+	Sweep_hit(pWk, prim, t, s <= r ? r - s : 0.0f, n, V4_add(e0, V4_scale(e, mu)));
+}
+
+static void Sweep_quad(SWEEP_WORK* pWk, int prim, QVEC* pVtx) {
+	int i;
+	float t, u, depth;
+	QVEC axis, pos, n0;
+	QVEC back = V4_neg(pWk->d);
+
+	n0 = V4_normalize(V4_cross(V4_sub(pVtx[1], pVtx[0]), V4_sub(pVtx[2], pVtx[0])));
+	Sweep_sph_quad(pWk, prim, pWk->a0, pVtx, n0);
+	if (!pWk->capsule) return;
+	Sweep_sph_quad(pWk, prim, pWk->a1, pVtx, n0);
+	axis = V4_sub(pWk->a1, pWk->a0);
+	for (i = 0; i < 4; ++i) {
+		/* quad corner moving backwards into the capsule side */
+		if (Sweep_pnt_cyl(pVtx[i], back, pWk->a0, pWk->a1, pWk->r, Sweep_t_max(pWk), &t, &u, &depth)) {
+			pos = V4_add(pWk->a0, V4_scale(axis, u));
+			Sweep_hit(pWk, prim, t, depth, V4_sub(pos, V4_add(pVtx[i], V4_scale(back, t))), pVtx[i]);
+		}
+		Sweep_axis_edge(pWk, prim, pVtx[i], pVtx[(i + 1) & 3]);
 	}
-	pQry->res = res;
-	return res;
 }
 
-GEOM_AABB* BVH_get_node_bbox(BVH_HEAD* pBVH, int i) {
-	return (GEOM_AABB*)(pBVH + 1) + i;
-}
+/* box expanded by the swept shape's half extent, tested against the path of its center */
+D_FORCE_INLINE static int Wide_sweep_ck(BVH4_NODE* pNode, WIDE_RAY* pRay, __m128* pExt, __m128* pTmin) {
+	__m128 tmin, tmax, t0, t1, live;
 
-BVH_NODE* BVH_get_node(BVH_HEAD* pBVH, int i) {
-	return (BVH_NODE*)BVH_get_node_bbox(pBVH, pBVH->nb_node) + i;
+	t0 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(pNode->bmin[0].qv, pExt[0]), pRay->ox), pRay->ix);
+	t1 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(pNode->bmax[0].qv, pExt[0]), pRay->ox), pRay->ix);
+	tmin = _mm_min_ps(t0, t1);
+	tmax = _mm_max_ps(t0, t1);
+	t0 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(pNode->bmin[1].qv, pExt[1]), pRay->oy), pRay->iy);
+	t1 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(pNode->bmax[1].qv, pExt[1]), pRay->oy), pRay->iy);
+	tmin = _mm_max_ps(tmin, _mm_min_ps(t0, t1));
+	tmax = _mm_min_ps(tmax, _mm_max_ps(t0, t1));
+	t0 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(pNode->bmin[2].qv, pExt[2]), pRay->oz), pRay->iz);
+	t1 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(pNode->bmax[2].qv, pExt[2]), pRay->oz), pRay->iz);
+	tmin = _mm_max_ps(_mm_max_ps(tmin, _mm_min_ps(t0, t1)), _mm_set1_ps(-1e-4f));
+	tmax = _mm_min_ps(_mm_min_ps(tmax, _mm_max_ps(t0, t1)), _mm_set1_ps(pRay->t_hit));
+	live = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_castps_si128(_mm_and_ps(_mm_loadu_ps((float*)pNode->mask), pRay->qmask)), _mm_setzero_si128()));
+	*pTmin = tmin;
+	return _mm_movemask_ps(_mm_andnot_ps(live, _mm_cmple_ps(tmin, tmax)));
 }
 
-BVH_NODE* BVH_get_root(BVH_HEAD* pBVH) {
-	return BVH_get_node(pBVH, 0);
+/* Flat_ray_ck with the box expanded by ext and the segment cut at t_max */
+D_FORCE_INLINE static int Sweep_box_ck(QVEC vmin, QVEC vmax, FLAT_RAY* pRay, QVEC ext, float t_max) {
+	__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(vmin, ext), pRay->org), pRay->inv);
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(vmax, ext), pRay->org), pRay->inv);
+	__m128 tmin = _mm_min_ps(t0, t1);
+	__m128 tmax = _mm_max_ps(t0, t1);
+	tmin = _mm_max_ps(tmin, _mm_shuffle_ps(tmin, tmin, 0xC9));
+	tmin = _mm_max_ps(tmin, _mm_shuffle_ps(tmin, tmin, 0xD2));
+	tmax = _mm_min_ps(tmax, _mm_shuffle_ps(tmax, tmax, 0xC9));
+	tmax = _mm_min_ps(tmax, _mm_shuffle_ps(tmax, tmax, 0xD2));
+	tmin = _mm_max_ss(tmin, _mm_set_ss(-1e-4f));
+	tmax = _mm_min_ss(tmax, _mm_set_ss(t_max));
+	return _mm_comile_ss(tmin, tmax);
 }
 
-int BVH_get_node_id(BVH_HEAD* pBVH, BVH_NODE* pNode) {
-	return (int)(pNode - BVH_get_root(pBVH));
+static void Obst_sweep_direct(OBSTACLE* pObst, SWEEP_WORK* pWk) {
+	QVEC vtx[4];
+	int i, n;
+	OBST_POLY* pPol = pObst->pPol;
+
+	n = pObst->pData->nb_pol;
+	for (i = 0; i < n; ++i) {
+		if (pPol->attr & pWk->pSweep->mask) {
+			Get_pol_vtx(pObst, pPol, vtx);
+			Sweep_quad(pWk, i, vtx);
+		}
+		++pPol;
+	}
 }
 
-D_FORCE_INLINE static int Node_hit_ck(OBSTACLE* pObst, BVH_NODE* pNode, BVH_WORK* pWk) {
-	GEOM_AABB* pBox = BVH_get_node_bbox(pObst->pBVH, BVH_get_node_id(pObst->pBVH, pNode));
-	if (GEOM_aabb_overlap(&pWk->bbox, pBox)) {
-		if (GEOM_seg_aabb_check(pWk->pQry->p0.qv, pWk->pQry->p1.qv, pBox)) {
-			return 1;
+static void Obst_sweep_bvh(OBSTACLE* pObst, SWEEP_WORK* pWk, FLAT_RAY* pRay, QVEC ext, int node) {
+	QVEC vtx[4];
+	OBST_POLY* pPol;
+	BVH_NODE* pNode = BVH_get_node(pObst->pBVH, node);
+	GEOM_AABB* pBox = BVH_get_node_bbox(pObst->pBVH, node);
+
+	if (!Sweep_box_ck(pBox->min.qv, pBox->max.qv, pRay, ext, Sweep_t_box(pWk))) return;
+	if (pNode->right < 0) {
+		pPol = &pObst->pPol[pNode->prim];
+		if (pPol->attr & pWk->pSweep->mask) {
+			Get_pol_vtx(pObst, pPol, vtx);
+			Sweep_quad(pWk, pNode->prim, vtx);
 		}
+	} else {
+		Obst_sweep_bvh(pObst, pWk, pRay, ext, pNode->left);
+		Obst_sweep_bvh(pObst, pWk, pRay, ext, pNode->right);
 	}
-	return 0;
 }
 
-D_FORCE_INLINE static int Node_range_ck(OBSTACLE* pObst, BVH_NODE* pNode, GEOM_AABB* pRange) {
-	GEOM_AABB* pBox = BVH_get_node_bbox(pObst->pBVH, BVH_get_node_id(pObst->pBVH, pNode));
-	return GEOM_aabb_overlap(pRange, pBox);
+static void Obst_sweep_flat(OBSTACLE* pObst, SWEEP_WORK* pWk, FLAT_RAY* pRay, QVEC ext) {
+	QVEC vtx[4];
+	BVH_QNODE* pNode;
+	BVH_FLAT* pFlat = pObst->pFlat;
+	sys_ui32 mask = pWk->pSweep->mask;
+	int i = 0;
+	int n = pFlat->nb_node;
+
+	while (i < n) {
+		pNode = &pFlat->pNode[i];
+		if ((pNode->mask & mask) && Sweep_box_ck(Flat_decode(pFlat, pNode->qmin), Flat_decode(pFlat, pNode->qmax), pRay, ext, Sweep_t_box(pWk))) {
+			if (pNode->prim >= 0) {
+				Get_pol_vtx(pObst, &pObst->pPol[pNode->prim], vtx);
+				Sweep_quad(pWk, pNode->prim, vtx);
+			}
+			++i;
+			continue;
+		}
+		i = pNode->skip;
+	}
 }
 
-static void Obst_bvh_ck(OBSTACLE* pObst, BVH_NODE* pNode, BVH_WORK* pWk) {
+static void Obst_sweep_wide(OBSTACLE* pObst, SWEEP_WORK* pWk) {
+	BVH4_ENTRY stk[D_BVH4_STACK];
 	QVEC vtx[4];
-	QVEC hit_pos;
-	QVEC hit_nml;
-	float dist2;
-	if (Node_hit_ck(pObst, pNode, pWk)) {
-		if (pNode->right < 0) {
-			OBST_QUERY* pQry = pWk->pQry;
-			OBST_POLY* pPol = &pObst->pPol[pNode->prim];
-			if (pPol->attr & pQry->mask) {
-				Get_pol_vtx(pObst, pPol, vtx);
-				if (GEOM_seg_quad_intersect(pQry->p0.qv, pQry->p1.qv, vtx, &hit_pos, &hit_nml)) {
-					dist2 = V4_dist2(pQry->p0.qv, hit_pos);
-					if (dist2 < pWk->min_dist2) {
-						pQry->hit_pos.qv = hit_pos;
-						pQry->hit_nml.qv = hit_nml;
-						pQry->dist2 = dist2;
-						pQry->pol_no = pNode->prim;
-						pWk->min_dist2 = dist2;
+	__m128 ext[3];
+	OBST_QUERY qry;
+	WIDE_RAY ray;
+	UVEC tnear;
+	UVEC half;
+	BVH4_NODE* pNode;
+	BVH4_ENTRY ent;
+	OBST_POLY* pPol;
+	int i, sp, bits, nb_inner, prim;
+	int inner[4];
+
+	qry.p0.qv = V4_set_w1(V4_scale(V4_add(pWk->a0, pWk->a1), 0.5f));
+	qry.p1.qv = V4_set_w1(V4_add(qry.p0.qv, pWk->d));
+	qry.mask = pWk->pSweep->mask;
+	Wide_ray_init(&ray, &qry);
+	half.qv = Sweep_ext(pWk);
+	for (i = 0; i < 3; ++i) {
+		ext[i] = _mm_set1_ps(half.f[i]);
+	}
+	sp = 0;
+	stk[sp].node = 0;
+	stk[sp].t = 0.0f;
+	++sp;
+	while (sp > 0) {
+		ent = stk[--sp];
+		if (ent.t > ray.t_hit) continue;
+		pNode = &pObst->pWide->pNode[ent.node];
+		bits = Wide_sweep_ck(pNode, &ray, ext, &tnear.qv);
+		if (!bits) continue;
+		nb_inner = 0;
+		for (i = 0; i < 4; ++i) {
+			if (!(bits & (1 << i))) continue;
+			if (pNode->child[i] >= 0) {
+				inner[nb_inner++] = i;
+			} else {
+				prim = ~pNode->child[i];
+				pPol = &pObst->pPol[prim];
+				if (pPol->attr & qry.mask) {
+					Get_pol_vtx(pObst, pPol, vtx);
+					Sweep_quad(pWk, prim, vtx);
+					if (pWk->pSweep->res) {
+						ray.t_hit = pWk->pSweep->t + 1e-4f;
 					}
-					pWk->res = 1;
 				}
 			}
-		} else {
-			Obst_bvh_ck(pObst, BVH_get_node(pObst->pBVH, pNode->left), pWk);
-			Obst_bvh_ck(pObst, BVH_get_node(pObst->pBVH, pNode->right), pWk);
 		}
+		sp = Wide_push(stk, sp, pNode, inner, nb_inner, tnear.f, NULL);
 	}
 }
 
-static int Obst_check_bvh(OBSTACLE* pObst, OBST_QUERY* pQry) {
-	BVH_WORK wk;
-
-	wk.bbox.min.qv = V4_set_w1(V4_min(pQry->p0.qv, pQry->p1.qv));
-	wk.bbox.max.qv = V4_set_w1(V4_max(pQry->p0.qv, pQry->p1.qv));
-	wk.pQry = pQry;
-	wk.res = 0;
-	wk.min_dist2 = D_MAX_FLOAT;
-	Obst_bvh_ck(pObst, BVH_get_root(pObst->pBVH), &wk);
-	pQry->res = wk.res;
-	return wk.res;
-}
+int OBST_sweep(OBSTACLE* pObst, OBST_SWEEP* pSweep) {
+	SWEEP_WORK wk;
+	FLAT_RAY ray;
+	QVEC org;
 
-int OBST_check(OBSTACLE* pObst, OBST_QUERY* pQry) {
-	if (pObst->pBVH) {
-		return Obst_check_bvh(pObst, pQry);
-	} else {
-		return Obst_check_direct(pObst, pQry);
+	wk.pSweep = pSweep;
+	wk.a0 = V4_set_w1(pSweep->pos0.qv);
+	wk.a1 = V4_set_w1(pSweep->pos1.qv);
+	wk.d = V4_set_w0(pSweep->move.qv);
+	wk.r = pSweep->radius;
+	wk.capsule = V4_dist2(wk.a0, wk.a1) > 1e-12f;
+	pSweep->res = 0;
+	pSweep->t = 1.0f;
+	pSweep->depth = 0.0f;
+	if (pObst->pWide) {
+		Obst_sweep_wide(pObst, &wk);
+	} else if (pObst->pFlat || pObst->pBVH) {
+		/* the path of the axis middle against boxes grown by the half extent, as the wide traversal does */
+		org = V4_set_w1(V4_scale(V4_add(wk.a0, wk.a1), 0.5f));
+		Flat_ray_init(&ray, org, V4_add(org, wk.d));
+		if (pObst->pFlat) {
+			Obst_sweep_flat(pObst, &wk, &ray, Sweep_ext(&wk));
+		} else {
+			Obst_sweep_bvh(pObst, &wk, &ray, Sweep_ext(&wk), 0);
+		}
+	} else if (pObst->pData) {
+		Obst_sweep_direct(pObst, &wk);
 	}
+	return pSweep->res;
 }
 
-int OBST_collide(OBSTACLE* pObst, QVEC cur_pos, QVEC prev_pos, float r, sys_ui32 mask, QVEC* pNew_pos) {
-	QMTX m;
-	QVEC pos;
-	QVEC xz;
-	QVEC dir;
-	QVEC ck_dir;
-	OBST_QUERY qry;
-	int i, flg;
-	static float rot[] = {0.0f, D_DEG2RAD(30), -D_DEG2RAD(30)};
+/* moves the shape by pSweep->move, sliding along whatever it touches; the displacement actually done goes to pMove */
+int OBST_slide(OBSTACLE* pObst, OBST_SWEEP* pSweep, QVEC* pMove) {
+	int i, nb_hit;
+	float dn;
+	QVEC move, step, total, nml;
+	OBST_SWEEP sweep;
 
-	flg = 0;
-	pos = cur_pos;
-	dir = V4_normalize(V4_sub(pos, prev_pos));
-	qry.mask = mask;
-	for (i = 0; i < D_ARRAY_LENGTH(rot); ++i) {
-		MTX_rot_y(m, rot[i]);
-		ck_dir = MTX_calc_qvec(m, dir);
-		qry.p0.qv = V4_set_w1(pos);
-		qry.p1.qv = V4_set_w1(V4_add(pos, V4_scale(ck_dir, r)));
-		xz = V4_zero();
-		if (OBST_check(pObst, &qry)) {
-			xz = V4_sub(qry.p1.qv, qry.hit_pos.qv);
-			pos = V4_sub(pos, xz);
-			flg = 1;
+	nb_hit = 0;
+	sweep = *pSweep;
+	move = V4_set_w0(pSweep->move.qv);
+	total = V4_zero();
+	for (i = 0; i < D_SLIDE_MAX_ITER; ++i) {
+		if (V4_mag2(move) < 1e-12f) break;
+		sweep.pos0.qv = V4_add(pSweep->pos0.qv, total);
+		sweep.pos1.qv = V4_add(pSweep->pos1.qv, total);
+		sweep.move.qv = move;
+		if (!OBST_sweep(pObst, &sweep)) {
+			total = V4_add(total, move);
+			break;
+		}
+		if (!nb_hit) {
+			pSweep->hit_pos = sweep.hit_pos;
+			pSweep->hit_nml = sweep.hit_nml;
+			pSweep->t = sweep.t;
+			pSweep->depth = sweep.depth;
+			pSweep->pol_no = sweep.pol_no;
+		}
+		++nb_hit;
+		nml = sweep.hit_nml.qv;
+		step = V4_add(V4_scale(move, sweep.t), V4_scale(nml, D_SLIDE_SKIN + sweep.depth));
+		total = V4_add(total, step);
+		move = V4_scale(move, 1.0f - sweep.t);
+		dn = V4_dot(move, nml);
+		if (dn < 0.0f) {
+			move = V4_sub(move, V4_scale(nml, dn));
 		}
 	}
-	*pNew_pos = V4_set(V4_at(pos, 0), V4_at(cur_pos, 1), V4_at(pos, 2), 1.0f);
-	return flg;
+	pSweep->res = nb_hit > 0;
+	*pMove = V4_set_w0(total);
+	return pSweep->res;
 }
 
 static void Obst_range_direct(OBSTACLE* pObst, OBST_RANGE_QUERY* pQry) {
@@ -267,9 +2241,87 @@ static void Obst_range_bvh(OBSTACLE* pObst, BVH_NODE* pNode, OBST_RANGE_QUERY* p
 	}
 }
 
+static void Obst_range_flat(OBSTACLE* pObst, OBST_RANGE_QUERY* pQry) {
+	QVEC vtx[4];
+	BVH_QNODE* pNode;
+	BVH_FLAT* pFlat = pObst->pFlat;
+	int i = 0;
+	int n = pFlat->nb_node;
+
+	while (i < n) {
+		pNode = &pFlat->pNode[i];
+		if (pNode->mask & pQry->mask) {
+			if (Flat_range_ck(pFlat, pNode, &pQry->range)) {
+				if (pNode->prim >= 0) {
+					/* leaf boxes are padded by quantization, the exact test keeps counts as before */
+					Get_pol_vtx(pObst, &pObst->pPol[pNode->prim], vtx);
+					if (Ck_pol_aabb(vtx, &pQry->range)) {
+						++pQry->state.count;
+						if (pQry->func) {
+							pQry->func(pNode->prim, &pQry->state, vtx);
+						}
+					}
+				}
+				++i;
+				continue;
+			}
+		}
+		i = pNode->skip;
+	}
+}
+
+static void Obst_range_wide(OBSTACLE* pObst, OBST_RANGE_QUERY* pQry) {
+	sys_i32 stk[D_BVH4_STACK];
+	QVEC vtx[4];
+	__m128 rmin[3];
+	__m128 rmax[3];
+	__m128 m, qmask;
+	BVH4_NODE* pNode;
+	int i, sp, bits, prim;
+
+	for (i = 0; i < 3; ++i) {
+		rmin[i] = _mm_set1_ps(pQry->range.min.f[i]);
+		rmax[i] = _mm_set1_ps(pQry->range.max.f[i]);
+	}
+	qmask = _mm_castsi128_ps(_mm_set1_epi32(pQry->mask));
+	sp = 0;
+	stk[sp++] = 0;
+	while (sp > 0) {
+		pNode = &pObst->pWide->pNode[stk[--sp]];
+		m = _mm_and_ps(_mm_cmple_ps(pNode->bmin[0].qv, rmax[0]), _mm_cmpnlt_ps(pNode->bmax[0].qv, rmin[0]));
+		m = _mm_and_ps(m, _mm_and_ps(_mm_cmple_ps(pNode->bmin[1].qv, rmax[1]), _mm_cmpnlt_ps(pNode->bmax[1].qv, rmin[1])));
+		m = _mm_and_ps(m, _mm_and_ps(_mm_cmple_ps(pNode->bmin[2].qv, rmax[2]), _mm_cmpnlt_ps(pNode->bmax[2].qv, rmin[2])));
+		bits = _mm_movemask_ps(_mm_andnot_ps(
+		         _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_castps_si128(_mm_and_ps(_mm_loadu_ps((float*)pNode->mask), qmask)), _mm_setzero_si128())), m));
+		for (i = 0; i < 4; ++i) {
+			if (!(bits & (1 << i))) continue;
+			if (pNode->child[i] >= 0) {
+				if (sp < D_BVH4_STACK) {
+					stk[sp++] = pNode->child[i];
+				}
+			} else {
+				prim = ~pNode->child[i];
+				if (pObst->pPol[prim].attr & pQry->mask) {
+					Get_pol_vtx(pObst, &pObst->pPol[prim], vtx);
+					if (Ck_pol_aabb(vtx, &pQry->range)) {
+						++pQry->state.count;
+						if (pQry->func) {
+							pQry->func(prim, &pQry->state, vtx);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
 int OBST_range(OBSTACLE* pObst, OBST_RANGE_QUERY* pQry) {
 	pQry->state.count = 0;
-	if (pObst->pBVH) {
+	if (pObst->pWide) {
+		Obst_range_wide(pObst, pQry);
+	} else if (pObst->pFlat) {
+		Obst_range_flat(pObst, pQry);
+	} else if (pObst->pBVH) {
 		Obst_range_bvh(pObst, BVH_get_root(pObst->pBVH), pQry);
 	} else {
 		Obst_range_direct(pObst, pQry);
@@ -277,6 +2329,251 @@ int OBST_range(OBSTACLE* pObst, OBST_RANGE_QUERY* pQry) {
 	return pQry->state.count;
 }
 
+typedef enum _E_RANGE_SHAPE {
+	E_RANGE_BOX,
+	E_RANGE_SPH,
+	E_RANGE_FST
+} E_RANGE_SHAPE;
+
+/* query shape broadcast across lanes */
+typedef struct _RANGE_WORK {
+	__m128 a[3]; /* box min, sphere center */
+	__m128 b[3]; /* box max */
+	__m128 r2;
+	__m128 pn[6][3]; /* frustum plane normals */
+	__m128 pd[6];
+	int sel[6]; /* per plane, bit set where the nearest box corner takes max on that axis */
+	int kind;
+	sys_ui32 mask;
+	int* pOut;
+	int max;
+	int count;
+} RANGE_WORK;
+
+D_FORCE_INLINE static int Range_lanes(RANGE_WORK* pWork, __m128* bmin, __m128* bmax) {
+	int i;
+	__m128 m, d, e, s;
+
+	if (pWork->kind == E_RANGE_BOX) {
+		m = _mm_and_ps(_mm_cmple_ps(bmin[0], pWork->b[0]), _mm_cmpnlt_ps(bmax[0], pWork->a[0]));
+		m = _mm_and_ps(m, _mm_and_ps(_mm_cmple_ps(bmin[1], pWork->b[1]), _mm_cmpnlt_ps(bmax[1], pWork->a[1])));
+		m = _mm_and_ps(m, _mm_and_ps(_mm_cmple_ps(bmin[2], pWork->b[2]), _mm_cmpnlt_ps(bmax[2], pWork->a[2])));
+		return _mm_movemask_ps(m);
+	}
+	if (pWork->kind == E_RANGE_SPH) {
+		s = _mm_setzero_ps();
+		for (i = 0; i < 3; ++i) {
+			d = _mm_max_ps(_mm_max_ps(_mm_sub_ps(bmin[i], pWork->a[i]), _mm_sub_ps(pWork->a[i], bmax[i])), _mm_setzero_ps());
+			s = _mm_add_ps(s, _mm_mul_ps(d, d));
+		}
+		return _mm_movemask_ps(_mm_cmple_ps(s, pWork->r2));
+	}
+	m = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	for (i = 0; i < 6; ++i) {
+		d = _mm_mul_ps(pWork->pn[i][0], (pWork->sel[i] & 1) ? bmax[0] : bmin[0]);
+		e = _mm_mul_ps(pWork->pn[i][1], (pWork->sel[i] & 2) ? bmax[1] : bmin[1]);
+		d = _mm_add_ps(d, e);
+		e = _mm_mul_ps(pWork->pn[i][2], (pWork->sel[i] & 4) ? bmax[2] : bmin[2]);
+		d = _mm_add_ps(d, e);
+		m = _mm_and_ps(m, _mm_cmple_ps(d, pWork->pd[i]));
+	}
+	return _mm_movemask_ps(m);
+}
+
+D_FORCE_INLINE static void Range_put(RANGE_WORK* pWork, int pol_no) {
+	if (pWork->count < pWork->max) {
+		pWork->pOut[pWork->count] = pol_no;
+	}
+	++pWork->count;
+}
+
+/* exact quad bounds of four leaves at once from the SoA record */
+static void Range_quads(RANGE_WORK* pWork, OBST_QUAD4* pQuad, int lanes) {
+	int i, bits;
+	__m128 bmin[3];
+	__m128 bmax[3];
+
+	bmin[0] = _mm_min_ps(_mm_min_ps(pQuad->vx[0].qv, pQuad->vx[1].qv), _mm_min_ps(pQuad->vx[2].qv, pQuad->vx[3].qv));
+	bmin[1] = _mm_min_ps(_mm_min_ps(pQuad->vy[0].qv, pQuad->vy[1].qv), _mm_min_ps(pQuad->vy[2].qv, pQuad->vy[3].qv));
+	bmin[2] = _mm_min_ps(_mm_min_ps(pQuad->vz[0].qv, pQuad->vz[1].qv), _mm_min_ps(pQuad->vz[2].qv, pQuad->vz[3].qv));
+	bmax[0] = _mm_max_ps(_mm_max_ps(pQuad->vx[0].qv, pQuad->vx[1].qv), _mm_max_ps(pQuad->vx[2].qv, pQuad->vx[3].qv));
+	bmax[1] = _mm_max_ps(_mm_max_ps(pQuad->vy[0].qv, pQuad->vy[1].qv), _mm_max_ps(pQuad->vy[2].qv, pQuad->vy[3].qv));
+	bmax[2] = _mm_max_ps(_mm_max_ps(pQuad->vz[0].qv, pQuad->vz[1].qv), _mm_max_ps(pQuad->vz[2].qv, pQuad->vz[3].qv));
+	bits = Range_lanes(pWork, bmin, bmax) & lanes;
+	for (i = 0; i < 4; ++i) {
+		if ((bits & (1 << i)) && (pQuad->attr[i] & pWork->mask)) {
+			Range_put(pWork, pQuad->prim[i]);
+		}
+	}
+}
+
+/* a single box through lane 0 */
+static int Range_box(RANGE_WORK* pWork, QVEC vmin, QVEC vmax) {
+	int i;
+	UVEC a, b;
+	__m128 bmin[3];
+	__m128 bmax[3];
+
+	a.qv = vmin;
+	b.qv = vmax;
+	for (i = 0; i < 3; ++i) {
+		bmin[i] = _mm_set1_ps(a.f[i]);
+		bmax[i] = _mm_set1_ps(b.f[i]);
+	}
+	return Range_lanes(pWork, bmin, bmax) & 1;
+}
+
+static void Range_pol(OBSTACLE* pObst, RANGE_WORK* pWork, int pol_no) {
+	QVEC vtx[4];
+
+	if (!(pObst->pPol[pol_no].attr & pWork->mask)) return;
+	Get_pol_vtx(pObst, &pObst->pPol[pol_no], vtx);
+	if (Range_box(pWork, V4_min(V4_min(vtx[0], vtx[1]), V4_min(vtx[2], vtx[3])), V4_max(V4_max(vtx[0], vtx[1]), V4_max(vtx[2], vtx[3])))) {
+		Range_put(pWork, pol_no);
+	}
+}
+
+static void Range_direct(OBSTACLE* pObst, RANGE_WORK* pWork) {
+	int i, n;
+
+	n = pObst->pData->nb_pol;
+	for (i = 0; i < n; ++i) {
+		Range_pol(pObst, pWork, i);
+	}
+}
+
+static void Range_bvh(OBSTACLE* pObst, RANGE_WORK* pWork, int node) {
+	BVH_NODE* pNode = BVH_get_node(pObst->pBVH, node);
+	GEOM_AABB* pBox = BVH_get_node_bbox(pObst->pBVH, node);
+
+	if (!Range_box(pWork, pBox->min.qv, pBox->max.qv)) return;
+	if (pNode->right < 0) {
+		Range_pol(pObst, pWork, pNode->prim);
+	} else {
+		Range_bvh(pObst, pWork, pNode->left);
+		Range_bvh(pObst, pWork, pNode->right);
+	}
+}
+
+/* leaf boxes are padded by quantization, Range_pol keeps the exact test */
+static void Range_flat(OBSTACLE* pObst, RANGE_WORK* pWork) {
+	BVH_QNODE* pNode;
+	BVH_FLAT* pFlat = pObst->pFlat;
+	int i = 0;
+	int n = pFlat->nb_node;
+
+	while (i < n) {
+		pNode = &pFlat->pNode[i];
+		if ((pNode->mask & pWork->mask) && Range_box(pWork, Flat_decode(pFlat, pNode->qmin), Flat_decode(pFlat, pNode->qmax))) {
+			if (pNode->prim >= 0) {
+				Range_pol(pObst, pWork, pNode->prim);
+			}
+			++i;
+			continue;
+		}
+		i = pNode->skip;
+	}
+}
+
+static int Range_collect(OBSTACLE* pObst, RANGE_WORK* pWork) {
+	sys_i32 stk[D_BVH4_STACK];
+	__m128 qmask;
+	BVH4* pWide;
+	BVH4_NODE* pNode;
+	int i, sp, no, bits, leaves;
+
+	pWork->count = 0;
+	if (!pObst->pData) return 0;
+	pWide = pObst->pWide;
+	if (!pWide) {
+		if (pObst->pFlat) {
+			Range_flat(pObst, pWork);
+		} else if (pObst->pBVH) {
+			Range_bvh(pObst, pWork, 0);
+		} else {
+			Range_direct(pObst, pWork);
+		}
+		return pWork->count;
+	}
+	qmask = _mm_castsi128_ps(_mm_set1_epi32(pWork->mask));
+	sp = 0;
+	stk[sp++] = 0;
+	while (sp > 0) {
+		no = stk[--sp];
+		pNode = &pWide->pNode[no];
+		bits = Range_lanes(pWork, (__m128*)pNode->bmin, (__m128*)pNode->bmax);
+		bits &= ~_mm_movemask_ps(
+		         _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_castps_si128(_mm_and_ps(_mm_loadu_ps((float*)pNode->mask), qmask)), _mm_setzero_si128())));
+		if (!bits) continue;
+		leaves = 0;
+		for (i = 0; i < 4; ++i) {
+			if (!(bits & (1 << i))) continue;
+			if (pNode->child[i] < 0) {
+				leaves |= 1 << i;
+			} else if (sp < D_BVH4_STACK) {
+				stk[sp++] = pNode->child[i];
+			}
+		}
+		if (leaves) {
+			Range_quads(pWork, &pWide->pQuad[pWide->pNode_quad[no]], leaves);
+		}
+	}
+	return pWork->count;
+}
+
+/* polygons whose bounds overlap the box, no callback and no allocation;
+   returns the full count, only the first max numbers are written */
+int OBST_range_collect(OBSTACLE* pObst, GEOM_AABB* pBox, sys_ui32 mask, int* pOut, int max) {
+	int i;
+	RANGE_WORK work;
+
+	work.kind = E_RANGE_BOX;
+	for (i = 0; i < 3; ++i) {
+		work.a[i] = _mm_set1_ps(pBox->min.f[i]);
+		work.b[i] = _mm_set1_ps(pBox->max.f[i]);
+	}
+	work.mask = mask;
+	work.pOut = pOut;
+	work.max = max;
+	return Range_collect(pObst, &work);
+}
+
+int OBST_range_collect_sph(OBSTACLE* pObst, GEOM_SPHERE* pSph, sys_ui32 mask, int* pOut, int max) {
+	RANGE_WORK work;
+
+	work.kind = E_RANGE_SPH;
+	work.a[0] = _mm_set1_ps(pSph->x);
+	work.a[1] = _mm_set1_ps(pSph->y);
+	work.a[2] = _mm_set1_ps(pSph->z);
+	work.r2 = _mm_set1_ps(pSph->r * pSph->r);
+	work.mask = mask;
+	work.pOut = pOut;
+	work.max = max;
+	return Range_collect(pObst, &work);
+}
+
+/* conservative like GEOM_frustum_aabb_cull: a box is dropped only when it is outside one plane */
+int OBST_range_collect_fst(OBSTACLE* pObst, GEOM_FRUSTUM* pFst, sys_ui32 mask, int* pOut, int max) {
+	int i, j;
+	RANGE_WORK work;
+
+	work.kind = E_RANGE_FST;
+	for (i = 0; i < 6; ++i) {
+		work.sel[i] = 0;
+		for (j = 0; j < 3; ++j) {
+			work.pn[i][j] = _mm_set1_ps(V4_at(pFst->pln[i].qv, j));
+			if (V4_at(pFst->pln[i].qv, j) < 0.0f) {
+				work.sel[i] |= 1 << j;
+			}
+		}
+		work.pd[i] = _mm_set1_ps(pFst->pln[i].d);
+	}
+	work.mask = mask;
+	work.pOut = pOut;
+	work.max = max;
+	return Range_collect(pObst, &work);
+}
+
 void OBST_get_pol(OBSTACLE* pObst, int pol_no, QVEC* pVtx, QVEC* pNrm) {
 	QVEC vtx[4];
 	OBST_POLY* pPol = &pObst->pPol[pol_no];
@@ -291,3 +2588,184 @@ void OBST_get_pol(OBSTACLE* pObst, int pol_no, QVEC* pVtx, QVEC* pNrm) {
 		*pNrm = GEOM_tri_norm_ccw(vtx[0], vtx[1], vtx[2]);
 	}
 }
+
+int OBST_scene_init(OBST_SCENE* pScn, int max_inst) {
+	memset(pScn, 0, sizeof(OBST_SCENE));
+	pScn->pInst = (OBST_INST*)SYS_malloc(max_inst*sizeof(OBST_INST));
+	pScn->pInst_box = (GEOM_AABB*)SYS_malloc(max_inst*sizeof(GEOM_AABB));
+	if (!pScn->pInst || !pScn->pInst_box) {
+		OBST_scene_free(pScn);
+		return 0;
+	}
+	pScn->max_inst = max_inst;
+	return 1;
+}
+
+void OBST_scene_free(OBST_SCENE* pScn) {
+	if (pScn) {
+		SYS_free(pScn->pInst);
+		pScn->pInst = NULL;
+		SYS_free(pScn->pInst_box);
+		pScn->pInst_box = NULL;
+		SYS_free(pScn->pTLAS);
+		pScn->pTLAS = NULL;
+		pScn->nb_inst = 0;
+		pScn->max_inst = 0;
+	}
+}
+
+int OBST_scene_add(OBST_SCENE* pScn, OBSTACLE* pObst, MTX m) {
+	int i, n;
+	OBST_INST* pInst;
+
+	if (pScn->nb_inst >= pScn->max_inst || !pObst->pData) return -1;
+	pInst = &pScn->pInst[pScn->nb_inst];
+	pInst->pObst = pObst;
+	pInst->mask = 0;
+	n = pObst->pData->nb_pol;
+	for (i = 0; i < n; ++i) {
+		pInst->mask |= pObst->pPol[i].attr;
+	}
+	OBST_scene_move(pScn, pScn->nb_inst, m);
+	return pScn->nb_inst++;
+}
+
+void OBST_scene_move(OBST_SCENE* pScn, int inst_no, MTX m) {
+	GEOM_AABB local;
+	OBST_INST* pInst = &pScn->pInst[inst_no];
+
+	MTX_cpy(pInst->mtx, m);
+	MTX_invert(pInst->inv, m);
+	if (pInst->pObst->pBVH) {
+		local = *BVH_get_node_bbox(pInst->pObst->pBVH, 0);
+	} else {
+		local.min.qv = V4_zero();
+		local.max.qv = V4_zero();
+	}
+	GEOM_aabb_transform(&pInst->box, pInst->mtx, &local);
+	pScn->pInst_box[inst_no] = pInst->box;
+}
+
+static int Bvh_depth(BVH_HEAD* pBVH, int node) {
+	BVH_NODE* pNode = BVH_get_node(pBVH, node);
+	if (pNode->right < 0) return 1;
+	return 1 + D_MAX(Bvh_depth(pBVH, pNode->left), Bvh_depth(pBVH, pNode->right));
+}
+
+/* a rebuild gives the best tree for the new layout, a refit keeps the old topology */
+void OBST_scene_update(OBST_SCENE* pScn, int rebuild, int nb_wrk) {
+	int n = pScn->nb_inst;
+
+	if (n <= 0) return;
+	if (!pScn->pTLAS || (int)pScn->pTLAS->nb_node != 2*n - 1) {
+		SYS_free(pScn->pTLAS);
+		pScn->pTLAS = BVH_alloc(2*n - 1);
+		rebuild = 1;
+	}
+	if (!pScn->pTLAS) return;
+	if (rebuild) {
+		BVH_build(pScn->pTLAS, pScn->pInst_box, n, nb_wrk);
+		pScn->depth = Bvh_depth(pScn->pTLAS, 0);
+	} else {
+		BVH_refit(pScn->pTLAS, pScn->pInst_box);
+	}
+}
+
+static float Scene_box_ck(GEOM_AABB* pBox, QVEC org, QVEC inv, float t_max) {
+	UVEC t0, t1, tmin, tmax;
+	float t_near, t_far;
+
+	t0.qv = V4_mul(V4_sub(pBox->min.qv, org), inv);
+	t1.qv = V4_mul(V4_sub(pBox->max.qv, org), inv);
+	tmin.qv = V4_min(t0.qv, t1.qv);
+	tmax.qv = V4_max(t0.qv, t1.qv);
+	t_near = D_MAX(D_MAX(tmin.x, tmin.y), D_MAX(tmin.z, 0.0f));
+	t_far = D_MIN(D_MIN(tmax.x, tmax.y), D_MIN(tmax.z, t_max));
+	return t_near <= t_far ? t_near : -1.0f;
+}
+
+/* the segment is taken into each instance's space and checked against its own tree */
+int OBST_scene_check(OBST_SCENE* pScn, OBST_QUERY* pQry, int* pInst_no) {
+	int stk[D_BVH4_STACK];
+	int* pStk = stk;
+	int i, sp, res, left, right;
+	float t_max, tl, tr, dist2;
+	float min_dist2 = D_MAX_FLOAT;
+	QVEC dir;
+	UVEC inv;
+	UVEC d;
+	BVH_NODE* pNode;
+	OBST_INST* pInst;
+	OBST_QUERY loc;
+
+	res = 0;
+	pQry->res = 0;
+	if (!pScn->pTLAS || pScn->nb_inst <= 0) return 0;
+	/* one pending sibling per level */
+	if (pScn->depth > D_BVH4_STACK) {
+		pStk = (int*)SYS_malloc(pScn->depth*sizeof(int));
+		if (!pStk) return 0;
+	}
+	dir = V4_sub(pQry->p1.qv, pQry->p0.qv);
+	d.qv = dir;
+	for (i = 0; i < 3; ++i) {
+		inv.f[i] = (d.f[i] > 1e-20f || d.f[i] < -1e-20f) ? 1.0f / d.f[i] : 1e30f;
+	}
+	inv.w = 0.0f;
+	t_max = 1.0f;
+	sp = 0;
+	pStk[sp++] = 0;
+	while (sp > 0) {
+		i = pStk[--sp];
+		if (Scene_box_ck(BVH_get_node_bbox(pScn->pTLAS, i), pQry->p0.qv, inv.qv, t_max) < 0.0f) continue;
+		pNode = BVH_get_node(pScn->pTLAS, i);
+		if (pNode->right >= 0) {
+			left = pNode->left;
+			right = pNode->right;
+			tl = Scene_box_ck(BVH_get_node_bbox(pScn->pTLAS, left), pQry->p0.qv, inv.qv, t_max);
+			tr = Scene_box_ck(BVH_get_node_bbox(pScn->pTLAS, right), pQry->p0.qv, inv.qv, t_max);
+			/* nearer child on top */
+			if (tl >= 0.0f && tr >= 0.0f) {
+				pStk[sp++] = tl < tr ? right : left;
+				pStk[sp++] = tl < tr ? left : right;
+			} else if (tl >= 0.0f) {
+				pStk[sp++] = left;
+			} else if (tr >= 0.0f) {
+				pStk[sp++] = right;
+			}
+			continue;
+		}
+		pInst = &pScn->pInst[pNode->prim];
+		if (!(pInst->mask & pQry->mask)) continue;
+		loc.p0.qv = V4_set_w1(MTX_calc_qpnt(pInst->inv, pQry->p0.qv));
+		loc.p1.qv = V4_set_w1(MTX_calc_qpnt(pInst->inv, V4_add(pQry->p0.qv, V4_scale(dir, D_MIN(t_max + 1e-4f, 1.0f)))));
+		loc.mask = pQry->mask;
+		if (OBST_check(pInst->pObst, &loc)) {
+			UVEC hit_pos;
+			hit_pos.qv = V4_set_w1(MTX_calc_qpnt(pInst->mtx, loc.hit_pos.qv));
+			dist2 = V4_dist2(pQry->p0.qv, hit_pos.qv);
+			if (dist2 < min_dist2) {
+				min_dist2 = dist2;
+				pQry->hit_pos = hit_pos;
+				/* normals go through the inverse transpose */
+				pQry->hit_nml.qv = V4_normalize(V4_set_vec(V4_dot(V4_load(pInst->inv[0]), loc.hit_nml.qv),
+				                                           V4_dot(V4_load(pInst->inv[1]), loc.hit_nml.qv),
+				                                           V4_dot(V4_load(pInst->inv[2]), loc.hit_nml.qv)));
+				pQry->dist2 = dist2;
+				pQry->pol_no = loc.pol_no;
+				if (pInst_no) {
+					*pInst_no = pNode->prim;
+				}
+				if (V4_mag2(dir) > 0.0f) {
+					t_max = V4_dot(V4_sub(hit_pos.qv, pQry->p0.qv), dir) / V4_mag2(dir);
+				}
+			}
+			res = 1;
+		}
+	}
+	if (pStk != stk) {
+		SYS_free(pStk);
+	}
+	pQry->res = res;
+	return res;
+}
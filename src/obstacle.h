@@ -30,8 +30,13 @@ typedef struct _OBST_HEAD {
 	sys_ui32 nb_pol;
 } OBST_HEAD;
 
-typedef struct _OBST_POLY {
+typedef struct _OBST_FILE_POLY {
 	sys_ui16 idx[4];
+	sys_ui32 attr;
+} OBST_FILE_POLY;
+
+typedef struct _OBST_POLY {
+	sys_ui32 idx[4];
 	sys_ui32 attr; /* E_OBST_POLYATTR */
 } OBST_POLY;
 
@@ -41,21 +46,127 @@ typedef struct _BVH_HEAD {
 	sys_ui32 reserved[2];
 } BVH_HEAD;
 
-typedef struct _BVH_NODE {
+typedef struct _BVH_FILE_NODE {
 	union {
 		sys_i16 left;
 		sys_i16 prim;
 	};
 	sys_i16 right;
+} BVH_FILE_NODE;
+
+/* root first, leaves have right < 0; built trees are in pre-order, trees from files needn't be */
+typedef struct _BVH_NODE {
+	union {
+		sys_i32 left;
+		sys_i32 prim;
+	};
+	sys_i32 right;
 } BVH_NODE;
 
+/* own bounds quantized to the tree's frame, so a node is tested without its parent */
+typedef struct _BVH_QNODE {
+	sys_ui16 qmin[3];
+	sys_ui16 qmax[3];
+	sys_i32  skip; /* next node in depth-first order once this subtree is done or missed */
+	sys_i32  prim; /* < 0 for inner nodes */
+	sys_ui32 mask; /* E_OBST_POLYATTR of everything below */
+	sys_ui32 reserved[2];
+} BVH_QNODE;
+
+typedef struct _BVH_FLAT {
+	UVEC org;
+	UVEC step;
+	BVH_QNODE* pNode;
+	sys_i32 nb_node;
+} BVH_FLAT;
+
+/* four children tested at once, boxes stored per axis */
+typedef struct _BVH4_NODE {
+	UVEC bmin[3];
+	UVEC bmax[3];
+	sys_i32  child[4]; /* node index, or ~prim for leaves */
+	sys_ui32 mask[4];
+} BVH4_NODE;
+
+/* leaf quads of one wide node, one per lane in child slot order */
+typedef struct _OBST_QUAD4 {
+	UVEC vx[4];
+	UVEC vy[4];
+	UVEC vz[4];
+	UVEC nx;
+	UVEC ny;
+	UVEC nz;
+	sys_ui32 attr[4]; /* 0 in lanes without a quad */
+	sys_i32  prim[4];
+	sys_ui32 reserved[12];
+} OBST_QUAD4;
+
+typedef struct _BVH4 {
+	BVH4_NODE* pNode;
+	OBST_QUAD4* pQuad;
+	sys_i32* pNode_quad; /* record of each node's leaves, -1 when it has none */
+	sys_i32 nb_node;
+	sys_i32 nb_quad;
+} BVH4;
+
+typedef struct _OBST_FLOOR_CELL {
+	sys_i32 first; /* into the candidate list */
+	sys_i32 count;
+	sys_i32 cover; /* +1/-1 winding when a single quad covers the whole cell, 0 otherwise */
+} OBST_FLOOR_CELL;
+
+typedef struct _OBST_FLOOR_PLANE {
+	UVEC nml;
+	UVEC org;
+	UVEC bmin; /* quad bounds, padded like the BVH4 leaf boxes */
+	UVEC bmax;
+} OBST_FLOOR_PLANE;
+
+/* 2D grid over the floor quads for vertical checks */
+typedef struct _OBST_FLOOR {
+	float org_x;
+	float org_z;
+	float cell;
+	float inv_cell;
+	sys_i32 nx;
+	sys_i32 nz;
+	sys_i32 nb_list;
+	sys_i32 nb_cover;
+	OBST_FLOOR_CELL* pCell;
+	OBST_FLOOR_PLANE* pPlane; /* by polygon number */
+	sys_i32* pList;
+} OBST_FLOOR;
+
 typedef struct _OBSTACLE {
 	OBST_HEAD* pData;
 	BVH_HEAD* pBVH;
+	BVH_FLAT* pFlat;
+	BVH4* pWide;
+	OBST_FLOOR* pFloor;
 	UVEC3* pPnt;
 	OBST_POLY* pPol;
 } OBSTACLE;
 
+/* an obstacle placed in the world, its own tree is built once in local space */
+typedef struct _OBST_INST {
+	QMTX mtx; /* local to world */
+	QMTX inv;
+	GEOM_AABB box; /* world bounds */
+	OBSTACLE* pObst;
+	sys_ui32 mask; /* E_OBST_POLYATTR of all its quads */
+	sys_ui32 reserved[3];
+} OBST_INST;
+
+/* top-level tree over instances, rebuilt or refit after they move */
+typedef struct _OBST_SCENE {
+	OBST_INST* pInst;
+	GEOM_AABB* pInst_box;
+	BVH_HEAD* pTLAS;
+	int nb_inst;
+	int max_inst;
+	int depth; /* of pTLAS, sizes the traversal stack */
+} OBST_SCENE;
+
 typedef struct _OBST_QUERY {
 	UVEC p0;
 	UVEC p1;
@@ -67,6 +178,21 @@ typedef struct _OBST_QUERY {
 	int pol_no;
 } OBST_QUERY;
 
+/* sphere when pos0 == pos1, capsule otherwise */
+typedef struct _OBST_SWEEP {
+	UVEC pos0;
+	UVEC pos1;
+	UVEC move;
+	UVEC hit_pos;
+	UVEC hit_nml;
+	float radius;
+	float t;     /* fraction of move until contact */
+	float depth; /* penetration when already touching at t == 0 */
+	sys_ui32 mask;
+	int res;
+	int pol_no;
+} OBST_SWEEP;
+
 typedef struct _OBST_RANGE_STATE {
 	void* pData;
 	int   count;
@@ -81,9 +207,34 @@ typedef struct _OBST_RANGE_QUERY {
 	sys_ui32         mask;
 } OBST_RANGE_QUERY;
 
+D_EXTERN_FUNC BVH_HEAD* BVH_alloc(int nb_node);
+D_EXTERN_FUNC void BVH_build(BVH_HEAD* pBVH, GEOM_AABB* pPrim_box, int nb_prim, int nb_wrk);
+D_EXTERN_FUNC void BVH_refit(BVH_HEAD* pBVH, GEOM_AABB* pPrim_box);
+D_EXTERN_FUNC GEOM_AABB* BVH_get_node_bbox(BVH_HEAD* pBVH, int i);
+D_EXTERN_FUNC BVH_NODE* BVH_get_node(BVH_HEAD* pBVH, int i);
+
+D_EXTERN_FUNC int OBST_init(OBSTACLE* pObst, int nb_pnt, int nb_pol);
 D_EXTERN_FUNC void OBST_load(OBSTACLE* pObst, const char* obs_name, const char* bvh_name);
+D_EXTERN_FUNC void OBST_build_bvh(OBSTACLE* pObst, int nb_wrk);
+D_EXTERN_FUNC void OBST_build_flat(OBSTACLE* pObst);
+D_EXTERN_FUNC void OBST_build_wide(OBSTACLE* pObst);
+D_EXTERN_FUNC void OBST_build_floor(OBSTACLE* pObst);
+D_EXTERN_FUNC void OBST_refit(OBSTACLE* pObst);
 D_EXTERN_FUNC void OBST_free(OBSTACLE* pObst);
 D_EXTERN_FUNC int OBST_check(OBSTACLE* pObst, OBST_QUERY* pQry);
+D_EXTERN_FUNC int OBST_check_batch(OBSTACLE* pObst, OBST_QUERY* pQry, int n);
 D_EXTERN_FUNC int OBST_collide(OBSTACLE* pObst, QVEC cur_pos, QVEC prev_pos, float r, sys_ui32 mask, QVEC* pNew_pos);
+D_EXTERN_FUNC int OBST_sweep(OBSTACLE* pObst, OBST_SWEEP* pSweep);
+D_EXTERN_FUNC int OBST_slide(OBSTACLE* pObst, OBST_SWEEP* pSweep, QVEC* pMove);
 D_EXTERN_FUNC int OBST_range(OBSTACLE* pObst, OBST_RANGE_QUERY* pQry);
+D_EXTERN_FUNC int OBST_range_collect(OBSTACLE* pObst, GEOM_AABB* pBox, sys_ui32 mask, int* pOut, int max);
+D_EXTERN_FUNC int OBST_range_collect_sph(OBSTACLE* pObst, GEOM_SPHERE* pSph, sys_ui32 mask, int* pOut, int max);
+D_EXTERN_FUNC int OBST_range_collect_fst(OBSTACLE* pObst, GEOM_FRUSTUM* pFst, sys_ui32 mask, int* pOut, int max);
 D_EXTERN_FUNC void OBST_get_pol(OBSTACLE* pObst, int pol_no, QVEC* pVtx, QVEC* pNrm);
+
+D_EXTERN_FUNC int OBST_scene_init(OBST_SCENE* pScn, int max_inst);
+D_EXTERN_FUNC void OBST_scene_free(OBST_SCENE* pScn);
+D_EXTERN_FUNC int OBST_scene_add(OBST_SCENE* pScn, OBSTACLE* pObst, MTX m);
+D_EXTERN_FUNC void OBST_scene_move(OBST_SCENE* pScn, int inst_no, MTX m);
+D_EXTERN_FUNC void OBST_scene_update(OBST_SCENE* pScn, int rebuild, int nb_wrk);
+D_EXTERN_FUNC int OBST_scene_check(OBST_SCENE* pScn, OBST_QUERY* pQry, int* pInst_no);
@@ -0,0 +1,257 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+#include "system.h"
+#include "calc.h"
+#include "obstacle.h"
+#include "obstgen.h"
+
+#define D_GEN_CELL (0.5f)
+#define D_GEN_ROOM (4.0f)
+#define D_GEN_STOREY (3.0f)
+#define D_GEN_STOREYS (4)
+#define D_GEN_DOOR (0.6f)
+#define D_GEN_DOOR_H (2.2f)
+#define D_GEN_WALL_R (0.1f)
+#define D_GEN_ROOM_QUADS (14)
+
+typedef struct _GEN_WORK {
+	OBSTACLE* pObst;
+	UVEC3* pPnt;
+	OBST_POLY* pPol;
+	sys_ui32 seed;
+} GEN_WORK;
+
+/* own generator so a seed gives the same world on every platform */
+static float Gen_rand(GEN_WORK* pGen) {
+	pGen->seed = pGen->seed * 1664525 + 1013904223;
+	return (float)(pGen->seed >> 8) * (1.0f / 16777216.0f);
+}
+
+static int Gen_init(GEN_WORK* pGen, OBSTACLE* pObst, int nb_pnt, int nb_pol, sys_ui32 seed) {
+	if (!OBST_init(pObst, nb_pnt, nb_pol)) return 0;
+	pGen->pObst = pObst;
+	pGen->pPnt = pObst->pPnt;
+	pGen->pPol = pObst->pPol;
+	pGen->seed = seed;
+	return 1;
+}
+
+static void Gen_quad(GEN_WORK* pGen, QVEC* pVtx, sys_ui32 attr) {
+	int i;
+	UVEC v;
+	sys_ui32 org = (sys_ui32)(pGen->pPnt - pGen->pObst->pPnt);
+
+	for (i = 0; i < 4; ++i) {
+		v.qv = pVtx[i];
+		pGen->pPnt->x = v.x;
+		pGen->pPnt->y = v.y;
+		pGen->pPnt->z = v.z;
+		++pGen->pPnt;
+		pGen->pPol->idx[i] = org + i;
+	}
+	pGen->pPol->attr = attr;
+	++pGen->pPol;
+}
+
+/* vertical quad from (x0, z0) to (x1, z1), facing (dz, 0, -dx) */
+static void Gen_wall(GEN_WORK* pGen, float x0, float z0, float x1, float z1, float y0, float y1) {
+	QVEC vtx[4];
+
+	vtx[0] = V4_set_pnt(x0, y0, z0);
+	vtx[1] = V4_set_pnt(x0, y1, z0);
+	vtx[2] = V4_set_pnt(x1, y1, z1);
+	vtx[3] = V4_set_pnt(x1, y0, z1);
+	Gen_quad(pGen, vtx, E_OBST_POLYATTR_WALL);
+}
+
+/* both faces of a thin wall along x or z */
+static void Gen_slab(GEN_WORK* pGen, float x0, float z0, float x1, float z1, float y0, float y1) {
+	float ox = x1 > x0 ? 0.0f : D_GEN_WALL_R;
+	float oz = x1 > x0 ? D_GEN_WALL_R : 0.0f;
+
+	Gen_wall(pGen, x0 + ox, z0 - oz, x1 + ox, z1 - oz, y0, y1);
+	Gen_wall(pGen, x1 - ox, z1 + oz, x0 - ox, z0 + oz, y0, y1);
+}
+
+/* level floor or ceiling over [x0, x1] x [z0, z1], floors face up */
+static void Gen_flat(GEN_WORK* pGen, float x0, float z0, float x1, float z1, float y, sys_ui32 attr) {
+	QVEC vtx[4];
+
+	if (attr & E_OBST_POLYATTR_FLOOR) {
+		vtx[0] = V4_set_pnt(x0, y, z0);
+		vtx[1] = V4_set_pnt(x0, y, z1);
+		vtx[2] = V4_set_pnt(x1, y, z1);
+		vtx[3] = V4_set_pnt(x1, y, z0);
+	} else {
+		vtx[0] = V4_set_pnt(x0, y, z0);
+		vtx[1] = V4_set_pnt(x1, y, z0);
+		vtx[2] = V4_set_pnt(x1, y, z1);
+		vtx[3] = V4_set_pnt(x0, y, z1);
+	}
+	Gen_quad(pGen, vtx, attr);
+}
+
+/* heightfield terrain with one wall quad per eight quads scattered over it */
+int OBST_gen_terrain(OBSTACLE* pObst, int nb_quad, sys_ui32 seed) {
+	int i, x, z, org, side, nb_floor, nb_wall;
+	float cx, cz, dx, dz, ang, len;
+	UVEC3* pPnt;
+	OBST_POLY* pPol;
+	GEN_WORK gen;
+
+	nb_wall = nb_quad / 8;
+	side = (int)sqrtf((float)(nb_quad - nb_wall));
+	nb_floor = side * side;
+	if (!Gen_init(&gen, pObst, (side + 1)*(side + 1) + nb_wall*4, nb_floor + nb_wall, seed)) return 0;
+	pPnt = pObst->pPnt;
+	for (z = 0; z <= side; ++z) {
+		for (x = 0; x <= side; ++x) {
+			pPnt->x = (float)x * D_GEN_CELL;
+			pPnt->y = sinf((float)x * 0.3f) * cosf((float)z * 0.2f) * 1.5f;
+			pPnt->z = (float)z * D_GEN_CELL;
+			++pPnt;
+		}
+	}
+	pPol = pObst->pPol;
+	for (z = 0; z < side; ++z) {
+		for (x = 0; x < side; ++x) {
+			org = z*(side + 1) + x;
+			pPol->idx[0] = org;
+			pPol->idx[1] = org + side + 1;
+			pPol->idx[2] = org + side + 2;
+			pPol->idx[3] = org + 1;
+			pPol->attr = E_OBST_POLYATTR_FLOOR;
+			++pPol;
+		}
+	}
+	gen.pPnt = pPnt;
+	gen.pPol = pPol;
+	for (i = 0; i < nb_wall; ++i) {
+		cx = Gen_rand(&gen) * (float)side * D_GEN_CELL;
+		cz = Gen_rand(&gen) * (float)side * D_GEN_CELL;
+		ang = Gen_rand(&gen) * D_PI * 2.0f;
+		len = 0.5f + Gen_rand(&gen) * 1.5f;
+		dx = cosf(ang) * len;
+		dz = sinf(ang) * len;
+		Gen_wall(&gen, cx - dx, cz - dz, cx + dx, cz + dz, -2.0f, 3.0f);
+	}
+	return 1;
+}
+
+/*
+ * Storeys of square rooms. Each room owns its floor, ceiling and the
+ * west and south walls, both faces, each with a door and a lintel.
+ */
+int OBST_gen_interior(OBSTACLE* pObst, int nb_quad, sys_ui32 seed) {
+	int x, z, s, side, nb_room;
+	float x0, z0, y0, x1, z1, y1, d0, d1, top;
+	GEN_WORK gen;
+
+	nb_room = D_MAX(nb_quad / (D_GEN_ROOM_QUADS * D_GEN_STOREYS), 1);
+	side = D_MAX((int)sqrtf((float)nb_room), 1);
+	nb_room = side * side * D_GEN_STOREYS;
+	if (!Gen_init(&gen, pObst, nb_room * D_GEN_ROOM_QUADS * 4, nb_room * D_GEN_ROOM_QUADS, seed)) return 0;
+	for (s = 0; s < D_GEN_STOREYS; ++s) {
+		y0 = (float)s * D_GEN_STOREY;
+		y1 = y0 + D_GEN_STOREY - D_GEN_WALL_R;
+		top = y0 + D_GEN_DOOR_H;
+		for (z = 0; z < side; ++z) {
+			for (x = 0; x < side; ++x) {
+				x0 = (float)x * D_GEN_ROOM;
+				z0 = (float)z * D_GEN_ROOM;
+				x1 = x0 + D_GEN_ROOM;
+				z1 = z0 + D_GEN_ROOM;
+				Gen_flat(&gen, x0, z0, x1, z1, y0, E_OBST_POLYATTR_FLOOR);
+				Gen_flat(&gen, x0, z0, x1, z1, y1, E_OBST_POLYATTR_CEIL);
+				/* doors at random spots along the wall */
+				d0 = z0 + 0.5f + Gen_rand(&gen) * (D_GEN_ROOM - 1.0f - D_GEN_DOOR);
+				d1 = d0 + D_GEN_DOOR;
+				Gen_slab(&gen, x0, z0, x0, d0, y0, y1);
+				Gen_slab(&gen, x0, d1, x0, z1, y0, y1);
+				Gen_slab(&gen, x0, d0, x0, d1, top, y1);
+				d0 = x0 + 0.5f + Gen_rand(&gen) * (D_GEN_ROOM - 1.0f - D_GEN_DOOR);
+				d1 = d0 + D_GEN_DOOR;
+				Gen_slab(&gen, x0, z0, d0, z0, y0, y1);
+				Gen_slab(&gen, d1, z0, x1, z0, y0, y1);
+				Gen_slab(&gen, d0, z0, d1, z0, top, y1);
+			}
+		}
+	}
+	return 1;
+}
+
+/* planar quads of random size and orientation at constant density */
+int OBST_gen_soup(OBSTACLE* pObst, int nb_quad, sys_ui32 seed) {
+	int i;
+	float side, size;
+	QVEC vtx[4];
+	QVEC c, n, u, v;
+	UVEC nml;
+	sys_ui32 attr;
+	GEN_WORK gen;
+
+	if (!Gen_init(&gen, pObst, nb_quad * 4, nb_quad, seed)) return 0;
+	side = powf((float)nb_quad, 1.0f / 3.0f) * 2.0f;
+	for (i = 0; i < nb_quad; ++i) {
+		c = V4_set_pnt(Gen_rand(&gen) * side, Gen_rand(&gen) * side, Gen_rand(&gen) * side);
+		do {
+			n = V4_set_vec(Gen_rand(&gen) - 0.5f, Gen_rand(&gen) - 0.5f, Gen_rand(&gen) - 0.5f);
+		} while (V4_mag2(n) < 1e-4f);
+		n = V4_normalize(n);
+		u = V4_cross(n, fabsf(V4_at(n, 1)) < 0.9f ? V4_set_vec(0.0f, 1.0f, 0.0f) : V4_set_vec(1.0f, 0.0f, 0.0f));
+		u = V4_normalize(u);
+		v = V4_cross(n, u);
+		size = 0.1f + Gen_rand(&gen) * 0.9f;
+		u = V4_scale(u, size);
+		v = V4_scale(v, size * (0.5f + Gen_rand(&gen)));
+		/* wound so that the geometric normal is n */
+		vtx[0] = V4_sub(V4_sub(c, u), v);
+		vtx[1] = V4_sub(V4_add(c, u), v);
+		vtx[2] = V4_add(V4_add(c, u), v);
+		vtx[3] = V4_add(V4_sub(c, u), v);
+		nml.qv = n;
+		if (nml.y > 0.7f) {
+			attr = E_OBST_POLYATTR_FLOOR;
+		} else if (nml.y < -0.7f) {
+			attr = E_OBST_POLYATTR_CEIL;
+		} else {
+			attr = E_OBST_POLYATTR_WALL;
+		}
+		Gen_quad(&gen, vtx, attr);
+	}
+	return 1;
+}
+
+int OBST_gen(OBSTACLE* pObst, E_OBST_GEN kind, int nb_quad, sys_ui32 seed) {
+	switch (kind) {
+		case E_OBST_GEN_TERRAIN: return OBST_gen_terrain(pObst, nb_quad, seed);
+		case E_OBST_GEN_INTERIOR: return OBST_gen_interior(pObst, nb_quad, seed);
+		case E_OBST_GEN_SOUP: return OBST_gen_soup(pObst, nb_quad, seed);
+		default: break;
+	}
+	return 0;
+}
+
+const char* OBST_gen_name(E_OBST_GEN kind) {
+	static const char* name[] = {"terrain", "interior", "soup"};
+	if ((unsigned)kind >= E_OBST_GEN_MAX) return "?";
+	return name[kind];
+}
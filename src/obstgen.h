@@ -0,0 +1,34 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/* synthetic obstacle worlds for benchmarks, no data files */
+
+typedef enum _E_OBST_GEN {
+	E_OBST_GEN_TERRAIN,
+	E_OBST_GEN_INTERIOR,
+	E_OBST_GEN_SOUP,
+	E_OBST_GEN_MAX
+} E_OBST_GEN;
+
+D_EXTERN_FUNC int OBST_gen_terrain(OBSTACLE* pObst, int nb_quad, sys_ui32 seed);
+D_EXTERN_FUNC int OBST_gen_interior(OBSTACLE* pObst, int nb_quad, sys_ui32 seed);
+D_EXTERN_FUNC int OBST_gen_soup(OBSTACLE* pObst, int nb_quad, sys_ui32 seed);
+D_EXTERN_FUNC int OBST_gen(OBSTACLE* pObst, E_OBST_GEN kind, int nb_quad, sys_ui32 seed);
+D_EXTERN_FUNC const char* OBST_gen_name(E_OBST_GEN kind);
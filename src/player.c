@@ -52,12 +52,12 @@ void PLR_init() {
 	pPl->pAnm_data[1] = ANM_data_create(pPl->pAnm, pKfr);
 
 	ANM_set(pPl->pAnm, pPl->pAnm_data[0], 0);
-	MDL_calc_local(pPl->pMdl);
-	ANM_calc_ik(pPl->pAnm);
 	ANM_blend_init(pPl->pAnm, 0);
-	MDL_calc_world(pPl->pMdl);
+	ANM_calc_local(pPl->pAnm);
+	ANM_calc_world(pPl->pAnm);
 	pPl->ctrl.var[0] = E_PLSTATE_IDLE;
 	pPl->ctrl.var[1] = 1;
+	pPl->wall_slide = !!CFG_get_i("plr_slide", 0);
 }
 
 void PLR_free() {
@@ -158,12 +158,36 @@ static void Plr_check_floor(PLAYER* pPl) {
 	}
 }
 
+static void Plr_wall_slide(PLAYER* pPl) {
+	OBST_SWEEP sweep;
+	UVEC move;
+	MODEL* pMdl = pPl->pMdl;
+	ANIMATION* pAnm = pPl->pAnm;
+	sweep.pos0.qv = pMdl->prev_pos.qv;
+	sweep.pos0.y += 1.0f;
+	sweep.pos1.qv = sweep.pos0.qv;
+	sweep.move.qv = V4_sub(pMdl->pos.qv, pMdl->prev_pos.qv);
+	sweep.move.y = 0.0f;
+	sweep.radius = 0.8f;
+	sweep.mask = E_OBST_POLYATTR_WALL;
+	if (OBST_slide(&g_room.obst, &sweep, &move.qv)) {
+		pMdl->pos.x = pMdl->prev_pos.x + move.x;
+		pMdl->pos.z = pMdl->prev_pos.z + move.z;
+		pAnm->move.pos.x = pMdl->pos.x;
+		pAnm->move.pos.z = pMdl->pos.z;
+	}
+}
+
 static void Plr_wall_collide(PLAYER* pPl) {
 	UVEC cur_pos;
 	UVEC prev_pos;
 	UVEC new_pos;
 	MODEL* pMdl = pPl->pMdl;
 	ANIMATION* pAnm = pPl->pAnm;
+	if (pPl->wall_slide) {
+		Plr_wall_slide(pPl);
+		return;
+	}
 	cur_pos.qv = pMdl->pos.qv;
 	cur_pos.y += 1.0f;
 	prev_pos.qv = pMdl->prev_pos.qv;
@@ -183,6 +207,7 @@ void PLR_ctrl() {
 	pPl->inp_on = g_input.state;
 	pPl->inp_trg = g_input.state_trg;
 	Plr_ctrl(pPl);
+	ANM_lod_calc(pPl->pAnm, &g_cam);
 	ANM_play(pPl->pAnm);
 	ANM_move(pPl->pAnm);
 	Plr_wall_collide(pPl);
@@ -192,10 +217,8 @@ void PLR_ctrl() {
 void PLR_calc(CAMERA* pCam) {
 	PLAYER* pPl = &g_pl;
 
-	MDL_calc_local(pPl->pMdl);
-	ANM_calc_ik(pPl->pAnm);
-	ANM_blend_calc(pPl->pAnm);
-	MDL_calc_world(pPl->pMdl);
+	ANM_calc_local(pPl->pAnm);
+	ANM_calc_world(pPl->pAnm);
 	MDL_cull(pPl->pMdl, pCam);
 	MDL_disp(pPl->pMdl);
 }
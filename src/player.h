@@ -37,6 +37,7 @@ typedef struct _PLAYER {
 	PLAYER_CTRL ctrl;
 	sys_ui32 inp_on;
 	sys_ui32 inp_trg;
+	int wall_slide; /* sphere sweep and slide instead of OBST_collide */
 } PLAYER;
 
 D_EXTERN_DATA PLAYER g_pl;
@@ -0,0 +1,625 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/*
+ * Frame capture and replay. A captured frame is what was recorded between RDR_begin and
+ * RDR_exec, taken after the merge: the context, the batches with their params and values,
+ * and the layer entries with their keys in merge order.
+ * Vertex and index buffers are described, not saved, and textures are only told apart,
+ * so a replay reproduces the submission and state changes of the frame, not its image.
+ */
+
+#include <string.h>
+
+#include "system.h"
+#include "calc.h"
+#include "util.h"
+#include "job.h"
+#include "render.h"
+#include "rdrdb.h"
+#include "rdrcap.h"
+
+/*
+ * Values are shared by pointer, e.g. skin matrices by the zbuf, cast and material batches.
+ * The same pointer can come with another type or count, those get blocks of their own chained from the first.
+ */
+typedef struct _RDR_CAP_BLK {
+	const void* pSrc;
+	sys_ui32 vec;
+	sys_ui32 size;
+	sys_ui32 type;
+	sys_i32 next; /* block with the same pointer, -1 at the end */
+} RDR_CAP_BLK;
+
+typedef struct _RDR_CAP_WK {
+	DICT* pBatch_dict;
+	DICT* pBlk_dict;
+	DICT* pVtx_dict;
+	DICT* pIdx_dict;
+	DICT* pTex_dict;
+	RDR_BATCH** ppBatch;
+	RDR_CAP_BLK* pBlk;
+	RDR_VTX_BUFFER** ppVtx;
+	RDR_IDX_BUFFER** ppIdx;
+	int nb_batch;
+	int nb_blk;
+	int nb_param;
+	int nb_vtx;
+	int nb_idx;
+	int nb_tex;
+	int nb_miss; /* values not found once they are sized */
+	int sized;
+	sys_ui32 nb_vec;
+} RDR_CAP_WK;
+
+struct _RDR_REPLAY {
+	RDR_CAP_HEAD* pHead;
+	RDR_VTX_BUFFER** ppVtx;
+	RDR_IDX_BUFFER** ppIdx;
+	RDR_SAMPLER* pSmp;
+	RDR_BATCH_PARAM* pParam;
+	RDR_BATCH** ppBatch;
+};
+
+static char s_cap_name[256];
+
+static int Cap_item_size(sys_ui32 type) {
+	if (type == E_RDR_PARAMTYPE_SMP) return sizeof(RDR_CAP_SMP);
+	return RDR_VAL_WK::Get_item_size((E_RDR_PARAMTYPE)type);
+}
+
+static int Cap_id(DICT* pDict, const void* p) {
+	return DICT_get_i(pDict, (const char*)p) - 1;
+}
+
+static int Cap_add_id(DICT* pDict, const void* p, int* pCount) {
+	int id = Cap_id(pDict, p);
+	if (id < 0) {
+		id = (*pCount)++;
+		DICT_put_i(pDict, (const char*)p, id + 1);
+	}
+	return id;
+}
+
+static int Cap_find_val(RDR_CAP_WK* pWk, const void* pSrc, sys_ui32 type, sys_ui32 size) {
+	int i;
+	for (i = Cap_id(pWk->pBlk_dict, pSrc); i >= 0; i = pWk->pBlk[i].next) {
+		if (pWk->pBlk[i].type == type && pWk->pBlk[i].size == size) break;
+	}
+	return i;
+}
+
+/* only Cap_scan adds blocks, the write pass must find every value it sized */
+static sys_ui32 Cap_val(RDR_CAP_WK* pWk, const void* pSrc, sys_ui32 type, int count) {
+	int i;
+	RDR_CAP_BLK* pBlk;
+	RDR_SAMPLER* pSmp;
+	sys_ui32 size = count * Cap_item_size(type);
+
+	if (!pSrc || !size) return 0;
+	i = Cap_find_val(pWk, pSrc, type, size);
+	if (i >= 0) return pWk->pBlk[i].vec;
+	if (pWk->sized) {
+		++pWk->nb_miss;
+		return 0;
+	}
+	i = pWk->nb_blk++;
+	pBlk = &pWk->pBlk[i];
+	pBlk->pSrc = pSrc;
+	pBlk->vec = pWk->nb_vec;
+	pBlk->size = size;
+	pBlk->type = type;
+	pBlk->next = Cap_id(pWk->pBlk_dict, pSrc);
+	pWk->nb_vec += (sys_ui32)D_ALIGN(size, 16) / 16;
+	DICT_put_i(pWk->pBlk_dict, (const char*)pSrc, i + 1);
+	if (type == E_RDR_PARAMTYPE_SMP) {
+		pSmp = (RDR_SAMPLER*)pSrc;
+		for (i = 0; i < count; ++i) {
+			if (pSmp[i].hTex) {
+				Cap_add_id(pWk->pTex_dict, pSmp[i].hTex, &pWk->nb_tex);
+			}
+		}
+	}
+	return pBlk->vec;
+}
+
+static void Cap_scan(RDR_CAP_WK* pWk) {
+	int i, j, n;
+	RDR_BATCH* pBatch;
+	RDR_BATCH_PARAM* pParam;
+	RDR_LAYER* pLyr;
+
+	for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+		pLyr = g_rdr_db.Get_work_lyr(i);
+		n = pLyr->Get_count();
+		for (j = 0; j < n; ++j) {
+			pBatch = pLyr->mppBatch[j];
+			if (Cap_id(pWk->pBatch_dict, pBatch) >= 0) continue;
+			pWk->ppBatch[Cap_add_id(pWk->pBatch_dict, pBatch, &pWk->nb_batch)] = pBatch;
+		}
+	}
+	for (i = 0; i < pWk->nb_batch; ++i) {
+		pBatch = pWk->ppBatch[i];
+		if (pBatch->pVtx && Cap_id(pWk->pVtx_dict, pBatch->pVtx) < 0) {
+			pWk->ppVtx[Cap_add_id(pWk->pVtx_dict, pBatch->pVtx, &pWk->nb_vtx)] = pBatch->pVtx;
+		}
+		if (pBatch->pIdx && Cap_id(pWk->pIdx_dict, pBatch->pIdx) < 0) {
+			pWk->ppIdx[Cap_add_id(pWk->pIdx_dict, pBatch->pIdx, &pWk->nb_idx)] = pBatch->pIdx;
+		}
+		if (pBatch->pInst) {
+			Cap_val(pWk, pBatch->pInst, E_RDR_PARAMTYPE_FVEC, pBatch->nb_inst*3);
+		}
+		pParam = pBatch->pParam;
+		for (j = 0; j < pBatch->nb_param; ++j) {
+			Cap_val(pWk, pParam->pVal, pParam->id.type, pParam->count);
+			++pParam;
+		}
+		pWk->nb_param += pBatch->nb_param;
+	}
+}
+
+static void Cap_put_vals(RDR_CAP_WK* pWk, UVEC* pVal) {
+	int i, j, n;
+	RDR_CAP_BLK* pBlk;
+	RDR_CAP_SMP* pDst;
+	RDR_SAMPLER* pSrc;
+
+	for (i = 0; i < pWk->nb_blk; ++i) {
+		pBlk = &pWk->pBlk[i];
+		if (pBlk->type == E_RDR_PARAMTYPE_SMP) {
+			pDst = (RDR_CAP_SMP*)&pVal[pBlk->vec];
+			pSrc = (RDR_SAMPLER*)pBlk->pSrc;
+			n = pBlk->size / sizeof(RDR_CAP_SMP);
+			for (j = 0; j < n; ++j) {
+				pDst->tex = pSrc->hTex ? Cap_id(pWk->pTex_dict, pSrc->hTex) : -1;
+				pDst->border = pSrc->border;
+				pDst->mip_bias = pSrc->mip_bias;
+				pDst->addr_u = pSrc->addr_u;
+				pDst->addr_v = pSrc->addr_v;
+				pDst->addr_w = pSrc->addr_w;
+				pDst->min = pSrc->min;
+				pDst->mag = pSrc->mag;
+				pDst->mip = pSrc->mip;
+				pDst->anisotropy = pSrc->anisotropy;
+				pDst->max_mip = pSrc->max_mip;
+				++pDst;
+				++pSrc;
+			}
+		} else {
+			memcpy(&pVal[pBlk->vec], pBlk->pSrc, pBlk->size);
+		}
+	}
+}
+
+static void Cap_write(const char* fname) {
+	int i, j, k, n, nb_ent;
+	sys_ui32 size;
+	sys_byte* pTop;
+	RDR_CAP_WK wk;
+	RDR_CAP_HEAD* pHead;
+	RDR_CAP_BATCH* pCap;
+	RDR_CAP_PARAM* pCap_prm;
+	RDR_CAP_VTX* pCap_vtx;
+	RDR_CAP_IDX* pCap_idx;
+	RDR_CAP_ENT* pEnt;
+	RDR_BATCH* pBatch;
+	RDR_BATCH_PARAM* pParam;
+	RDR_LAYER* pLyr;
+
+	nb_ent = 0;
+	for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+		nb_ent += g_rdr_db.Get_work_lyr(i)->Get_count();
+	}
+	memset(&wk, 0, sizeof(wk));
+	n = D_MAX(nb_ent, 1);
+	wk.pBatch_dict = DICT_new();
+	wk.pBlk_dict = DICT_new();
+	wk.pVtx_dict = DICT_new();
+	wk.pIdx_dict = DICT_new();
+	wk.pTex_dict = DICT_new();
+	DICT_set_hash_addr(wk.pBatch_dict, 1);
+	DICT_set_hash_addr(wk.pBlk_dict, 1);
+	DICT_set_hash_addr(wk.pVtx_dict, 1);
+	DICT_set_hash_addr(wk.pIdx_dict, 1);
+	DICT_set_hash_addr(wk.pTex_dict, 1);
+	wk.ppBatch = (RDR_BATCH**)SYS_malloc(n*sizeof(RDR_BATCH*));
+	wk.ppVtx = (RDR_VTX_BUFFER**)SYS_malloc(n*sizeof(RDR_VTX_BUFFER*));
+	wk.ppIdx = (RDR_IDX_BUFFER**)SYS_malloc(n*sizeof(RDR_IDX_BUFFER*));
+	size = 0;
+	for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+		pLyr = g_rdr_db.Get_work_lyr(i);
+		for (j = 0; j < pLyr->Get_count(); ++j) {
+			size += pLyr->mppBatch[j]->nb_param + 1;
+		}
+	}
+	wk.pBlk = (RDR_CAP_BLK*)SYS_malloc(D_MAX(size, 1)*sizeof(RDR_CAP_BLK));
+	Cap_scan(&wk);
+
+	size = (sys_ui32)D_ALIGN(sizeof(RDR_CAP_HEAD), 16);
+	pTop = NULL;
+	pHead = NULL;
+	for (k = 0; k < 2; ++k) {
+		/* sizes, then the same walk again to fill */
+		if (k) {
+			pTop = (sys_byte*)SYS_malloc(size);
+			if (!pTop) break;
+			memset(pTop, 0, size);
+			pHead = (RDR_CAP_HEAD*)pTop;
+			pHead->magic = D_FOURCC('R','C','A','P');
+			pHead->ver = D_RDR_CAP_VER;
+			pHead->nb_batch = wk.nb_batch;
+			pHead->nb_param = wk.nb_param;
+			pHead->nb_vec = wk.nb_vec;
+			pHead->nb_vtx = wk.nb_vtx;
+			pHead->nb_idx = wk.nb_idx;
+			pHead->nb_tex = wk.nb_tex;
+			size = (sys_ui32)D_ALIGN(sizeof(RDR_CAP_HEAD), 16);
+		}
+		if (pHead) pHead->offs_ctx = size;
+		size += (sys_ui32)D_ALIGN(sizeof(RDR_CONTEXT), 16);
+		if (pHead) pHead->offs_val = size;
+		size += wk.nb_vec * 16;
+		if (pHead) pHead->offs_batch = size;
+		size += (sys_ui32)D_ALIGN(wk.nb_batch * sizeof(RDR_CAP_BATCH), 16);
+		if (pHead) pHead->offs_param = size;
+		size += (sys_ui32)D_ALIGN(wk.nb_param * sizeof(RDR_CAP_PARAM), 16);
+		if (pHead) pHead->offs_vtx = size;
+		size += (sys_ui32)D_ALIGN(wk.nb_vtx * sizeof(RDR_CAP_VTX), 16);
+		if (pHead) pHead->offs_idx = size;
+		size += (sys_ui32)D_ALIGN(wk.nb_idx * sizeof(RDR_CAP_IDX), 16);
+		if (pHead) pHead->offs_ent = size;
+		size += nb_ent * sizeof(RDR_CAP_ENT);
+	}
+
+	if (pHead) {
+		wk.sized = 1;
+		memcpy(pTop + pHead->offs_ctx, g_rdr_db.Get_work_ctx(), sizeof(RDR_CONTEXT));
+		Cap_put_vals(&wk, (UVEC*)(pTop + pHead->offs_val));
+
+		pCap = (RDR_CAP_BATCH*)(pTop + pHead->offs_batch);
+		pCap_prm = (RDR_CAP_PARAM*)(pTop + pHead->offs_param);
+		n = 0;
+		for (i = 0; i < wk.nb_batch; ++i) {
+			pBatch = wk.ppBatch[i];
+			pCap->vtx = pBatch->pVtx ? Cap_id(wk.pVtx_dict, pBatch->pVtx) : -1;
+			pCap->idx = pBatch->pIdx ? Cap_id(wk.pIdx_dict, pBatch->pIdx) : -1;
+			pCap->param = n;
+			pCap->count = pBatch->count;
+			pCap->start = pBatch->start;
+			pCap->base = pBatch->base;
+			pCap->blend_state = pBatch->blend_state;
+			pCap->draw_state = pBatch->draw_state;
+			pCap->type = pBatch->type;
+			pCap->nb_param = pBatch->nb_param;
+			pCap->vtx_prog = pBatch->vtx_prog;
+			pCap->pix_prog = pBatch->pix_prog;
+			pCap->mtl_id = pBatch->mtl_id;
+			pCap->depth = pBatch->depth;
+			pCap->inst = pBatch->pInst ? (sys_i32)Cap_val(&wk, pBatch->pInst, E_RDR_PARAMTYPE_FVEC, pBatch->nb_inst*3) : -1;
+			pCap->nb_inst = pBatch->nb_inst;
+			pParam = pBatch->pParam;
+			for (j = 0; j < pBatch->nb_param; ++j) {
+				pCap_prm->val = Cap_val(&wk, pParam->pVal, pParam->id.type, pParam->count);
+				pCap_prm->id = pParam->id;
+				pCap_prm->count = pParam->count;
+				++pCap_prm;
+				++pParam;
+			}
+			n += pBatch->nb_param;
+			++pCap;
+		}
+
+		pCap_vtx = (RDR_CAP_VTX*)(pTop + pHead->offs_vtx);
+		for (i = 0; i < wk.nb_vtx; ++i) {
+			pCap_vtx[i].type = wk.ppVtx[i]->type;
+			pCap_vtx[i].attr = wk.ppVtx[i]->attr;
+			pCap_vtx[i].vtx_size = wk.ppVtx[i]->vtx_size;
+			pCap_vtx[i].nb_vtx = wk.ppVtx[i]->nb_vtx;
+		}
+		pCap_idx = (RDR_CAP_IDX*)(pTop + pHead->offs_idx);
+		for (i = 0; i < wk.nb_idx; ++i) {
+			pCap_idx[i].type = wk.ppIdx[i]->type;
+			pCap_idx[i].attr = wk.ppIdx[i]->attr;
+			pCap_idx[i].nb_idx = wk.ppIdx[i]->nb_idx;
+		}
+
+		pEnt = (RDR_CAP_ENT*)(pTop + pHead->offs_ent);
+		for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			pLyr = g_rdr_db.Get_work_lyr(i);
+			n = pLyr->Get_count();
+			pHead->nb_ent[i] = n;
+			pHead->sort[i] = (sys_byte)pLyr->mSort;
+			for (j = 0; j < n; ++j) {
+				pEnt->key = pLyr->mpPair[j].key;
+				pEnt->batch = Cap_id(wk.pBatch_dict, pLyr->mppBatch[j]);
+				++pEnt;
+			}
+		}
+
+		if (wk.nb_miss) {
+			SYS_log("Capture %s not written: %d values were not sized\n", fname, wk.nb_miss);
+		} else if (SYS_save(fname, pTop, size)) {
+			SYS_log("Frame captured to %s: %d batches, %d entries, %d bytes\n", fname, wk.nb_batch, nb_ent, size);
+		} else {
+			SYS_log("Can't write capture %s\n", fname);
+		}
+		SYS_free(pTop);
+	}
+
+	SYS_free(wk.pBlk);
+	SYS_free(wk.ppIdx);
+	SYS_free(wk.ppVtx);
+	SYS_free(wk.ppBatch);
+	DICT_destroy(wk.pTex_dict);
+	DICT_destroy(wk.pIdx_dict);
+	DICT_destroy(wk.pVtx_dict);
+	DICT_destroy(wk.pBlk_dict);
+	DICT_destroy(wk.pBatch_dict);
+}
+
+/* called by the backends right after the merge, while the layers still hold the recorded order */
+void Capture_frame() {
+	if (!s_cap_name[0]) return;
+	Cap_write(s_cap_name);
+	s_cap_name[0] = 0;
+}
+
+/* the frame recorded next is written when it's executed */
+void RDR_capture(const char* fname) {
+	if (!fname) return;
+	strncpy(s_cap_name, fname, sizeof(s_cap_name) - 1);
+	s_cap_name[sizeof(s_cap_name) - 1] = 0;
+}
+
+static int Rep_span(sys_ui32 offs, sys_ui64 len, int size) {
+	return (sys_ui64)offs + len <= (sys_ui64)size;
+}
+
+static int Rep_vals(RDR_CAP_HEAD* pHead, sys_ui32 vec, sys_ui64 len) {
+	return (sys_ui64)vec + (len + 15) / 16 <= pHead->nb_vec;
+}
+
+/* items of the type's section in RDR_GPARAM, 0 for unknown types or types the shaders don't use */
+static int Rep_nb_gparam(sys_ui32 type) {
+	static const int top[] = {
+		D_RDR_GPTOP_FVEC, D_RDR_GPTOP_IVEC, D_RDR_GPTOP_FLOAT, D_RDR_GPTOP_INT, D_RDR_GPTOP_SMP, D_RDR_GPTOP_BOOL
+	};
+	int i, end;
+
+	if (type >= D_ARRAY_LENGTH(top) || top[type] < 0) return 0;
+	end = sizeof(RDR_GPARAM);
+	for (i = 0; i < (int)D_ARRAY_LENGTH(top); ++i) {
+		if (top[i] > top[type] && top[i] < end) end = top[i];
+	}
+	return (end - top[type]) / RDR_VAL_WK::Get_item_size((E_RDR_PARAMTYPE)type);
+}
+
+/* every offset and index in the file against its size, before anything is created from it */
+static int Rep_check(RDR_CAP_HEAD* pHead, int size) {
+	int i;
+	sys_ui64 nb_ent;
+	RDR_CAP_BATCH* pCap;
+	RDR_CAP_PARAM* pCap_prm;
+
+	if (size < (int)sizeof(RDR_CAP_HEAD)) return 0;
+	if (pHead->magic != D_FOURCC('R','C','A','P') || pHead->ver != D_RDR_CAP_VER) return 0;
+	nb_ent = 0;
+	for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+		if (pHead->sort[i] > E_RDR_SORT_DEPTH) return 0;
+		nb_ent += pHead->nb_ent[i];
+	}
+	if (!Rep_span(pHead->offs_ctx, sizeof(RDR_CONTEXT), size) ||
+	    !Rep_span(pHead->offs_val, (sys_ui64)pHead->nb_vec * 16, size) ||
+	    !Rep_span(pHead->offs_batch, (sys_ui64)pHead->nb_batch * sizeof(RDR_CAP_BATCH), size) ||
+	    !Rep_span(pHead->offs_param, (sys_ui64)pHead->nb_param * sizeof(RDR_CAP_PARAM), size) ||
+	    !Rep_span(pHead->offs_vtx, (sys_ui64)pHead->nb_vtx * sizeof(RDR_CAP_VTX), size) ||
+	    !Rep_span(pHead->offs_idx, (sys_ui64)pHead->nb_idx * sizeof(RDR_CAP_IDX), size) ||
+	    !Rep_span(pHead->offs_ent, nb_ent * sizeof(RDR_CAP_ENT), size)) {
+		return 0;
+	}
+	pCap = (RDR_CAP_BATCH*)D_INCR_PTR(pHead, pHead->offs_batch);
+	for (i = 0; i < (int)pHead->nb_batch; ++i) {
+		if ((sys_ui64)pCap[i].param + pCap[i].nb_param > pHead->nb_param) return 0;
+		if (pCap[i].vtx >= (sys_i32)pHead->nb_vtx || pCap[i].idx >= (sys_i32)pHead->nb_idx) return 0;
+		if (pCap[i].inst >= 0 && !Rep_vals(pHead, pCap[i].inst, (sys_ui64)pCap[i].nb_inst * 3 * sizeof(UVEC))) return 0;
+	}
+	pCap_prm = (RDR_CAP_PARAM*)D_INCR_PTR(pHead, pHead->offs_param);
+	for (i = 0; i < (int)pHead->nb_param; ++i) {
+		if (pCap_prm[i].id.type > E_RDR_PARAMTYPE_BOOL) return 0;
+		if ((sys_ui32)pCap_prm[i].id.offs + pCap_prm[i].count > (sys_ui32)Rep_nb_gparam(pCap_prm[i].id.type)) return 0;
+		if (!Rep_vals(pHead, pCap_prm[i].val, (sys_ui64)pCap_prm[i].count * Cap_item_size(pCap_prm[i].id.type))) return 0;
+	}
+	return 1;
+}
+
+/*
+ * Creates the captured resources and sets the layers' sort modes as captured.
+ * Textures get placeholder handles, so the replay needs a backend that doesn't touch them (rdrnull).
+ */
+RDR_REPLAY* RDR_replay_load(const char* fname) {
+	int i, j, n, size;
+	UVEC* pVal;
+	RDR_CAP_HEAD* pHead;
+	RDR_CAP_PARAM* pCap_prm;
+	RDR_CAP_VTX* pCap_vtx;
+	RDR_CAP_IDX* pCap_idx;
+	RDR_CAP_SMP* pCap_smp;
+	RDR_SAMPLER* pSmp;
+	RDR_BATCH_PARAM* pParam;
+	RDR_REPLAY* pRep;
+
+	pHead = (RDR_CAP_HEAD*)SYS_load_ex(fname, &size);
+	if (!pHead) return NULL;
+	if (!Rep_check(pHead, size)) {
+		SYS_log("Invalid capture file %s\n", fname);
+		SYS_free(pHead);
+		return NULL;
+	}
+	pRep = (RDR_REPLAY*)SYS_malloc(sizeof(RDR_REPLAY));
+	memset(pRep, 0, sizeof(RDR_REPLAY));
+	pRep->pHead = pHead;
+	pRep->ppVtx = (RDR_VTX_BUFFER**)SYS_malloc(D_MAX(pHead->nb_vtx, 1)*sizeof(RDR_VTX_BUFFER*));
+	pRep->ppIdx = (RDR_IDX_BUFFER**)SYS_malloc(D_MAX(pHead->nb_idx, 1)*sizeof(RDR_IDX_BUFFER*));
+	pRep->ppBatch = (RDR_BATCH**)SYS_malloc(D_MAX(pHead->nb_batch, 1)*sizeof(RDR_BATCH*));
+	pRep->pParam = (RDR_BATCH_PARAM*)SYS_malloc(D_MAX(pHead->nb_param, 1)*sizeof(RDR_BATCH_PARAM));
+
+	pCap_vtx = (RDR_CAP_VTX*)D_INCR_PTR(pHead, pHead->offs_vtx);
+	for (i = 0; i < (int)pHead->nb_vtx; ++i) {
+		if (pCap_vtx[i].attr & E_RDR_RSRCATTR_DYNAMIC) {
+			pRep->ppVtx[i] = RDR_vtx_create_dyn((E_RDR_VTXTYPE)pCap_vtx[i].type, pCap_vtx[i].nb_vtx);
+		} else {
+			pRep->ppVtx[i] = RDR_vtx_create((E_RDR_VTXTYPE)pCap_vtx[i].type, pCap_vtx[i].nb_vtx);
+		}
+	}
+	pCap_idx = (RDR_CAP_IDX*)D_INCR_PTR(pHead, pHead->offs_idx);
+	for (i = 0; i < (int)pHead->nb_idx; ++i) {
+		if (pCap_idx[i].attr & E_RDR_RSRCATTR_DYNAMIC) {
+			pRep->ppIdx[i] = RDR_idx_create_dyn((E_RDR_IDXTYPE)pCap_idx[i].type, pCap_idx[i].nb_idx);
+		} else {
+			pRep->ppIdx[i] = RDR_idx_create((E_RDR_IDXTYPE)pCap_idx[i].type, pCap_idx[i].nb_idx);
+		}
+	}
+
+	pVal = (UVEC*)D_INCR_PTR(pHead, pHead->offs_val);
+	pCap_prm = (RDR_CAP_PARAM*)D_INCR_PTR(pHead, pHead->offs_param);
+	n = 0;
+	for (i = 0; i < (int)pHead->nb_param; ++i) {
+		if (pCap_prm[i].id.type == E_RDR_PARAMTYPE_SMP) n += pCap_prm[i].count;
+	}
+	pRep->pSmp = (RDR_SAMPLER*)SYS_malloc(D_MAX(n, 1)*sizeof(RDR_SAMPLER));
+	pSmp = pRep->pSmp;
+	pParam = pRep->pParam;
+	for (i = 0; i < (int)pHead->nb_param; ++i) {
+		pParam->id = pCap_prm->id;
+		pParam->count = pCap_prm->count;
+		if (pCap_prm->id.type == E_RDR_PARAMTYPE_SMP) {
+			pParam->pSmp = pSmp;
+			pCap_smp = (RDR_CAP_SMP*)&pVal[pCap_prm->val];
+			for (j = 0; j < pCap_prm->count; ++j) {
+				memset(pSmp, 0, sizeof(RDR_SAMPLER));
+				pSmp->hTex = pCap_smp->tex < 0 ? NULL : (sys_handle)(sys_intptr)(pCap_smp->tex + 1);
+				pSmp->border = pCap_smp->border;
+				pSmp->mip_bias = pCap_smp->mip_bias;
+				pSmp->addr_u = pCap_smp->addr_u;
+				pSmp->addr_v = pCap_smp->addr_v;
+				pSmp->addr_w = pCap_smp->addr_w;
+				pSmp->min = pCap_smp->min;
+				pSmp->mag = pCap_smp->mag;
+				pSmp->mip = pCap_smp->mip;
+				pSmp->anisotropy = pCap_smp->anisotropy;
+				pSmp->max_mip = pCap_smp->max_mip;
+				++pSmp;
+				++pCap_smp;
+			}
+		} else {
+			pParam->pVal = &pVal[pCap_prm->val];
+		}
+		++pParam;
+		++pCap_prm;
+	}
+
+	for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+		RDR_set_lyr_sort(i, (E_RDR_SORT)pHead->sort[i]);
+	}
+	return pRep;
+}
+
+/*
+ * Records the captured frame again, between RDR_begin and RDR_exec.
+ * With rekey the layers make their own keys, as they would for a live frame,
+ * otherwise the captured ones are used as they are.
+ */
+void RDR_replay_put(RDR_REPLAY* pRep, int rekey) {
+	int i, j, n;
+	RDR_CAP_HEAD* pHead;
+	RDR_CAP_BATCH* pCap;
+	RDR_CAP_ENT* pEnt;
+	RDR_BATCH* pBatch;
+	UVEC* pVal;
+
+	if (!pRep) return;
+	pHead = pRep->pHead;
+	memcpy(RDR_get_ctx(), D_INCR_PTR(pHead, pHead->offs_ctx), sizeof(RDR_CONTEXT));
+	pVal = (UVEC*)D_INCR_PTR(pHead, pHead->offs_val);
+	for (i = 0; i < (int)pHead->nb_batch; ++i) {
+		pCap = (RDR_CAP_BATCH*)D_INCR_PTR(pHead, pHead->offs_batch) + i;
+		pBatch = RDR_get_batch();
+		pRep->ppBatch[i] = pBatch;
+		if (!pBatch) continue;
+		pBatch->pVtx = pCap->vtx < 0 ? NULL : pRep->ppVtx[pCap->vtx];
+		pBatch->pIdx = pCap->idx < 0 ? NULL : pRep->ppIdx[pCap->idx];
+		pBatch->count = pCap->count;
+		pBatch->type = pCap->type;
+		pBatch->start = pCap->start;
+		pBatch->base = pCap->base;
+		pBatch->blend_state = pCap->blend_state;
+		pBatch->draw_state = pCap->draw_state;
+		pBatch->vtx_prog = pCap->vtx_prog;
+		pBatch->pix_prog = pCap->pix_prog;
+		pBatch->mtl_id = pCap->mtl_id;
+		pBatch->depth = pCap->depth;
+		pBatch->pInst = pCap->inst < 0 ? NULL : &pVal[pCap->inst];
+		pBatch->nb_inst = pCap->nb_inst;
+		pBatch->nb_param = pCap->nb_param;
+		pBatch->pParam = NULL;
+		if (pCap->nb_param) {
+			pBatch->pParam = RDR_get_param(pCap->nb_param);
+			if (!pBatch->pParam) {
+				pRep->ppBatch[i] = NULL;
+				continue;
+			}
+			memcpy(pBatch->pParam, &pRep->pParam[pCap->param], pCap->nb_param*sizeof(RDR_BATCH_PARAM));
+		}
+	}
+
+	pEnt = (RDR_CAP_ENT*)D_INCR_PTR(pHead, pHead->offs_ent);
+	for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+		n = pHead->nb_ent[i];
+		for (j = 0; j < n; ++j) {
+			pBatch = pEnt->batch < pHead->nb_batch ? pRep->ppBatch[pEnt->batch] : NULL;
+			if (pBatch) {
+				if (rekey) {
+					RDR_put_batch(pBatch, pEnt->key, i);
+				} else {
+					g_rdr_db.Put_batch_key(pBatch, pEnt->key, i);
+				}
+			}
+			++pEnt;
+		}
+	}
+}
+
+void RDR_replay_free(RDR_REPLAY* pRep) {
+	int i;
+	if (!pRep) return;
+	for (i = 0; i < (int)pRep->pHead->nb_vtx; ++i) {
+		RDR_vtx_release(pRep->ppVtx[i]);
+	}
+	for (i = 0; i < (int)pRep->pHead->nb_idx; ++i) {
+		RDR_idx_release(pRep->ppIdx[i]);
+	}
+	SYS_free(pRep->pSmp);
+	SYS_free(pRep->pParam);
+	SYS_free(pRep->ppBatch);
+	SYS_free(pRep->ppIdx);
+	SYS_free(pRep->ppVtx);
+	SYS_free(pRep->pHead);
+	SYS_free(pRep);
+}
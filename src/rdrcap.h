@@ -0,0 +1,103 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+#define D_RDR_CAP_VER (1)
+
+/* RDR_capture file layout: head, context, values (16 byte units), batches, params, VBs, IBs, layer entries */
+typedef struct _RDR_CAP_HEAD {
+	sys_ui32 magic;
+	sys_ui32 ver;
+	sys_ui32 nb_batch;
+	sys_ui32 nb_param;
+	sys_ui32 nb_vec;
+	sys_ui32 nb_vtx;
+	sys_ui32 nb_idx;
+	sys_ui32 nb_tex;
+	sys_ui32 offs_ctx;
+	sys_ui32 offs_val;
+	sys_ui32 offs_batch;
+	sys_ui32 offs_param;
+	sys_ui32 offs_vtx;
+	sys_ui32 offs_idx;
+	sys_ui32 offs_ent;
+	sys_ui32 nb_ent[E_RDR_LAYER_MAX];
+	sys_byte sort[E_RDR_LAYER_MAX]; /* E_RDR_SORT */
+} RDR_CAP_HEAD;
+
+typedef struct _RDR_CAP_BATCH {
+	sys_i32  vtx;   /* VB no., -1 if none */
+	sys_i32  idx;   /* IB no., -1 if none */
+	sys_ui32 param; /* first param no. */
+	sys_ui32 count;
+	sys_ui32 start;
+	sys_ui32 base;
+	RDR_BLEND_STATE blend_state;
+	RDR_DRAW_STATE draw_state;
+	sys_ui16 type;
+	sys_ui16 nb_param;
+	sys_ui16 vtx_prog;
+	sys_ui16 pix_prog;
+	sys_ui16 mtl_id;
+	sys_ui16 reserved;
+	float    depth;
+	sys_i32  inst;  /* value no. of the instance rows, -1 if not instanced */
+	sys_ui32 nb_inst;
+} RDR_CAP_BATCH;
+
+typedef struct _RDR_CAP_PARAM {
+	sys_ui32      val;
+	RDR_GPARAM_ID id;
+	sys_ui16      count;
+} RDR_CAP_PARAM;
+
+/* RDR_SAMPLER without the handle, same size for 32 and 64 bit builds */
+typedef struct _RDR_CAP_SMP {
+	sys_i32     tex; /* texture no., -1 if none */
+	RDR_COLOR32 border;
+	float       mip_bias;
+	sys_ui32 addr_u     : 3;
+	sys_ui32 addr_v     : 3;
+	sys_ui32 addr_w     : 3;
+	sys_ui32 min        : 2;
+	sys_ui32 mag        : 2;
+	sys_ui32 mip        : 2;
+	sys_ui32 anisotropy : 4;
+	sys_ui32 max_mip    : 4;
+} RDR_CAP_SMP;
+
+typedef struct _RDR_CAP_VTX {
+	sys_byte type;
+	sys_byte attr;
+	sys_ui16 vtx_size;
+	sys_ui32 nb_vtx;
+} RDR_CAP_VTX;
+
+typedef struct _RDR_CAP_IDX {
+	sys_byte type;
+	sys_byte attr;
+	sys_ui16 reserved;
+	sys_ui32 nb_idx;
+} RDR_CAP_IDX;
+
+typedef struct _RDR_CAP_ENT {
+	sys_ui64 key;
+	sys_ui32 batch;
+	sys_ui32 reserved;
+} RDR_CAP_ENT;
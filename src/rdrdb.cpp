@@ -0,0 +1,326 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+#include <string.h>
+
+#include "system.h"
+#include "calc.h"
+#include "util.h"
+#include "job.h"
+#include "render.h"
+#include "rdrdb.h"
+
+RDR_GPARAM g_rdr_param;
+RDR_STATS g_rdr_stats;
+RDR_DB_WK g_rdr_db;
+
+void Apply_param(RDR_BATCH_PARAM* pParam) {
+	int i, n;
+	UVEC* pSrc_v;
+	UVEC* pDst_v;
+	float* pSrc_f;
+	float* pDst_f;
+	sys_i32* pSrc_i;
+	sys_i32* pDst_i;
+	RDR_SAMPLER* pSrc_s;
+	RDR_SAMPLER* pDst_s;
+	sys_byte* pSrc_b;
+	sys_byte* pDst_b;
+	RDR_GPARAM* pGP = &g_rdr_param;
+
+	n = pParam->count;
+	switch (pParam->id.type) {
+		case E_RDR_PARAMTYPE_FVEC:
+			pSrc_v = pParam->pVec;
+			pDst_v = (UVEC*)D_INCR_PTR(pGP, D_RDR_GPTOP_FVEC) + pParam->id.offs;
+			for (i = 0; i < n; ++i) {
+				pDst_v->qv = pSrc_v->qv;
+				++pSrc_v;
+				++pDst_v;
+			}
+			break;
+		case E_RDR_PARAMTYPE_IVEC:
+			pSrc_v = pParam->pVec;
+			pDst_v = (UVEC*)D_INCR_PTR(pGP, D_RDR_GPTOP_IVEC) + pParam->id.offs;
+			for (i = 0; i < n; ++i) {
+				pDst_v->iv = pSrc_v->iv;
+				++pSrc_v;
+				++pDst_v;
+			}
+			break;
+		case E_RDR_PARAMTYPE_FLOAT:
+			pSrc_f = pParam->pFloat;
+			pDst_f = (float*)D_INCR_PTR(pGP, D_RDR_GPTOP_FLOAT) + pParam->id.offs;
+			for (i = 0; i < n; ++i) {
+				*pDst_f++ = *pSrc_f++;
+			}
+			break;
+		case E_RDR_PARAMTYPE_INT:
+			pSrc_i = pParam->pInt;
+			pDst_i = (sys_i32*)D_INCR_PTR(pGP, D_RDR_GPTOP_INT) + pParam->id.offs;
+			for (i = 0; i < n; ++i) {
+				*pDst_i++ = *pSrc_i++;
+			}
+			break;
+		case E_RDR_PARAMTYPE_SMP:
+			pSrc_s = pParam->pSmp;
+			pDst_s = (RDR_SAMPLER*)D_INCR_PTR(pGP, D_RDR_GPTOP_SMP) + pParam->id.offs;
+			for (i = 0; i < n; ++i) {
+				memcpy(pDst_s, pSrc_s, sizeof(RDR_SAMPLER));
+				++pSrc_s;
+				++pDst_s;
+			}
+			break;
+		case E_RDR_PARAMTYPE_BOOL:
+			pSrc_b = pParam->pBool;
+			pDst_b = (sys_byte*)D_INCR_PTR(pGP, D_RDR_GPTOP_BOOL) + pParam->id.offs;
+			for (i = 0; i < n; ++i) {
+				*pDst_b++ = *pSrc_b++;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/* light view-projection covering the near part of the view, casters up to 40 units towards the light included */
+void Shadow_calc(QMTX view_proj, RDR_VIEW* pView, RDR_SHADOW* pSdw) {
+	QMTX vm;
+	QMTX cm;
+	QMTX tm;
+	QMTX fm;
+	QMTX inv_vp;
+	UVEC sdir;
+	UVEC vdir;
+	UVEC iprj;
+	UVEC up;
+	UVEC tgt;
+	UVEC pos;
+	UVEC tv;
+	UVEC offs;
+	UVEC vmin;
+	UVEC vmax;
+	UVEC box[8];
+	int i;
+	float vdist, snear, sfar, zmin, zmax, ymin, ymax, y, sy, t;
+
+	sdir.qv = V4_normalize(pSdw->dir.qv);
+	vdir.qv = V4_scale(V4_load(pView->iview[2]), -1.0f);
+	vdist = 25.0f * pView->proj[1][1];
+	iprj.qv = MTX_calc_qpnt(pView->iproj, V4_zero());
+	snear = -iprj.z/iprj.w;
+	sfar = snear + (vdist - snear) * (1.0f - fabsf(V4_dot(sdir.qv, V4_load(pView->iview[2]))) * 0.8f);
+	pos.qv = MTX_calc_qpnt(pView->view_proj, V4_add(V4_scale(vdir.qv, snear), V4_load(pView->iview[3])));
+	zmin = pos.z / pos.w;
+	pos.qv = MTX_calc_qpnt(pView->view_proj, V4_add(V4_scale(vdir.qv, sfar), V4_load(pView->iview[3])));
+	zmax = pos.z / pos.w;
+	if (zmin < 0.0f) zmin = 0.0f;
+	if (zmax > 1.0f) zmax = 1.0f;
+	box[0].qv = V4_set_pnt(-1.0f, -1.0f, zmin);
+	box[1].qv = V4_set_pnt(1.0f, -1.0f, zmin);
+	box[2].qv = V4_set_pnt(-1.0f, 1.0f, zmin);
+	box[3].qv = V4_set_pnt(1.0f, 1.0f, zmin);
+	box[4].qv = V4_set_pnt(-1.0f, -1.0f, zmax);
+	box[5].qv = V4_set_pnt(1.0f, -1.0f, zmax);
+	box[6].qv = V4_set_pnt(-1.0f, 1.0f, zmax);
+	box[7].qv = V4_set_pnt(1.0f, 1.0f, zmax);
+	MTX_invert(inv_vp, pView->view_proj);
+	for (i = 0; i < 8; ++i) {
+		box[i].qv = MTX_calc_qpnt(inv_vp, box[i].qv);
+		box[i].qv = V4_set_w1(V4_scale(box[i].qv, 1.0f/box[i].w));
+	}
+	up.qv = V4_normalize(V4_cross(sdir.qv, V4_cross(vdir.qv, sdir.qv)));
+	pos.qv = V4_load(pView->iview[3]);
+	tgt.qv = V4_sub(pos.qv, sdir.qv);
+	MTX_make_view(vm, pos.qv, tgt.qv, up.qv);
+	ymin = D_MAX_FLOAT;
+	ymax = -D_MAX_FLOAT;
+	for (i = 0; i < 8; ++i) {
+		tv.qv = MTX_calc_qpnt(vm, box[i].qv);
+		ymin = F_min(ymin, tv.y);
+		ymax = F_max(ymax, tv.y);
+	}
+	sy = sqrtf(1.0f - D_SQ(V4_dot(vdir.qv, sdir.qv)));
+	t = (snear + sqrtf(snear*sfar)) / sy;
+	y = (ymax - ymin) / t;
+	MTX_unit(cm);
+	cm[0][0] = -1.0f;
+	cm[1][1] = (y + t) / (y - t);
+	cm[1][3] = 1.0f;
+	cm[3][1] = (-2.0f*y*t) / (y - t);
+	cm[3][3] = 0.0f;
+
+	pos.qv = V4_set_w1(V4_add(V4_load(pView->iview[3]), V4_scale(up.qv, ymin - t)));
+	tgt.qv = V4_sub(pos.qv, sdir.qv);
+	MTX_make_view(vm, pos.qv, tgt.qv, up.qv);
+	MTX_mul(tm, vm, cm);
+	vmin.qv = V4_fill(D_MAX_FLOAT);
+	vmax.qv = V4_fill(-D_MAX_FLOAT);
+	for (i = 0; i < 8; ++i) {
+		tv.qv = MTX_calc_qpnt(tm, box[i].qv);
+		tv.qv = V4_set_w1(V4_scale(tv.qv, 1.0f/tv.w));
+		vmin.qv = V4_min(vmin.qv, tv.qv);
+		vmax.qv = V4_max(vmax.qv, tv.qv);
+	}
+	offs.qv = V4_set_w0(V4_scale(sdir.qv, 40.0f));
+	zmin = vmin.z;
+	for (i = 0; i < 8; ++i) {
+		tv.qv = V4_sub(box[i].qv, offs.qv);
+		tv.qv = MTX_calc_qpnt(tm, tv.qv);
+		tv.z /= tv.w;
+		zmin = F_min(zmin, tv.z);
+	}
+	vmin.z = zmin;
+	MTX_unit(fm);
+	tv.qv = V4_div(V4_fill(1.0f), V4_set_w1(V4_sub(vmax.qv, vmin.qv)));
+	fm[0][0] = 2.0f * tv.x;
+	fm[1][1] = 2.0f * tv.y;
+	fm[2][2] = tv.z;
+	fm[3][0] = -(vmin.x + vmax.x) * tv.x;
+	fm[3][1] = -(vmin.y + vmax.y) * tv.y;
+	fm[3][2] = -vmin.z * tv.z;
+	MTX_mul(fm, cm, fm);
+	MTX_mul(view_proj, vm, fm);
+}
+
+int RDR_cull_cast(GEOM_AABB* pBox) {
+	RDR_CULL_STATS* pStats = &g_rdr_db.Get_rec()->mCull;
+	if (pBox && GEOM_clip_vol_aabb_cull(g_rdr_db.Get_shadow_vol(), pBox)) {
+		++pStats->nb_cast_culled;
+		return 1;
+	}
+	++pStats->nb_cast;
+	return 0;
+}
+
+int RDR_cull_recv(GEOM_AABB* pBox) {
+	RDR_CULL_STATS* pStats = &g_rdr_db.Get_rec()->mCull;
+	if (pBox && GEOM_clip_vol_aabb_cull(g_rdr_db.Get_shadow_vol(), pBox)) {
+		++pStats->nb_recv_culled;
+		return 1;
+	}
+	++pStats->nb_recv;
+	return 0;
+}
+
+int RDR_discard() {
+	int nb_ent = g_rdr_db.Merge();
+	g_rdr_db.Begin();
+	return nb_ent;
+}
+
+int RDR_set_nb_frame(int n) {
+	return g_rdr_db.Set_nb_frame(n) ? 1 : 0;
+}
+
+int RDR_get_nb_frame() {
+	return g_rdr_db.Get_nb_frame();
+}
+
+RDR_CONTEXT* RDR_get_ctx() {
+	return g_rdr_db.Get_work_ctx();
+}
+
+UVEC* RDR_get_val_v(int n) {
+	return (UVEC*)g_rdr_db.Get_val(E_RDR_PARAMTYPE_FVEC, n);
+}
+
+float* RDR_get_val_f(int n) {
+	return (float*)g_rdr_db.Get_val(E_RDR_PARAMTYPE_FLOAT, n);
+}
+
+sys_i32* RDR_get_val_i(int n) {
+	return (sys_i32*)g_rdr_db.Get_val(E_RDR_PARAMTYPE_INT, n);
+}
+
+RDR_SAMPLER* RDR_get_val_s(int n) {
+	return (RDR_SAMPLER*)g_rdr_db.Get_val(E_RDR_PARAMTYPE_SMP, n);
+}
+
+sys_byte* RDR_get_val_b(int n) {
+	return (sys_byte*)g_rdr_db.Get_val(E_RDR_PARAMTYPE_BOOL, n);
+}
+
+RDR_BATCH_PARAM* RDR_get_param(int n) {
+	RDR_BATCH_PARAM* pParam = g_rdr_db.Get_param(n);
+	return pParam;
+}
+
+RDR_BATCH* RDR_get_batch() {
+	RDR_BATCH* pBatch = g_rdr_db.Get_batch();
+	if (pBatch) {
+		pBatch->nb_param = 0;
+		pBatch->vtx_prog = D_RDRPROG_vtx_default;
+		pBatch->pix_prog = D_RDRPROG_pix_default;
+		pBatch->blend_state.on = false;
+		pBatch->blend_state.op = E_RDR_BLENDOP_ADD;
+		pBatch->blend_state.src = E_RDR_BLENDMODE_SRCA;
+		pBatch->blend_state.dst = E_RDR_BLENDMODE_INVSRCA;
+		pBatch->blend_state.op_a = E_RDR_BLENDOP_MAX;
+		pBatch->blend_state.src_a = E_RDR_BLENDMODE_ONE;
+		pBatch->blend_state.dst_a = E_RDR_BLENDMODE_ONE;
+		pBatch->draw_state.color_mask = 0xF;
+		pBatch->draw_state.cull = E_RDR_CULL_CCW;
+		pBatch->draw_state.ztest = true;
+		pBatch->draw_state.zwrite = true;
+		pBatch->draw_state.zfunc = E_RDR_CMPFUNC_LESSEQUAL;
+		pBatch->draw_state.atest = false;
+		pBatch->draw_state.afunc = E_RDR_CMPFUNC_GREATER;
+		pBatch->draw_state.msaa = true;
+		pBatch->base = 0;
+		pBatch->mtl_id = 0;
+		pBatch->depth = 0.0f;
+		pBatch->pInst = NULL;
+		pBatch->nb_inst = 0;
+	}
+	return pBatch;
+}
+
+void RDR_put_batch(RDR_BATCH* pBatch, sys_ui64 key, sys_uint lyr_id) {
+	if (lyr_id >= E_RDR_LAYER_MAX) return;
+	g_rdr_db.Put_batch(pBatch, key, lyr_id);
+}
+
+/*
+ * pInst holds 3 world rows per instance (as the world param), e.g. from RDR_get_val_v.
+ * Returns 0 if the batch can't be instanced and has to be put per instance.
+ */
+int RDR_put_instanced(RDR_BATCH* pBatch, UVEC* pInst, int nb_inst, sys_uint lyr_id) {
+	if (!pBatch || !pInst || nb_inst <= 0 || !Inst_drawable(pBatch)) return 0;
+	pBatch->pInst = pInst;
+	pBatch->nb_inst = nb_inst;
+	RDR_put_batch(pBatch, 0, lyr_id);
+	return 1;
+}
+
+float RDR_calc_depth(QVEC pos) {
+	RDR_VIEW* pView = g_rdr_db.Get_work_view();
+	return V4_dot(V4_sub(pos, pView->pos.qv), pView->dir.qv);
+}
+
+void RDR_set_lyr_sort(sys_uint lyr_id, E_RDR_SORT sort) {
+	if (lyr_id >= E_RDR_LAYER_MAX) return;
+	g_rdr_db.Set_lyr_sort(lyr_id, sort);
+}
+
+E_RDR_SORT RDR_get_lyr_sort(sys_uint lyr_id) {
+	if (lyr_id >= E_RDR_LAYER_MAX) return E_RDR_SORT_NONE;
+	return g_rdr_db.Get_exec_lyr(lyr_id)->mSort;
+}
@@ -0,0 +1,1052 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/*
+ * Backend neutral part of the renderer: batch recording, layers, sorting and instancing.
+ * Included by the backends (render.cpp, rdrnull.cpp), which pass their batch function to Exec.
+ */
+
+#define D_RDR_SORT_MT_MIN (16384)
+#define D_RDR_REC_MAX (D_MAX_WORKERS + 1) /* main thread + job workers */
+#define D_RDR_REC_BATCH (32)
+#define D_RDR_REC_PARAM (32)
+#define D_RDR_REC_VAL (128)
+#define D_RDR_BIN_CHUNK (64)
+#define D_RDR_INST_SCAN (64)
+#define D_RDR_INST_GRP (256)
+#define D_RDR_FRAME_MIN (2)
+#define D_RDR_FRAME_MAX (4)
+#define D_RDR_POOL_DIR (1024) /* chunks a work pool can grow to */
+#define D_RDR_POOL_SHRINK (120) /* frames of low use before spare chunks are freed */
+#define D_RDR_CHUNK_BATCH (1024)
+#define D_RDR_CHUNK_PARAM (1024)
+#define D_RDR_CHUNK_VAL (4096)
+#define D_RDR_CHUNK_BIN (128)
+#define D_RDR_CHUNK_LYR (4096)
+
+struct RDR_LAYER;
+typedef void (*RDR_LYR_FUNC)(RDR_LAYER* pLyr);
+typedef void (*RDR_BATCH_FUNC)(RDR_BATCH* pBatch);
+
+/*
+ * 48 bits of state: pix prog (10), vtx prog (10), VB (12), material (16),
+ * and 16 bits of depth, above the state for E_RDR_SORT_DEPTH.
+ * Positive floats compare as integers, so the top half of the bits is a
+ * coarse front to back order.
+ */
+static D_INLINE sys_ui64 Batch_sort_key(RDR_BATCH* pBatch, E_RDR_SORT sort) {
+	union {float f; sys_ui32 u;} z;
+	sys_ui32 vb;
+	sys_ui64 state;
+
+	z.f = pBatch->depth;
+	z.u = z.f > 0.0f ? z.u >> 16 : 0;
+	vb = (sys_ui32)((sys_intptr)pBatch->pVtx >> 4);
+	vb = (vb ^ (vb >> 12)) & 0xFFF;
+	state = ((sys_ui64)(pBatch->pix_prog & 0x3FF) << 38) | ((sys_ui64)(pBatch->vtx_prog & 0x3FF) << 28) | ((sys_ui64)vb << 16) | pBatch->mtl_id;
+	if (sort == E_RDR_SORT_DEPTH) {
+		return ((sys_ui64)z.u << 48) | state;
+	}
+	return (state << 16) | z.u;
+}
+
+struct RDR_LAYER {
+	RDR_BATCH** mppBatch;
+	RDR_BATCH** mppTmp;
+	UTL_SORT_PAIR* mpPair; /* (key, put order), twice the size for the sort's scratch */
+	int mCount;
+	int mSize;
+	E_RDR_SORT mSort;
+	RDR_LYR_STATS mStats;
+	const char* mName;
+	RDR_LYR_FUNC mpPrologue;
+	RDR_LYR_FUNC mpEpilogue;
+
+	int mNb_low;
+	int mLow_peak;
+
+	void Alloc(const char* name, int n, E_RDR_SORT sort) {
+		mName = name;
+		mSize = 0;
+		mSort = sort;
+		mppBatch = NULL;
+		mppTmp = NULL;
+		mpPair = NULL;
+		memset(&mStats, 0, sizeof(mStats));
+		mCount = 0;
+		mNb_low = 0;
+		mLow_peak = 0;
+		mpPrologue = NULL;
+		mpEpilogue = NULL;
+		Resize(n);
+	}
+
+	/* keeps the entries put so far */
+	void Resize(int n) {
+		RDR_BATCH** ppBatch = (RDR_BATCH**)SYS_malloc(n*sizeof(RDR_BATCH*));
+		RDR_BATCH** ppTmp = (RDR_BATCH**)SYS_malloc(n*sizeof(RDR_BATCH*));
+		UTL_SORT_PAIR* pPair = (UTL_SORT_PAIR*)SYS_malloc(2*n*sizeof(UTL_SORT_PAIR));
+		if (!ppBatch || !ppTmp || !pPair) {
+			SYS_free(ppBatch);
+			SYS_free(ppTmp);
+			SYS_free(pPair);
+			return;
+		}
+		mCount = Get_count();
+		mCount = D_MIN(mCount, n);
+		if (mCount) {
+			memcpy(ppBatch, mppBatch, mCount*sizeof(RDR_BATCH*));
+			memcpy(pPair, mpPair, mCount*sizeof(UTL_SORT_PAIR));
+		}
+		SYS_free(mppBatch);
+		SYS_free(mppTmp);
+		SYS_free(mpPair);
+		mppBatch = ppBatch;
+		mppTmp = ppTmp;
+		mpPair = pPair;
+		mSize = n;
+	}
+
+	/* grows in whole chunks, before Merge puts the entries */
+	void Reserve(int n) {
+		n += Get_count();
+		if (n > mSize) {
+			Resize((int)D_ALIGN(n, D_RDR_CHUNK_LYR));
+		}
+	}
+
+	/* at the start of a frame, drops to the recent peak after D_RDR_POOL_SHRINK frames below half the size */
+	void Reset() {
+		int used = (int)D_ALIGN(Get_count(), D_RDR_CHUNK_LYR);
+		used = D_MAX(used, D_RDR_CHUNK_LYR);
+		if (used*2 <= mSize) {
+			mLow_peak = D_MAX(mLow_peak, used);
+			if (++mNb_low >= D_RDR_POOL_SHRINK) {
+				mCount = 0;
+				Resize(mLow_peak);
+				mNb_low = 0;
+				mLow_peak = 0;
+			}
+		} else {
+			mNb_low = 0;
+			mLow_peak = 0;
+		}
+		mCount = 0;
+	}
+
+	int Get_count() const {
+		return mCount < mSize ? mCount : mSize;
+	}
+
+	/* single threaded, layers are only filled by RDR_DB_WK::Merge */
+	void Put(RDR_BATCH* pEntry, sys_ui64 key) {
+		int idx = mCount;
+		if (idx < mSize) {
+			mppBatch[idx] = pEntry;
+			mpPair[idx].key = key;
+			mpPair[idx].idx = idx;
+			++mCount;
+		} else {
+			SYS_log("Layer overflow [%s]\n", mName);
+		}
+	}
+
+	void Sort(int nb_wrk) {
+		int i, n;
+		UTL_SORT_PAIR* pRes;
+		RDR_BATCH** ppSwap;
+
+		n = Get_count();
+		if (mSort == E_RDR_SORT_NONE || n <= 1) return;
+		if (nb_wrk > 1 && n >= D_RDR_SORT_MT_MIN) {
+			pRes = UTL_radix_sort_mt(mpPair, mpPair + mSize, n, nb_wrk);
+		} else {
+			pRes = UTL_radix_sort(mpPair, mpPair + mSize, n);
+		}
+		for (i = 0; i < n; ++i) {
+			mppTmp[i] = mppBatch[pRes[i].idx];
+		}
+		ppSwap = mppBatch;
+		mppBatch = mppTmp;
+		mppTmp = ppSwap;
+	}
+
+	void Count_changes(RDR_BATCH* pPrev, RDR_BATCH* pBatch) {
+		++mStats.nb_batch;
+		if (!pPrev || pPrev->pix_prog != pBatch->pix_prog) ++mStats.nb_pix_prog;
+		if (!pPrev || pPrev->vtx_prog != pBatch->vtx_prog) ++mStats.nb_vtx_prog;
+		if (!pPrev || pPrev->pVtx != pBatch->pVtx) ++mStats.nb_vtx_buf;
+		if (!pPrev || pPrev->mtl_id != pBatch->mtl_id) ++mStats.nb_mtl;
+		if (pBatch->pInst) {
+			++mStats.nb_inst_draw;
+			mStats.nb_inst += pBatch->nb_inst;
+		}
+	}
+
+	void Exec(RDR_BATCH_FUNC exec) {
+		int i, n;
+		RDR_BATCH** ppBatch = mppBatch;
+		RDR_BATCH* pPrev = NULL;
+		n = Get_count();
+		//if (n <= 0) return;
+		memset(&mStats, 0, sizeof(mStats));
+		if (mpPrologue) {
+			mpPrologue(this);
+		}
+		for (i = 0; i < n; ++i) {
+			if (*ppBatch) {
+				Count_changes(pPrev, *ppBatch);
+				exec(*ppBatch);
+				pPrev = *ppBatch;
+			}
+			++ppBatch;
+		}
+		if (mpEpilogue) {
+			mpEpilogue(this);
+		}
+	}
+};
+
+struct RDR_LYR_WK {
+	RDR_LAYER mLyr[E_RDR_LAYER_MAX];
+
+	void Init() {
+		int n = D_RDR_CHUNK_LYR;
+		mLyr[E_RDR_LAYER_ZBUF].Alloc("ZBUF", n, E_RDR_SORT_DEPTH);
+		mLyr[E_RDR_LAYER_CAST].Alloc("CAST", n, E_RDR_SORT_STATE);
+		mLyr[E_RDR_LAYER_MTL0].Alloc("MTL0", n, E_RDR_SORT_STATE);
+		mLyr[E_RDR_LAYER_MTL1].Alloc("MTL1", n, E_RDR_SORT_KEY);
+		mLyr[E_RDR_LAYER_RECV].Alloc("RECV", n, E_RDR_SORT_STATE);
+		mLyr[E_RDR_LAYER_MTL2].Alloc("MTL2", n, E_RDR_SORT_KEY);
+		mLyr[E_RDR_LAYER_PTCL].Alloc("PTCL", n, E_RDR_SORT_KEY);
+	}
+
+	void Reset() {
+		for (int i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			mLyr[i].Reset();
+		}
+	}
+
+	void Get_pool_stats(sys_ui32* pPeak, sys_ui32* pSize) {
+		*pPeak = 0;
+		*pSize = 0;
+		for (int i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			*pPeak += mLyr[i].Get_count();
+			*pSize += mLyr[i].mSize;
+		}
+	}
+
+	void Sort(int nb_wrk) {
+		for (int i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			mLyr[i].Sort(nb_wrk);
+		}
+	}
+
+	void Exec(RDR_BATCH_FUNC exec) {
+		for (int i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			mLyr[i].Exec(exec);
+		}
+	}
+};
+
+/* shared data built by the first thread that needs it */
+typedef enum _E_RDR_INIT {
+	E_RDR_INIT_EMPTY,
+	E_RDR_INIT_BUSY,
+	E_RDR_INIT_READY
+} E_RDR_INIT;
+
+/*
+ * Frame work pool shared by the recording threads. Items are taken with one atomic add,
+ * the chunk they fall in is allocated by the first thread to reach it, others wait for it to be ready.
+ * A request is never split between chunks, the tail it does not fit in is skipped.
+ * Chunks stay allocated from frame to frame, see Reset.
+ */
+template <typename _T, int _CHUNK> struct RDR_POOL {
+	_T* mpChunk[D_RDR_POOL_DIR];
+	sys_i32 mState[D_RDR_POOL_DIR]; /* E_RDR_INIT */
+	sys_i32 mCount;
+	sys_i32 mNb_chunk;
+	sys_i32 mNb_fail;
+	int mNb_low;
+	int mLow_peak;
+	const char* mName;
+
+	void Alloc(const char* name) {
+		mName = name;
+		memset(mpChunk, 0, sizeof(mpChunk));
+		memset(mState, 0, sizeof(mState));
+		mCount = 0;
+		mNb_chunk = 0;
+		mNb_fail = 0;
+		mNb_low = 0;
+		mLow_peak = 0;
+		Get_chunk(0);
+	}
+
+	/* NULL if the chunk could not be allocated, the entry is left empty for a later retry */
+	_T* Get_chunk(int idx) {
+		_T* pChunk;
+		sys_i32 state = *(volatile sys_i32*)&mState[idx];
+		if (state == E_RDR_INIT_EMPTY && SYNC_cas(&mState[idx], E_RDR_INIT_BUSY, E_RDR_INIT_EMPTY) == E_RDR_INIT_EMPTY) {
+			pChunk = (_T*)SYS_malloc(_CHUNK*sizeof(_T));
+			if (!pChunk) {
+				SYNC_xchg(&mState[idx], E_RDR_INIT_EMPTY);
+				return NULL;
+			}
+			mpChunk[idx] = pChunk;
+			SYNC_inc(&mNb_chunk);
+			SYNC_xchg(&mState[idx], E_RDR_INIT_READY);
+			return pChunk;
+		}
+		while ((state = *(volatile sys_i32*)&mState[idx]) == E_RDR_INIT_BUSY) {
+			_mm_pause();
+		}
+		return state == E_RDR_INIT_READY ? mpChunk[idx] : NULL;
+	}
+
+	_T* Get(int n) {
+		sys_i32 idx;
+		int chunk, offs;
+		_T* pChunk = NULL;
+		if (n > 0 && n <= _CHUNK) {
+			do {
+				idx = SYNC_add(&mCount, n);
+				chunk = idx / _CHUNK;
+				offs = idx % _CHUNK;
+			} while (chunk < D_RDR_POOL_DIR && offs + n > _CHUNK);
+			if (chunk < D_RDR_POOL_DIR) {
+				pChunk = Get_chunk(chunk);
+			}
+		}
+		if (!pChunk) {
+			if (SYNC_inc(&mNb_fail) == 1) {
+				SYS_log("%s work overflow\n", mName);
+			}
+			return NULL;
+		}
+		return pChunk + offs;
+	}
+
+	int Get_nb_used() const {
+		int n = mCount;
+		return D_MIN(n, D_RDR_POOL_DIR*_CHUNK);
+	}
+
+	int Get_size() const {
+		return mNb_chunk*_CHUNK;
+	}
+
+	/*
+	 * Single threaded, at the start of a frame. After D_RDR_POOL_SHRINK frames using
+	 * at most half of the chunks, the ones above the peak of those frames are freed.
+	 * Chunks need not be contiguous, a request that does not fit skips the rest of one.
+	 */
+	void Reset() {
+		int i;
+		int used = (Get_nb_used() + _CHUNK - 1) / _CHUNK;
+		used = D_MAX(used, 1);
+		if (used*2 <= mNb_chunk) {
+			mLow_peak = D_MAX(mLow_peak, used);
+			if (++mNb_low >= D_RDR_POOL_SHRINK) {
+				for (i = mLow_peak; i < D_RDR_POOL_DIR; ++i) {
+					if (mState[i] == E_RDR_INIT_READY) {
+						SYS_free(mpChunk[i]);
+						mpChunk[i] = NULL;
+						mState[i] = E_RDR_INIT_EMPTY;
+						--mNb_chunk;
+					}
+				}
+				mNb_low = 0;
+				mLow_peak = 0;
+			}
+		} else {
+			mNb_low = 0;
+			mLow_peak = 0;
+		}
+		mCount = 0;
+		mNb_fail = 0;
+	}
+};
+
+typedef RDR_POOL<RDR_BATCH, D_RDR_CHUNK_BATCH> RDR_BATCH_WK;
+typedef RDR_POOL<RDR_BATCH_PARAM, D_RDR_CHUNK_PARAM> RDR_PARAM_WK;
+
+struct RDR_VAL_WK : RDR_POOL<UVEC, D_RDR_CHUNK_VAL> {
+	__m128* Get(int nb_vec) {
+		return (__m128*)RDR_POOL<UVEC, D_RDR_CHUNK_VAL>::Get(nb_vec);
+	}
+
+	static int Get_item_size(E_RDR_PARAMTYPE type) {
+		int item_size = 0;
+		switch (type) {
+			case E_RDR_PARAMTYPE_FVEC:
+			case E_RDR_PARAMTYPE_IVEC:
+				item_size = sizeof(UVEC);
+				break;
+			case E_RDR_PARAMTYPE_INT:
+				item_size = sizeof(sys_i32);
+				break;
+			case E_RDR_PARAMTYPE_FLOAT:
+				item_size = sizeof(float);
+				break;
+			case E_RDR_PARAMTYPE_SMP:
+				item_size = sizeof(RDR_SAMPLER);
+				break;
+			case E_RDR_PARAMTYPE_BOOL:
+				item_size = sizeof(sys_byte);
+				break;
+			default:
+				break;
+		}
+		return item_size;
+	}
+};
+
+static D_INLINE int Inst_vtx_prog(int vtx_prog) {
+	int inst_prog = -1;
+	switch (vtx_prog) {
+		case D_RDRPROG_vtx_solid:
+			inst_prog = D_RDRPROG_vtx_solid_inst;
+			break;
+		case D_RDRPROG_vtx_solid_zbuf:
+			inst_prog = D_RDRPROG_vtx_solid_zbuf_inst;
+			break;
+		case D_RDRPROG_vtx_solid_cast:
+			inst_prog = D_RDRPROG_vtx_solid_cast_inst;
+			break;
+		case D_RDRPROG_vtx_solid_recv:
+			inst_prog = D_RDRPROG_vtx_solid_recv_inst;
+			break;
+		default:
+			break;
+	}
+	return inst_prog;
+}
+
+/* hardware instancing is only set up for indexed SOLID geometry */
+static D_INLINE bool Inst_drawable(RDR_BATCH* pBatch) {
+	return pBatch->pIdx && pBatch->pVtx && pBatch->pVtx->type == E_RDR_VTXTYPE_SOLID && Inst_vtx_prog(pBatch->vtx_prog) >= 0;
+}
+
+static D_INLINE RDR_BATCH_PARAM* Inst_world_param(RDR_BATCH* pBatch) {
+	int i;
+	RDR_BATCH_PARAM* pParam = pBatch->pParam;
+	for (i = 0; i < pBatch->nb_param; ++i) {
+		if (pParam->id.type == E_RDR_PARAMTYPE_FVEC && pParam->id.offs == D_RDR_GP_world && pParam->count == 3) {
+			return pParam;
+		}
+		++pParam;
+	}
+	return NULL;
+}
+
+static D_INLINE bool Inst_state_eq(RDR_BATCH* pA, RDR_BATCH* pB) {
+	RDR_BLEND_STATE* pBsA = &pA->blend_state;
+	RDR_BLEND_STATE* pBsB = &pB->blend_state;
+	RDR_DRAW_STATE* pDsA = &pA->draw_state;
+	RDR_DRAW_STATE* pDsB = &pB->draw_state;
+	if (pBsA->on != pBsB->on) return false;
+	if (pBsA->on) {
+		if (pBsA->op != pBsB->op || pBsA->src != pBsB->src || pBsA->dst != pBsB->dst) return false;
+		if (pBsA->op_a != pBsB->op_a || pBsA->src_a != pBsB->src_a || pBsA->dst_a != pBsB->dst_a) return false;
+	}
+	return pDsA->color_mask == pDsB->color_mask && pDsA->cull == pDsB->cull &&
+	       pDsA->ztest == pDsB->ztest && pDsA->zwrite == pDsB->zwrite && pDsA->zfunc == pDsB->zfunc &&
+	       pDsA->atest == pDsB->atest && pDsA->afunc == pDsB->afunc && pDsA->msaa == pDsB->msaa;
+}
+
+/* same draw apart from the world matrix */
+static D_INLINE bool Inst_match(RDR_BATCH* pA, RDR_BATCH* pB) {
+	int i, size;
+	RDR_BATCH_PARAM* pPrmA;
+	RDR_BATCH_PARAM* pPrmB;
+
+	if (pB->pInst) return false;
+	if (pA->pVtx != pB->pVtx || pA->pIdx != pB->pIdx) return false;
+	if (pA->start != pB->start || pA->count != pB->count || pA->base != pB->base || pA->type != pB->type) return false;
+	if (pA->vtx_prog != pB->vtx_prog || pA->pix_prog != pB->pix_prog || pA->mtl_id != pB->mtl_id) return false;
+	if (pA->nb_param != pB->nb_param) return false;
+	if (!Inst_state_eq(pA, pB)) return false;
+	pPrmA = pA->pParam;
+	pPrmB = pB->pParam;
+	for (i = 0; i < pA->nb_param; ++i) {
+		if (pPrmA->id.type != pPrmB->id.type || pPrmA->id.offs != pPrmB->id.offs || pPrmA->count != pPrmB->count) return false;
+		if (pPrmA->pVal != pPrmB->pVal && !(pPrmA->id.type == E_RDR_PARAMTYPE_FVEC && pPrmA->id.offs == D_RDR_GP_world)) {
+			size = pPrmA->count * RDR_VAL_WK::Get_item_size((E_RDR_PARAMTYPE)pPrmA->id.type);
+			if (memcmp(pPrmA->pVal, pPrmB->pVal, size)) return false;
+		}
+		++pPrmA;
+		++pPrmB;
+	}
+	return true;
+}
+
+struct RDR_BIN_CHUNK {
+	sys_ui64 key[D_RDR_BIN_CHUNK];
+	RDR_BATCH* pBatch[D_RDR_BIN_CHUNK];
+	RDR_BIN_CHUNK* pNext;
+	int count;
+};
+
+struct RDR_BIN_WK : RDR_POOL<RDR_BIN_CHUNK, D_RDR_CHUNK_BIN> {
+	RDR_BIN_CHUNK* Get() {
+		RDR_BIN_CHUNK* pChunk = RDR_POOL<RDR_BIN_CHUNK, D_RDR_CHUNK_BIN>::Get(1);
+		if (pChunk) {
+			pChunk->pNext = NULL;
+			pChunk->count = 0;
+		}
+		return pChunk;
+	}
+};
+
+struct RDR_BIN {
+	RDR_BIN_CHUNK* pHead;
+	RDR_BIN_CHUNK* pTail;
+};
+
+/*
+ * Recording context of one thread: the shared pools are only touched once per chunk,
+ * layer entries go to private bins until RDR_DB_WK::Merge.
+ */
+struct RDR_REC {
+	RDR_BATCH* mpBatch;
+	RDR_BATCH_PARAM* mpParam;
+	__m128* mpVal;
+	int mBatch_left;
+	int mParam_left;
+	int mVal_left;
+	RDR_BIN mBin[E_RDR_LAYER_MAX];
+	RDR_CULL_STATS mCull;
+	sys_byte mPad[64]; /* keeps neighbouring threads off each other's cache lines */
+
+	void Reset() {
+		mpBatch = NULL;
+		mpParam = NULL;
+		mpVal = NULL;
+		mBatch_left = 0;
+		mParam_left = 0;
+		mVal_left = 0;
+		memset(mBin, 0, sizeof(mBin));
+		memset(&mCull, 0, sizeof(mCull));
+	}
+
+	RDR_BATCH* Get_batch(RDR_BATCH_WK* pWk) {
+		if (!mBatch_left) {
+			mpBatch = pWk->Get(D_RDR_REC_BATCH);
+			if (!mpBatch) return NULL;
+			mBatch_left = D_RDR_REC_BATCH;
+		}
+		--mBatch_left;
+		return mpBatch++;
+	}
+
+	RDR_BATCH_PARAM* Get_param(RDR_PARAM_WK* pWk, int n) {
+		RDR_BATCH_PARAM* pParam;
+		if (n > D_RDR_REC_PARAM) return pWk->Get(n);
+		if (n > mParam_left) {
+			mpParam = pWk->Get(D_RDR_REC_PARAM);
+			mParam_left = mpParam ? D_RDR_REC_PARAM : 0;
+			if (!mpParam) return NULL;
+		}
+		pParam = mpParam;
+		mpParam += n;
+		mParam_left -= n;
+		return pParam;
+	}
+
+	__m128* Get_val(RDR_VAL_WK* pWk, int nb_vec) {
+		__m128* pVal;
+		if (nb_vec > D_RDR_REC_VAL) return pWk->Get(nb_vec);
+		if (nb_vec > mVal_left) {
+			mpVal = pWk->Get(D_RDR_REC_VAL);
+			mVal_left = mpVal ? D_RDR_REC_VAL : 0;
+			if (!mpVal) return NULL;
+		}
+		pVal = mpVal;
+		mpVal += nb_vec;
+		mVal_left -= nb_vec;
+		return pVal;
+	}
+
+	void Put(RDR_BIN_WK* pWk, RDR_BATCH* pBatch, sys_ui64 key, sys_uint lyr_no) {
+		RDR_BIN* pBin = &mBin[lyr_no];
+		RDR_BIN_CHUNK* pChunk = pBin->pTail;
+		if (!pChunk || pChunk->count == D_RDR_BIN_CHUNK) {
+			pChunk = pWk->Get();
+			if (!pChunk) return;
+			if (pBin->pTail) {
+				pBin->pTail->pNext = pChunk;
+			} else {
+				pBin->pHead = pChunk;
+			}
+			pBin->pTail = pChunk;
+		}
+		pChunk->key[pChunk->count] = key;
+		pChunk->pBatch[pChunk->count] = pBatch;
+		++pChunk->count;
+	}
+};
+
+void Shadow_calc(QMTX view_proj, RDR_VIEW* pView, RDR_SHADOW* pSdw);
+
+/*
+ * Frames are recorded into a ring of work buffers and drawn in submission order.
+ * Frame n uses buffer n % mNb_frame; the count of drawn frames is the fence:
+ * a buffer can be recorded again once the frame that used it before has been drawn.
+ */
+struct RDR_DB_WK {
+	int mIdx_db;
+	int mIdx_exec;
+	int mNb_frame;
+	int mNb_alloc;
+	sys_i32 mFrame_sub;
+	sys_i32 mFrame_drawn;
+	sys_i64 mWait;
+	sys_i32 mShadow_state; /* E_RDR_INIT */
+	GEOM_CLIP_VOL mShadow_vol;
+	sys_i64 mBegin[D_RDR_FRAME_MAX];
+	RDR_STATS mStats[D_RDR_FRAME_MAX];
+	RDR_LYR_WK mLyr_wk[D_RDR_FRAME_MAX];
+	RDR_BATCH_WK mBatch_wk[D_RDR_FRAME_MAX];
+	RDR_PARAM_WK mParam_wk[D_RDR_FRAME_MAX];
+	RDR_VAL_WK mVal_wk[D_RDR_FRAME_MAX];
+	RDR_BIN_WK mBin_wk[D_RDR_FRAME_MAX];
+	RDR_REC mRec[D_RDR_FRAME_MAX][D_RDR_REC_MAX];
+	RDR_CONTEXT mCtx[D_RDR_FRAME_MAX];
+
+	static void Set_def_light(RDR_CONTEXT* pCtx) {
+		RDR_LIGHT* pLit = &pCtx->light;
+		pLit->headlight_color.qv = V4_set(0.7f, 0.7f, 0.7f, 1.0f);
+		pLit->sh_intensity = 0.1f;
+	}
+
+	static void Set_def_shadow(RDR_CONTEXT* pCtx) {
+		RDR_SHADOW* pSdw = &pCtx->shadow;
+		pSdw->dir.qv = V4_normalize(V4_set_vec(-0.15f, -0.9f, -0.6f));
+		pSdw->color_density.qv = V4_set(0.1f, 0.1f, 0.0f, 0.8f);
+	}
+
+	static void Set_def_view(RDR_CONTEXT* pCtx) {
+		RDR_VIEW* pView = &pCtx->view;
+		pView->pos.qv = V4_set_pnt(7.0f, 3.0f, 12.0f);
+		MTX_make_view(pView->view, pView->pos.qv, V4_set_w1(V4_zero()), V4_load(g_identity[1]));
+		MTX_invert(pView->iview, pView->view);
+		pView->dir.qv = V4_scale(V4_load(pView->iview[2]), -1.0f);
+		MTX_make_proj(pView->proj, D_DEG2RAD(40.0f), 320.0f/240.0f, 0.1f, 10000.0f);
+		MTX_invert(pView->iproj, pView->proj);
+		MTX_mul(pView->view_proj, pView->view, pView->proj);
+	}
+
+	static void Set_def_fog(RDR_CONTEXT* pCtx) {
+		RDR_FOG* pFog = &pCtx->fog;
+		pFog->start = 0.0f;
+		pFog->end = 100.0f;
+		SPL_bezier01_reset(&pFog->curve);
+		pFog->color.r = 0.9f;
+		pFog->color.g = 0.9f;
+		pFog->color.b = 0.8f;
+		pFog->color.a = 0.0f;
+	}
+
+	void Init_ctx(int idx) {
+		RDR_CONTEXT* pCtx = &mCtx[idx];
+		Set_def_light(pCtx);
+		Set_def_shadow(pCtx);
+		Set_def_view(pCtx);
+		Set_def_fog(pCtx);
+		pCtx->clear_color = D_RDR_ARGB32(0xFF, 0x55, 0x66, 0x77);
+	}
+
+	void Alloc_frame(int idx) {
+		mLyr_wk[idx].Init();
+		mBatch_wk[idx].Alloc("Batch");
+		mVal_wk[idx].Alloc("Value");
+		mParam_wk[idx].Alloc("Param");
+		mBin_wk[idx].Alloc("Bin");
+		if (idx) {
+			for (int i = 0; i < E_RDR_LAYER_MAX; ++i) {
+				mLyr_wk[idx].mLyr[i].mSort = mLyr_wk[0].mLyr[i].mSort;
+			}
+		}
+		Init_ctx(idx);
+	}
+
+	void Init() {
+		mIdx_db = 0;
+		mIdx_exec = 0;
+		mNb_frame = 0;
+		mNb_alloc = 0;
+		mFrame_sub = 0;
+		mFrame_drawn = 0;
+		mWait = 0;
+		mShadow_state = E_RDR_INIT_EMPTY;
+		memset(mBegin, 0, sizeof(mBegin));
+		memset(mStats, 0, sizeof(mStats));
+		Set_nb_frame(D_RDR_FRAME_MIN);
+	}
+
+	/* only between frames, with nothing left to draw */
+	bool Set_nb_frame(int n) {
+		n = D_MAX(n, D_RDR_FRAME_MIN);
+		n = D_MIN(n, D_RDR_FRAME_MAX);
+		if (Get_nb_pending()) return false;
+		while (mNb_alloc < n) {
+			Alloc_frame(mNb_alloc++);
+		}
+		if (mNb_frame && mIdx_db != 0) {
+			mCtx[0] = mCtx[mIdx_db];
+		}
+		mNb_frame = n;
+		mFrame_sub = 0;
+		mFrame_drawn = 0;
+		mIdx_db = 0;
+		mIdx_exec = 0;
+		return true;
+	}
+
+	int Get_nb_frame() const {
+		return mNb_frame;
+	}
+
+	/* submitted, not yet drawn */
+	int Get_nb_pending() const {
+		return mFrame_sub - mFrame_drawn;
+	}
+
+	/* the recording buffer is no longer drawn from */
+	bool Frame_free() const {
+		return mFrame_sub - mFrame_drawn < mNb_frame;
+	}
+
+	/*
+	 * After Frame_free, wait is how long the caller had to wait for it.
+	 * The context carries over, so settings made once stay in effect for all the buffers.
+	 */
+	void Begin_frame(sys_i64 wait) {
+		int idx = mFrame_sub % mNb_frame;
+		if (idx != mIdx_db) {
+			mCtx[idx] = mCtx[mIdx_db];
+			mIdx_db = idx;
+		}
+		mWait = wait;
+		mBegin[mIdx_db] = SYS_get_timestamp();
+		Begin();
+	}
+
+	void Begin() {
+		int idx = mIdx_db;
+		mLyr_wk[idx].Reset();
+		mBatch_wk[idx].Reset();
+		mParam_wk[idx].Reset();
+		mVal_wk[idx].Reset();
+		mBin_wk[idx].Reset();
+		for (int i = 0; i < D_RDR_REC_MAX; ++i) {
+			mRec[idx][i].Reset();
+		}
+		mShadow_state = E_RDR_INIT_EMPTY;
+	}
+
+	/* shadow volume of the work context, built on first use: the view has to be set by then */
+	GEOM_CLIP_VOL* Get_shadow_vol() {
+		QMTX vp;
+		sys_i32 state = *(volatile sys_i32*)&mShadow_state;
+		if (state != E_RDR_INIT_READY) {
+			if (state == E_RDR_INIT_EMPTY && SYNC_cas(&mShadow_state, E_RDR_INIT_BUSY, E_RDR_INIT_EMPTY) == E_RDR_INIT_EMPTY) {
+				Shadow_calc(vp, Get_work_view(), Get_work_shadow());
+				GEOM_clip_vol_init(&mShadow_vol, vp);
+				SYNC_xchg(&mShadow_state, E_RDR_INIT_READY);
+			} else {
+				while (*(volatile sys_i32*)&mShadow_state != E_RDR_INIT_READY) {
+					_mm_pause();
+				}
+			}
+		}
+		return &mShadow_vol;
+	}
+
+	/* slot 0 is the main thread, job workers follow */
+	RDR_REC* Get_rec() {
+		int idx = mIdx_db;
+		return &mRec[idx][JOB_get_worker_id() + 1];
+	}
+
+	void* Get_val(E_RDR_PARAMTYPE type, int nb_item) {
+		int idx = mIdx_db;
+		int nb_vec = (int)D_ALIGN(nb_item*RDR_VAL_WK::Get_item_size(type), 16) / 16;
+		if (nb_vec <= 0) return NULL;
+		return Get_rec()->Get_val(&mVal_wk[idx], nb_vec);
+	}
+
+	RDR_BATCH_PARAM* Get_param(int n) {
+		int idx = mIdx_db;
+		return Get_rec()->Get_param(&mParam_wk[idx], n);
+	}
+
+	RDR_BATCH* Get_batch() {
+		int idx = mIdx_db;
+		return Get_rec()->Get_batch(&mBatch_wk[idx]);
+	}
+
+	void Put_batch(RDR_BATCH* pBatch, sys_ui64 key, sys_uint lyr_no) {
+		int idx = mIdx_db;
+		E_RDR_SORT sort = mLyr_wk[idx].mLyr[lyr_no].mSort;
+		if (sort > E_RDR_SORT_KEY) {
+			key = Batch_sort_key(pBatch, sort);
+		}
+		Get_rec()->Put(&mBin_wk[idx], pBatch, key, lyr_no);
+	}
+
+	/* as is, for replaying recorded keys */
+	void Put_batch_key(RDR_BATCH* pBatch, sys_ui64 key, sys_uint lyr_no) {
+		int idx = mIdx_db;
+		Get_rec()->Put(&mBin_wk[idx], pBatch, key, lyr_no);
+	}
+
+	/*
+	 * Bins are appended slot by slot, in recording order within a slot,
+	 * so the layer order does not depend on thread timing.
+	 */
+	int Merge() {
+		int i, j, k, n, nb_ent;
+		RDR_BIN_CHUNK* pChunk;
+		int idx = mIdx_db;
+		nb_ent = 0;
+		for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			RDR_LAYER* pLyr = &mLyr_wk[idx].mLyr[i];
+			n = 0;
+			for (j = 0; j < D_RDR_REC_MAX; ++j) {
+				for (pChunk = mRec[idx][j].mBin[i].pHead; pChunk; pChunk = pChunk->pNext) {
+					n += pChunk->count;
+				}
+			}
+			pLyr->Reserve(n);
+			for (j = 0; j < D_RDR_REC_MAX; ++j) {
+				for (pChunk = mRec[idx][j].mBin[i].pHead; pChunk; pChunk = pChunk->pNext) {
+					for (k = 0; k < pChunk->count; ++k) {
+						pLyr->Put(pChunk->pBatch[k], pChunk->key[k]);
+					}
+				}
+			}
+			nb_ent += pLyr->Get_count();
+		}
+		return nb_ent;
+	}
+
+	/*
+	 * Folds batches that differ only in their world matrix into one instanced draw,
+	 * placed where the first of them was sorted. Layers with a caller defined order are left alone.
+	 */
+	void Instance() {
+		int i, j, k, n, lim, nb_grp;
+		int grp[D_RDR_INST_GRP];
+		RDR_BATCH** ppBatch;
+		RDR_BATCH* pBatch;
+		RDR_BATCH* pInst;
+		RDR_BATCH_PARAM* pWorld;
+		UVEC* pRow;
+		int idx = mIdx_db;
+
+		for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			RDR_LAYER* pLyr = &mLyr_wk[idx].mLyr[i];
+			if (pLyr->mSort != E_RDR_SORT_STATE && pLyr->mSort != E_RDR_SORT_DEPTH) continue;
+			n = pLyr->Get_count();
+			ppBatch = pLyr->mppBatch;
+			for (j = 0; j < n; ++j) {
+				pBatch = ppBatch[j];
+				if (!pBatch || pBatch->pInst || !Inst_drawable(pBatch) || !Inst_world_param(pBatch)) continue;
+				nb_grp = 0;
+				grp[nb_grp++] = j;
+				lim = D_MIN(n, j + 1 + D_RDR_INST_SCAN);
+				for (k = j + 1; k < lim && nb_grp < D_RDR_INST_GRP; ++k) {
+					if (ppBatch[k] && Inst_match(pBatch, ppBatch[k])) {
+						grp[nb_grp++] = k;
+						lim = D_MIN(n, k + 1 + D_RDR_INST_SCAN);
+					}
+				}
+				if (nb_grp < 2) continue;
+				/* batches can be shared between layers, the instanced one is a copy */
+				pRow = (UVEC*)Get_val(E_RDR_PARAMTYPE_FVEC, nb_grp*3);
+				pInst = pRow ? Get_batch() : NULL;
+				if (!pInst) return;
+				*pInst = *pBatch;
+				for (k = 0; k < nb_grp; ++k) {
+					pWorld = Inst_world_param(ppBatch[grp[k]]);
+					pRow[k*3 + 0].qv = pWorld->pVec[0].qv;
+					pRow[k*3 + 1].qv = pWorld->pVec[1].qv;
+					pRow[k*3 + 2].qv = pWorld->pVec[2].qv;
+					ppBatch[grp[k]] = NULL;
+				}
+				pInst->pInst = pRow;
+				pInst->nb_inst = nb_grp;
+				ppBatch[j] = pInst;
+			}
+		}
+	}
+
+	/* the work side is sorted on the main thread, where the job workers are free to help */
+	void Sort(int nb_wrk) {
+		int idx = mIdx_db;
+		mLyr_wk[idx].Sort(nb_wrk);
+	}
+
+	/* the work side stays on the submitted buffer until the next Begin_frame */
+	void Submit() {
+		int idx = mIdx_db;
+		Get_pool_stats(&mStats[idx].pool);
+		Get_cull_stats(&mStats[idx].cull);
+		SYNC_add(&mFrame_sub, 1);
+	}
+
+	/* the oldest submitted frame becomes the exec side, drawn on a single thread */
+	void Exec_begin() {
+		mIdx_exec = mFrame_drawn % mNb_frame;
+	}
+
+	void Exec(RDR_BATCH_FUNC exec) {
+		int idx = mIdx_exec;
+		mLyr_wk[idx].Exec(exec);
+	}
+
+	void Exec_end(const RDR_CALL_STATS* pCall) {
+		int idx = mIdx_exec;
+		RDR_STATS* pStats = &mStats[idx];
+		for (int i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			pStats->lyr[i] = mLyr_wk[idx].mLyr[i].mStats;
+		}
+		pStats->call = *pCall;
+		pStats->frame.latency = (float)((double)(SYS_get_timestamp() - mBegin[idx]) * 1000.0 / (double)SYS_get_timestamp_freq());
+		SYNC_add(&mFrame_drawn, 1);
+	}
+
+	void Get_cull_stats(RDR_CULL_STATS* pStats) {
+		int idx = mIdx_db;
+		memset(pStats, 0, sizeof(RDR_CULL_STATS));
+		for (int i = 0; i < D_RDR_REC_MAX; ++i) {
+			RDR_CULL_STATS* pRec = &mRec[idx][i].mCull;
+			pStats->nb_cast += pRec->nb_cast;
+			pStats->nb_cast_culled += pRec->nb_cast_culled;
+			pStats->nb_recv += pRec->nb_recv;
+			pStats->nb_recv_culled += pRec->nb_recv_culled;
+		}
+	}
+
+	void Get_pool_stats(RDR_POOL_STATS* pStats) {
+		int idx = mIdx_db;
+		pStats->peak[E_RDR_POOL_BATCH] = mBatch_wk[idx].Get_nb_used();
+		pStats->size[E_RDR_POOL_BATCH] = mBatch_wk[idx].Get_size();
+		pStats->nb_fail[E_RDR_POOL_BATCH] = mBatch_wk[idx].mNb_fail;
+		pStats->peak[E_RDR_POOL_PARAM] = mParam_wk[idx].Get_nb_used();
+		pStats->size[E_RDR_POOL_PARAM] = mParam_wk[idx].Get_size();
+		pStats->nb_fail[E_RDR_POOL_PARAM] = mParam_wk[idx].mNb_fail;
+		pStats->peak[E_RDR_POOL_VAL] = mVal_wk[idx].Get_nb_used();
+		pStats->size[E_RDR_POOL_VAL] = mVal_wk[idx].Get_size();
+		pStats->nb_fail[E_RDR_POOL_VAL] = mVal_wk[idx].mNb_fail;
+		pStats->peak[E_RDR_POOL_BIN] = mBin_wk[idx].Get_nb_used();
+		pStats->size[E_RDR_POOL_BIN] = mBin_wk[idx].Get_size();
+		pStats->nb_fail[E_RDR_POOL_BIN] = mBin_wk[idx].mNb_fail;
+		mLyr_wk[idx].Get_pool_stats(&pStats->peak[E_RDR_POOL_LYR], &pStats->size[E_RDR_POOL_LYR]);
+		pStats->nb_fail[E_RDR_POOL_LYR] = 0;
+	}
+
+	/* the last drawn frame, with the recording side wait */
+	void Get_stats(RDR_STATS* pStats) {
+		int n = mFrame_drawn;
+		if (n > 0) {
+			*pStats = mStats[(n - 1) % mNb_frame];
+		}
+		pStats->frame.wait = (float)((double)mWait * 1000.0 / (double)SYS_get_timestamp_freq());
+		pStats->frame.nb_in_flight = Get_nb_pending();
+	}
+
+	RDR_LAYER* Get_work_lyr(sys_uint lyr_no) {
+		int idx = mIdx_db;
+		return &mLyr_wk[idx].mLyr[lyr_no];
+	}
+
+	RDR_LAYER* Get_exec_lyr(sys_uint lyr_no) {
+		int idx = mIdx_exec;
+		return &mLyr_wk[idx].mLyr[lyr_no];
+	}
+
+	void Set_lyr_sort(sys_uint lyr_no, E_RDR_SORT sort) {
+		for (int i = 0; i < mNb_alloc; ++i) {
+			mLyr_wk[i].mLyr[lyr_no].mSort = sort;
+		}
+	}
+
+	RDR_CONTEXT* Get_work_ctx() {
+		int idx = mIdx_db;
+		return &mCtx[idx];
+	}
+
+	RDR_CONTEXT* Get_exec_ctx() {
+		int idx = mIdx_exec;
+		return &mCtx[idx];
+	}
+
+	RDR_VIEW* Get_work_view() {
+		return &Get_work_ctx()->view;
+	}
+
+	RDR_VIEW* Get_exec_view() {
+		return &Get_exec_ctx()->view;
+	}
+
+	void Apply_exec_view() {
+		QMTX tm;
+		RDR_VIEW* pView = Get_exec_view();
+		MTX_transpose(tm, pView->view_proj);
+		g_rdr_param.view_proj[0].qv = V4_load(tm[0]);
+		g_rdr_param.view_proj[1].qv = V4_load(tm[1]);
+		g_rdr_param.view_proj[2].qv = V4_load(tm[2]);
+		g_rdr_param.view_proj[3].qv = V4_load(tm[3]);
+		g_rdr_param.view_pos.qv = pView->pos.qv;
+	}
+
+	void Apply_exec_fog() {
+		RDR_CONTEXT* pCtx = Get_exec_ctx();
+		RDR_FOG* pFog = &pCtx->fog;
+		RDR_GPARAM* pGP = &g_rdr_param;
+		pGP->fog_param.qv = V4_set(pFog->start, 1.0f/(pFog->end - pFog->start), pFog->curve.p1, pFog->curve.p2);
+		pGP->fog_color.qv = pFog->color.qv;
+	}
+
+	RDR_LIGHT* Get_work_light() {
+		return &Get_work_ctx()->light;
+	}
+
+	RDR_LIGHT* Get_exec_light() {
+		return &Get_exec_ctx()->light;
+	}
+
+	RDR_SHADOW* Get_work_shadow() {
+		return &Get_work_ctx()->shadow;
+	}
+
+	RDR_SHADOW* Get_exec_shadow() {
+		return &Get_exec_ctx()->shadow;
+	}
+};
+
+extern RDR_DB_WK g_rdr_db;
+
+void Apply_param(RDR_BATCH_PARAM* pParam);
+void Capture_frame(void);
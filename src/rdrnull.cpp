@@ -0,0 +1,399 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/*
+ * Headless backend, linked instead of render.cpp.
+ * Resources live in system memory and nothing is drawn, but frames go through
+ * the same recording, merging, sorting, instancing and state tracking as on the device,
+ * so g_rdr_stats means the same thing.
+ */
+
+#include <string.h>
+
+#include "system.h"
+#include "calc.h"
+#include "util.h"
+#include "job.h"
+#include "render.h"
+#include "rdrstate.h"
+#include "rdrdb.h"
+
+/* programs have no register tables here, batch params are laid out in order from register 0 */
+struct NULL_REG {
+	sys_uint f;
+	sys_uint i;
+	sys_uint b;
+	sys_uint smp;
+};
+
+struct RDR_NULL_WORK {
+	RST_TRACKER mState;
+	int mWidth;
+	int mHeight;
+	float mDepth_bias;
+	float mNrm_scale;
+	float mNrm_bias;
+};
+
+static RDR_NULL_WORK s_rdr_null;
+
+static void Null_set_rs(void*, E_RST_RS, sys_ui32) {
+}
+
+static void Null_set_prog(void*, sys_handle, int) {
+}
+
+static void Null_set_vb(void*, RDR_VTX_BUFFER*) {
+}
+
+static void Null_set_ib(void*, RDR_IDX_BUFFER*) {
+}
+
+static void Null_set_smp(void*, sys_uint, int, E_RST_SMP, sys_ui32) {
+}
+
+static void Null_set_tex(void*, sys_uint, int, sys_handle) {
+}
+
+static void Null_set_const_f(void*, const UVEC*, sys_uint, sys_uint, int) {
+}
+
+static void Null_set_const_i(void*, const UVEC*, sys_uint, sys_uint, int) {
+}
+
+static void Null_set_const_b(void*, const sys_byte*, sys_uint, sys_uint, int) {
+}
+
+static const RST_BACKEND s_rst_null = {
+	Null_set_rs,
+	Null_set_prog,
+	Null_set_vb,
+	Null_set_ib,
+	Null_set_smp,
+	Null_set_tex,
+	Null_set_const_f,
+	Null_set_const_i,
+	Null_set_const_b
+};
+
+static sys_handle Null_prog_handle(int id) {
+	return (sys_handle)(sys_intptr)(id + 1);
+}
+
+static void Null_upload(RST_TRACKER* pState, RDR_BATCH_PARAM* pParam, NULL_REG* pReg) {
+	int i, n;
+	UVEC vtmp[32];
+
+	n = pParam->count;
+	switch (pParam->id.type) {
+		case E_RDR_PARAMTYPE_FVEC:
+			RST_set_const_f(pState, pParam->pVec, pReg->f, n, true);
+			pReg->f += n;
+			break;
+		case E_RDR_PARAMTYPE_IVEC:
+			RST_set_const_i(pState, pParam->pVec, pReg->i, n, true);
+			pReg->i += n;
+			break;
+		case E_RDR_PARAMTYPE_FLOAT:
+			n = D_MIN(n, (int)D_ARRAY_LENGTH(vtmp));
+			memset(vtmp, 0, n*sizeof(UVEC));
+			for (i = 0; i < n; ++i) {
+				vtmp[i].f[0] = pParam->pFloat[i];
+			}
+			RST_set_const_f(pState, vtmp, pReg->f, n, true);
+			pReg->f += n;
+			break;
+		case E_RDR_PARAMTYPE_INT:
+			n = D_MIN(n, (int)D_ARRAY_LENGTH(vtmp));
+			memset(vtmp, 0, n*sizeof(UVEC));
+			for (i = 0; i < n; ++i) {
+				vtmp[i].i[0] = pParam->pInt[i];
+			}
+			RST_set_const_i(pState, vtmp, pReg->i, n, true);
+			pReg->i += n;
+			break;
+		case E_RDR_PARAMTYPE_SMP:
+			for (i = 0; i < n; ++i) {
+				RST_set_sampler(pState, &pParam->pSmp[i], pReg->smp, false);
+				++pReg->smp;
+			}
+			break;
+		case E_RDR_PARAMTYPE_BOOL:
+			RST_set_const_b(pState, pParam->pBool, pReg->b, n, true);
+			pReg->b += n;
+			break;
+		default:
+			break;
+	}
+}
+
+static void Batch_exec(RDR_BATCH* pBatch) {
+	int i, n, vtx_prog;
+	NULL_REG reg;
+	RDR_BATCH_PARAM* pParam;
+	RDR_NULL_WORK* pRdr = &s_rdr_null;
+	RST_TRACKER* pState = &pRdr->mState;
+
+	memset(&reg, 0, sizeof(reg));
+	n = pBatch->nb_param;
+	pParam = pBatch->pParam;
+	for (i = 0; i < n; ++i) {
+		Apply_param(pParam);
+		Null_upload(pState, pParam, &reg);
+		++pParam;
+	}
+	RST_set_blend(pState, pBatch->blend_state);
+	RST_set_draw(pState, pBatch->draw_state);
+	vtx_prog = pBatch->pInst ? Inst_vtx_prog(pBatch->vtx_prog) : pBatch->vtx_prog;
+	RST_set_prog(pState, Null_prog_handle(vtx_prog), true);
+	RST_set_prog(pState, Null_prog_handle(pBatch->pix_prog), false);
+	RST_set_vb(pState, pBatch->pVtx);
+	if (pBatch->pIdx) {
+		RST_set_ib(pState, pBatch->pIdx);
+	}
+}
+
+static void GParam_init() {
+	RDR_GPARAM* pGP = &g_rdr_param;
+	memset(&g_rdr_param, 0, sizeof(RDR_GPARAM));
+	pGP->inv_gamma.qv = V4_fill(1.0f);
+#ifdef D_RDR_GP_pos_scale
+	pGP->pos_scale.qv = V4_fill(1.0f);
+#endif
+}
+
+void RDR_init(void* /*hWnd*/, int width, int height, int /*fullscreen*/) {
+	RDR_NULL_WORK* pRdr = &s_rdr_null;
+
+	pRdr->mWidth = width;
+	pRdr->mHeight = height;
+	pRdr->mDepth_bias = 0.0f;
+	pRdr->mNrm_scale = 1.0f;
+	pRdr->mNrm_bias = 0.0f;
+	RST_init(&pRdr->mState, &s_rst_null, pRdr);
+	GParam_init();
+	g_rdr_db.Init();
+	g_rdr_db.Set_nb_frame(CFG_get_i("rdr_frames", D_RDR_FRAME_MIN));
+	memset(&g_rdr_stats, 0, sizeof(RDR_STATS));
+}
+
+void RDR_reset() {
+	RST_invalidate(&s_rdr_null.mState);
+}
+
+void RDR_init_thread_FPU() {
+	SYS_init_FPU();
+}
+
+void RDR_begin() {
+	g_rdr_db.Begin_frame(0);
+}
+
+static void Null_frame() {
+	RDR_NULL_WORK* pRdr = &s_rdr_null;
+	RDR_GPARAM* pGP = &g_rdr_param;
+
+	g_rdr_db.Exec_begin();
+	pGP->vtx_param.qv = V4_set(pRdr->mDepth_bias, pRdr->mNrm_scale, pRdr->mNrm_bias, 0.0f);
+	g_rdr_db.Apply_exec_view();
+	g_rdr_db.Apply_exec_fog();
+	RST_stats_reset(&pRdr->mState);
+	g_rdr_db.Exec(Batch_exec);
+	g_rdr_db.Exec_end(&pRdr->mState.stats);
+}
+
+/* draws the oldest frame once all the work buffers are taken, as the device backend does without its thread */
+void RDR_exec() {
+	g_rdr_db.Merge();
+	Capture_frame();
+	g_rdr_db.Sort(D_MAX_WORKERS);
+	g_rdr_db.Instance();
+	g_rdr_db.Submit();
+	while (g_rdr_db.Get_nb_pending() >= g_rdr_db.Get_nb_frame()) {
+		Null_frame();
+	}
+	g_rdr_db.Get_stats(&g_rdr_stats);
+}
+
+void RDR_set_nvec_encoding(float scale, float bias) {
+	RDR_NULL_WORK* pRdr = &s_rdr_null;
+	pRdr->mNrm_scale = scale;
+	pRdr->mNrm_bias = bias;
+}
+
+static RDR_VTX_BUFFER* VB_create(E_RDR_VTXTYPE type, int n, bool dyn_flg) {
+	RDR_VTX_BUFFER* pVB = NULL;
+	int vsize = 0;
+
+	switch (type) {
+		case E_RDR_VTXTYPE_GENERAL:
+			vsize = sizeof(RDR_VTX_GENERAL);
+			break;
+		case E_RDR_VTXTYPE_SOLID:
+			vsize = sizeof(RDR_VTX_SOLID);
+			break;
+		case E_RDR_VTXTYPE_SKIN:
+			vsize = sizeof(RDR_VTX_SKIN);
+			break;
+		case E_RDR_VTXTYPE_SCREEN:
+			vsize = sizeof(RDR_VTX_SCREEN);
+			break;
+		default:
+			break;
+	}
+	if (vsize && n > 0) {
+		pVB = (RDR_VTX_BUFFER*)SYS_malloc((int)D_ALIGN(sizeof(RDR_VTX_BUFFER), 16) + vsize*n);
+		if (pVB) {
+			memset(pVB, 0, sizeof(RDR_VTX_BUFFER));
+			pVB->type = type;
+			pVB->nb_vtx = n;
+			pVB->vtx_size = vsize;
+			pVB->handle = D_INCR_PTR(pVB, D_ALIGN(sizeof(RDR_VTX_BUFFER), 16));
+			if (dyn_flg) {
+				pVB->attr |= E_RDR_RSRCATTR_DYNAMIC;
+			}
+		} else {
+			SYS_log("Can't create vertex buffer.\n");
+		}
+	}
+	return pVB;
+}
+
+RDR_VTX_BUFFER* RDR_vtx_create(E_RDR_VTXTYPE type, int n) {
+	return VB_create(type, n, false);
+}
+
+RDR_VTX_BUFFER* RDR_vtx_create_dyn(E_RDR_VTXTYPE type, int n) {
+	return VB_create(type, n, true);
+}
+
+void RDR_vtx_release(RDR_VTX_BUFFER* pVB) {
+	if (pVB) {
+		SYS_free(pVB);
+	}
+}
+
+void RDR_vtx_lock(RDR_VTX_BUFFER* pVB) {
+	if (pVB) {
+		if (pVB->locked.pData) {
+			SYS_log("RDR_vtx_lock: already locked\n");
+		} else {
+			pVB->locked.pData = pVB->handle;
+		}
+	}
+}
+
+void RDR_vtx_unlock(RDR_VTX_BUFFER* pVB) {
+	if (pVB) {
+		if (pVB->locked.pData) {
+			pVB->locked.pData = NULL;
+		} else {
+			SYS_log("RDR_vtx_unlock: not locked\n");
+		}
+	}
+}
+
+static RDR_IDX_BUFFER* IB_create(E_RDR_IDXTYPE type, int n, bool dyn_flg) {
+	RDR_IDX_BUFFER* pIB = NULL;
+	int len = 0;
+
+	switch (type) {
+		case E_RDR_IDXTYPE_16BIT:
+			len = n*sizeof(sys_ui16);
+			break;
+		case E_RDR_IDXTYPE_32BIT:
+			len = n*sizeof(sys_ui32);
+			break;
+		default:
+			break;
+	}
+	if (len > 0) {
+		pIB = (RDR_IDX_BUFFER*)SYS_malloc((int)D_ALIGN(sizeof(RDR_IDX_BUFFER), 16) + len);
+		if (pIB) {
+			memset(pIB, 0, sizeof(RDR_IDX_BUFFER));
+			pIB->type = type;
+			pIB->nb_idx = n;
+			pIB->handle = D_INCR_PTR(pIB, D_ALIGN(sizeof(RDR_IDX_BUFFER), 16));
+			if (dyn_flg) {
+				pIB->attr |= E_RDR_RSRCATTR_DYNAMIC;
+			}
+		} else {
+			SYS_log("Can't create index buffer.\n");
+		}
+	}
+	return pIB;
+}
+
+RDR_IDX_BUFFER* RDR_idx_create(E_RDR_IDXTYPE type, int n) {
+	return IB_create(type, n, false);
+}
+
+RDR_IDX_BUFFER* RDR_idx_create_dyn(E_RDR_IDXTYPE type, int n) {
+	return IB_create(type, n, true);
+}
+
+void RDR_idx_release(RDR_IDX_BUFFER* pIB) {
+	if (pIB) {
+		SYS_free(pIB);
+	}
+}
+
+void RDR_idx_lock(RDR_IDX_BUFFER* pIB) {
+	if (pIB) {
+		if (pIB->pData) {
+			SYS_log("RDR_idx_lock: already locked\n");
+		} else {
+			pIB->pData = pIB->handle;
+		}
+	}
+}
+
+void RDR_idx_unlock(RDR_IDX_BUFFER* pIB) {
+	if (pIB) {
+		if (pIB->pData) {
+			pIB->pData = NULL;
+		} else {
+			SYS_log("RDR_idx_unlock: not locked\n");
+		}
+	}
+}
+
+/* the texels are not kept, only what a sampler needs to tell textures apart */
+RDR_TEXTURE* RDR_tex_create(void* /*pTop*/, int w, int h, int d, int nb_lvl, sys_ui32 /*fmt*/, sys_i32* /*pOffs*/) {
+	RDR_TEXTURE* pTex;
+
+	if (d > 0) return NULL;
+	pTex = (RDR_TEXTURE*)SYS_malloc(sizeof(RDR_TEXTURE));
+	if (pTex) {
+		memset(pTex, 0, sizeof(RDR_TEXTURE));
+		pTex->handle = pTex;
+		pTex->w = w;
+		pTex->h = h;
+		pTex->nb_lvl = nb_lvl;
+		pTex->type = d < 0 ? E_RDR_TEXTYPE_CUBE : E_RDR_TEXTYPE_2D;
+	}
+	return pTex;
+}
+
+void RDR_tex_release(RDR_TEXTURE* pTex) {
+	if (pTex) {
+		SYS_free(pTex);
+	}
+}
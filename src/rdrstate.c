@@ -0,0 +1,256 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+#include <string.h>
+
+#include "system.h"
+#include "calc.h"
+#include "util.h"
+#include "render.h"
+#include "rdrstate.h"
+
+void RST_init(RST_TRACKER* pTrk, const RST_BACKEND* pBackend, void* pCtx) {
+	memset(pTrk, 0, sizeof(RST_TRACKER));
+	pTrk->pBackend = pBackend;
+	pTrk->pCtx = pCtx;
+}
+
+/* whatever the device holds is unknown, e.g. after a reset or a direct device call */
+void RST_invalidate(RST_TRACKER* pTrk) {
+	memset(&pTrk->valid, 0, sizeof(RST_VALID));
+}
+
+void RST_stats_reset(RST_TRACKER* pTrk) {
+	memset(&pTrk->stats, 0, sizeof(RDR_CALL_STATS));
+}
+
+static void Rst_rs(RST_TRACKER* pTrk, E_RST_RS rs, sys_ui32 val) {
+	if (D_BIT_CK(pTrk->valid.rs, rs) && pTrk->rs[rs] == val) {
+		++pTrk->stats.skipped[E_RDR_CALL_RS];
+		return;
+	}
+	pTrk->rs[rs] = val;
+	D_BIT_ST(pTrk->valid.rs, rs);
+	++pTrk->stats.issued[E_RDR_CALL_RS];
+	pTrk->pBackend->set_rs(pTrk->pCtx, rs, val);
+}
+
+void RST_set_blend(RST_TRACKER* pTrk, RDR_BLEND_STATE bs) {
+	Rst_rs(pTrk, E_RST_RS_BLEND_ON, bs.on);
+	if (bs.on) {
+		Rst_rs(pTrk, E_RST_RS_BLEND_OP, bs.op);
+		Rst_rs(pTrk, E_RST_RS_BLEND_SRC, bs.src);
+		Rst_rs(pTrk, E_RST_RS_BLEND_DST, bs.dst);
+		Rst_rs(pTrk, E_RST_RS_BLEND_OP_A, bs.op_a);
+		Rst_rs(pTrk, E_RST_RS_BLEND_SRC_A, bs.src_a);
+		Rst_rs(pTrk, E_RST_RS_BLEND_DST_A, bs.dst_a);
+	}
+}
+
+void RST_set_draw(RST_TRACKER* pTrk, RDR_DRAW_STATE ds) {
+	Rst_rs(pTrk, E_RST_RS_COLOR_MASK, ds.color_mask);
+	Rst_rs(pTrk, E_RST_RS_CULL, ds.cull);
+	Rst_rs(pTrk, E_RST_RS_ZWRITE, ds.zwrite);
+	Rst_rs(pTrk, E_RST_RS_ZTEST, ds.ztest);
+	if (ds.ztest) {
+		Rst_rs(pTrk, E_RST_RS_ZFUNC, ds.zfunc);
+	}
+	Rst_rs(pTrk, E_RST_RS_ATEST, ds.atest);
+	if (ds.atest) {
+		Rst_rs(pTrk, E_RST_RS_AFUNC, ds.afunc);
+	}
+	Rst_rs(pTrk, E_RST_RS_MSAA, ds.msaa);
+}
+
+void RST_set_prog(RST_TRACKER* pTrk, sys_handle hProg, int vtx_flg) {
+	int idx = !!vtx_flg;
+	if ((pTrk->valid.prog & (1 << idx)) && pTrk->prog[idx] == hProg) {
+		++pTrk->stats.skipped[E_RDR_CALL_PROG];
+		return;
+	}
+	pTrk->prog[idx] = hProg;
+	pTrk->valid.prog |= 1 << idx;
+	++pTrk->stats.issued[E_RDR_CALL_PROG];
+	pTrk->pBackend->set_prog(pTrk->pCtx, hProg, vtx_flg);
+}
+
+void RST_set_vb(RST_TRACKER* pTrk, RDR_VTX_BUFFER* pVB) {
+	if (pTrk->valid.vb && pTrk->pVB == pVB) {
+		++pTrk->stats.skipped[E_RDR_CALL_VB];
+		return;
+	}
+	pTrk->pVB = pVB;
+	pTrk->valid.vb = 1;
+	++pTrk->stats.issued[E_RDR_CALL_VB];
+	pTrk->pBackend->set_vb(pTrk->pCtx, pVB);
+}
+
+void RST_set_ib(RST_TRACKER* pTrk, RDR_IDX_BUFFER* pIB) {
+	if (pTrk->valid.ib && pTrk->pIB == pIB) {
+		++pTrk->stats.skipped[E_RDR_CALL_IB];
+		return;
+	}
+	pTrk->pIB = pIB;
+	pTrk->valid.ib = 1;
+	++pTrk->stats.issued[E_RDR_CALL_IB];
+	pTrk->pBackend->set_ib(pTrk->pCtx, pIB);
+}
+
+static void Rst_smp(RST_TRACKER* pTrk, sys_uint slot, sys_uint stage, int vtx_flg, E_RST_SMP smp, sys_ui32 val) {
+	sys_uint bit = slot*E_RST_SMP_MAX + smp;
+	if (slot < D_RST_MAX_STAGE) {
+		if (D_BIT_CK(pTrk->valid.smp, bit) && pTrk->smp[slot][smp] == val) {
+			++pTrk->stats.skipped[E_RDR_CALL_SMP];
+			return;
+		}
+		pTrk->smp[slot][smp] = val;
+		D_BIT_ST(pTrk->valid.smp, bit);
+	}
+	++pTrk->stats.issued[E_RDR_CALL_SMP];
+	pTrk->pBackend->set_smp(pTrk->pCtx, stage, vtx_flg, smp, val);
+}
+
+void RST_set_sampler(RST_TRACKER* pTrk, RDR_SAMPLER* pSmp, sys_uint stage, int vtx_flg) {
+	sys_uint slot;
+	union {
+		float f32;
+		sys_ui32 u32;
+	} d32;
+
+	slot = vtx_flg ? D_RST_VTX_STAGE + stage : stage;
+	if (!vtx_flg && stage >= D_RST_VTX_STAGE) {
+		slot = D_RST_MAX_STAGE;
+	}
+	d32.f32 = pSmp->mip_bias;
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_MIP_BIAS, d32.u32);
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_BORDER, pSmp->border.argb32);
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_ADDR_U, pSmp->addr_u);
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_ADDR_V, pSmp->addr_v);
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_ADDR_W, pSmp->addr_w);
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_MIN, pSmp->min);
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_MAG, pSmp->mag);
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_MIP, pSmp->mip);
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_MAX_MIP, pSmp->max_mip);
+	Rst_smp(pTrk, slot, stage, vtx_flg, E_RST_SMP_ANISOTROPY, pSmp->anisotropy);
+	if (slot < D_RST_MAX_STAGE) {
+		if (D_BIT_CK(pTrk->valid.tex, slot) && pTrk->tex[slot] == pSmp->hTex) {
+			++pTrk->stats.skipped[E_RDR_CALL_TEX];
+			return;
+		}
+		pTrk->tex[slot] = pSmp->hTex;
+		D_BIT_ST(pTrk->valid.tex, slot);
+	}
+	++pTrk->stats.issued[E_RDR_CALL_TEX];
+	pTrk->pBackend->set_tex(pTrk->pCtx, stage, vtx_flg, pSmp->hTex);
+}
+
+static D_FORCE_INLINE int Rst_vec_eq(const UVEC* pA, const UVEC* pB) {
+	return pA->i[0] == pB->i[0] && pA->i[1] == pB->i[1] && pA->i[2] == pB->i[2] && pA->i[3] == pB->i[3];
+}
+
+/*
+ * Updates the shadow registers and returns the first changed element, or -1;
+ * *pLast gets the last one. Registers past the shadow size always count as changed.
+ */
+static int Rst_diff_vec(UVEC* pShadow, sys_ui32* pValid, sys_uint lim, const UVEC* pData, sys_uint org, sys_uint count, sys_uint* pLast) {
+	sys_uint i, reg;
+	int first = -1;
+	for (i = 0; i < count; ++i) {
+		reg = org + i;
+		if (reg >= lim) {
+			if (first < 0) first = (int)i;
+			*pLast = count - 1;
+			break;
+		}
+		if (!D_BIT_CK(pValid, reg) || !Rst_vec_eq(&pShadow[reg], &pData[i])) {
+			pShadow[reg] = pData[i];
+			D_BIT_ST(pValid, reg);
+			if (first < 0) first = (int)i;
+			*pLast = i;
+		}
+	}
+	return first;
+}
+
+void RST_set_const_f(RST_TRACKER* pTrk, const UVEC* pData, sys_uint org, sys_uint count, int vtx_flg) {
+	int first;
+	sys_uint last = 0;
+	if (vtx_flg) {
+		first = Rst_diff_vec(pTrk->vtx_f, pTrk->valid.vtx_f, D_RST_VTX_FVEC, pData, org, count, &last);
+	} else {
+		first = Rst_diff_vec(pTrk->pix_f, pTrk->valid.pix_f, D_RST_PIX_FVEC, pData, org, count, &last);
+	}
+	if (first < 0) {
+		++pTrk->stats.skipped[E_RDR_CALL_CONST_F];
+		return;
+	}
+	++pTrk->stats.issued[E_RDR_CALL_CONST_F];
+	pTrk->stats.nb_const_vec += last - first + 1;
+	pTrk->pBackend->set_const_f(pTrk->pCtx, pData + first, org + first, last - first + 1, vtx_flg);
+}
+
+void RST_set_const_i(RST_TRACKER* pTrk, const UVEC* pData, sys_uint org, sys_uint count, int vtx_flg) {
+	int first;
+	sys_uint last = 0;
+	if (vtx_flg) {
+		first = Rst_diff_vec(pTrk->vtx_i, pTrk->valid.vtx_i, D_RST_IVEC, pData, org, count, &last);
+	} else {
+		first = Rst_diff_vec(pTrk->pix_i, pTrk->valid.pix_i, D_RST_IVEC, pData, org, count, &last);
+	}
+	if (first < 0) {
+		++pTrk->stats.skipped[E_RDR_CALL_CONST_I];
+		return;
+	}
+	++pTrk->stats.issued[E_RDR_CALL_CONST_I];
+	pTrk->stats.nb_const_vec += last - first + 1;
+	pTrk->pBackend->set_const_i(pTrk->pCtx, pData + first, org + first, last - first + 1, vtx_flg);
+}
+
+void RST_set_const_b(RST_TRACKER* pTrk, const sys_byte* pData, sys_uint org, sys_uint count, int vtx_flg) {
+	sys_uint i, reg, last;
+	int first;
+	sys_byte val;
+	sys_byte* pShadow = vtx_flg ? pTrk->vtx_b : pTrk->pix_b;
+	sys_ui32* pValid = vtx_flg ? pTrk->valid.vtx_b : pTrk->valid.pix_b;
+
+	first = -1;
+	last = 0;
+	for (i = 0; i < count; ++i) {
+		reg = org + i;
+		if (reg >= D_RST_BOOL) {
+			if (first < 0) first = (int)i;
+			last = count - 1;
+			break;
+		}
+		val = !!pData[i];
+		if (!D_BIT_CK(pValid, reg) || pShadow[reg] != val) {
+			pShadow[reg] = val;
+			D_BIT_ST(pValid, reg);
+			if (first < 0) first = (int)i;
+			last = i;
+		}
+	}
+	if (first < 0) {
+		++pTrk->stats.skipped[E_RDR_CALL_CONST_B];
+		return;
+	}
+	++pTrk->stats.issued[E_RDR_CALL_CONST_B];
+	pTrk->pBackend->set_const_b(pTrk->pCtx, pData + first, org + first, last - first + 1, vtx_flg);
+}
@@ -0,0 +1,121 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/* shadow copy of device state, only changed values reach the backend */
+
+#define D_RST_MAX_STAGE (20) /* 16 pixel + 4 vertex samplers */
+#define D_RST_VTX_STAGE (16)
+#define D_RST_VTX_FVEC (256)
+#define D_RST_PIX_FVEC (224)
+#define D_RST_IVEC (16)
+#define D_RST_BOOL (16)
+
+typedef enum _E_RST_RS {
+	E_RST_RS_BLEND_ON,
+	E_RST_RS_BLEND_OP,
+	E_RST_RS_BLEND_SRC,
+	E_RST_RS_BLEND_DST,
+	E_RST_RS_BLEND_OP_A,
+	E_RST_RS_BLEND_SRC_A,
+	E_RST_RS_BLEND_DST_A,
+	E_RST_RS_COLOR_MASK,
+	E_RST_RS_CULL,
+	E_RST_RS_ZWRITE,
+	E_RST_RS_ZTEST,
+	E_RST_RS_ZFUNC,
+	E_RST_RS_ATEST,
+	E_RST_RS_AFUNC,
+	E_RST_RS_MSAA,
+	E_RST_RS_MAX
+} E_RST_RS;
+
+typedef enum _E_RST_SMP {
+	E_RST_SMP_MIP_BIAS,
+	E_RST_SMP_BORDER,
+	E_RST_SMP_ADDR_U,
+	E_RST_SMP_ADDR_V,
+	E_RST_SMP_ADDR_W,
+	E_RST_SMP_MIN,
+	E_RST_SMP_MAG,
+	E_RST_SMP_MIP,
+	E_RST_SMP_MAX_MIP,
+	E_RST_SMP_ANISOTROPY,
+	E_RST_SMP_MAX
+} E_RST_SMP;
+
+/* values are the engine's E_RDR_* enums, translation is up to the backend */
+typedef struct _RST_BACKEND {
+	void (*set_rs)(void* pCtx, E_RST_RS rs, sys_ui32 val);
+	void (*set_prog)(void* pCtx, sys_handle hProg, int vtx_flg);
+	void (*set_vb)(void* pCtx, RDR_VTX_BUFFER* pVB);
+	void (*set_ib)(void* pCtx, RDR_IDX_BUFFER* pIB);
+	void (*set_smp)(void* pCtx, sys_uint stage, int vtx_flg, E_RST_SMP smp, sys_ui32 val);
+	void (*set_tex)(void* pCtx, sys_uint stage, int vtx_flg, sys_handle hTex);
+	void (*set_const_f)(void* pCtx, const UVEC* pData, sys_uint org, sys_uint count, int vtx_flg);
+	void (*set_const_i)(void* pCtx, const UVEC* pData, sys_uint org, sys_uint count, int vtx_flg);
+	void (*set_const_b)(void* pCtx, const sys_byte* pData, sys_uint org, sys_uint count, int vtx_flg);
+} RST_BACKEND;
+
+typedef struct _RST_VALID {
+	D_BIT_ARY(rs, E_RST_RS_MAX);
+	D_BIT_ARY(smp, D_RST_MAX_STAGE*E_RST_SMP_MAX);
+	D_BIT_ARY(tex, D_RST_MAX_STAGE);
+	D_BIT_ARY(vtx_f, D_RST_VTX_FVEC);
+	D_BIT_ARY(pix_f, D_RST_PIX_FVEC);
+	D_BIT_ARY(vtx_i, D_RST_IVEC);
+	D_BIT_ARY(pix_i, D_RST_IVEC);
+	D_BIT_ARY(vtx_b, D_RST_BOOL);
+	D_BIT_ARY(pix_b, D_RST_BOOL);
+	sys_ui32 prog : 2;
+	sys_ui32 vb   : 1;
+	sys_ui32 ib   : 1;
+} RST_VALID;
+
+typedef struct _RST_TRACKER {
+	UVEC vtx_f[D_RST_VTX_FVEC];
+	UVEC pix_f[D_RST_PIX_FVEC];
+	UVEC vtx_i[D_RST_IVEC];
+	UVEC pix_i[D_RST_IVEC];
+	sys_byte vtx_b[D_RST_BOOL];
+	sys_byte pix_b[D_RST_BOOL];
+	sys_ui32 rs[E_RST_RS_MAX];
+	sys_ui32 smp[D_RST_MAX_STAGE][E_RST_SMP_MAX];
+	sys_handle tex[D_RST_MAX_STAGE];
+	sys_handle prog[2]; /* pix, vtx */
+	RDR_VTX_BUFFER* pVB;
+	RDR_IDX_BUFFER* pIB;
+	RST_VALID valid;
+	RDR_CALL_STATS stats;
+	const RST_BACKEND* pBackend;
+	void* pCtx;
+} RST_TRACKER;
+
+D_EXTERN_FUNC void RST_init(RST_TRACKER* pTrk, const RST_BACKEND* pBackend, void* pCtx);
+D_EXTERN_FUNC void RST_invalidate(RST_TRACKER* pTrk);
+D_EXTERN_FUNC void RST_stats_reset(RST_TRACKER* pTrk);
+D_EXTERN_FUNC void RST_set_blend(RST_TRACKER* pTrk, RDR_BLEND_STATE bs);
+D_EXTERN_FUNC void RST_set_draw(RST_TRACKER* pTrk, RDR_DRAW_STATE ds);
+D_EXTERN_FUNC void RST_set_prog(RST_TRACKER* pTrk, sys_handle hProg, int vtx_flg);
+D_EXTERN_FUNC void RST_set_vb(RST_TRACKER* pTrk, RDR_VTX_BUFFER* pVB);
+D_EXTERN_FUNC void RST_set_ib(RST_TRACKER* pTrk, RDR_IDX_BUFFER* pIB);
+D_EXTERN_FUNC void RST_set_sampler(RST_TRACKER* pTrk, RDR_SAMPLER* pSmp, sys_uint stage, int vtx_flg);
+D_EXTERN_FUNC void RST_set_const_f(RST_TRACKER* pTrk, const UVEC* pData, sys_uint org, sys_uint count, int vtx_flg);
+D_EXTERN_FUNC void RST_set_const_i(RST_TRACKER* pTrk, const UVEC* pData, sys_uint org, sys_uint count, int vtx_flg);
+D_EXTERN_FUNC void RST_set_const_b(RST_TRACKER* pTrk, const sys_byte* pData, sys_uint org, sys_uint count, int vtx_flg);
@@ -28,12 +28,11 @@
 #include "util.h"
 #include "job.h"
 #include "render.h"
+#include "rdrstate.h"
+#include "rdrdb.h"
 
-#define D_PIX_BOOL_CK (16)
-#define D_PIX_FVEC_CK (48)
-#define D_VTX_FVEC_CK (64)
-
-RDR_GPARAM g_rdr_param;
+#define D_RDR_INST_MAX (4096) /* instance stream ring */
+#define D_RDR_INST_STRIDE (3*sizeof(UVEC))
 
 static ULONG Safe_release(IUnknown* pUnk);
 static IDirect3DDevice9* Get_dev();
@@ -48,43 +47,7 @@ static RDR_TARGET* Rt_create_fp(int w, int h, bool mono_flg, D3DFORMAT fmt, D3DF
 static void Batch_exec(RDR_BATCH* pBatch);
 static void Set_vb(RDR_VTX_BUFFER* pVB);
 static void Set_rt(RDR_TARGET* pRT);
-static void Rdr_draw();
-
-template <int N> struct CONST_CACHE {
-	__m128 mState[N];
-
-	void Init() {
-		memset(mState, 0, sizeof(mState));
-	}
-
-	D_FORCE_INLINE sys_uint Check(const UVEC* pSrc, sys_uint org, sys_uint count) {
-		sys_uint i, set_count;
-		if (org + count > N) {
-			set_count = count;
-			if (org < N) {
-				__m128* pDst = &mState[org];
-				for (i = 0; i < N - org; ++i) {
-					*pDst = pSrc->qv;
-					++pSrc;
-					++pDst;
-				}
-			}
-		} else {
-			__m128* pDst = &mState[org];
-			set_count = 0;
-			for (i = 0; i < count; ++i) {
-				__m128 val128 = pSrc->qv;
-				if (0xF != _mm_movemask_ps(_mm_cmpeq_ps(*pDst, val128))) {
-					*pDst = val128;
-					++set_count;
-				}
-				++pSrc;
-				++pDst;
-			}
-		}
-		return set_count;
-	}
-};
+static void Rdr_frame();
 
 struct GPU_HEAD {
 	sys_ui32 magic;
@@ -263,427 +226,6 @@ struct GPU_CODE {
 };
 
 
-struct RDR_LAYER;
-typedef void (*RDR_LYR_FUNC)(RDR_LAYER* pLyr);
-
-struct RDR_LAYER {
-	RDR_BATCH** mppBatch;
-	sys_ui32*   mpKey;
-	LONG mCount;
-	int mSize;
-	const char* mName;
-	RDR_LYR_FUNC mpPrologue;
-	RDR_LYR_FUNC mpEpilogue;
-
-	void Alloc(const char* name, int n, bool sorted) {
-		mName = name;
-		mSize = n;
-		mppBatch = (RDR_BATCH**)SYS_malloc(n*sizeof(RDR_BATCH*));
-		mpKey = NULL;
-		if (sorted) {
-			mpKey = (sys_ui32*)SYS_malloc(n*sizeof(sys_ui32));
-		}
-		mCount = 0;
-		mpPrologue = NULL;
-		mpEpilogue = NULL;
-	}
-
-	void Reset() {
-		mCount = 0;
-	}
-
-	void Put(RDR_BATCH* pEntry, sys_ui32 key) {
-		LONG idx = _InterlockedExchangeAdd(&mCount, 1);
-		if (idx < mSize) {
-			mppBatch[idx] = pEntry;
-			if (mpKey) {
-				mpKey[idx] = key;
-			}
-		} else {
-			SYS_log("Layer overflow [%s]\n", mName);
-		}
-	}
-
-	void Swap(int i0, int i1) {
-		sys_ui32 k = mpKey[i0];
-		mpKey[i0] = mpKey[i1];
-		mpKey[i1] = k;
-		RDR_BATCH* pBatch = mppBatch[i0];
-		mppBatch[i0] = mppBatch[i1];
-		mppBatch[i1] = pBatch;
-	}
-
-	void Sort_sub(int left, int right) {
-		int count, mid, lo, hi;
-
-		count = right - left;
-		if (count < 0) return;
-		mid = count / 2;
-		lo = left;
-		hi = right;
-		sys_ui32* pKey = mpKey;
-		sys_ui32 k = pKey[left + mid];
-		while (lo < hi) {
-			if (pKey[lo] < k) {
-				++lo;
-			} else if (pKey[hi] > k) {
-				--hi;
-			} else {
-				Swap(lo, hi);
-				++lo;
-				--hi;
-			}
-		}
-		if (lo == hi) {
-			if (count == 1) return;
-			if (pKey[lo] < k) {
-				++lo;
-			} else {
-				--hi;
-			}
-		}
-		if (left < hi) {
-			Sort_sub(left, hi);
-		}
-		if (lo < right) {
-			Sort_sub(lo, right);
-		}
-	}
-
-	void Sort() {
-		if (!mpKey || mCount <= 0) return;
-		Sort_sub(0, mCount-1);
-	}
-
-	void Exec() {
-		int i, n;
-		RDR_BATCH** ppBatch = mppBatch;
-		n = mCount;
-		//if (n <= 0) return;
-		Sort();
-		if (mpPrologue) {
-			mpPrologue(this);
-		}
-		for (i = 0; i < n; ++i) {
-			if (*ppBatch) {
-				Batch_exec(*ppBatch);
-			}
-			++ppBatch;
-		}
-		if (mpEpilogue) {
-			mpEpilogue(this);
-		}
-	}
-};
-
-struct RDR_LYR_WK {
-	RDR_LAYER mLyr[E_RDR_LAYER_MAX];
-
-	void Init() {
-		int n = 32768;
-		mLyr[E_RDR_LAYER_ZBUF].Alloc("ZBUF", n, false);
-		mLyr[E_RDR_LAYER_CAST].Alloc("CAST", n, false);
-		mLyr[E_RDR_LAYER_MTL0].Alloc("MTL0", n, false);
-		mLyr[E_RDR_LAYER_MTL1].Alloc("MTL1", n, true);
-		mLyr[E_RDR_LAYER_RECV].Alloc("RECV", n, false);
-		mLyr[E_RDR_LAYER_MTL2].Alloc("MTL2", n, true);
-		mLyr[E_RDR_LAYER_PTCL].Alloc("PTCL", n, true);
-	}
-
-	void Reset() {
-		for (int i = 0; i < D_ARRAY_LENGTH(mLyr); ++i) {
-			mLyr[i].Reset();
-		}
-	}
-
-	void Exec() {
-		for (int i = 0; i < D_ARRAY_LENGTH(mLyr); ++i) {
-			mLyr[i].Exec();
-		}
-	}
-};
-
-struct RDR_BATCH_WK {
-	RDR_BATCH* mpBatch;
-	LONG mCount;
-	int mSize;
-
-	void Alloc(int n) {
-		mSize = n;
-		mpBatch = (RDR_BATCH*)SYS_malloc(n*sizeof(RDR_BATCH));
-		mCount = 0;
-	}
-
-	void Reset() {
-		mCount = 0;
-	}
-
-	RDR_BATCH* Get() {
-		RDR_BATCH* pRes = NULL;
-		LONG idx = _InterlockedExchangeAdd(&mCount, 1);
-		if (idx < mSize) {
-			pRes = mpBatch + idx;
-		} else {
-			SYS_log("Batch work overflow\n");
-		}
-		return pRes;
-	}
-};
-
-struct RDR_PARAM_WK {
-	RDR_BATCH_PARAM* mpParam;
-	LONG mCount;
-	int mSize;
-
-	void Alloc(int n) {
-		mSize = n;
-		mpParam = (RDR_BATCH_PARAM*)SYS_malloc(n*sizeof(RDR_BATCH_PARAM));
-		mCount = 0;
-	}
-
-	void Reset() {
-		mCount = 0;
-	}
-
-	RDR_BATCH_PARAM* Get(int n) {
-		RDR_BATCH_PARAM* pParam = NULL;
-		LONG idx = _InterlockedExchangeAdd(&mCount, n);
-		if (idx < mSize) {
-			pParam = mpParam + idx;
-		} else {
-			SYS_log("Param work overflow\n");
-		}
-		return pParam;
-	}
-};
-
-struct RDR_VAL_WK {
-	__m128* mpMem;
-	LONG mCount;
-	int mSize;
-
-	void Alloc(int n) {
-		mSize = n;
-		mpMem = (__m128*)SYS_malloc(n*sizeof(__m128));
-		mCount = 0;
-	}
-
-	void Reset() {
-		mCount = 0;
-	}
-
-	void* Get(int data_size) {
-		void* pRes = NULL;
-		data_size = (int)D_ALIGN(data_size, 16);
-		int incr = data_size / 16;
-		LONG idx = _InterlockedExchangeAdd(&mCount, incr);
-		if (idx < mSize) {
-			pRes = mpMem + idx;
-		} else {
-			SYS_log("Value work overflow\n");
-		}
-		return pRes;
-	}
-
-	void* Get_items(E_RDR_PARAMTYPE type, int nb_item) {
-		void* pRes = NULL;
-		int item_size = 0;
-		switch (type) {
-			case E_RDR_PARAMTYPE_FVEC:
-			case E_RDR_PARAMTYPE_IVEC:
-				item_size = sizeof(UVEC);
-				break;
-			case E_RDR_PARAMTYPE_INT:
-				item_size = sizeof(sys_i32);
-				break;
-			case E_RDR_PARAMTYPE_FLOAT:
-				item_size = sizeof(float);
-				break;
-			case E_RDR_PARAMTYPE_SMP:
-				item_size = sizeof(RDR_SAMPLER);
-				break;
-			case E_RDR_PARAMTYPE_BOOL:
-				item_size = sizeof(sys_byte);
-				break;
-			default:
-				break;
-		}
-		if (item_size) {
-			pRes = Get(nb_item*item_size);
-		}
-		return pRes;
-	}
-};
-
-struct RDR_DB_WK {
-	int mIdx_db;
-	RDR_LYR_WK mLyr_wk[2];
-	RDR_BATCH_WK mBatch_wk[2];
-	RDR_PARAM_WK mParam_wk[2];
-	RDR_VAL_WK mVal_wk[2];
-	RDR_CONTEXT mCtx[2];
-
-	static void Set_def_light(RDR_CONTEXT* pCtx) {
-		RDR_LIGHT* pLit = &pCtx->light;
-		pLit->headlight_color.qv = V4_set(0.7f, 0.7f, 0.7f, 1.0f);
-		pLit->sh_intensity = 0.1f;
-	}
-
-	static void Set_def_shadow(RDR_CONTEXT* pCtx) {
-		RDR_SHADOW* pSdw = &pCtx->shadow;
-		pSdw->dir.qv = V4_normalize(V4_set_vec(-0.15f, -0.9f, -0.6f));
-		pSdw->color_density.qv = V4_set(0.1f, 0.1f, 0.0f, 0.8f);
-	}
-
-	static void Set_def_view(RDR_CONTEXT* pCtx) {
-		RDR_VIEW* pView = &pCtx->view;
-		pView->pos.qv = V4_set_pnt(7.0f, 3.0f, 12.0f);
-		MTX_make_view(pView->view, pView->pos.qv, V4_set_w1(V4_zero()), V4_load(g_identity[1]));
-		MTX_invert(pView->iview, pView->view);
-		pView->dir.qv = V4_scale(V4_load(pView->iview[2]), -1.0f);
-		MTX_make_proj(pView->proj, D_DEG2RAD(40.0f), 320.0f/240.0f, 0.1f, 10000.0f);
-		MTX_invert(pView->iproj, pView->proj);
-		MTX_mul(pView->view_proj, pView->view, pView->proj);
-	}
-
-	static void Set_def_fog(RDR_CONTEXT* pCtx) {
-		RDR_FOG* pFog = &pCtx->fog;
-		pFog->start = 0.0f;
-		pFog->end = 100.0f;
-		SPL_bezier01_reset(&pFog->curve);
-		pFog->color.r = 0.9f;
-		pFog->color.g = 0.9f;
-		pFog->color.b = 0.8f;
-		pFog->color.a = 0.0f;
-	}
-
-	void Init_ctx(int idx) {
-		RDR_CONTEXT* pCtx = &mCtx[idx];
-		Set_def_light(pCtx);
-		Set_def_shadow(pCtx);
-		Set_def_view(pCtx);
-		Set_def_fog(pCtx);
-		pCtx->clear_color = D_RDR_ARGB32(0xFF, 0x55, 0x66, 0x77);
-	}
-
-	void Init() {
-		mIdx_db = 0;
-		mLyr_wk[0].Init();
-		mLyr_wk[1].Init();
-
-		int n = 16384;
-		mBatch_wk[0].Alloc(n);
-		mBatch_wk[1].Alloc(n);
-
-		n = 8192;
-		mVal_wk[0].Alloc(n);
-		mVal_wk[1].Alloc(n);
-
-		n = 8192;
-		mParam_wk[0].Alloc(n);
-		mParam_wk[1].Alloc(n);
-
-		Init_ctx(0);
-		Init_ctx(1);
-	}
-
-	void Begin() {
-		int idx = mIdx_db;
-		mLyr_wk[idx].Reset();
-		mBatch_wk[idx].Reset();
-		mParam_wk[idx].Reset();
-		mVal_wk[idx].Reset();
-	}
-
-	void* Get_val(E_RDR_PARAMTYPE type, int nb_item) {
-		int idx = mIdx_db;
-		return mVal_wk[idx].Get_items(type, nb_item);
-	}
-
-	RDR_BATCH_PARAM* Get_param(int n) {
-		int idx = mIdx_db;
-		return mParam_wk[idx].Get(n);
-	}
-
-	RDR_BATCH* Get_batch() {
-		int idx = mIdx_db;
-		return mBatch_wk[idx].Get();
-	}
-
-	void Put_batch(RDR_BATCH* pBatch, sys_ui32 key, sys_uint lyr_no) {
-		int idx = mIdx_db;
-		mLyr_wk[idx].mLyr[lyr_no].Put(pBatch, key);
-	}
-
-	void Exec() {
-		int idx = mIdx_db ^ 1;
-		mLyr_wk[idx].Exec();
-	}
-
-	RDR_LAYER* Get_exec_lyr(sys_uint lyr_no) {
-		int idx = mIdx_db ^ 1;
-		return &mLyr_wk[idx].mLyr[lyr_no];
-	}
-
-	RDR_CONTEXT* Get_work_ctx() {
-		int idx = mIdx_db;
-		return &mCtx[idx];
-	}
-
-	RDR_CONTEXT* Get_exec_ctx() {
-		int idx = mIdx_db ^ 1;
-		return &mCtx[idx];
-	}
-
-	RDR_VIEW* Get_work_view() {
-		return &Get_work_ctx()->view;
-	}
-
-	RDR_VIEW* Get_exec_view() {
-		return &Get_exec_ctx()->view;
-	}
-
-	void Apply_exec_view() {
-		QMTX tm;
-		RDR_VIEW* pView = Get_exec_view();
-		MTX_transpose(tm, pView->view_proj);
-		g_rdr_param.view_proj[0].qv = V4_load(tm[0]);
-		g_rdr_param.view_proj[1].qv = V4_load(tm[1]);
-		g_rdr_param.view_proj[2].qv = V4_load(tm[2]);
-		g_rdr_param.view_proj[3].qv = V4_load(tm[3]);
-		g_rdr_param.view_pos.qv = pView->pos.qv;
-	}
-
-	void Apply_exec_fog() {
-		RDR_CONTEXT* pCtx = Get_exec_ctx();
-		RDR_FOG* pFog = &pCtx->fog;
-		RDR_GPARAM* pGP = &g_rdr_param;
-		pGP->fog_param.qv = V4_set(pFog->start, 1.0f/(pFog->end - pFog->start), pFog->curve.p1, pFog->curve.p2);
-		pGP->fog_color.qv = pFog->color.qv;
-	}
-
-	RDR_LIGHT* Get_work_light() {
-		return &Get_work_ctx()->light;
-	}
-
-	RDR_LIGHT* Get_exec_light() {
-		return &Get_exec_ctx()->light;
-	}
-
-	RDR_SHADOW* Get_work_shadow() {
-		return &Get_work_ctx()->shadow;
-	}
-
-	RDR_SHADOW* Get_exec_shadow() {
-		return &Get_exec_ctx()->shadow;
-	}
-
-	void Flip() {
-		mIdx_db ^= 1;
-	}
-};
-
-
 template <typename _T> struct RSRC_BLOCK {
 	int             bitmask;
 	RSRC_BLOCK<_T>* pNext;
@@ -966,6 +508,7 @@ struct RDR_DECL {
 	IDirect3DVertexDeclaration9* pSolid;
 	IDirect3DVertexDeclaration9* pSkin;
 	IDirect3DVertexDeclaration9* pScreen;
+	IDirect3DVertexDeclaration9* pSolid_inst;
 };
 
 struct RDR_TGT_LIST {
@@ -1122,15 +665,15 @@ struct RDR_THREAD {
 	bool   mFlg_end;
 	bool   mFlg_use;
 
+	/* draws whatever was submitted, a frame at a time, signalling after each one */
 	void Loop() {
 		SetEvent(mSig_done);
 		while (!mFlg_end) {
 			if (WaitForSingleObject(mSig_exec, INFINITE) == WAIT_OBJECT_0) {
-				ResetEvent(mSig_exec);
-				if (!mFlg_end) {
-					Rdr_draw();
+				while (!mFlg_end && g_rdr_db.Get_nb_pending()) {
+					Rdr_frame();
+					SetEvent(mSig_done);
 				}
-				SetEvent(mSig_done);
 			}
 		}
 	}
@@ -1172,7 +715,6 @@ struct RDR_THREAD {
 
 	void Exec() {
 		if (mFlg_use) {
-			ResetEvent(mSig_done);
 			SetEvent(mSig_exec);
 		}
 	}
@@ -1203,36 +745,20 @@ struct RDR_WORK {
 	QMTX mShadow_mtx;
 	QVEC mShadow_dir;
 
-	IDirect3DVertexShader9* mpCurr_vtx_shader;
-	IDirect3DPixelShader9* mpCurr_pix_shader;
+	RST_TRACKER mState;
+
+	IDirect3DVertexBuffer9* mpInst_vb;
+	int mInst_pos;
 
 	float mDepth_bias;
 	float mNrm_scale;
 	float mNrm_bias;
 
-#if (D_VTX_FVEC_CK > 0)
-	CONST_CACHE<D_VTX_FVEC_CK> mVtx_fvec_cache;
-#endif
-#if (D_PIX_FVEC_CK > 0)
-	CONST_CACHE<D_PIX_FVEC_CK> mPix_fvec_cache;
-#endif
-#if (D_PIX_BOOL_CK > 0)
-	D_BIT_ARY(mPix_bool_cache, D_PIX_BOOL_CK);
-#endif
-
-	RDR_DB_WK mDb_wk;
-
 	void Init() {
-#if (D_VTX_FVEC_CK > 0)
-		mVtx_fvec_cache.Init();
-#endif
-#if (D_PIX_FVEC_CK > 0)
-		mPix_fvec_cache.Init();
-#endif
-
 		mRsrc.Init();
 		mRT.Init(mMain_rt.w, mMain_rt.h, 1024);
-		mDb_wk.Init();
+		g_rdr_db.Init();
+		g_rdr_db.Set_nb_frame(CFG_get_i("rdr_frames", D_RDR_FRAME_MIN));
 		mGpu_code.Init();
 		mImg.Init();
 		mThread.Init();
@@ -1243,17 +769,7 @@ struct RDR_WORK {
 	}
 
 	void Set_vtx_const_f(const UVEC* pData, sys_uint org, sys_uint count) {
-		HRESULT hres;
-#if (D_VTX_FVEC_CK > 0)
-		int set_count = mVtx_fvec_cache.Check(pData, org, count);
-		if (set_count) {
-			hres = mpDev->SetVertexShaderConstantF(org, (const float*)pData, count);
-		} else {
-			hres = D3D_OK;
-		}
-#else
-		hres = mpDev->SetVertexShaderConstantF(org, (const float*)pData, count);
-#endif
+		HRESULT hres = mpDev->SetVertexShaderConstantF(org, (const float*)pData, count);
 	}
 
 	void Set_vtx_const_i(const UVEC* pData, sys_uint org, sys_uint count) {
@@ -1265,17 +781,7 @@ struct RDR_WORK {
 	}
 
 	void Set_pix_const_f(const UVEC* pData, sys_uint org, sys_uint count) {
-		HRESULT hres;
-#if (D_PIX_FVEC_CK > 0)
-		int set_count = mPix_fvec_cache.Check(pData, org, count);
-		if (set_count) {
-			hres = mpDev->SetPixelShaderConstantF(org, (const float*)pData, count);
-		} else {
-			hres = D3D_OK;
-		}
-#else
-		hres = mpDev->SetPixelShaderConstantF(org, (const float*)pData, count);
-#endif
+		HRESULT hres = mpDev->SetPixelShaderConstantF(org, (const float*)pData, count);
 	}
 
 	void Set_pix_const_i(const UVEC* pData, sys_uint org, sys_uint count) {
@@ -1283,30 +789,7 @@ struct RDR_WORK {
 	}
 
 	void Set_pix_const_b(const BOOL* pData, sys_uint org, sys_uint count) {
-		HRESULT hres;
-#if (D_PIX_BOOL_CK > 0)
-		sys_uint i;
-		int set_count = 0;
-		for (i = 0; i < count; ++i) {
-			sys_uint idx = org + i;
-			bool flg = D_BIT_CK(mPix_bool_cache, idx);
-			if (flg != !!pData[i]) {
-				if (pData[i]) {
-					D_BIT_ST(mPix_bool_cache, idx);
-				} else {
-					D_BIT_CL(mPix_bool_cache, idx);
-				}
-				++set_count;
-			}
-		}
-		if (set_count) {
-			hres = mpDev->SetPixelShaderConstantB(org, pData, count);
-		} else {
-			hres = D3D_OK;
-		}
-#else
-		hres = mpDev->SetPixelShaderConstantB(org, pData, count);
-#endif
+		HRESULT hres = mpDev->SetPixelShaderConstantB(org, pData, count);
 	}
 
 	void Set_vb(RDR_VTX_BUFFER* pVB) {
@@ -1370,31 +853,15 @@ IDirect3DDevice9* Get_dev() {
 }
 
 void Set_prog_const_f(const UVEC* pData, sys_uint org, sys_uint count, bool vtx_flg) {
-	if (vtx_flg) {
-		s_rdr.Set_vtx_const_f(pData, org, count);
-	} else {
-		s_rdr.Set_pix_const_f(pData, org, count);
-	}
+	RST_set_const_f(&s_rdr.mState, pData, org, count, vtx_flg);
 }
 
 void Set_prog_const_i(const UVEC* pData, sys_uint org, sys_uint count, bool vtx_flg) {
-	if (vtx_flg) {
-		s_rdr.Set_vtx_const_i(pData, org, count);
-	} else {
-		s_rdr.Set_pix_const_i(pData, org, count);
-	}
+	RST_set_const_i(&s_rdr.mState, pData, org, count, vtx_flg);
 }
 
 void Set_prog_const_b(const sys_byte* pData, sys_uint org, sys_uint count, bool vtx_flg) {
-	BOOL b[32];
-	for (sys_uint i = 0; i < count; ++i) {
-		b[i] = !!pData[i];
-	}
-	if (vtx_flg) {
-		s_rdr.Set_vtx_const_b(b, org, count);
-	} else {
-		s_rdr.Set_pix_const_b(b, org, count);
-	}
+	RST_set_const_b(&s_rdr.mState, pData, org, count, vtx_flg);
 }
 
 static D3DTEXTUREADDRESS Xlat_tex_addr(sys_ui32 tex_addr) {
@@ -1439,46 +906,15 @@ static D3DTEXTUREFILTERTYPE Xlat_tex_filter(sys_ui32 filt) {
 }
 
 void Set_sampler(RDR_SAMPLER* pSmp, sys_uint stage, bool vtx_flg) {
-	RDR_WORK* pRdr = &s_rdr;
-	IDirect3DDevice9* pDev = pRdr->mpDev;
-	union {
-		float f32;
-		sys_ui32 u32;
-	} d32;
-
-	if (vtx_flg) {
-		stage += D3DVERTEXTEXTURESAMPLER0;
-	}
-	d32.f32 = pSmp->mip_bias;
-	pDev->SetSamplerState(stage, D3DSAMP_MIPMAPLODBIAS, d32.u32);
-	pDev->SetSamplerState(stage, D3DSAMP_BORDERCOLOR, pSmp->border.argb32);
-	pDev->SetSamplerState(stage, D3DSAMP_ADDRESSU, Xlat_tex_addr(pSmp->addr_u));
-	pDev->SetSamplerState(stage, D3DSAMP_ADDRESSV, Xlat_tex_addr(pSmp->addr_v));
-	pDev->SetSamplerState(stage, D3DSAMP_ADDRESSW, Xlat_tex_addr(pSmp->addr_w));
-	pDev->SetSamplerState(stage, D3DSAMP_MINFILTER, Xlat_tex_filter(pSmp->min));
-	pDev->SetSamplerState(stage, D3DSAMP_MAGFILTER, Xlat_tex_filter(pSmp->mag));
-	pDev->SetSamplerState(stage, D3DSAMP_MIPFILTER, Xlat_tex_filter(pSmp->mip));
-	pDev->SetSamplerState(stage, D3DSAMP_MAXMIPLEVEL, pSmp->max_mip);
-	pDev->SetSamplerState(stage, D3DSAMP_MAXANISOTROPY, pSmp->anisotropy);
-	pDev->SetTexture(stage, (IDirect3DBaseTexture9*)pSmp->hTex);
+	RST_set_sampler(&s_rdr.mState, pSmp, stage, vtx_flg);
 }
 
 void Set_vtx_shader(IDirect3DVertexShader9* pShader) {
-	RDR_WORK* pRdr = &s_rdr;
-	IDirect3DDevice9* pDev = pRdr->mpDev;
-	if (pShader != pRdr->mpCurr_vtx_shader) {
-		pRdr->mpCurr_vtx_shader = pShader;
-		pDev->SetVertexShader(pShader);
-	}
+	RST_set_prog(&s_rdr.mState, (sys_handle)pShader, true);
 }
 
 void Set_pix_shader(IDirect3DPixelShader9* pShader) {
-	RDR_WORK* pRdr = &s_rdr;
-	IDirect3DDevice9* pDev = pRdr->mpDev;
-	if (pShader != pRdr->mpCurr_pix_shader) {
-		pRdr->mpCurr_pix_shader = pShader;
-		pDev->SetPixelShader(pShader);
-	}
+	RST_set_prog(&s_rdr.mState, (sys_handle)pShader, false);
 }
 
 RDR_TARGET* Rt_create(int w, int h, bool depth_flg, D3DFORMAT fmt, D3DFORMAT dfmt) {
@@ -1714,122 +1150,234 @@ static D3DCMPFUNC Xlat_cmp_func(E_RDR_CMPFUNC func) {
 	return d3d_func;
 }
 
-static void Apply_blend_state(RDR_BLEND_STATE bs) {
-	RDR_WORK* pRdr = &s_rdr;
-	IDirect3DDevice9* pDev = pRdr->mpDev;
-
-	if (bs.on) {
-		pDev->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
-		pDev->SetRenderState(D3DRS_BLENDOP, Xlat_blend_op((E_RDR_BLENDOP)bs.op));
-		pDev->SetRenderState(D3DRS_SRCBLEND, Xlat_blend_mode((E_RDR_BLENDMODE)bs.src));
-		pDev->SetRenderState(D3DRS_DESTBLEND, Xlat_blend_mode((E_RDR_BLENDMODE)bs.dst));
-		pDev->SetRenderState(D3DRS_BLENDOPALPHA, Xlat_blend_op((E_RDR_BLENDOP)bs.op_a));
-		pDev->SetRenderState(D3DRS_SRCBLENDALPHA, Xlat_blend_mode((E_RDR_BLENDMODE)bs.src_a));
-		pDev->SetRenderState(D3DRS_DESTBLENDALPHA, Xlat_blend_mode((E_RDR_BLENDMODE)bs.dst_a));
-	} else {
-		pDev->SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE);
-	}
-}
-
-static void Apply_draw_state(RDR_DRAW_STATE ds) {
-	RDR_WORK* pRdr = &s_rdr;
-	IDirect3DDevice9* pDev = pRdr->mpDev;
+static void Dx_set_rs(void* pCtx, E_RST_RS rs, sys_ui32 val) {
+	IDirect3DDevice9* pDev = ((RDR_WORK*)pCtx)->mpDev;
+	D3DCULL cull;
 
-	pDev->SetRenderState(D3DRS_COLORWRITEENABLE, ds.color_mask);
-
-	D3DCULL cull = D3DCULL_NONE;
-	switch (ds.cull) {
-		case E_RDR_CULL_CCW:
-			cull = D3DCULL_CCW;
+	switch (rs) {
+		case E_RST_RS_BLEND_ON:
+			pDev->SetRenderState(D3DRS_ALPHABLENDENABLE, !!val);
+			break;
+		case E_RST_RS_BLEND_OP:
+			pDev->SetRenderState(D3DRS_BLENDOP, Xlat_blend_op((E_RDR_BLENDOP)val));
+			break;
+		case E_RST_RS_BLEND_SRC:
+			pDev->SetRenderState(D3DRS_SRCBLEND, Xlat_blend_mode((E_RDR_BLENDMODE)val));
+			break;
+		case E_RST_RS_BLEND_DST:
+			pDev->SetRenderState(D3DRS_DESTBLEND, Xlat_blend_mode((E_RDR_BLENDMODE)val));
+			break;
+		case E_RST_RS_BLEND_OP_A:
+			pDev->SetRenderState(D3DRS_BLENDOPALPHA, Xlat_blend_op((E_RDR_BLENDOP)val));
 			break;
-		case E_RDR_CULL_CW:
-			cull = D3DCULL_CW;
+		case E_RST_RS_BLEND_SRC_A:
+			pDev->SetRenderState(D3DRS_SRCBLENDALPHA, Xlat_blend_mode((E_RDR_BLENDMODE)val));
+			break;
+		case E_RST_RS_BLEND_DST_A:
+			pDev->SetRenderState(D3DRS_DESTBLENDALPHA, Xlat_blend_mode((E_RDR_BLENDMODE)val));
+			break;
+		case E_RST_RS_COLOR_MASK:
+			pDev->SetRenderState(D3DRS_COLORWRITEENABLE, val);
+			break;
+		case E_RST_RS_CULL:
+			cull = D3DCULL_NONE;
+			switch (val) {
+				case E_RDR_CULL_CCW:
+					cull = D3DCULL_CCW;
+					break;
+				case E_RDR_CULL_CW:
+					cull = D3DCULL_CW;
+					break;
+			}
+			pDev->SetRenderState(D3DRS_CULLMODE, cull);
+			break;
+		case E_RST_RS_ZWRITE:
+			pDev->SetRenderState(D3DRS_ZWRITEENABLE, !!val);
+			break;
+		case E_RST_RS_ZTEST:
+			pDev->SetRenderState(D3DRS_ZENABLE, !!val);
+			break;
+		case E_RST_RS_ZFUNC:
+			pDev->SetRenderState(D3DRS_ZFUNC, Xlat_cmp_func((E_RDR_CMPFUNC)val));
+			break;
+		case E_RST_RS_ATEST:
+			pDev->SetRenderState(D3DRS_ALPHATESTENABLE, !!val);
+			break;
+		case E_RST_RS_AFUNC:
+			pDev->SetRenderState(D3DRS_ALPHAFUNC, Xlat_cmp_func((E_RDR_CMPFUNC)val));
+			break;
+		case E_RST_RS_MSAA:
+			pDev->SetRenderState(D3DRS_MULTISAMPLEANTIALIAS, !!val);
+			break;
+		default:
 			break;
 	}
-	pDev->SetRenderState(D3DRS_CULLMODE, cull);
+}
 
-	pDev->SetRenderState(D3DRS_ZWRITEENABLE, !!ds.zwrite);
-	pDev->SetRenderState(D3DRS_ZENABLE, !!ds.ztest);
-	if (ds.ztest) {
-		pDev->SetRenderState(D3DRS_ZFUNC, Xlat_cmp_func((E_RDR_CMPFUNC)ds.zfunc));
-	}
-	pDev->SetRenderState(D3DRS_ALPHATESTENABLE, !!ds.atest);
-	if (ds.atest) {
-		pDev->SetRenderState(D3DRS_ALPHAFUNC, Xlat_cmp_func((E_RDR_CMPFUNC)ds.afunc));
+static void Dx_set_prog(void* pCtx, sys_handle hProg, int vtx_flg) {
+	IDirect3DDevice9* pDev = ((RDR_WORK*)pCtx)->mpDev;
+	if (vtx_flg) {
+		pDev->SetVertexShader((IDirect3DVertexShader9*)hProg);
+	} else {
+		pDev->SetPixelShader((IDirect3DPixelShader9*)hProg);
 	}
-	pDev->SetRenderState(D3DRS_MULTISAMPLEANTIALIAS, !!ds.msaa);
 }
 
-void Apply_param(RDR_BATCH_PARAM* pParam) {
-	int i, n;
-	UVEC* pSrc_v;
-	UVEC* pDst_v;
-	float* pSrc_f;
-	float* pDst_f;
-	sys_i32* pSrc_i;
-	sys_i32* pDst_i;
-	RDR_SAMPLER* pSrc_s;
-	RDR_SAMPLER* pDst_s;
-	sys_byte* pSrc_b;
-	sys_byte* pDst_b;
-	RDR_GPARAM* pGP = &g_rdr_param;
+static void Dx_set_vb(void* pCtx, RDR_VTX_BUFFER* pVB) {
+	((RDR_WORK*)pCtx)->Set_vb(pVB);
+}
 
-	n = pParam->count;
-	switch (pParam->id.type) {
-		case E_RDR_PARAMTYPE_FVEC:
-			pSrc_v = pParam->pVec;
-			pDst_v = (UVEC*)D_INCR_PTR(pGP, D_RDR_GPTOP_FVEC) + pParam->id.offs;
-			for (i = 0; i < n; ++i) {
-				pDst_v->qv = pSrc_v->qv;
-				++pSrc_v;
-				++pDst_v;
-			}
+static void Dx_set_ib(void* pCtx, RDR_IDX_BUFFER* pIB) {
+	((RDR_WORK*)pCtx)->Set_ib(pIB);
+}
+
+static void Dx_set_smp(void* pCtx, sys_uint stage, int vtx_flg, E_RST_SMP smp, sys_ui32 val) {
+	IDirect3DDevice9* pDev = ((RDR_WORK*)pCtx)->mpDev;
+	if (vtx_flg) {
+		stage += D3DVERTEXTEXTURESAMPLER0;
+	}
+	switch (smp) {
+		case E_RST_SMP_MIP_BIAS:
+			pDev->SetSamplerState(stage, D3DSAMP_MIPMAPLODBIAS, val);
 			break;
-		case E_RDR_PARAMTYPE_IVEC:
-			pSrc_v = pParam->pVec;
-			pDst_v = (UVEC*)D_INCR_PTR(pGP, D_RDR_GPTOP_IVEC) + pParam->id.offs;
-			for (i = 0; i < n; ++i) {
-				pDst_v->iv = pSrc_v->iv;
-				++pSrc_v;
-				++pDst_v;
-			}
+		case E_RST_SMP_BORDER:
+			pDev->SetSamplerState(stage, D3DSAMP_BORDERCOLOR, val);
 			break;
-		case E_RDR_PARAMTYPE_FLOAT:
-			pSrc_f = pParam->pFloat;
-			pDst_f = (float*)D_INCR_PTR(pGP, D_RDR_GPTOP_FLOAT) + pParam->id.offs;
-			for (i = 0; i < n; ++i) {
-				*pDst_f++ = *pSrc_f++;
-			}
+		case E_RST_SMP_ADDR_U:
+			pDev->SetSamplerState(stage, D3DSAMP_ADDRESSU, Xlat_tex_addr(val));
 			break;
-		case E_RDR_PARAMTYPE_INT:
-			pSrc_i = pParam->pInt;
-			pDst_i = (sys_i32*)D_INCR_PTR(pGP, D_RDR_GPTOP_INT) + pParam->id.offs;
-			for (i = 0; i < n; ++i) {
-				*pDst_i++ = *pSrc_i++;
-			}
+		case E_RST_SMP_ADDR_V:
+			pDev->SetSamplerState(stage, D3DSAMP_ADDRESSV, Xlat_tex_addr(val));
 			break;
-		case E_RDR_PARAMTYPE_SMP:
-			pSrc_s = pParam->pSmp;
-			pDst_s = (RDR_SAMPLER*)D_INCR_PTR(pGP, D_RDR_GPTOP_SMP) + pParam->id.offs;
-			for (i = 0; i < n; ++i) {
-				memcpy(pDst_s, pSrc_s, sizeof(RDR_SAMPLER));
-				++pSrc_s;
-				++pDst_s;
-			}
+		case E_RST_SMP_ADDR_W:
+			pDev->SetSamplerState(stage, D3DSAMP_ADDRESSW, Xlat_tex_addr(val));
 			break;
-		case E_RDR_PARAMTYPE_BOOL:
-			pSrc_b = pParam->pBool;
-			pDst_b = (sys_byte*)D_INCR_PTR(pGP, D_RDR_GPTOP_BOOL) + pParam->id.offs;
-			for (i = 0; i < n; ++i) {
-				*pDst_b++ = *pSrc_b++;
-			}
+		case E_RST_SMP_MIN:
+			pDev->SetSamplerState(stage, D3DSAMP_MINFILTER, Xlat_tex_filter(val));
+			break;
+		case E_RST_SMP_MAG:
+			pDev->SetSamplerState(stage, D3DSAMP_MAGFILTER, Xlat_tex_filter(val));
+			break;
+		case E_RST_SMP_MIP:
+			pDev->SetSamplerState(stage, D3DSAMP_MIPFILTER, Xlat_tex_filter(val));
+			break;
+		case E_RST_SMP_MAX_MIP:
+			pDev->SetSamplerState(stage, D3DSAMP_MAXMIPLEVEL, val);
+			break;
+		case E_RST_SMP_ANISOTROPY:
+			pDev->SetSamplerState(stage, D3DSAMP_MAXANISOTROPY, val);
 			break;
 		default:
 			break;
 	}
 }
 
-void Batch_exec(RDR_BATCH* pBatch) {
+static void Dx_set_tex(void* pCtx, sys_uint stage, int vtx_flg, sys_handle hTex) {
+	IDirect3DDevice9* pDev = ((RDR_WORK*)pCtx)->mpDev;
+	if (vtx_flg) {
+		stage += D3DVERTEXTEXTURESAMPLER0;
+	}
+	pDev->SetTexture(stage, (IDirect3DBaseTexture9*)hTex);
+}
+
+static void Dx_set_const_f(void* pCtx, const UVEC* pData, sys_uint org, sys_uint count, int vtx_flg) {
+	RDR_WORK* pRdr = (RDR_WORK*)pCtx;
+	if (vtx_flg) {
+		pRdr->Set_vtx_const_f(pData, org, count);
+	} else {
+		pRdr->Set_pix_const_f(pData, org, count);
+	}
+}
+
+static void Dx_set_const_i(void* pCtx, const UVEC* pData, sys_uint org, sys_uint count, int vtx_flg) {
+	RDR_WORK* pRdr = (RDR_WORK*)pCtx;
+	if (vtx_flg) {
+		pRdr->Set_vtx_const_i(pData, org, count);
+	} else {
+		pRdr->Set_pix_const_i(pData, org, count);
+	}
+}
+
+static void Dx_set_const_b(void* pCtx, const sys_byte* pData, sys_uint org, sys_uint count, int vtx_flg) {
+	RDR_WORK* pRdr = (RDR_WORK*)pCtx;
+	BOOL b[32];
+	for (sys_uint i = 0; i < count; ++i) {
+		b[i] = !!pData[i];
+	}
+	if (vtx_flg) {
+		pRdr->Set_vtx_const_b(b, org, count);
+	} else {
+		pRdr->Set_pix_const_b(b, org, count);
+	}
+}
+
+static const RST_BACKEND s_rst_dx = {
+	Dx_set_rs,
+	Dx_set_prog,
+	Dx_set_vb,
+	Dx_set_ib,
+	Dx_set_smp,
+	Dx_set_tex,
+	Dx_set_const_f,
+	Dx_set_const_i,
+	Dx_set_const_b
+};
+
+/* one draw with the world rows in stream 1, or a draw per instance when the stream can't be filled */
+static void Inst_exec(RDR_BATCH* pBatch, D3DPRIMITIVETYPE prim_type) {
+	int i, n;
+	DWORD flg;
+	UINT size;
+	void* pDst = NULL;
+	RDR_BATCH_PARAM world;
+	RDR_WORK* pRdr = &s_rdr;
+	IDirect3DDevice9* pDev = pRdr->mpDev;
+	IDirect3DVertexBuffer9* pInst_vb = pRdr->mpInst_vb;
+
+	n = pBatch->nb_inst;
+	size = (UINT)(n * D_RDR_INST_STRIDE);
+	RST_set_vb(&pRdr->mState, pBatch->pVtx);
+	RST_set_ib(&pRdr->mState, pBatch->pIdx);
+	if (pInst_vb && pRdr->mDecl.pSolid_inst && n <= D_RDR_INST_MAX) {
+		if (pRdr->mInst_pos + n > D_RDR_INST_MAX) {
+			pRdr->mInst_pos = 0;
+			flg = D3DLOCK_DISCARD;
+		} else {
+			flg = D3DLOCK_NOOVERWRITE;
+		}
+		if (FAILED(pInst_vb->Lock((UINT)(pRdr->mInst_pos * D_RDR_INST_STRIDE), size, &pDst, flg))) {
+			pDst = NULL;
+		}
+	}
+	if (pDst) {
+		memcpy(pDst, pBatch->pInst, size);
+		pInst_vb->Unlock();
+		pRdr->mGpu_code.Set_pipeline(Inst_vtx_prog(pBatch->vtx_prog), pBatch->pix_prog);
+		pDev->SetVertexDeclaration(pRdr->mDecl.pSolid_inst);
+		pDev->SetStreamSource(1, pInst_vb, (UINT)(pRdr->mInst_pos * D_RDR_INST_STRIDE), (UINT)D_RDR_INST_STRIDE);
+		pDev->SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | n);
+		pDev->SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1);
+		pDev->DrawIndexedPrimitive(prim_type, pBatch->base, 0, pBatch->pVtx->nb_vtx, pBatch->start, pBatch->count);
+		pDev->SetStreamSourceFreq(0, 1);
+		pDev->SetStreamSourceFreq(1, 1);
+		pDev->SetStreamSource(1, NULL, 0, 0);
+		/* back to what the state tracker thinks is set for this VB */
+		pDev->SetVertexDeclaration(pRdr->mDecl.pSolid);
+		pRdr->mInst_pos += n;
+	} else {
+		world.count = 3;
+		world.id.type = E_RDR_PARAMTYPE_FVEC;
+		world.id.offs = D_RDR_GP_world;
+		for (i = 0; i < n; ++i) {
+			world.pVec = pBatch->pInst + i*3;
+			Apply_param(&world);
+			pRdr->mGpu_code.Set_pipeline(pBatch->vtx_prog, pBatch->pix_prog);
+			pDev->DrawIndexedPrimitive(prim_type, pBatch->base, 0, pBatch->pVtx->nb_vtx, pBatch->start, pBatch->count);
+		}
+	}
+}
+
+static void Batch_exec(RDR_BATCH* pBatch) {
 	int i, n;
 	RDR_BATCH_PARAM* pParam;
 	RDR_WORK* pRdr = &s_rdr;
@@ -1842,8 +1390,8 @@ void Batch_exec(RDR_BATCH* pBatch) {
 		Apply_param(pParam);
 		++pParam;
 	}
-	Apply_blend_state(pBatch->blend_state);
-	Apply_draw_state(pBatch->draw_state);
+	RST_set_blend(&pRdr->mState, pBatch->blend_state);
+	RST_set_draw(&pRdr->mState, pBatch->draw_state);
 	switch (pBatch->type) {
 		default:
 		case E_RDR_PRIMTYPE_TRILIST:
@@ -1859,10 +1407,14 @@ void Batch_exec(RDR_BATCH* pBatch) {
 			prim_type = D3DPT_LINESTRIP;
 			break;
 	}
-	pRdr->Set_vb(pBatch->pVtx);
+	if (pBatch->pInst) {
+		Inst_exec(pBatch, prim_type);
+		return;
+	}
+	RST_set_vb(&pRdr->mState, pBatch->pVtx);
 	pRdr->mGpu_code.Set_pipeline(pBatch->vtx_prog, pBatch->pix_prog);
 	if (pBatch->pIdx) {
-		pRdr->Set_ib(pBatch->pIdx);
+		RST_set_ib(&pRdr->mState, pBatch->pIdx);
 		pDev->DrawIndexedPrimitive(prim_type, pBatch->base, 0, pBatch->pVtx->nb_vtx, pBatch->start, pBatch->count);
 	} else {
 		pDev->DrawPrimitive(prim_type, pBatch->start, pBatch->count);
@@ -1876,6 +1428,7 @@ static void Dev_init() {
 	pDev->SetRenderState(D3DRS_SEPARATEALPHABLENDENABLE, TRUE);
 	pDev->SetVertexShader(NULL);
 	pDev->SetPixelShader(NULL);
+	RST_init(&pRdr->mState, &s_rst_dx, pRdr);
 }
 
 static void GParam_init() {
@@ -2051,6 +1604,28 @@ void RDR_init(void* hWnd, int width, int height, int fullscreen) {
 		SYS_log("Can't create vertex declaration (SCREEN)\n");
 	}
 
+	static D3DVERTEXELEMENT9 elem_solid_inst[] = {
+		{0, D_FIELD_OFFS(RDR_VTX_SOLID, pos), D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0},
+		{0, D_FIELD_OFFS(RDR_VTX_SOLID, nrm), D3DDECLTYPE_UBYTE4N, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL, 0},
+		{0, D_FIELD_OFFS(RDR_VTX_SOLID, tng), D3DDECLTYPE_UBYTE4N, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TANGENT, 0},
+		{0, D_FIELD_OFFS(RDR_VTX_SOLID, clr), D3DDECLTYPE_D3DCOLOR, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_COLOR, 0},
+		{0, D_FIELD_OFFS(RDR_VTX_SOLID, tex), D3DDECLTYPE_FLOAT16_4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0},
+		{1, 0, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 4},
+		{1, 16, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 5},
+		{1, 32, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 6},
+		D3DDECL_END()
+	};
+	hres = pRdr->mpDev->CreateVertexDeclaration(elem_solid_inst, &pRdr->mDecl.pSolid_inst);
+	if (FAILED(hres)) {
+		SYS_log("Can't create vertex declaration (SOLID_INST)\n");
+	}
+	hres = pRdr->mpDev->CreateVertexBuffer(D_RDR_INST_MAX * D_RDR_INST_STRIDE, D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, 0, D3DPOOL_DEFAULT, &pRdr->mpInst_vb, NULL);
+	if (FAILED(hres)) {
+		SYS_log("Can't create instance buffer\n");
+		pRdr->mpInst_vb = NULL;
+	}
+	pRdr->mInst_pos = 0;
+
 	pRdr->Init();
 	Dev_init();
 }
@@ -2075,6 +1650,7 @@ void RDR_reset() {
 		pDev->SetVertexShader(NULL);
 		pDev->SetPixelShader(NULL);
 	}
+	RST_invalidate(&pRdr->mState);
 
 	pRdr->mGpu_code.Reset();
 	pRdr->mRsrc.Release();
@@ -2083,6 +1659,11 @@ void RDR_reset() {
 	D_RELEASE_DECL(Solid);
 	D_RELEASE_DECL(Skin);
 	D_RELEASE_DECL(Screen);
+	D_RELEASE_DECL(Solid_inst);
+	if (pRdr->mpInst_vb) {
+		pRdr->mpInst_vb->Release();
+		pRdr->mpInst_vb = NULL;
+	}
 
 	if (pRdr->mMain_rt.hTgt_surf) {
 		((IDirect3DSurface9*)pRdr->mMain_rt.hTgt_surf)->Release();
@@ -2110,13 +1691,15 @@ void RDR_init_thread_FPU() {
 
 void RDR_begin() {
 	RDR_WORK* pRdr = &s_rdr;
-	pRdr->mThread.Exec();
-	pRdr->mDb_wk.Begin();
+	sys_i64 t0 = SYS_get_timestamp();
+	while (pRdr->mThread.mFlg_use && !g_rdr_db.Frame_free()) {
+		pRdr->mThread.Wait();
+	}
+	g_rdr_db.Begin_frame(SYS_get_timestamp() - t0);
 }
 
 void Set_vb(RDR_VTX_BUFFER* pVB) {
-	RDR_WORK* pRdr = &s_rdr;
-	pRdr->Set_vb(pVB);
+	RST_set_vb(&s_rdr.mState, pVB);
 }
 
 void Set_rt(RDR_TARGET* pRT) {
@@ -2146,28 +1729,8 @@ static void Cpy_back(RDR_TARGET* pRT, D3DTEXTUREFILTERTYPE filt) {
 }
 
 static void Rdr_shadow_calc() {
-	QMTX vm;
-	QMTX cm;
-	QMTX tm;
-	QMTX fm;
 	QMTX sm;
-	QMTX inv_vp;
-	UVEC sdir;
-	UVEC vdir;
-	UVEC iprj;
-	UVEC up;
-	UVEC tgt;
-	UVEC pos;
-	UVEC tv;
-	UVEC offs;
-	UVEC vmin;
-	UVEC vmax;
-	UVEC box[8];
 	RDR_WORK* pRdr = &s_rdr;
-	RDR_VIEW* pView = pRdr->mDb_wk.Get_exec_view();
-	RDR_SHADOW* pSdw = pRdr->mDb_wk.Get_exec_shadow();
-	int i;
-	float vdist, snear, sfar, zmin, zmax, ymin, ymax, y, sy, t;
 
 	static QMTX bias = {
 		{0.5f, 0.0f, 0.0f, 0.0f},
@@ -2176,86 +1739,9 @@ static void Rdr_shadow_calc() {
 		{0.5f, 0.5f, 0.0f, 1.0f}
 	};
 
-	sdir.qv = V4_normalize(pSdw->dir.qv);
-	pRdr->mShadow_dir = sdir.qv;
-	vdir.qv = V4_scale(V4_load(pView->iview[2]), -1.0f);
-	vdist = 25.0f * pView->proj[1][1];
-	iprj.qv = MTX_calc_qpnt(pView->iproj, V4_zero());
-	snear = -iprj.z/iprj.w;
-	sfar = snear + (vdist - snear) * (1.0f - fabsf(V4_dot(sdir.qv, V4_load(pView->iview[2]))) * 0.8f);
-	pos.qv = MTX_calc_qpnt(pView->view_proj, V4_add(V4_scale(vdir.qv, snear), V4_load(pView->iview[3])));
-	zmin = pos.z / pos.w;
-	pos.qv = MTX_calc_qpnt(pView->view_proj, V4_add(V4_scale(vdir.qv, sfar), V4_load(pView->iview[3])));
-	zmax = pos.z / pos.w;
-	if (zmin < 0.0f) zmin = 0.0f;
-	if (zmax > 1.0f) zmax = 1.0f;
-	box[0].qv = V4_set_pnt(-1.0f, -1.0f, zmin);
-	box[1].qv = V4_set_pnt(1.0f, -1.0f, zmin);
-	box[2].qv = V4_set_pnt(-1.0f, 1.0f, zmin);
-	box[3].qv = V4_set_pnt(1.0f, 1.0f, zmin);
-	box[4].qv = V4_set_pnt(-1.0f, -1.0f, zmax);
-	box[5].qv = V4_set_pnt(1.0f, -1.0f, zmax);
-	box[6].qv = V4_set_pnt(-1.0f, 1.0f, zmax);
-	box[7].qv = V4_set_pnt(1.0f, 1.0f, zmax);
-	MTX_invert(inv_vp, pView->view_proj);
-	for (i = 0; i < 8; ++i) {
-		box[i].qv = MTX_calc_qpnt(inv_vp, box[i].qv);
-		box[i].qv = V4_set_w1(V4_scale(box[i].qv, 1.0f/box[i].w));
-	}
-	up.qv = V4_normalize(V4_cross(sdir.qv, V4_cross(vdir.qv, sdir.qv)));
-	pos.qv = V4_load(pView->iview[3]);
-	tgt.qv = V4_sub(pos.qv, sdir.qv);
-	MTX_make_view(vm, pos.qv, tgt.qv, up.qv);
-	ymin = D_MAX_FLOAT;
-	ymax = -D_MAX_FLOAT;
-	for (i = 0; i < 8; ++i) {
-		tv.qv = MTX_calc_qpnt(vm, box[i].qv);
-		ymin = F_min(ymin, tv.y);
-		ymax = F_max(ymax, tv.y);
-	}
-	sy = sqrtf(1.0f - D_SQ(V4_dot(vdir.qv, sdir.qv)));
-	t = (snear + sqrtf(snear*sfar)) / sy;
-	y = (ymax - ymin) / t;
-	MTX_unit(cm);
-	cm[0][0] = -1.0f;
-	cm[1][1] = (y + t) / (y - t);
-	cm[1][3] = 1.0f;
-	cm[3][1] = (-2.0f*y*t) / (y - t);
-	cm[3][3] = 0.0f;
-
-	pos.qv = V4_set_w1(V4_add(V4_load(pView->iview[3]), V4_scale(up.qv, ymin - t)));
-	tgt.qv = V4_sub(pos.qv, sdir.qv);
-	MTX_make_view(vm, pos.qv, tgt.qv, up.qv);
-	MTX_mul(tm, vm, cm);
-	vmin.qv = V4_fill(D_MAX_FLOAT);
-	vmax.qv = V4_fill(-D_MAX_FLOAT);
-	for (i = 0; i < 8; ++i) {
-		tv.qv = MTX_calc_qpnt(tm, box[i].qv);
-		tv.qv = V4_set_w1(V4_scale(tv.qv, 1.0f/tv.w));
-		vmin.qv = V4_min(vmin.qv, tv.qv);
-		vmax.qv = V4_max(vmax.qv, tv.qv);
-	}
-	offs.qv = V4_set_w0(V4_scale(sdir.qv, 40.0f));
-	zmin = vmin.z;
-	for (i = 0; i < 8; ++i) {
-		tv.qv = V4_sub(box[i].qv, offs.qv);
-		tv.qv = MTX_calc_qpnt(tm, tv.qv);
-		tv.z /= tv.w;
-		zmin = F_min(zmin, tv.z);
-	}
-	vmin.z = zmin;
-	MTX_unit(fm);
-	tv.qv = V4_div(V4_fill(1.0f), V4_set_w1(V4_sub(vmax.qv, vmin.qv)));
-	fm[0][0] = 2.0f * tv.x;
-	fm[1][1] = 2.0f * tv.y;
-	fm[2][2] = tv.z;
-	fm[3][0] = -(vmin.x + vmax.x) * tv.x;
-	fm[3][1] = -(vmin.y + vmax.y) * tv.y;
-	fm[3][2] = -vmin.z * tv.z;
-	MTX_mul(fm, cm, fm);
-	MTX_mul(sm, vm, fm);
-	MTX_cpy(pRdr->mShadow_view_proj, sm);
-	MTX_mul(sm, sm, bias);
+	pRdr->mShadow_dir = V4_normalize(g_rdr_db.Get_exec_shadow()->dir.qv);
+	Shadow_calc(pRdr->mShadow_view_proj, g_rdr_db.Get_exec_view(), g_rdr_db.Get_exec_shadow());
+	MTX_mul(sm, pRdr->mShadow_view_proj, bias);
 	MTX_cpy(pRdr->mShadow_mtx, sm);
 }
 
@@ -2266,7 +1752,7 @@ static void Rdr_zbuf_prologue(RDR_LAYER* pLyr) {
 
 	Set_rt(NULL);
 	pDev->Clear(0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, 0xFFFFFFFF, 1.0f, 0);
-	pRdr->mDb_wk.Apply_exec_view();
+	g_rdr_db.Apply_exec_view();
 }
 
 static void Rdr_zbuf_epilogue(RDR_LAYER* pLyr) {
@@ -2300,7 +1786,7 @@ static void Rdr_mtl_prologue(RDR_LAYER* pLyr) {
 	UVEC dir_color;
 	RDR_WORK* pRdr = &s_rdr;
 	RDR_GPARAM* pGP = &g_rdr_param;
-	RDR_CONTEXT* pCtx = pRdr->mDb_wk.Get_exec_ctx();
+	RDR_CONTEXT* pCtx = g_rdr_db.Get_exec_ctx();
 	RDR_VIEW* pView = &pCtx->view;
 	RDR_LIGHT* pLit = &pCtx->light;
 	IDirect3DDevice9* pDev = pRdr->mpDev;
@@ -2314,7 +1800,7 @@ static void Rdr_mtl_prologue(RDR_LAYER* pLyr) {
 	Set_rt(NULL);
 	pDev->Clear(0, NULL, D3DCLEAR_TARGET, pCtx->clear_color, 0.0f, 0);
 
-	pRdr->mDb_wk.Apply_exec_view();
+	g_rdr_db.Apply_exec_view();
 	pGP->base_color.qv = V4_fill(1.0f);
 	pGP->world[0].qv = V4_load(g_identity[0]);
 	pGP->world[1].qv = V4_load(g_identity[1]);
@@ -2349,11 +1835,11 @@ static void Rdr_recv_prologue(RDR_LAYER* pLyr) {
 	RDR_WORK* pRdr = &s_rdr;
 	RDR_GPARAM* pGP = &g_rdr_param;
 	IDirect3DDevice9* pDev = pRdr->mpDev;
-	RDR_SHADOW* pSdw = pRdr->mDb_wk.Get_exec_shadow();
+	RDR_SHADOW* pSdw = g_rdr_db.Get_exec_shadow();
 	float smap_size = pRdr->mRT.mpShadow->w;
 
 	Set_rt(NULL);
-	pRdr->mDb_wk.Apply_exec_view();
+	g_rdr_db.Apply_exec_view();
 	pGP->smp_shadow.addr_u = E_RDR_TEXADDR_WRAP;
 	pGP->smp_shadow.addr_v = E_RDR_TEXADDR_WRAP;
 	pGP->smp_shadow.addr_w = E_RDR_TEXADDR_WRAP;
@@ -2411,40 +1897,57 @@ static void Rdr_exec_cc() {
 	}
 }
 
-void Rdr_draw() {
+static void Rdr_draw() {
 	RDR_WORK* pRdr = &s_rdr;
 	RDR_GPARAM* pGP = &g_rdr_param;
 	IDirect3DDevice9* pDev = pRdr->mpDev;
 
 	pGP->vtx_param.qv = V4_set(pRdr->mDepth_bias, pRdr->mNrm_scale, pRdr->mNrm_bias, 0.0f);
-	pRdr->mDb_wk.Apply_exec_fog();
+	g_rdr_db.Apply_exec_fog();
 
-	pRdr->mDb_wk.Get_exec_lyr(E_RDR_LAYER_ZBUF)->mpPrologue = Rdr_zbuf_prologue;
-	pRdr->mDb_wk.Get_exec_lyr(E_RDR_LAYER_ZBUF)->mpEpilogue = Rdr_zbuf_epilogue;
-	pRdr->mDb_wk.Get_exec_lyr(E_RDR_LAYER_CAST)->mpPrologue = Rdr_cast_prologue;
-	pRdr->mDb_wk.Get_exec_lyr(E_RDR_LAYER_MTL0)->mpPrologue = Rdr_mtl_prologue;
-	pRdr->mDb_wk.Get_exec_lyr(E_RDR_LAYER_RECV)->mpPrologue = Rdr_recv_prologue;
+	g_rdr_db.Get_exec_lyr(E_RDR_LAYER_ZBUF)->mpPrologue = Rdr_zbuf_prologue;
+	g_rdr_db.Get_exec_lyr(E_RDR_LAYER_ZBUF)->mpEpilogue = Rdr_zbuf_epilogue;
+	g_rdr_db.Get_exec_lyr(E_RDR_LAYER_CAST)->mpPrologue = Rdr_cast_prologue;
+	g_rdr_db.Get_exec_lyr(E_RDR_LAYER_MTL0)->mpPrologue = Rdr_mtl_prologue;
+	g_rdr_db.Get_exec_lyr(E_RDR_LAYER_RECV)->mpPrologue = Rdr_recv_prologue;
 
+	RST_stats_reset(&pRdr->mState);
 	pDev->BeginScene();
 	Rdr_shadow_calc();
-	pRdr->mDb_wk.Exec();
+	g_rdr_db.Exec(Batch_exec);
 	Cpy_back(pRdr->mRT.mpScene, D3DTEXF_POINT);
 	Rdr_exec_cc();
 	pDev->EndScene();
 }
 
+static void Rdr_frame() {
+	RDR_WORK* pRdr = &s_rdr;
+	g_rdr_db.Exec_begin();
+	Rdr_draw();
+	pRdr->mpDev->Present(NULL, NULL, NULL, NULL);
+	g_rdr_db.Exec_end(&pRdr->mState.stats);
+}
+
+/*
+ * Without the render thread the oldest frame is drawn once all the work buffers are taken,
+ * with 2 of them that is the previous frame.
+ */
 void RDR_exec() {
 	RDR_WORK* pRdr = &s_rdr;
-	IDirect3DDevice9* pDev = pRdr->mpDev;
 
+	g_rdr_db.Merge();
+	Capture_frame();
+	g_rdr_db.Sort(D_MAX_WORKERS);
+	g_rdr_db.Instance();
+	g_rdr_db.Submit();
 	if (pRdr->mThread.mFlg_use) {
-		pRdr->mThread.Wait();
+		pRdr->mThread.Exec();
 	} else {
-		Rdr_draw();
+		while (g_rdr_db.Get_nb_pending() >= g_rdr_db.Get_nb_frame()) {
+			Rdr_frame();
+		}
 	}
-
-	pDev->Present(NULL, NULL, NULL, NULL);
-	pRdr->mDb_wk.Flip();
+	g_rdr_db.Get_stats(&g_rdr_stats);
 }
 
 void RDR_set_nvec_encoding(float scale, float bias) {
@@ -2453,66 +1956,6 @@ void RDR_set_nvec_encoding(float scale, float bias) {
 	pRdr->mNrm_bias = bias;
 }
 
-RDR_CONTEXT* RDR_get_ctx() {
-	return s_rdr.mDb_wk.Get_work_ctx();
-}
-
-UVEC* RDR_get_val_v(int n) {
-	return (UVEC*)s_rdr.mDb_wk.Get_val(E_RDR_PARAMTYPE_FVEC, n);
-}
-
-float* RDR_get_val_f(int n) {
-	return (float*)s_rdr.mDb_wk.Get_val(E_RDR_PARAMTYPE_FLOAT, n);
-}
-
-sys_i32* RDR_get_val_i(int n) {
-	return (sys_i32*)s_rdr.mDb_wk.Get_val(E_RDR_PARAMTYPE_INT, n);
-}
-
-RDR_SAMPLER* RDR_get_val_s(int n) {
-	return (RDR_SAMPLER*)s_rdr.mDb_wk.Get_val(E_RDR_PARAMTYPE_SMP, n);
-}
-
-sys_byte* RDR_get_val_b(int n) {
-	return (sys_byte*)s_rdr.mDb_wk.Get_val(E_RDR_PARAMTYPE_BOOL, n);
-}
-
-RDR_BATCH_PARAM* RDR_get_param(int n) {
-	RDR_BATCH_PARAM* pParam = s_rdr.mDb_wk.Get_param(n);
-	return pParam;
-}
-
-RDR_BATCH* RDR_get_batch() {
-	RDR_BATCH* pBatch = s_rdr.mDb_wk.Get_batch();
-	if (pBatch) {
-		pBatch->nb_param = 0;
-		pBatch->vtx_prog = D_RDRPROG_vtx_default;
-		pBatch->pix_prog = D_RDRPROG_pix_default;
-		pBatch->blend_state.on = false;
-		pBatch->blend_state.op = E_RDR_BLENDOP_ADD;
-		pBatch->blend_state.src = E_RDR_BLENDMODE_SRCA;
-		pBatch->blend_state.dst = E_RDR_BLENDMODE_INVSRCA;
-		pBatch->blend_state.op_a = E_RDR_BLENDOP_MAX;
-		pBatch->blend_state.src_a = E_RDR_BLENDMODE_ONE;
-		pBatch->blend_state.dst_a = E_RDR_BLENDMODE_ONE;
-		pBatch->draw_state.color_mask = 0xF;
-		pBatch->draw_state.cull = E_RDR_CULL_CCW;
-		pBatch->draw_state.ztest = true;
-		pBatch->draw_state.zwrite = true;
-		pBatch->draw_state.zfunc = E_RDR_CMPFUNC_LESSEQUAL;
-		pBatch->draw_state.atest = false;
-		pBatch->draw_state.afunc = E_RDR_CMPFUNC_GREATER;
-		pBatch->draw_state.msaa = true;
-		pBatch->base = 0;
-	}
-	return pBatch;
-}
-
-void RDR_put_batch(RDR_BATCH* pBatch, sys_ui32 key, sys_uint lyr_id) {
-	if (lyr_id >= E_RDR_LAYER_MAX) return;
-	s_rdr.mDb_wk.Put_batch(pBatch, key, lyr_id);
-}
-
 static RDR_VTX_BUFFER* VB_create(E_RDR_VTXTYPE type, int n, bool dyn_flg) {
 	HRESULT hres;
 	RDR_WORK* pRdr = &s_rdr;
@@ -32,6 +32,13 @@ typedef enum _E_RDR_LAYER {
 	E_RDR_LAYER_MAX
 } E_RDR_LAYER;
 
+typedef enum _E_RDR_SORT {
+	E_RDR_SORT_NONE,  /* submission order */
+	E_RDR_SORT_KEY,   /* key passed to RDR_put_batch */
+	E_RDR_SORT_STATE, /* pix prog, vtx prog, VB, material, then depth */
+	E_RDR_SORT_DEPTH  /* front to back, then as STATE */
+} E_RDR_SORT;
+
 typedef enum _E_RDR_PARAMTYPE {
 	E_RDR_PARAMTYPE_FVEC  = 0,
 	E_RDR_PARAMTYPE_IVEC  = 1,
@@ -303,6 +310,10 @@ typedef struct _RDR_BATCH {
 	sys_ui16 vtx_prog;
 	sys_ui16 pix_prog;
 	sys_ui16 nb_param;
+	sys_ui16 mtl_id; /* MATERIAL sort_id, 0 if none */
+	float depth;     /* view distance, see RDR_calc_depth */
+	UVEC* pInst;     /* 3 world rows per instance, NULL if not instanced */
+	sys_ui32 nb_inst;
 } RDR_BATCH;
 
 typedef struct _RDR_PROG_INFO {
@@ -345,6 +356,73 @@ typedef struct _RDR_FOG {
 	float end;
 } RDR_FOG;
 
+typedef struct _RDR_LYR_STATS {
+	sys_ui32 nb_batch;
+	sys_ui32 nb_pix_prog;
+	sys_ui32 nb_vtx_prog;
+	sys_ui32 nb_vtx_buf;
+	sys_ui32 nb_mtl;
+	sys_ui32 nb_inst_draw; /* instanced draws */
+	sys_ui32 nb_inst;      /* batches folded into them */
+} RDR_LYR_STATS;
+
+typedef enum _E_RDR_CALL {
+	E_RDR_CALL_RS,
+	E_RDR_CALL_PROG,
+	E_RDR_CALL_VB,
+	E_RDR_CALL_IB,
+	E_RDR_CALL_SMP,
+	E_RDR_CALL_TEX,
+	E_RDR_CALL_CONST_F,
+	E_RDR_CALL_CONST_I,
+	E_RDR_CALL_CONST_B,
+	E_RDR_CALL_MAX
+} E_RDR_CALL;
+
+typedef struct _RDR_CALL_STATS {
+	sys_ui32 issued[E_RDR_CALL_MAX];
+	sys_ui32 skipped[E_RDR_CALL_MAX];
+	sys_ui32 nb_const_vec; /* float and int constant registers sent */
+} RDR_CALL_STATS;
+
+typedef struct _RDR_FRAME_STATS {
+	float latency; /* ms from RDR_begin to the end of the draw */
+	float wait;    /* ms RDR_begin waited for a free work buffer */
+	sys_ui32 nb_in_flight; /* submitted frames not yet drawn */
+} RDR_FRAME_STATS;
+
+typedef enum _E_RDR_POOL {
+	E_RDR_POOL_BATCH,
+	E_RDR_POOL_PARAM,
+	E_RDR_POOL_VAL,
+	E_RDR_POOL_BIN,
+	E_RDR_POOL_LYR,
+	E_RDR_POOL_MAX
+} E_RDR_POOL;
+
+/* work memory of a frame, in items (vectors for values, entries of all the layers) */
+typedef struct _RDR_POOL_STATS {
+	sys_ui32 peak[E_RDR_POOL_MAX];
+	sys_ui32 size[E_RDR_POOL_MAX];
+	sys_ui32 nb_fail[E_RDR_POOL_MAX]; /* requests dropped, the pool could not grow */
+} RDR_POOL_STATS;
+
+/* RDR_cull_cast and RDR_cull_recv results */
+typedef struct _RDR_CULL_STATS {
+	sys_ui32 nb_cast;
+	sys_ui32 nb_cast_culled;
+	sys_ui32 nb_recv;
+	sys_ui32 nb_recv_culled;
+} RDR_CULL_STATS;
+
+typedef struct _RDR_STATS {
+	RDR_LYR_STATS lyr[E_RDR_LAYER_MAX];
+	RDR_CALL_STATS call;
+	RDR_FRAME_STATS frame;
+	RDR_POOL_STATS pool;
+	RDR_CULL_STATS cull;
+} RDR_STATS;
+
 typedef struct _RDR_CONTEXT {
 	RDR_VIEW view;
 	RDR_LIGHT light;
@@ -353,17 +431,23 @@ typedef struct _RDR_CONTEXT {
 	sys_ui32 clear_color;
 } RDR_CONTEXT;
 
+typedef struct _RDR_REPLAY RDR_REPLAY;
+
 
 #include "gen/gparam.h"
 
 D_EXTERN_DATA RDR_GPARAM g_rdr_param;
+D_EXTERN_DATA RDR_STATS g_rdr_stats; /* state changes of the last drawn frame */
 
 D_EXTERN_FUNC void RDR_init(void* hWnd, int width, int height, int fullscreen);
 D_EXTERN_FUNC void RDR_reset(void);
 D_EXTERN_FUNC void RDR_init_thread_FPU(void);
 D_EXTERN_FUNC void RDR_begin(void);
 D_EXTERN_FUNC void RDR_exec(void);
+D_EXTERN_FUNC int RDR_discard(void); /* merges and drops what was recorded since RDR_begin, returns # of layer entries */
 D_EXTERN_FUNC void RDR_set_nvec_encoding(float scale, float bias);
+D_EXTERN_FUNC int RDR_set_nb_frame(int n); /* work buffers (frames in flight), 2..4, between frames; returns 0 while frames are pending */
+D_EXTERN_FUNC int RDR_get_nb_frame(void);
 D_EXTERN_FUNC RDR_CONTEXT* RDR_get_ctx(void);
 
 D_EXTERN_FUNC UVEC* RDR_get_val_v(int n);
@@ -373,7 +457,18 @@ D_EXTERN_FUNC RDR_SAMPLER* RDR_get_val_s(int n);
 D_EXTERN_FUNC sys_byte* RDR_get_val_b(int n);
 D_EXTERN_FUNC RDR_BATCH_PARAM* RDR_get_param(int n);
 D_EXTERN_FUNC RDR_BATCH* RDR_get_batch(void);
-D_EXTERN_FUNC void RDR_put_batch(RDR_BATCH* pBatch, sys_ui32 key, sys_uint lyr_id);
+D_EXTERN_FUNC void RDR_put_batch(RDR_BATCH* pBatch, sys_ui64 key, sys_uint lyr_id);
+D_EXTERN_FUNC int RDR_put_instanced(RDR_BATCH* pBatch, UVEC* pInst, int nb_inst, sys_uint lyr_id);
+D_EXTERN_FUNC float RDR_calc_depth(QVEC pos);
+D_EXTERN_FUNC int RDR_cull_cast(GEOM_AABB* pBox); /* 1 if outside the shadow volume of the current view, NULL box: unknown bounds, kept */
+D_EXTERN_FUNC int RDR_cull_recv(GEOM_AABB* pBox);
+D_EXTERN_FUNC void RDR_set_lyr_sort(sys_uint lyr_id, E_RDR_SORT sort);
+D_EXTERN_FUNC E_RDR_SORT RDR_get_lyr_sort(sys_uint lyr_id);
+
+D_EXTERN_FUNC void RDR_capture(const char* fname);
+D_EXTERN_FUNC RDR_REPLAY* RDR_replay_load(const char* fname);
+D_EXTERN_FUNC void RDR_replay_put(RDR_REPLAY* pRep, int rekey);
+D_EXTERN_FUNC void RDR_replay_free(RDR_REPLAY* pRep);
 
 D_EXTERN_FUNC RDR_VTX_BUFFER* RDR_vtx_create(E_RDR_VTXTYPE type, int n);
 D_EXTERN_FUNC RDR_VTX_BUFFER* RDR_vtx_create_dyn(E_RDR_VTXTYPE type, int n);
@@ -177,6 +177,7 @@ void RMD_cull(ROOM_MODEL* pRmd, CAMERA* pCam) {
 void RMD_disp(ROOM_MODEL* pRmd) {
 	int i, n;
 	RM_PRIM_GRP* pGrp;
+	MATERIAL* pMtl;
 	RDR_BATCH* pBatch;
 	RDR_BATCH_PARAM* pParam;
 
@@ -197,6 +198,7 @@ void RMD_disp(ROOM_MODEL* pRmd) {
 			pBatch->pIdx = pRmd->pIdx;
 			pBatch->start = pGrp->start;
 			pBatch->count = pGrp->count;
+			pBatch->depth = RDR_calc_depth(GEOM_aabb_center(&pRmd->pGrp_bbox[i]));
 
 			pBatch->nb_param = 1;
 			pParam = RDR_get_param(pBatch->nb_param);
@@ -224,6 +226,9 @@ void RMD_disp(ROOM_MODEL* pRmd) {
 			pBatch->pIdx = pRmd->pIdx;
 			pBatch->start = pGrp->start;
 			pBatch->count = pGrp->count;
+			pMtl = &pRmd->pMtl_lst->pMtl[pGrp->mtl_id];
+			pBatch->mtl_id = pMtl->sort_id;
+			pBatch->depth = RDR_calc_depth(GEOM_aabb_center(&pRmd->pGrp_bbox[i]));
 
 			pBatch->nb_param = 7;
 			pParam = RDR_get_param(pBatch->nb_param);
@@ -241,7 +246,7 @@ void RMD_disp(ROOM_MODEL* pRmd) {
 			pParam->pVec = &pRmd->base_color;
 			++pParam;
 
-			pParam = MTL_apply(&pRmd->pMtl_lst->pMtl[pGrp->mtl_id], pParam);
+			pParam = MTL_apply(pMtl, pParam);
 
 			RDR_put_batch(pBatch, 0, E_RDR_LAYER_MTL0);
 		}
@@ -250,7 +255,7 @@ void RMD_disp(ROOM_MODEL* pRmd) {
 
 	pGrp = pRmd->pGrp;
 	for (i = 0; i < n; ++i) {
-		if (!D_BIT_CK(pRmd->pCull, i) && !D_BIT_CK(pRmd->pHide, i)) {
+		if (!D_BIT_CK(pRmd->pCull, i) && !D_BIT_CK(pRmd->pHide, i) && !RDR_cull_recv(&pRmd->pGrp_bbox[i])) {
 			pBatch = RDR_get_batch();
 			pBatch->vtx_prog = D_RDRPROG_vtx_solid_recv;
 			pBatch->pix_prog = D_RDRPROG_pix_recv;
@@ -259,6 +264,7 @@ void RMD_disp(ROOM_MODEL* pRmd) {
 			pBatch->pIdx = pRmd->pIdx;
 			pBatch->start = pGrp->start;
 			pBatch->count = pGrp->count;
+			pBatch->depth = RDR_calc_depth(GEOM_aabb_center(&pRmd->pGrp_bbox[i]));
 
 			pBatch->blend_state.on = 1;
 			pBatch->blend_state.src = E_RDR_BLENDMODE_SRCA;
@@ -22,6 +22,13 @@ struct VTX {
 	float4 wgt : BLENDWEIGHT0;
 };
 
+/* per-instance world rows, stream 1 */
+struct INST {
+	float4 wm0 : TEXCOORD4;
+	float4 wm1 : TEXCOORD5;
+	float4 wm2 : TEXCOORD6;
+};
+
 struct PIX {
 	float4 tex;
 	float3 wpos;
@@ -42,6 +49,10 @@ wmtx_t Get_wmtx(VTX vtx) {
 	return g_world;
 }
 
+wmtx_t Get_wmtx_inst(INST inst) {
+	return wmtx_t(inst.wm0, inst.wm1, inst.wm2);
+}
+
 wmtx_t Get_wmtx_skin(VTX vtx) {
 	wmtx_t wm0 = g_skin[vtx.idx[0]] * vtx.wgt[0];
 	wmtx_t wm1 = g_skin[vtx.idx[1]] * vtx.wgt[1];
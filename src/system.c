@@ -80,10 +80,17 @@ void SYS_log(const char* fmt, ...) {
 
 
 void* SYS_load(const char* fname) {
+	return SYS_load_ex(fname, NULL);
+}
+
+/* pSize gets the number of bytes loaded, 0 on failure */
+void* SYS_load_ex(const char* fname, int* pSize) {
 	FILE* f;
 	void* pData = NULL;
 	char fpath[256];
 
+	if (pSize) *pSize = 0;
+
 	sprintf_s(fpath, sizeof(fpath), "../data/%s", fname);
 	if (0 == fopen_s(&f, fpath, "rb") && f) {
 		long len = 0;
@@ -95,12 +102,26 @@ void* SYS_load(const char* fname) {
 		pData = SYS_malloc(len);
 		if (pData) {
 			fread(pData, len, 1, f);
+			if (pSize) *pSize = (int)len;
 		}
 		fclose(f);
 	}
 	return pData;
 }
 
+int SYS_save(const char* fname, const void* pData, int size) {
+	FILE* f;
+	int res = 0;
+	char fpath[256];
+
+	sprintf_s(fpath, sizeof(fpath), "../data/%s", fname);
+	if (0 == fopen_s(&f, fpath, "wb") && f) {
+		res = fwrite(pData, size, 1, f) == 1;
+		fclose(f);
+	}
+	return res;
+}
+
 static void CPU_serialize() {
 #if defined (__GNUC__) || defined(_WIN64)
 	int dummy[4];
@@ -138,6 +159,12 @@ sys_i64 SYS_get_timestamp() {
 	return res;
 }
 
+sys_i64 SYS_get_timestamp_freq() {
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return freq.QuadPart;
+}
+
 void SYS_init_FPU() {
 #if !defined(_WIN64)
 #	if defined(_MSC_VER) || defined(__INTEL_COMPILER)
@@ -18,7 +18,9 @@
  * Author: Sergey Chaban <sergey.chaban@gmail.com>
  */
 
-#include <tchar.h>
+#ifdef _WIN32
+#	include <tchar.h>
+#endif
 
 #include <stdio.h>
 #include <stddef.h>
@@ -108,8 +110,8 @@
 	typedef unsigned char sys_ui8;
 	typedef short sys_i16;
 	typedef unsigned short sys_ui16;
-	typedef long sys_i32;
-	typedef unsigned long sys_ui32;
+	typedef int sys_i32;
+	typedef unsigned int sys_ui32;
 #	if defined(__GNUC__)
 		typedef long long sys_i64;
 		typedef unsigned long long sys_ui64;
@@ -133,7 +135,7 @@ typedef unsigned long sys_ulong;
 #ifdef _INTPTR_T_DEFINED
 typedef intptr_t sys_intptr;
 #else
-# if defined(_WIN64)
+# if defined(_WIN64) || defined(__LP64__)
 typedef sys_i64 sys_intptr;
 # else
 typedef sys_i32 sys_intptr;
@@ -178,7 +180,10 @@ void* SYS_malloc(int size);
 void SYS_free(void* pMem);
 void SYS_log(const char* fmt, ...);
 void* SYS_load(const char* fname);
+void* SYS_load_ex(const char* fname, int* pSize);
+int SYS_save(const char* fname, const void* pData, int size);
 sys_i64 SYS_get_timestamp(void);
+sys_i64 SYS_get_timestamp_freq(void);
 void SYS_init_FPU(void);
 void SYS_con_init(void);
 void SYS_mutex_init(SYS_MUTEX* pMut);
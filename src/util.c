@@ -22,10 +22,16 @@
 #include <string.h>
 
 #include "system.h"
+#include "job.h"
 #include "calc.h"
 #include "util.h"
 
 #define D_SYMPOOL_DEF_SIZE (1024)
+#define D_RSORT_BITS (11)
+#define D_RSORT_BINS (1 << D_RSORT_BITS)
+#define D_RSORT_MASK (D_RSORT_BINS - 1)
+#define D_RSORT_PASSES (6)
+#define D_RSORT_MIN_CHUNK (4096)
 #define D_DICT_MAX_INT32 ((sys_i32)(((sys_ui32)-1) >> 1))
 #define D_DICT_CHAIN_MARKER (~D_DICT_MAX_INT32)
 #define D_DICT_HSTEP(_hash, _size) ((((sys_uint)((_hash) >> 5) + 1) % ((_size) - 1)) + 1);
@@ -45,6 +51,12 @@ static struct _CFG_WK {
 	DICT*     pDict;
 } s_cfg_wk = {NULL, NULL};
 
+static struct _NAME_WK {
+	SYM_POOL* pSym;
+	DICT*     pDict;
+	sys_i32   count;
+} s_name_wk = {NULL, NULL, 0};
+
 
 static int Dict_prime_ck(sys_int x) {
 	sys_int n;
@@ -415,14 +427,22 @@ void CFG_init(const char* fname) {
 	const char* pName;
 	const char* pVal;
 
+#ifdef _MSC_VER
 	fopen_s(&f, fname, "r");
+#else
+	f = fopen(fname, "r");
+#endif
 	if (!f) return;
 	s_cfg_wk.pSym = DICT_pool_create();
 	s_cfg_wk.pDict = DICT_new();
 	while (1) {
 		if (NULL == fgets(buff, sizeof(buff), f)) break;
 		if (buff[0] == '#') continue;
+#ifdef _MSC_VER
 		sscanf_s(buff, "%[_.a-z0-9] = %[-_./a-z0-9]", name, sizeof(name), val, sizeof(val));
+#else
+		sscanf(buff, "%255[_.a-z0-9] = %255[-_./a-z0-9]", name, val);
+#endif
 		pName = DICT_pool_add(s_cfg_wk.pSym, (const char*)name);
 		pVal = DICT_pool_add(s_cfg_wk.pSym, (const char*)val);
 		DICT_put_p(s_cfg_wk.pDict, pName, (void*)pVal);
@@ -458,6 +478,38 @@ float CFG_get_f(const char* pName, float def_val) {
 }
 
 
+/* ids are stored +1 so that a missing entry reads as -1 */
+sys_i32 NAME_get_id(const char* pName) {
+	sys_i32 id;
+	if (!pName) return -1;
+	if (!s_name_wk.pDict) {
+		s_name_wk.pSym = DICT_pool_create();
+		s_name_wk.pDict = DICT_new();
+	}
+	id = (sys_i32)DICT_get_i(s_name_wk.pDict, pName);
+	if (!id) {
+		id = ++s_name_wk.count;
+		DICT_put_i(s_name_wk.pDict, DICT_pool_add(s_name_wk.pSym, pName), id);
+	}
+	return id - 1;
+}
+
+sys_i32 NAME_find_id(const char* pName) {
+	if (!pName || !s_name_wk.pDict) return -1;
+	return (sys_i32)DICT_get_i(s_name_wk.pDict, pName) - 1;
+}
+
+void NAME_reset() {
+	if (s_name_wk.pDict) {
+		DICT_destroy(s_name_wk.pDict);
+		DICT_pool_destroy(s_name_wk.pSym);
+	}
+	s_name_wk.pDict = NULL;
+	s_name_wk.pSym = NULL;
+	s_name_wk.count = 0;
+}
+
+
 UTL_GEOMETRY* GMT_load(const char* fname) {
 	GMT_HEAD* pHead;
 	UTL_GEOMETRY* pGeo = NULL;
@@ -650,6 +702,144 @@ float UTL_smooth_chg(float prev, float now, int len) {
 	return (prev*(flen-1.0f) + now) / flen;
 }
 
+/*
+ * LSD radix sort of (key, index) pairs, 64-bit keys in 11-bit digits.
+ * Stable, so equal keys keep their input order. A pass whose digit is the
+ * same for every pair is skipped, so narrow keys only pay for the digits
+ * they use. Returns whichever buffer holds the result.
+ */
+UTL_SORT_PAIR* UTL_radix_sort(UTL_SORT_PAIR* pSrc, UTL_SORT_PAIR* pTmp, int n) {
+	int i, pass, shift;
+	sys_ui32 d, c, sum;
+	sys_ui64 k;
+	sys_ui32* pCnt;
+	UTL_SORT_PAIR* pSwap;
+	sys_ui32 cnt[D_RSORT_PASSES][D_RSORT_BINS];
+
+	if (n <= 1) return pSrc;
+	memset(cnt, 0, sizeof(cnt));
+	for (i = 0; i < n; ++i) {
+		k = pSrc[i].key;
+		for (pass = 0; pass < D_RSORT_PASSES; ++pass) {
+			++cnt[pass][(sys_ui32)k & D_RSORT_MASK];
+			k >>= D_RSORT_BITS;
+		}
+	}
+	for (pass = 0; pass < D_RSORT_PASSES; ++pass) {
+		shift = pass * D_RSORT_BITS;
+		pCnt = cnt[pass];
+		if (pCnt[(sys_ui32)(pSrc[0].key >> shift) & D_RSORT_MASK] == (sys_ui32)n) continue;
+		for (i = 0, sum = 0; i < D_RSORT_BINS; ++i) {
+			c = pCnt[i];
+			pCnt[i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < n; ++i) {
+			d = (sys_ui32)(pSrc[i].key >> shift) & D_RSORT_MASK;
+			pTmp[pCnt[d]++] = pSrc[i];
+		}
+		pSwap = pSrc; pSrc = pTmp; pTmp = pSwap;
+	}
+	return pSrc;
+}
+
+typedef struct _RSORT_CHUNK {
+	UTL_SORT_PAIR* pSrc;
+	UTL_SORT_PAIR* pDst;
+	int start;
+	int count;
+	int shift;
+	sys_ui32 cnt[D_RSORT_BINS];
+} RSORT_CHUNK;
+
+static void Rsort_count(void* pData) {
+	int i, end;
+	RSORT_CHUNK* pChunk = (RSORT_CHUNK*)pData;
+	UTL_SORT_PAIR* pSrc = pChunk->pSrc;
+	int shift = pChunk->shift;
+
+	memset(pChunk->cnt, 0, sizeof(pChunk->cnt));
+	end = pChunk->start + pChunk->count;
+	for (i = pChunk->start; i < end; ++i) {
+		++pChunk->cnt[(sys_ui32)(pSrc[i].key >> shift) & D_RSORT_MASK];
+	}
+}
+
+static void Rsort_scatter(void* pData) {
+	int i, end;
+	sys_ui32 d;
+	RSORT_CHUNK* pChunk = (RSORT_CHUNK*)pData;
+	UTL_SORT_PAIR* pSrc = pChunk->pSrc;
+	UTL_SORT_PAIR* pDst = pChunk->pDst;
+	int shift = pChunk->shift;
+
+	end = pChunk->start + pChunk->count;
+	for (i = pChunk->start; i < end; ++i) {
+		d = (sys_ui32)(pSrc[i].key >> shift) & D_RSORT_MASK;
+		pDst[pChunk->cnt[d]++] = pSrc[i];
+	}
+}
+
+/* same result as UTL_radix_sort; each pass counts and scatters contiguous chunks on the workers */
+UTL_SORT_PAIR* UTL_radix_sort_mt(UTL_SORT_PAIR* pSrc, UTL_SORT_PAIR* pTmp, int n, int nb_wrk) {
+	int i, j, pass, size, nb_chunk;
+	sys_ui32 c, sum;
+	sys_ui32 digit;
+	JOB job;
+	JOB_QUEUE* pQue;
+	RSORT_CHUNK* pChunk;
+	UTL_SORT_PAIR* pSwap;
+
+	nb_chunk = D_MIN(D_MIN(nb_wrk, D_MAX_WORKERS), n / D_RSORT_MIN_CHUNK);
+	if (nb_chunk <= 1) return UTL_radix_sort(pSrc, pTmp, n);
+	pQue = JOB_que_alloc(nb_chunk);
+	pChunk = (RSORT_CHUNK*)SYS_malloc(nb_chunk * sizeof(RSORT_CHUNK));
+	if (!pQue || !pChunk) {
+		if (pQue) JOB_que_free(pQue);
+		if (pChunk) SYS_free(pChunk);
+		return UTL_radix_sort(pSrc, pTmp, n);
+	}
+	size = (n + nb_chunk - 1) / nb_chunk;
+	for (i = 0; i < nb_chunk; ++i) {
+		pChunk[i].start = D_MIN(i*size, n);
+		pChunk[i].count = D_MIN(size, n - pChunk[i].start);
+	}
+	for (pass = 0; pass < D_RSORT_PASSES; ++pass) {
+		for (i = 0; i < nb_chunk; ++i) {
+			pChunk[i].pSrc = pSrc;
+			pChunk[i].pDst = pTmp;
+			pChunk[i].shift = pass * D_RSORT_BITS;
+			job.pData = &pChunk[i];
+			job.func = Rsort_count;
+			JOB_put(pQue, &job);
+		}
+		JOB_schedule(pQue, nb_wrk);
+		digit = (sys_ui32)(pSrc[0].key >> (pass * D_RSORT_BITS)) & D_RSORT_MASK;
+		for (i = 0, sum = 0; i < nb_chunk; ++i) {
+			sum += pChunk[i].cnt[digit];
+		}
+		if (sum == (sys_ui32)n) continue;
+		/* bin-major, chunk-minor offsets keep the sort stable */
+		for (j = 0, sum = 0; j < D_RSORT_BINS; ++j) {
+			for (i = 0; i < nb_chunk; ++i) {
+				c = pChunk[i].cnt[j];
+				pChunk[i].cnt[j] = sum;
+				sum += c;
+			}
+		}
+		for (i = 0; i < nb_chunk; ++i) {
+			job.pData = &pChunk[i];
+			job.func = Rsort_scatter;
+			JOB_put(pQue, &job);
+		}
+		JOB_schedule(pQue, nb_wrk);
+		pSwap = pSrc; pSrc = pTmp; pTmp = pSwap;
+	}
+	SYS_free(pChunk);
+	JOB_que_free(pQue);
+	return pSrc;
+}
+
 void TBALL_init(TRACKBALL* pBall, sys_i32 w, sys_i32 h, float r) {
 	memset(pBall, 0, sizeof(TRACKBALL));
 	pBall->width = w;
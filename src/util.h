@@ -101,6 +101,13 @@ typedef struct _UTL_GEOMETRY {
 } UTL_GEOMETRY;
 
 
+typedef struct _UTL_SORT_PAIR {
+	sys_ui64 key;
+	sys_ui32 idx;
+	sys_ui32 reserved;
+} UTL_SORT_PAIR;
+
+
 typedef struct _TRACKBALL_COORD {
 	sys_i32 x;
 	sys_i32 y;
@@ -145,6 +152,10 @@ D_EXTERN_FUNC const char* CFG_get(const char* pName);
 D_EXTERN_FUNC int CFG_get_i(const char* pName, int def_val);
 D_EXTERN_FUNC float CFG_get_f(const char* pName, float def_val);
 
+D_EXTERN_FUNC sys_i32 NAME_get_id(const char* pName);
+D_EXTERN_FUNC sys_i32 NAME_find_id(const char* pName);
+D_EXTERN_FUNC void NAME_reset(void);
+
 D_EXTERN_FUNC UTL_GEOMETRY* GMT_load(const char* fname);
 D_EXTERN_FUNC void GMT_free(UTL_GEOMETRY* pGeo);
 D_EXTERN_FUNC UVEC* GMT_get_pnt(UTL_GEOMETRY* pGeo, int i);
@@ -165,6 +176,8 @@ D_EXTERN_FUNC QVEC GMT_calc_pol_normal(UTL_GEOMETRY* pGeo, int pol_id);
 D_EXTERN_FUNC float UTL_frand01(void);
 D_EXTERN_FUNC float UTL_frand_11(void);
 D_EXTERN_FUNC float UTL_smooth_chg(float prev, float now, int len);
+D_EXTERN_FUNC UTL_SORT_PAIR* UTL_radix_sort(UTL_SORT_PAIR* pSrc, UTL_SORT_PAIR* pTmp, int n);
+D_EXTERN_FUNC UTL_SORT_PAIR* UTL_radix_sort_mt(UTL_SORT_PAIR* pSrc, UTL_SORT_PAIR* pTmp, int n, int nb_wrk);
 
 D_EXTERN_FUNC void TBALL_init(TRACKBALL* pBall, sys_i32 w, sys_i32 h, float r);
 D_EXTERN_FUNC void TBALL_update(TRACKBALL* pBall, sys_i32 x, sys_i32 y, sys_i32 prev_x, sys_i32 prev_y, int drag_flg);
@@ -0,0 +1,279 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/*
+ * Obstacle query benchmark on synthetic worlds, no data files.
+ * For every world and size: BVH build time, then a mixed stream of
+ * OBST_check, OBST_collide and OBST_range queries with per-query
+ * latency (p50/p99) and throughput for each query type.
+ * Then every accelerator is checked against its reference path on the same
+ * world (obst_check.c), any row that differs makes the exit code nonzero.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "job.h"
+#include "calc.h"
+#include "obstacle.h"
+#include "obstgen.h"
+#include "obst_check.h"
+
+#define D_QRY_DEF (100000)
+#define D_QUAD_DEF (1000000)
+#define D_SEED (1234)
+#define D_CHECK_DIV (10) /* checks use a tenth of the queries */
+
+typedef enum _E_QRY {
+	E_QRY_CHECK,
+	E_QRY_COLLIDE,
+	E_QRY_RANGE,
+	E_QRY_MAX
+} E_QRY;
+
+typedef struct _QRY {
+	UVEC p0;
+	UVEC p1;
+	float r;
+	sys_ui32 mask;
+	sys_i32 kind;
+	sys_i32 reserved;
+} QRY;
+
+typedef struct _QRY_STAT {
+	sys_i64* pTime;
+	sys_i64 total;
+	int count;
+	int nb_hit;
+} QRY_STAT;
+
+static const char* s_qry_name[] = {"check", "collide", "range"};
+static sys_ui32 s_seed = D_SEED;
+
+static float Frand() {
+	s_seed = s_seed * 1664525 + 1013904223;
+	return (float)(s_seed >> 8) * (1.0f / 16777216.0f);
+}
+
+static int Cmp_time(const void* p0, const void* p1) {
+	sys_i64 t0 = *(const sys_i64*)p0;
+	sys_i64 t1 = *(const sys_i64*)p1;
+	return t0 < t1 ? -1 : t0 > t1 ? 1 : 0;
+}
+
+static sys_i64 Percentile(QRY_STAT* pStat, int pct) {
+	int idx;
+	if (pStat->count <= 0) return 0;
+	idx = (int)(((sys_i64)pStat->count * pct) / 100);
+	if (idx >= pStat->count) idx = pStat->count - 1;
+	return pStat->pTime[idx];
+}
+
+/* a third each; vertical floor probes and short rays, small moves, boxes around the player's size */
+static void Make_queries(QRY* pQry, int n, GEOM_AABB* pBox) {
+	int i;
+	float ext;
+	UVEC size, pos, dir;
+
+	size.qv = GEOM_aabb_size(pBox);
+	for (i = 0; i < n; ++i) {
+		pos.qv = V4_set_pnt(pBox->min.x + Frand()*size.x, pBox->min.y + Frand()*size.y, pBox->min.z + Frand()*size.z);
+		dir.qv = V4_normalize(V4_set_vec(Frand() - 0.5f, Frand() - 0.5f, Frand() - 0.5f));
+		pQry->kind = (sys_i32)(Frand() * E_QRY_MAX);
+		if (pQry->kind >= E_QRY_MAX) pQry->kind = E_QRY_MAX - 1;
+		pQry->p0 = pos;
+		pQry->mask = E_OBST_POLYATTR_FLOOR | E_OBST_POLYATTR_CEIL | E_OBST_POLYATTR_WALL;
+		switch (pQry->kind) {
+			case E_QRY_CHECK:
+				if (i & 1) {
+					pQry->p1.qv = V4_add(pos.qv, V4_scale(dir.qv, 3.0f));
+				} else {
+					pQry->p0.y = pBox->max.y + 1.0f;
+					pQry->p1.qv = pos.qv;
+					pQry->p1.y = pBox->min.y - 1.0f;
+					pQry->mask = E_OBST_POLYATTR_FLOOR;
+				}
+				break;
+			case E_QRY_COLLIDE:
+				pQry->p1.qv = V4_add(pos.qv, V4_scale(dir.qv, 0.5f));
+				pQry->r = 0.5f;
+				pQry->mask = E_OBST_POLYATTR_WALL;
+				break;
+			default:
+				ext = 0.3f + Frand() * 2.0f;
+				pQry->p0.qv = V4_sub(pos.qv, V4_set_vec(ext, ext, ext));
+				pQry->p1.qv = V4_add(pos.qv, V4_set_vec(ext, ext, ext));
+				break;
+		}
+		++pQry;
+	}
+}
+
+static int Exec_query(OBSTACLE* pObst, QRY* pQry) {
+	OBST_QUERY chk;
+	OBST_RANGE_QUERY rng;
+	QVEC new_pos;
+
+	switch (pQry->kind) {
+		case E_QRY_CHECK:
+			chk.p0 = pQry->p0;
+			chk.p1 = pQry->p1;
+			chk.mask = pQry->mask;
+			return OBST_check(pObst, &chk);
+		case E_QRY_COLLIDE:
+			return OBST_collide(pObst, pQry->p1.qv, pQry->p0.qv, pQry->r, pQry->mask, &new_pos);
+		default:
+			memset(&rng, 0, sizeof(rng));
+			rng.range.min = pQry->p0;
+			rng.range.max = pQry->p1;
+			rng.mask = pQry->mask;
+			return OBST_range(pObst, &rng) > 0;
+	}
+}
+
+/* cost of the two timestamps around each query, reported so the small latencies can be read */
+static sys_i64 Timer_cost() {
+	int i;
+	sys_i64 t0, best;
+
+	best = 1 << 30;
+	for (i = 0; i < 1000; ++i) {
+		t0 = SYS_get_timestamp();
+		t0 = SYS_get_timestamp() - t0;
+		if (t0 < best) best = t0;
+	}
+	return best;
+}
+
+static int Run(E_OBST_GEN kind, int nb_quad, QRY* pQry, int nb_qry, QRY_STAT* pStat, int nb_wrk) {
+	int i, k, res, nb_fail;
+	sys_i64 t0, t_build;
+	double freq;
+	OBSTACLE obst;
+	QRY_STAT* pSt;
+
+	if (!OBST_gen(&obst, kind, nb_quad, D_SEED)) {
+		SYS_log("%-8s %8d: out of memory\n", OBST_gen_name(kind), nb_quad);
+		return 0;
+	}
+	t0 = SYS_get_timestamp();
+	OBST_build_bvh(&obst, nb_wrk);
+	t_build = SYS_get_timestamp() - t0;
+	if (!obst.pBVH) {
+		SYS_log("%-8s %8d: BVH build failed\n", OBST_gen_name(kind), nb_quad);
+		OBST_free(&obst);
+		return 1;
+	}
+	freq = (double)SYS_get_timestamp_freq();
+	s_seed = D_SEED + nb_quad;
+	Make_queries(pQry, nb_qry, BVH_get_node_bbox(obst.pBVH, 0));
+	for (k = 0; k < E_QRY_MAX; ++k) {
+		pStat[k].total = 0;
+		pStat[k].count = 0;
+		pStat[k].nb_hit = 0;
+	}
+	for (i = 0; i < nb_qry; ++i) {
+		pSt = &pStat[pQry[i].kind];
+		t0 = SYS_get_timestamp();
+		res = Exec_query(&obst, &pQry[i]);
+		t0 = SYS_get_timestamp() - t0;
+		pSt->pTime[pSt->count++] = t0;
+		pSt->total += t0;
+		pSt->nb_hit += !!res;
+	}
+	SYS_log("%-8s %8d quads, build %8.2f ms\n", OBST_gen_name(kind), obst.pData->nb_pol, (double)t_build * 1e3 / freq);
+	for (k = 0; k < E_QRY_MAX; ++k) {
+		pSt = &pStat[k];
+		qsort(pSt->pTime, pSt->count, sizeof(sys_i64), Cmp_time);
+		SYS_log("  %-8s %7d  p50 %8.0f ns  p99 %8.0f ns  %10.0f q/s  %5.1f%% hit\n",
+		        s_qry_name[k], pSt->count,
+		        (double)Percentile(pSt, 50) * 1e9 / freq, (double)Percentile(pSt, 99) * 1e9 / freq,
+		        pSt->total > 0 ? (double)pSt->count * freq / (double)pSt->total : 0.0,
+		        pSt->count > 0 ? 100.0 * pSt->nb_hit / pSt->count : 0.0);
+	}
+	nb_fail = CHK_world(&obst, kind, nb_qry/D_CHECK_DIV, D_SEED + nb_quad);
+	OBST_free(&obst);
+	return nb_fail;
+}
+
+static void Usage() {
+	SYS_log("obst_bench [-q queries] [-m max_quads] [-w workers] [-t terrain|interior|soup]\n");
+}
+
+int main(int argc, char* argv[]) {
+	int i, k, nb_qry, max_quad, nb_wrk, kind;
+	int nb_quad, nb_fail;
+	QRY* pQry;
+	QRY_STAT stat[E_QRY_MAX];
+
+	nb_qry = D_QRY_DEF;
+	max_quad = D_QUAD_DEF;
+	nb_wrk = D_MAX_WORKERS;
+	kind = -1;
+	for (i = 1; i < argc; ++i) {
+		if (i + 1 < argc && !strcmp(argv[i], "-q")) {
+			nb_qry = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-m")) {
+			max_quad = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-w")) {
+			nb_wrk = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-t")) {
+			++i;
+			for (k = 0; k < E_OBST_GEN_MAX; ++k) {
+				if (!strcmp(argv[i], OBST_gen_name((E_OBST_GEN)k))) kind = k;
+			}
+			if (kind < 0) {
+				Usage();
+				return 1;
+			}
+		} else {
+			Usage();
+			return 1;
+		}
+	}
+	if (nb_qry <= 0) nb_qry = D_QRY_DEF;
+	pQry = (QRY*)SYS_malloc(nb_qry * sizeof(QRY));
+	for (k = 0; k < E_QRY_MAX; ++k) {
+		stat[k].pTime = (sys_i64*)SYS_malloc(nb_qry * sizeof(sys_i64));
+	}
+	if (!pQry || !stat[0].pTime || !stat[1].pTime || !stat[2].pTime) {
+		SYS_log("out of memory\n");
+		return 1;
+	}
+	SYS_log("%d queries per world, timer cost %d ns included in latencies\n", nb_qry,
+	        (int)(Timer_cost() * 1000000000 / SYS_get_timestamp_freq()));
+	nb_fail = 0;
+	for (k = 0; k < E_OBST_GEN_MAX; ++k) {
+		if (kind >= 0 && k != kind) continue;
+		for (nb_quad = 1000; nb_quad <= max_quad; nb_quad *= 10) {
+			nb_fail += Run((E_OBST_GEN)k, nb_quad, pQry, nb_qry, stat, nb_wrk);
+		}
+	}
+	for (k = 0; k < E_QRY_MAX; ++k) {
+		SYS_free(stat[k].pTime);
+	}
+	SYS_free(pQry);
+	if (nb_fail) {
+		SYS_log("%d checks FAILED\n", nb_fail);
+		return 1;
+	}
+	return 0;
+}
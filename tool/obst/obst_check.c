@@ -0,0 +1,659 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/*
+ * Every row runs the same inputs through a reference path and an accelerated one,
+ * times both and counts the results that differ. Accelerators are hidden by
+ * clearing their pointers in a copy of the OBSTACLE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "job.h"
+#include "calc.h"
+#include "obstacle.h"
+#include "obstgen.h"
+#include "obst_check.h"
+
+#define D_CHK_RADIUS (0.8f)
+#define D_CHK_LIST (1024)
+#define D_CHK_BLAS (256)
+#define D_CHK_INST (256)
+#define D_CHK_DIRECT (4e7) /* quads times queries */
+
+typedef enum _E_CHK_HIDE {
+	E_CHK_HIDE_FLAT  = 1<<0,
+	E_CHK_HIDE_WIDE  = 1<<1,
+	E_CHK_HIDE_QUAD  = 1<<2,
+	E_CHK_HIDE_FLOOR = 1<<3,
+	E_CHK_HIDE_BVH   = 1<<4,
+	E_CHK_HIDE_ALL   = E_CHK_HIDE_FLAT | E_CHK_HIDE_WIDE | E_CHK_HIDE_FLOOR
+} E_CHK_HIDE;
+
+typedef enum _E_CHK_CMP {
+	E_CHK_CMP_VAL = 1<<0, /* dist2 or sweep t */
+	E_CHK_CMP_HIT = 1<<1  /* hit position and normal, bit exact */
+} E_CHK_CMP;
+
+/* one result of any query kind */
+typedef enum _E_CHK_RANGE {
+	E_CHK_RANGE_FUNC, /* OBST_range */
+	E_CHK_RANGE_BOX,  /* OBST_range_collect */
+	E_CHK_RANGE_SPH   /* OBST_range_collect_sph on the box's inner sphere */
+} E_CHK_RANGE;
+
+typedef struct _CHK_OUT {
+	UVEC pos;
+	UVEC nml;
+	float val;
+	int res; /* hit, or the polygon count of a range */
+	int id;  /* polygon number, or the sum of the numbers a range found */
+	int reserved;
+} CHK_OUT;
+
+typedef struct _CHK_WK {
+	OBSTACLE* pObst;
+	OBSTACLE tmp[2];
+	OBST_SCENE scn;
+	OBST_QUERY* pRay;
+	OBST_QUERY* pScn_ray;
+	OBST_QUERY* pRun;
+	GEOM_AABB* pRange;
+	OBST_SWEEP* pSweep;
+	int nb_qry;
+	int nb_sweep;
+	int nb_pol; /* per scene instance */
+	E_OBST_GEN kind;
+	sys_ui32 seed;
+} CHK_WK;
+
+typedef struct _CHK_ROW {
+	const char* name;
+	sys_ui32 cmp; /* E_CHK_CMP */
+	int (*init)(CHK_WK* pWk); /* returns 0 when the row does not apply to this world */
+	int (*run)(CHK_WK* pWk, CHK_OUT* pOut, int acc); /* returns the number of results */
+	void (*free)(CHK_WK* pWk);
+} CHK_ROW;
+
+static sys_ui32 s_seed;
+
+static float Chk_rand() {
+	s_seed = s_seed * 1664525 + 1013904223;
+	return (float)(s_seed >> 8) * (1.0f / 16777216.0f);
+}
+
+static void Chk_view(OBSTACLE* pView, BVH4* pWide, OBSTACLE* pObst, int hide) {
+	*pView = *pObst;
+	if (hide & E_CHK_HIDE_BVH) pView->pBVH = NULL;
+	if (hide & E_CHK_HIDE_FLAT) pView->pFlat = NULL;
+	if (hide & E_CHK_HIDE_WIDE) pView->pWide = NULL;
+	if (hide & E_CHK_HIDE_FLOOR) pView->pFloor = NULL;
+	if ((hide & E_CHK_HIDE_QUAD) && pView->pWide) {
+		*pWide = *pView->pWide;
+		pWide->pQuad = NULL;
+		pView->pWide = pWide;
+	}
+}
+
+/* half vertical floor probes, half short horizontal wall rays, spread over the box */
+static void Chk_make_rays(OBST_QUERY* pQry, int n, GEOM_AABB* pBox) {
+	int i;
+	float ang;
+	UVEC size, pos;
+
+	size.qv = GEOM_aabb_size(pBox);
+	for (i = 0; i < n; ++i) {
+		pos.qv = V4_set_pnt(pBox->min.x + Chk_rand()*size.x, pBox->min.y + Chk_rand()*size.y, pBox->min.z + Chk_rand()*size.z);
+		if (i & 1) {
+			ang = Chk_rand() * D_PI * 2.0f;
+			pQry[i].p0 = pos;
+			pQry[i].p1.qv = V4_add(pos.qv, V4_set_vec(cosf(ang)*3.0f, 0.0f, sinf(ang)*3.0f));
+			pQry[i].mask = E_OBST_POLYATTR_WALL;
+		} else {
+			pQry[i].p0.qv = V4_set_pnt(pos.x, pBox->max.y + 1.0f, pos.z);
+			pQry[i].p1.qv = V4_set_pnt(pos.x, pBox->min.y - 1.0f, pos.z);
+			pQry[i].mask = E_OBST_POLYATTR_FLOOR;
+		}
+	}
+}
+
+static void Chk_make_ranges(GEOM_AABB* pRange, int n, GEOM_AABB* pBox) {
+	int i;
+	float ext;
+	UVEC size, pos;
+
+	size.qv = GEOM_aabb_size(pBox);
+	for (i = 0; i < n; ++i) {
+		pos.qv = V4_set_pnt(pBox->min.x + Chk_rand()*size.x, pBox->min.y + Chk_rand()*size.y, pBox->min.z + Chk_rand()*size.z);
+		ext = 0.3f + Chk_rand() * 2.0f;
+		pRange[i].min.qv = V4_sub(pos.qv, V4_set_vec(ext, ext, ext));
+		pRange[i].max.qv = V4_add(pos.qv, V4_set_vec(ext, ext, ext));
+	}
+}
+
+/* movers start on the floor hits of the probes, clear of walls; slow and fast steps alternate */
+static int Chk_make_sweeps(OBSTACLE* pObst, OBST_SWEEP* pSweep, OBST_QUERY* pRay, int n) {
+	int i, count;
+	float ang, len;
+	OBST_QUERY qry;
+	OBST_RANGE_QUERY rng;
+
+	count = 0;
+	for (i = 0; i < n; ++i) {
+		if (pRay[i].mask != E_OBST_POLYATTR_FLOOR) continue;
+		qry = pRay[i];
+		if (!OBST_check(pObst, &qry)) continue;
+		memset(&rng, 0, sizeof(rng));
+		rng.range.min.qv = V4_set_w1(V4_sub(V4_add(qry.hit_pos.qv, V4_set_vec(0.0f, 1.0f, 0.0f)), V4_fill(D_CHK_RADIUS)));
+		rng.range.max.qv = V4_set_w1(V4_add(V4_add(qry.hit_pos.qv, V4_set_vec(0.0f, 1.0f, 0.0f)), V4_fill(D_CHK_RADIUS)));
+		rng.mask = E_OBST_POLYATTR_WALL;
+		if (OBST_range(pObst, &rng)) continue;
+		ang = Chk_rand() * D_PI * 2.0f;
+		len = (count & 1) ? 5.0f + Chk_rand() * 15.0f : 0.05f + Chk_rand() * 0.25f;
+		memset(&pSweep[count], 0, sizeof(OBST_SWEEP));
+		pSweep[count].pos0.qv = V4_add(qry.hit_pos.qv, V4_set_vec(0.0f, 1.0f, 0.0f));
+		pSweep[count].pos1 = pSweep[count].pos0;
+		pSweep[count].move.qv = V4_set_vec(cosf(ang)*len, 0.0f, sinf(ang)*len);
+		pSweep[count].radius = D_CHK_RADIUS;
+		pSweep[count].mask = E_OBST_POLYATTR_WALL;
+		++count;
+	}
+	return count;
+}
+
+static void Chk_put_ray(CHK_OUT* pOut, OBST_QUERY* pQry) {
+	memset(pOut, 0, sizeof(CHK_OUT));
+	pOut->res = pQry->res;
+	if (pQry->res) {
+		pOut->pos = pQry->hit_pos;
+		pOut->nml = pQry->hit_nml;
+		pOut->val = pQry->dist2;
+		pOut->id = pQry->pol_no;
+	}
+}
+
+static int Chk_rays(CHK_WK* pWk, OBSTACLE* pObst, OBST_QUERY* pRay, CHK_OUT* pOut, int batch) {
+	int i;
+
+	memcpy(pWk->pRun, pRay, pWk->nb_qry * sizeof(OBST_QUERY));
+	if (batch) {
+		OBST_check_batch(pObst, pWk->pRun, pWk->nb_qry);
+	} else {
+		for (i = 0; i < pWk->nb_qry; ++i) {
+			OBST_check(pObst, &pWk->pRun[i]);
+		}
+	}
+	for (i = 0; i < pWk->nb_qry; ++i) {
+		Chk_put_ray(&pOut[i], &pWk->pRun[i]);
+	}
+	return pWk->nb_qry;
+}
+
+static int Chk_hide_rays(CHK_WK* pWk, CHK_OUT* pOut, int hide) {
+	BVH4 wide;
+	OBSTACLE view;
+
+	Chk_view(&view, &wide, pWk->pObst, hide);
+	return Chk_rays(pWk, &view, pWk->pRay, pOut, 0);
+}
+
+/* lists longer than D_CHK_LIST are compared by count only, their order is up to the traversal */
+static void Chk_range_func(int pol_no, OBST_RANGE_STATE* pState, QVEC* pVtx) {
+	(void)pVtx;
+	if (pState->count <= D_CHK_LIST) {
+		((int*)pState->pData)[0] += pol_no;
+	}
+}
+
+static int Chk_ranges(CHK_WK* pWk, int hide, E_CHK_RANGE kind, CHK_OUT* pOut) {
+	int i, j, n, sum;
+	int list[D_CHK_LIST];
+	BVH4 wide;
+	OBSTACLE view;
+	OBST_RANGE_QUERY rng;
+	GEOM_SPHERE sph;
+
+	Chk_view(&view, &wide, pWk->pObst, hide);
+	memset(&rng, 0, sizeof(rng));
+	rng.func = Chk_range_func;
+	rng.mask = E_OBST_POLYATTR_FLOOR | E_OBST_POLYATTR_CEIL | E_OBST_POLYATTR_WALL;
+	for (i = 0; i < pWk->nb_qry; ++i) {
+		sum = 0;
+		if (kind == E_CHK_RANGE_FUNC) {
+			rng.range = pWk->pRange[i];
+			rng.state.pData = &sum;
+			n = OBST_range(&view, &rng);
+		} else {
+			if (kind == E_CHK_RANGE_SPH) {
+				sph.qv = V4_scale(V4_add(pWk->pRange[i].min.qv, pWk->pRange[i].max.qv), 0.5f);
+				sph.r = (pWk->pRange[i].max.x - pWk->pRange[i].min.x) * 0.5f;
+				n = OBST_range_collect_sph(&view, &sph, rng.mask, list, D_CHK_LIST);
+			} else {
+				n = OBST_range_collect(&view, &pWk->pRange[i], rng.mask, list, D_CHK_LIST);
+			}
+			for (j = 0; j < D_MIN(n, D_CHK_LIST); ++j) {
+				sum += list[j];
+			}
+		}
+		memset(&pOut[i], 0, sizeof(CHK_OUT));
+		pOut[i].res = n;
+		pOut[i].id = n <= D_CHK_LIST ? sum : 0;
+	}
+	return pWk->nb_qry;
+}
+
+static int Chk_sweeps(CHK_WK* pWk, int hide, CHK_OUT* pOut) {
+	int i;
+	BVH4 wide;
+	OBSTACLE view;
+	OBST_SWEEP sweep;
+
+	Chk_view(&view, &wide, pWk->pObst, hide);
+	for (i = 0; i < pWk->nb_sweep; ++i) {
+		sweep = pWk->pSweep[i];
+		OBST_sweep(&view, &sweep);
+		memset(&pOut[i], 0, sizeof(CHK_OUT));
+		pOut[i].res = sweep.res;
+		if (sweep.res) {
+			pOut[i].pos = sweep.hit_pos;
+			pOut[i].nml = sweep.hit_nml;
+			pOut[i].val = sweep.t;
+			pOut[i].id = sweep.pol_no;
+		}
+	}
+	return pWk->nb_sweep;
+}
+
+static int Run_flat(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_hide_rays(pWk, pOut, acc ? E_CHK_HIDE_WIDE | E_CHK_HIDE_FLOOR : E_CHK_HIDE_ALL);
+}
+
+static int Run_wide(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_hide_rays(pWk, pOut, acc ? E_CHK_HIDE_FLOOR : E_CHK_HIDE_ALL);
+}
+
+static int Init_quad(CHK_WK* pWk) {
+	return pWk->pObst->pWide && pWk->pObst->pWide->pQuad;
+}
+
+static int Run_quad(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_hide_rays(pWk, pOut, acc ? E_CHK_HIDE_FLOOR : E_CHK_HIDE_FLOOR | E_CHK_HIDE_QUAD);
+}
+
+static int Init_floor(CHK_WK* pWk) {
+	return pWk->pObst->pFloor != NULL;
+}
+
+static int Run_floor(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_hide_rays(pWk, pOut, acc ? 0 : E_CHK_HIDE_FLOOR);
+}
+
+static int Run_batch(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_rays(pWk, pWk->pObst, pWk->pRay, pOut, acc);
+}
+
+static int Chk_copy(OBSTACLE* pDst, OBSTACLE* pSrc) {
+	if (!OBST_init(pDst, pSrc->pData->nb_pnt, pSrc->pData->nb_pol)) return 0;
+	memcpy(pDst->pPnt, pSrc->pPnt, pSrc->pData->nb_pnt * sizeof(UVEC3));
+	memcpy(pDst->pPol, pSrc->pPol, pSrc->pData->nb_pol * sizeof(OBST_POLY));
+	return 1;
+}
+
+static void Chk_post_order(BVH_HEAD* pBVH, int node, sys_i32* pMap, int* pCount) {
+	BVH_NODE* pNode = BVH_get_node(pBVH, node);
+	if (pNode->right >= 0) {
+		Chk_post_order(pBVH, pNode->left, pMap, pCount);
+		Chk_post_order(pBVH, pNode->right, pMap, pCount);
+	}
+	if (node) {
+		pMap[node] = (*pCount)++;
+	}
+}
+
+/* the root stays first, every other node follows its children, as a tree from a file may be laid out */
+static BVH_HEAD* Chk_permute(BVH_HEAD* pSrc) {
+	int i, n, count;
+	sys_i32* pMap;
+	BVH_HEAD* pDst;
+	BVH_NODE* pNode;
+
+	n = pSrc->nb_node;
+	pDst = BVH_alloc(n);
+	pMap = (sys_i32*)SYS_malloc(n * sizeof(sys_i32));
+	if (!pDst || !pMap) {
+		SYS_free(pDst);
+		SYS_free(pMap);
+		return NULL;
+	}
+	pMap[0] = 0;
+	count = 1;
+	Chk_post_order(pSrc, 0, pMap, &count);
+	for (i = 0; i < n; ++i) {
+		*BVH_get_node_bbox(pDst, pMap[i]) = *BVH_get_node_bbox(pSrc, i);
+		pNode = BVH_get_node(pDst, pMap[i]);
+		*pNode = *BVH_get_node(pSrc, i);
+		if (pNode->right >= 0) {
+			pNode->left = pMap[pNode->left];
+			pNode->right = pMap[pNode->right];
+		}
+	}
+	SYS_free(pMap);
+	return pDst;
+}
+
+/* refit of a deformed copy laid out in post-order, against a tree built for the deformed points */
+static int Init_refit(CHK_WK* pWk) {
+	int i;
+	BVH_HEAD* pBVH;
+	OBSTACLE* pRefit = &pWk->tmp[0];
+	OBSTACLE* pBuilt = &pWk->tmp[1];
+
+	if (!Chk_copy(pRefit, pWk->pObst)) return 0;
+	OBST_build_bvh(pRefit, D_MAX_WORKERS);
+	pBVH = pRefit->pBVH ? Chk_permute(pRefit->pBVH) : NULL;
+	if (!pBVH) {
+		OBST_free(pRefit);
+		return 0;
+	}
+	SYS_free(pRefit->pBVH);
+	pRefit->pBVH = pBVH;
+	OBST_build_flat(pRefit);
+	OBST_build_wide(pRefit);
+	OBST_build_floor(pRefit);
+	for (i = 0; i < (int)pRefit->pData->nb_pnt; ++i) {
+		pRefit->pPnt[i].y += sinf(pRefit->pPnt[i].x * 0.7f) * 0.8f;
+	}
+	OBST_refit(pRefit);
+	if (!Chk_copy(pBuilt, pRefit)) {
+		OBST_free(pRefit);
+		return 0;
+	}
+	OBST_build_bvh(pBuilt, D_MAX_WORKERS);
+	return 1;
+}
+
+/* each pair of floor probe and wall ray goes through the next of the refit binary, flat, wide and floor grid */
+static int Run_refit(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	int i;
+	BVH4 wide[4];
+	OBSTACLE view[4];
+	static int hide[4] = {E_CHK_HIDE_ALL, E_CHK_HIDE_WIDE | E_CHK_HIDE_FLOOR, E_CHK_HIDE_FLOOR, 0};
+
+	if (!acc) {
+		Chk_view(&view[0], &wide[0], &pWk->tmp[1], E_CHK_HIDE_FLOOR);
+		return Chk_rays(pWk, &view[0], pWk->pRay, pOut, 0);
+	}
+	for (i = 0; i < 4; ++i) {
+		Chk_view(&view[i], &wide[i], &pWk->tmp[0], hide[i]);
+	}
+	memcpy(pWk->pRun, pWk->pRay, pWk->nb_qry * sizeof(OBST_QUERY));
+	for (i = 0; i < pWk->nb_qry; ++i) {
+		OBST_check(&view[(i >> 1) & 3], &pWk->pRun[i]);
+		Chk_put_ray(&pOut[i], &pWk->pRun[i]);
+	}
+	return pWk->nb_qry;
+}
+
+static void Free_tmp(CHK_WK* pWk) {
+	OBST_free(&pWk->tmp[0]);
+	OBST_free(&pWk->tmp[1]);
+}
+
+/* instances of a small world of the same kind, against the same world baked into one mesh */
+static int Init_scene(CHK_WK* pWk) {
+	int i, j, k, nb_pnt, nb_pol;
+	float side;
+	UVEC pos;
+	MTX m;
+	OBSTACLE* pBlas = &pWk->tmp[0];
+	OBSTACLE* pBake = &pWk->tmp[1];
+
+	if (!OBST_gen(pBlas, pWk->kind, D_CHK_BLAS, pWk->seed)) return 0;
+	OBST_build_bvh(pBlas, 1);
+	nb_pnt = pBlas->pData->nb_pnt;
+	nb_pol = pBlas->pData->nb_pol;
+	if (!OBST_scene_init(&pWk->scn, D_CHK_INST)) {
+		OBST_free(pBlas);
+		return 0;
+	}
+	if (!OBST_init(pBake, nb_pnt * D_CHK_INST, nb_pol * D_CHK_INST)) {
+		OBST_scene_free(&pWk->scn);
+		OBST_free(pBlas);
+		return 0;
+	}
+	side = sqrtf((float)D_CHK_INST) * 8.0f;
+	for (i = 0; i < D_CHK_INST; ++i) {
+		MTX_rot_y(m, Chk_rand() * D_PI * 2.0f);
+		m[3][0] = Chk_rand() * side;
+		m[3][1] = Chk_rand() * 4.0f;
+		m[3][2] = Chk_rand() * side;
+		OBST_scene_add(&pWk->scn, pBlas, m);
+		for (j = 0; j < nb_pnt; ++j) {
+			pos.qv = MTX_calc_qpnt(m, V4_set_pnt(pBlas->pPnt[j].x, pBlas->pPnt[j].y, pBlas->pPnt[j].z));
+			pBake->pPnt[i*nb_pnt + j].x = pos.x;
+			pBake->pPnt[i*nb_pnt + j].y = pos.y;
+			pBake->pPnt[i*nb_pnt + j].z = pos.z;
+		}
+		for (j = 0; j < nb_pol; ++j) {
+			for (k = 0; k < 4; ++k) {
+				pBake->pPol[i*nb_pol + j].idx[k] = pBlas->pPol[j].idx[k] + i*nb_pnt;
+			}
+			pBake->pPol[i*nb_pol + j].attr = pBlas->pPol[j].attr;
+		}
+	}
+	OBST_scene_update(&pWk->scn, 1, 1);
+	OBST_build_bvh(pBake, D_MAX_WORKERS);
+	Chk_make_rays(pWk->pScn_ray, pWk->nb_qry, BVH_get_node_bbox(pBake->pBVH, 0));
+	pWk->nb_pol = nb_pol;
+	return 1;
+}
+
+static int Run_scene(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	int i, inst_no;
+
+	if (!acc) {
+		return Chk_rays(pWk, &pWk->tmp[1], pWk->pScn_ray, pOut, 0);
+	}
+	memcpy(pWk->pRun, pWk->pScn_ray, pWk->nb_qry * sizeof(OBST_QUERY));
+	for (i = 0; i < pWk->nb_qry; ++i) {
+		OBST_scene_check(&pWk->scn, &pWk->pRun[i], &inst_no);
+		pWk->pRun[i].pol_no += inst_no * pWk->nb_pol;
+		Chk_put_ray(&pOut[i], &pWk->pRun[i]);
+	}
+	return pWk->nb_qry;
+}
+
+static void Free_scene(CHK_WK* pWk) {
+	OBST_scene_free(&pWk->scn);
+	Free_tmp(pWk);
+}
+
+static int Run_range_flat(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_ranges(pWk, acc ? E_CHK_HIDE_WIDE : E_CHK_HIDE_FLAT | E_CHK_HIDE_WIDE, E_CHK_RANGE_FUNC, pOut);
+}
+
+static int Run_range_wide(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_ranges(pWk, acc ? 0 : E_CHK_HIDE_FLAT | E_CHK_HIDE_WIDE, E_CHK_RANGE_FUNC, pOut);
+}
+
+/* collect rows against the OBST_range callback through the binary BVH */
+static int Run_collect(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return acc ? Chk_ranges(pWk, 0, E_CHK_RANGE_BOX, pOut) : Run_range_wide(pWk, pOut, 0);
+}
+
+static int Run_collect_flat(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return acc ? Chk_ranges(pWk, E_CHK_HIDE_WIDE, E_CHK_RANGE_BOX, pOut) : Run_range_wide(pWk, pOut, 0);
+}
+
+static int Run_collect_bvh(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return acc ? Chk_ranges(pWk, E_CHK_HIDE_FLAT | E_CHK_HIDE_WIDE, E_CHK_RANGE_BOX, pOut) : Run_range_wide(pWk, pOut, 0);
+}
+
+static int Run_collect_sph(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_ranges(pWk, acc ? 0 : E_CHK_HIDE_FLAT | E_CHK_HIDE_WIDE, E_CHK_RANGE_SPH, pOut);
+}
+
+/* the linear scans are only affordable on small worlds */
+static int Init_direct(CHK_WK* pWk) {
+	return (double)pWk->pObst->pData->nb_pol * (double)pWk->nb_qry <= D_CHK_DIRECT;
+}
+
+static int Init_sweep_direct(CHK_WK* pWk) {
+	return (double)pWk->pObst->pData->nb_pol * (double)pWk->nb_sweep <= D_CHK_DIRECT;
+}
+
+static int Run_bvh(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_hide_rays(pWk, pOut, acc ? E_CHK_HIDE_ALL : E_CHK_HIDE_BVH | E_CHK_HIDE_ALL);
+}
+
+static int Run_sweep_bvh(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_sweeps(pWk, acc ? E_CHK_HIDE_FLAT | E_CHK_HIDE_WIDE : E_CHK_HIDE_BVH | E_CHK_HIDE_FLAT | E_CHK_HIDE_WIDE, pOut);
+}
+
+static int Run_sweep_flat(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_sweeps(pWk, acc ? E_CHK_HIDE_WIDE : E_CHK_HIDE_FLAT | E_CHK_HIDE_WIDE, pOut);
+}
+
+static int Run_sweep_wide(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	return Chk_sweeps(pWk, acc ? 0 : E_CHK_HIDE_FLAT | E_CHK_HIDE_WIDE, pOut);
+}
+
+/* the mover tunneled when the straight path to where the sweep stopped crosses a wall */
+static int Run_tunnel(CHK_WK* pWk, CHK_OUT* pOut, int acc) {
+	int i;
+	OBST_SWEEP sweep;
+	OBST_QUERY qry;
+
+	for (i = 0; i < pWk->nb_sweep; ++i) {
+		memset(&pOut[i], 0, sizeof(CHK_OUT));
+		if (!acc) continue;
+		sweep = pWk->pSweep[i];
+		OBST_sweep(pWk->pObst, &sweep);
+		qry.p0 = sweep.pos0;
+		qry.p1.qv = V4_add(sweep.pos0.qv, V4_scale(sweep.move.qv, sweep.t));
+		qry.mask = E_OBST_POLYATTR_WALL;
+		pOut[i].res = OBST_check(pWk->pObst, &qry);
+	}
+	return pWk->nb_sweep;
+}
+
+static CHK_ROW s_chk_row[] = {
+	{"bvh",          E_CHK_CMP_VAL | E_CHK_CMP_HIT, Init_direct,       Run_bvh,          NULL},
+	{"flat",         E_CHK_CMP_VAL | E_CHK_CMP_HIT, NULL,              Run_flat,         NULL},
+	{"bvh4",         E_CHK_CMP_VAL | E_CHK_CMP_HIT, NULL,              Run_wide,         NULL},
+	{"quad4",        E_CHK_CMP_VAL | E_CHK_CMP_HIT, Init_quad,         Run_quad,         NULL},
+	{"floor",        E_CHK_CMP_HIT,                 Init_floor,        Run_floor,        NULL},
+	{"batch",        E_CHK_CMP_VAL | E_CHK_CMP_HIT, NULL,              Run_batch,        NULL},
+	{"refit",        E_CHK_CMP_HIT,                 Init_refit,        Run_refit,        Free_tmp},
+	{"scene",        0,                             Init_scene,        Run_scene,        Free_scene},
+	{"range flat",   0,                             NULL,              Run_range_flat,   NULL},
+	{"range bvh4",   0,                             NULL,              Run_range_wide,   NULL},
+	{"collect",      0,                             NULL,              Run_collect,      NULL},
+	{"collect flat", 0,                             NULL,              Run_collect_flat, NULL},
+	{"collect bvh",  0,                             NULL,              Run_collect_bvh,  NULL},
+	{"collect sph",  0,                             NULL,              Run_collect_sph,  NULL},
+	{"sweep bvh",    E_CHK_CMP_VAL | E_CHK_CMP_HIT, Init_sweep_direct, Run_sweep_bvh,    NULL},
+	{"sweep flat",   E_CHK_CMP_VAL | E_CHK_CMP_HIT, NULL,              Run_sweep_flat,   NULL},
+	{"sweep bvh4",   E_CHK_CMP_VAL | E_CHK_CMP_HIT, NULL,              Run_sweep_wide,   NULL},
+	{"tunnel",       0,                             NULL,              Run_tunnel,       NULL}
+};
+
+static int Chk_diff(CHK_OUT* pRef, CHK_OUT* pAcc, int n, sys_ui32 cmp) {
+	int i, nb_diff;
+
+	nb_diff = 0;
+	for (i = 0; i < n; ++i) {
+		if (pRef[i].res != pAcc[i].res || pRef[i].id != pAcc[i].id ||
+		    ((cmp & E_CHK_CMP_VAL) && pRef[i].val != pAcc[i].val) ||
+		    ((cmp & E_CHK_CMP_HIT) && (memcmp(&pRef[i].pos, &pAcc[i].pos, sizeof(UVEC)) || memcmp(&pRef[i].nml, &pAcc[i].nml, sizeof(UVEC))))) {
+			++nb_diff;
+		}
+	}
+	return nb_diff;
+}
+
+static double Chk_rate(int n, sys_i64 ticks) {
+	return ticks > 0 ? (double)n * (double)SYS_get_timestamp_freq() / (double)ticks : 0.0;
+}
+
+/* returns the number of rows with differences, the world must have its BVH built */
+int CHK_world(OBSTACLE* pObst, E_OBST_GEN kind, int nb_qry, sys_ui32 seed) {
+	int i, n, nb_diff, nb_fail;
+	sys_i64 t0, t_ref, t_acc;
+	CHK_WK wk;
+	CHK_ROW* pRow;
+	CHK_OUT* pRef;
+	CHK_OUT* pAcc;
+
+	if (!pObst->pBVH || nb_qry <= 0) return 0;
+	memset(&wk, 0, sizeof(wk));
+	wk.pObst = pObst;
+	wk.nb_qry = nb_qry;
+	wk.kind = kind;
+	wk.seed = seed;
+	wk.pRay = (OBST_QUERY*)SYS_malloc(nb_qry * sizeof(OBST_QUERY));
+	wk.pScn_ray = (OBST_QUERY*)SYS_malloc(nb_qry * sizeof(OBST_QUERY));
+	wk.pRun = (OBST_QUERY*)SYS_malloc(nb_qry * sizeof(OBST_QUERY));
+	wk.pRange = (GEOM_AABB*)SYS_malloc(nb_qry * sizeof(GEOM_AABB));
+	wk.pSweep = (OBST_SWEEP*)SYS_malloc(nb_qry * sizeof(OBST_SWEEP));
+	pRef = (CHK_OUT*)SYS_malloc(nb_qry * sizeof(CHK_OUT));
+	pAcc = (CHK_OUT*)SYS_malloc(nb_qry * sizeof(CHK_OUT));
+	nb_fail = 0;
+	if (!wk.pRay || !wk.pScn_ray || !wk.pRun || !wk.pRange || !wk.pSweep || !pRef || !pAcc) {
+		SYS_log("  checks: out of memory\n");
+		nb_fail = 1;
+	} else {
+		s_seed = seed;
+		OBST_build_floor(pObst);
+		Chk_make_rays(wk.pRay, nb_qry, BVH_get_node_bbox(pObst->pBVH, 0));
+		Chk_make_ranges(wk.pRange, nb_qry, BVH_get_node_bbox(pObst->pBVH, 0));
+		wk.nb_sweep = Chk_make_sweeps(pObst, wk.pSweep, wk.pRay, nb_qry);
+		for (i = 0; i < (int)D_ARRAY_LENGTH(s_chk_row); ++i) {
+			pRow = &s_chk_row[i];
+			if (pRow->init && !pRow->init(&wk)) {
+				SYS_log("  %-12s skipped\n", pRow->name);
+				continue;
+			}
+			t0 = SYS_get_timestamp();
+			n = pRow->run(&wk, pRef, 0);
+			t_ref = SYS_get_timestamp() - t0;
+			t0 = SYS_get_timestamp();
+			pRow->run(&wk, pAcc, 1);
+			t_acc = SYS_get_timestamp() - t0;
+			if (pRow->free) {
+				pRow->free(&wk);
+			}
+			nb_diff = Chk_diff(pRef, pAcc, n, pRow->cmp);
+			SYS_log("  %-12s %7d  %10.0f -> %10.0f q/s  %d differ%s\n",
+			        pRow->name, n, Chk_rate(n, t_ref), Chk_rate(n, t_acc), nb_diff, nb_diff ? "  FAILED" : "");
+			nb_fail += !!nb_diff;
+		}
+	}
+	SYS_free(pAcc);
+	SYS_free(pRef);
+	SYS_free(wk.pSweep);
+	SYS_free(wk.pRange);
+	SYS_free(wk.pRun);
+	SYS_free(wk.pScn_ray);
+	SYS_free(wk.pRay);
+	return nb_fail;
+}
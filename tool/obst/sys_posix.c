@@ -0,0 +1,201 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/* the parts of system.c and job.c the headless tools need, on POSIX */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "system.h"
+#include "job.h"
+
+JOB_SYS g_job_sys;
+
+static __thread sys_int s_wrk_id = -1; /* as on Windows, -1 outside of jobs */
+
+void* SYS_malloc(int size) {
+	void* p = NULL;
+	if (posix_memalign(&p, 16, size)) return NULL;
+	return p;
+}
+
+void SYS_free(void* pMem) {
+	free(pMem);
+}
+
+void SYS_log(const char* fmt, ...) {
+	va_list lst;
+	va_start(lst, fmt);
+	vprintf(fmt, lst);
+	va_end(lst);
+}
+
+void* SYS_load(const char* fname) {
+	return SYS_load_ex(fname, NULL);
+}
+
+void* SYS_load_ex(const char* fname, int* pSize) {
+	FILE* f;
+	long size;
+	void* pData = NULL;
+
+	if (pSize) *pSize = 0;
+	f = fopen(fname, "rb");
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size > 0) {
+		pData = SYS_malloc((int)size);
+		if (pData && fread(pData, 1, size, f) != (size_t)size) {
+			SYS_free(pData);
+			pData = NULL;
+		}
+		if (pData && pSize) *pSize = (int)size;
+	}
+	fclose(f);
+	return pData;
+}
+
+int SYS_save(const char* fname, const void* pData, int size) {
+	FILE* f;
+	int res;
+
+	f = fopen(fname, "wb");
+	if (!f) return 0;
+	res = fwrite(pData, size, 1, f) == 1;
+	fclose(f);
+	return res;
+}
+
+sys_i64 SYS_get_timestamp(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (sys_i64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+sys_i64 SYS_get_timestamp_freq(void) {
+	return 1000000000;
+}
+
+/* x87 precision control on Windows, SSE math needs nothing here */
+void SYS_init_FPU(void) {
+}
+
+sys_i32 SYNC_inc(sys_i32* pVal) {
+	return __sync_add_and_fetch(pVal, 1);
+}
+
+sys_i32 SYNC_dec(sys_i32* pVal) {
+	return __sync_sub_and_fetch(pVal, 1);
+}
+
+sys_i32 SYNC_xchg(sys_i32* pVal, sys_i32 new_val) {
+	return __sync_lock_test_and_set(pVal, new_val);
+}
+
+sys_i32 SYNC_cas(sys_i32* pVal, sys_i32 new_val, sys_i32 cmp_val) {
+	return __sync_val_compare_and_swap(pVal, cmp_val, new_val);
+}
+
+sys_i32 SYNC_add(sys_i32* pVal, sys_i32 add_val) {
+	return __sync_fetch_and_add(pVal, add_val);
+}
+
+JOB_QUEUE* JOB_que_alloc(sys_ui32 size) {
+	JOB_QUEUE* pQue = (JOB_QUEUE*)SYS_malloc(sizeof(JOB_QUEUE) + size*sizeof(JOB));
+	if (pQue) {
+		pQue->size = size;
+		pQue->pJob = (JOB*)(pQue + 1);
+		JOB_que_clear(pQue);
+	}
+	return pQue;
+}
+
+void JOB_que_free(JOB_QUEUE* pQue) {
+	SYS_free(pQue);
+}
+
+void JOB_que_clear(JOB_QUEUE* pQue) {
+	pQue->count = 0;
+	pQue->idx = 0;
+}
+
+void JOB_put(JOB_QUEUE* pQue, JOB* pJob) {
+	if ((sys_ui32)pQue->count < pQue->size) {
+		pQue->pJob[pQue->count++] = *pJob;
+	}
+}
+
+typedef struct _JOB_THREAD {
+	JOB_QUEUE* pQue;
+	sys_int id;
+} JOB_THREAD;
+
+static void* Job_exec(void* pData) {
+	sys_long idx;
+	JOB_THREAD* pThr = (JOB_THREAD*)pData;
+	JOB_QUEUE* pQue = pThr->pQue;
+	sys_int old_id = s_wrk_id;
+
+	s_wrk_id = pThr->id;
+	for (;;) {
+		idx = __sync_fetch_and_add(&pQue->idx, 1);
+		if (idx >= pQue->count) break;
+		pQue->pJob[idx].func(pQue->pJob[idx].pData);
+	}
+	s_wrk_id = old_id;
+	return NULL;
+}
+
+/* threads per call, the build jobs are coarse enough for this */
+void JOB_schedule(JOB_QUEUE* pQue, sys_int nb_wrk) {
+	int i;
+	pthread_t thr[D_MAX_WORKERS];
+	JOB_THREAD arg[D_MAX_WORKERS];
+
+	if (nb_wrk > D_MAX_WORKERS) nb_wrk = D_MAX_WORKERS;
+	if (nb_wrk < 1) nb_wrk = 1;
+	for (i = 0; i < nb_wrk; ++i) {
+		arg[i].pQue = pQue;
+		arg[i].id = i;
+	}
+	for (i = 1; i < nb_wrk; ++i) {
+		if (pthread_create(&thr[i], NULL, Job_exec, &arg[i])) break;
+	}
+	nb_wrk = i;
+	Job_exec(&arg[0]);
+	for (i = 1; i < nb_wrk; ++i) {
+		pthread_join(thr[i], NULL);
+	}
+	JOB_que_clear(pQue);
+}
+
+void JOB_lock(void) {}
+void JOB_unlock(void) {}
+
+sys_int JOB_get_worker_id(void) {
+	return s_wrk_id;
+}
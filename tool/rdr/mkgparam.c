@@ -0,0 +1,348 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/*
+ * gen/gparam.h for builds without the shader compiler.
+ * mkgpu takes the parameters from the compiled programs, here they come from the
+ * global declarations in the sources, so unused ones are kept as well.
+ * Layout and names follow mkgpu: grouped by type, programs numbered in list order.
+ *   mkgparam <shader dir> <vtx list> <pix list> > gen/gparam.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define D_MAX_PARAM (256)
+#define D_MAX_PROG (128)
+#define D_MAX_FILE (128)
+#define D_MAX_TYPEDEF (32)
+#define D_NAME_LEN (64)
+
+typedef enum _E_PARAMTYPE {
+	E_PARAMTYPE_FVEC  = 0,
+	E_PARAMTYPE_IVEC  = 1,
+	E_PARAMTYPE_FLOAT = 2,
+	E_PARAMTYPE_INT   = 3,
+	E_PARAMTYPE_SMP   = 4,
+	E_PARAMTYPE_BOOL  = 5,
+	E_PARAMTYPE_MAX
+} E_PARAMTYPE;
+
+typedef struct _PARAM {
+	char name[D_NAME_LEN];
+	int type;
+	int len;
+	int offs;
+} PARAM;
+
+typedef struct _TYPEDEF {
+	char name[D_NAME_LEN];
+	char base[D_NAME_LEN];
+	int row_major;
+} TYPEDEF;
+
+static const char* s_type_name[] = {"FVEC", "IVEC", "FLOAT", "INT", "SMP", "BOOL"};
+
+static PARAM s_param[D_MAX_PARAM];
+static int s_nb_param;
+static char s_prog[D_MAX_PROG][D_NAME_LEN];
+static int s_nb_prog;
+static char s_file[D_MAX_FILE][D_NAME_LEN];
+static int s_nb_file;
+static TYPEDEF s_typedef[D_MAX_TYPEDEF];
+static int s_nb_typedef;
+static const char* s_dir;
+
+static char* Skip_ws(char* p) {
+	while (*p && isspace((unsigned char)*p)) ++p;
+	return p;
+}
+
+static char* Get_word(char* p, char* pDst) {
+	int n = 0;
+	p = Skip_ws(p);
+	while (*p && (isalnum((unsigned char)*p) || *p == '_') && n < D_NAME_LEN - 1) {
+		pDst[n++] = *p++;
+	}
+	pDst[n] = 0;
+	return p;
+}
+
+/* array sizes as the shaders write them: 7, 2*4 */
+static int Eval_len(char* p) {
+	int val = 1;
+	while (1) {
+		p = Skip_ws(p);
+		if (!isdigit((unsigned char)*p)) break;
+		val *= (int)strtol(p, &p, 10);
+		p = Skip_ws(p);
+		if (*p != '*') break;
+		++p;
+	}
+	return val;
+}
+
+/* returns the number of registers one element takes, 0 for unknown types */
+static int Type_regs(const char* type, int row_major, int* pType) {
+	int r, c;
+	const char* p;
+	int i;
+
+	for (i = 0; i < s_nb_typedef; ++i) {
+		if (!strcmp(type, s_typedef[i].name)) {
+			return Type_regs(s_typedef[i].base, s_typedef[i].row_major, pType);
+		}
+	}
+	if (!strncmp(type, "sampler", 7)) {
+		*pType = E_PARAMTYPE_SMP;
+		return 1;
+	}
+	if (!strcmp(type, "bool")) {
+		*pType = E_PARAMTYPE_BOOL;
+		return 1;
+	}
+	if (!strncmp(type, "float", 5)) {
+		p = type + 5;
+		if (!*p) {
+			*pType = E_PARAMTYPE_FLOAT;
+			return 1;
+		}
+		*pType = E_PARAMTYPE_FVEC;
+	} else if (!strncmp(type, "int", 3)) {
+		p = type + 3;
+		if (!*p) {
+			*pType = E_PARAMTYPE_INT;
+			return 1;
+		}
+		*pType = E_PARAMTYPE_IVEC;
+	} else {
+		return 0;
+	}
+	if (p[1] != 'x') return 1;
+	r = p[0] - '0';
+	c = p[2] - '0';
+	/* matrices are column major unless declared otherwise, a register per column */
+	return row_major ? r : c;
+}
+
+static void Add_param(char* name, int type, int len) {
+	int i;
+	PARAM* pPrm;
+	if (!strncmp(name, "g_", 2)) name += 2;
+	for (i = 0; i < s_nb_param; ++i) {
+		pPrm = &s_param[i];
+		if (!strcmp(pPrm->name, name)) {
+			if (len > pPrm->len) pPrm->len = len;
+			return;
+		}
+	}
+	if (s_nb_param >= D_MAX_PARAM) return;
+	pPrm = &s_param[s_nb_param++];
+	strcpy(pPrm->name, name);
+	pPrm->type = type;
+	pPrm->len = len;
+	pPrm->offs = 0;
+}
+
+static void Parse_decl(char* p) {
+	char type[D_NAME_LEN];
+	char name[D_NAME_LEN];
+	int row_major, regs, kind, len;
+
+	row_major = 0;
+	p = Get_word(p, type);
+	if (!strcmp(type, "uniform")) p = Get_word(p, type);
+	if (!strcmp(type, "row_major") || !strcmp(type, "column_major")) {
+		row_major = type[0] == 'r';
+		p = Get_word(p, type);
+	}
+	p = Get_word(p, name);
+	if (strncmp(name, "g_", 2)) return;
+	p = Skip_ws(p);
+	if (*p == '(') return; /* function */
+	regs = Type_regs(type, row_major, &kind);
+	if (!regs) return;
+	len = 1;
+	if (*p == '[') {
+		len = Eval_len(p + 1);
+	}
+	Add_param(name, kind, regs * len);
+}
+
+static void Parse_typedef(char* p) {
+	TYPEDEF* pDef;
+	char word[D_NAME_LEN];
+	if (s_nb_typedef >= D_MAX_TYPEDEF) return;
+	pDef = &s_typedef[s_nb_typedef];
+	pDef->row_major = 0;
+	p = Get_word(p, word);
+	if (!strcmp(word, "row_major") || !strcmp(word, "column_major")) {
+		pDef->row_major = word[0] == 'r';
+		p = Get_word(p, word);
+	}
+	strcpy(pDef->base, word);
+	Get_word(p, pDef->name);
+	if (pDef->name[0]) ++s_nb_typedef;
+}
+
+static void Scan_file(const char* fname) {
+	int i;
+	FILE* f;
+	char path[512];
+	char line[1024];
+	char word[D_NAME_LEN];
+	char* p;
+	char* pEnd;
+
+	for (i = 0; i < s_nb_file; ++i) {
+		if (!strcmp(s_file[i], fname)) return;
+	}
+	if (s_nb_file >= D_MAX_FILE) return;
+	strncpy(s_file[s_nb_file], fname, D_NAME_LEN - 1);
+	++s_nb_file;
+
+	sprintf(path, "%s/%s", s_dir, fname);
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Can't open %s\n", path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (isspace((unsigned char)line[0])) continue; /* globals start at column 0 */
+		if (!strncmp(line, "#include", 8)) {
+			p = strchr(line, '"');
+			pEnd = p ? strchr(p + 1, '"') : NULL;
+			if (pEnd) {
+				*pEnd = 0;
+				Scan_file(p + 1);
+			}
+			continue;
+		}
+		p = Get_word(line, word);
+		if (!strcmp(word, "typedef")) {
+			Parse_typedef(p);
+		} else if (!strcmp(word, "extern")) {
+			Parse_decl(p);
+		} else if (!strncmp(word, "sampler", 7)) {
+			Parse_decl(line);
+		}
+	}
+	fclose(f);
+}
+
+static void Read_list(const char* fname, const char* prefix) {
+	FILE* f;
+	char line[256];
+	char name[D_NAME_LEN];
+	char src[D_NAME_LEN + 8];
+
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "Can't open %s\n", fname);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) && s_nb_prog < D_MAX_PROG) {
+		Get_word(line, name);
+		if (!name[0]) continue;
+		sprintf(s_prog[s_nb_prog], "%s_%s", prefix, name);
+		sprintf(src, "%s.hlsl", s_prog[s_nb_prog]);
+		Scan_file(src);
+		++s_nb_prog;
+	}
+	fclose(f);
+}
+
+static void Write_params() {
+	int i, t, offs;
+	PARAM* pPrm;
+
+	printf("typedef struct _RDR_GPARAM {\n");
+	for (t = 0; t < E_PARAMTYPE_MAX; ++t) {
+		offs = 0;
+		for (i = 0; i < s_nb_param; ++i) {
+			pPrm = &s_param[i];
+			if (pPrm->type != t) continue;
+			pPrm->offs = offs;
+			offs += pPrm->len;
+			switch (t) {
+				case E_PARAMTYPE_SMP: printf("\tRDR_SAMPLER %s", pPrm->name); break;
+				case E_PARAMTYPE_FLOAT: printf("\tfloat %s", pPrm->name); break;
+				case E_PARAMTYPE_INT: printf("\tsys_i32 %s", pPrm->name); break;
+				case E_PARAMTYPE_BOOL: printf("\tsys_byte %s", pPrm->name); break;
+				default: printf("\tUVEC %s", pPrm->name); break;
+			}
+			if (pPrm->len > 1 && t != E_PARAMTYPE_SMP) {
+				printf("[%d]", pPrm->len);
+			}
+			printf(";\n");
+		}
+	}
+	printf("} RDR_GPARAM;\n\n");
+
+	for (t = 0; t < E_PARAMTYPE_MAX; ++t) {
+		for (i = 0; i < s_nb_param; ++i) {
+			if (s_param[i].type == t) break;
+		}
+		if (i < s_nb_param) {
+			printf("#define D_RDR_GPTOP_%s D_FIELD_OFFS(RDR_GPARAM, %s)\n", s_type_name[t], s_param[i].name);
+		} else {
+			printf("#define D_RDR_GPTOP_%s (-1)\n", s_type_name[t]);
+		}
+	}
+	printf("\n");
+
+	for (t = 0; t < E_PARAMTYPE_MAX; ++t) {
+		for (i = 0; i < s_nb_param; ++i) {
+			pPrm = &s_param[i];
+			if (pPrm->type == t) {
+				printf("#define D_RDR_GP_%s (0x%X)\n", pPrm->name, pPrm->offs);
+			}
+		}
+	}
+}
+
+static void Write_progs(const char* prefix) {
+	int i, idx;
+	size_t n = strlen(prefix);
+	idx = 0;
+	printf("\n");
+	for (i = 0; i < s_nb_prog; ++i) {
+		if (!strncmp(s_prog[i], prefix, n)) {
+			printf("#define D_RDRPROG_%s (0x%X)\n", s_prog[i], idx);
+			++idx;
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 4) {
+		fprintf(stderr, "mkgparam <shader dir> <vtx list> <pix list>\n");
+		return 1;
+	}
+	s_dir = argv[1];
+	Read_list(argv[2], "vtx");
+	Read_list(argv[3], "pix");
+	Write_params();
+	Write_progs("vtx_");
+	Write_progs("pix_");
+	return 0;
+}
@@ -0,0 +1,457 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/*
+ * Render submission benchmark on the headless backend, no device and no data files.
+ * A synthetic scene of skinned characters (MDL_disp from jobs), a room (ROOM_disp)
+ * and repeated props is recorded and executed every frame; prints recording and
+ * exec time and the per-frame batch, state change and constant upload counts.
+ * -l sets the number of frames in flight (2..4), -o writes the last frame for rdr_replay.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "job.h"
+#include "calc.h"
+#include "util.h"
+#include "keyframe.h"
+#include "anim.h"
+#include "render.h"
+#include "material.h"
+#include "camera.h"
+#include "obstacle.h"
+#include "room.h"
+#include "model.h"
+#include "rdrstat.h"
+
+#define D_CROWD_DEF (32)
+#define D_PROP_DEF (256)
+#define D_FRAME_DEF (200)
+#define D_OMD_KIND (4)
+#define D_OMD_JNT (32)
+#define D_OMD_GRP (6)
+#define D_OMD_MTL (4)
+#define D_GRP_TRI (400)
+#define D_ROOM_GRP (100)
+#define D_ROOM_MTL (16)
+#define D_PROP_KIND (8)
+#define D_CROWD_JOB (16)
+
+typedef struct _BENCH_SCENE {
+	OMD* pOmd[D_OMD_KIND];
+	MODEL** ppMdl;
+	ROOM_MODEL rmd;
+	MTL_LIST* pProp_mtl;
+	RDR_VTX_BUFFER* pProp_vtx;
+	RDR_IDX_BUFFER* pProp_idx;
+	UVEC* pProp_pos;
+	int nb_mdl;
+	int nb_prop;
+	int frame;
+} BENCH_SCENE;
+
+typedef struct _BENCH_CROWD {
+	BENCH_SCENE* pScene;
+	int start;
+	int count;
+} BENCH_CROWD;
+
+static BENCH_SCENE s_scene;
+
+static void Usage() {
+	SYS_log("rdr_bench [-c characters] [-p props] [-f frames] [-l frames in flight] [-w workers] [-s none] [-o capture]\n");
+}
+
+static MTL_LIST* Mtl_create(int n) {
+	int i;
+	MTL_INFO info[D_ROOM_MTL];
+	sys_ui32 name_offs[D_ROOM_MTL];
+	char names[D_ROOM_MTL * 8];
+
+	n = D_MIN(n, D_ROOM_MTL);
+	memset(info, 0, sizeof(info));
+	for (i = 0; i < n; ++i) {
+		info[i].sun_dir.qv = V4_set(0.3f, -1.0f, 0.2f + 0.1f*i, 0.0f);
+		info[i].sun_color.qv = V4_set(1.0f, 0.9f, 0.8f, 1.0f);
+		info[i].sun_param.qv = V4_set(1.0f, 0.0f, 2.0f, 0.5f);
+		info[i].rim_color.qv = V4_set(0.2f, 0.2f, 0.3f, 1.0f);
+		info[i].rim_param.qv = V4_set(1.0f, 0.0f, 4.0f, 0.0f);
+		name_offs[i] = i * 8;
+		sprintf(&names[i * 8], "mtl%d", i);
+	}
+	return MTL_lst_create(info, name_offs, names, n);
+}
+
+/* a sphere per group around one of its joints, as the converter writes them */
+static OMD_CULL_HEAD* Omd_cull_create() {
+	int i, size, offs;
+	OMD_CULL_HEAD* pCull;
+	GEOM_SPHERE* pSph;
+	sys_byte* pJnt_id;
+	int grp_size = (int)D_ALIGN(sizeof(GEOM_SPHERE) + 1, 16);
+
+	offs = (int)D_ALIGN(sizeof(OMD_CULL_HEAD) + (D_OMD_GRP - 1) * sizeof(pCull->list[0]), 16);
+	size = offs + D_OMD_GRP * grp_size;
+	pCull = (OMD_CULL_HEAD*)SYS_malloc(size);
+	memset(pCull, 0, size);
+	pCull->data_size = size;
+	for (i = 0; i < D_OMD_GRP; ++i) {
+		pCull->list[i].offs = offs;
+		pCull->list[i].nb_jnt = 1;
+		pSph = (GEOM_SPHERE*)D_INCR_PTR(pCull, offs);
+		pSph->qv = V4_set(0.0f, 0.1f, 0.0f, 0.6f);
+		pJnt_id = (sys_byte*)(pSph + 1);
+		*pJnt_id = (sys_byte)(i * (D_OMD_JNT / D_OMD_GRP));
+		offs += grp_size;
+	}
+	return pCull;
+}
+
+static OMD* Omd_create(int kind) {
+	int i;
+	OMD* pOmd;
+	JNT_INFO* pInfo;
+	PRIM_GROUP* pGrp;
+
+	pOmd = (OMD*)SYS_malloc(sizeof(OMD));
+	memset(pOmd, 0, sizeof(OMD));
+	pOmd->nb_jnt = D_OMD_JNT;
+	pOmd->nb_grp = D_OMD_GRP;
+	pOmd->id = kind;
+	pOmd->pJnt_info = (JNT_INFO*)SYS_malloc(D_OMD_JNT * sizeof(JNT_INFO));
+	pOmd->pJnt_inv = (MTX*)SYS_malloc(D_OMD_JNT * sizeof(MTX));
+	pOmd->pGrp = (PRIM_GROUP*)SYS_malloc(D_OMD_GRP * sizeof(PRIM_GROUP));
+	memset(pOmd->pJnt_info, 0, D_OMD_JNT * sizeof(JNT_INFO));
+	for (i = 0; i < D_OMD_JNT; ++i) {
+		pInfo = &pOmd->pJnt_info[i];
+		pInfo->id = i;
+		pInfo->parent_id = i - 1;
+		pInfo->offs_len.qv = V4_set(0.0f, i ? 0.05f : 0.0f, 0.0f, 0.05f);
+		MTX_unit(pOmd->pJnt_inv[i]);
+	}
+	for (i = 0; i < D_OMD_GRP; ++i) {
+		pGrp = &pOmd->pGrp[i];
+		pGrp->base_color.qv = V4_set(0.8f, 0.7f, 0.6f, 1.0f);
+		pGrp->mtl_id = i % D_OMD_MTL;
+		pGrp->start = i * D_GRP_TRI * 3;
+		pGrp->count = D_GRP_TRI;
+	}
+	pOmd->pCull = Omd_cull_create();
+	pOmd->pMtl_lst = Mtl_create(D_OMD_MTL);
+	pOmd->pVtx = RDR_vtx_create(E_RDR_VTXTYPE_SKIN, D_OMD_GRP * D_GRP_TRI);
+	pOmd->pIdx = RDR_idx_create(E_RDR_IDXTYPE_16BIT, D_OMD_GRP * D_GRP_TRI * 3);
+	return pOmd;
+}
+
+static void Omd_destroy(OMD* pOmd) {
+	RDR_vtx_release(pOmd->pVtx);
+	RDR_idx_release(pOmd->pIdx);
+	MTL_lst_destroy(pOmd->pMtl_lst);
+	SYS_free(pOmd->pCull);
+	SYS_free(pOmd->pGrp);
+	SYS_free(pOmd->pJnt_inv);
+	SYS_free(pOmd->pJnt_info);
+	SYS_free(pOmd);
+}
+
+static void Room_create(ROOM_MODEL* pRmd) {
+	int i, x, z;
+	int side = 20;
+	int nb_bits = D_BIT_ARY_SIZE32(D_ROOM_GRP);
+
+	memset(pRmd, 0, sizeof(ROOM_MODEL));
+	pRmd->nb_grp = D_ROOM_GRP;
+	pRmd->base_color.qv = V4_fill(1.0f);
+	pRmd->pGrp = (RM_PRIM_GRP*)SYS_malloc(D_ROOM_GRP * sizeof(RM_PRIM_GRP));
+	pRmd->pGrp_bbox = (GEOM_AABB*)SYS_malloc(D_ROOM_GRP * sizeof(GEOM_AABB));
+	pRmd->pCull = (sys_ui32*)SYS_malloc(2 * nb_bits * sizeof(sys_ui32));
+	pRmd->pHide = pRmd->pCull + nb_bits;
+	memset(pRmd->pCull, 0, 2 * nb_bits * sizeof(sys_ui32));
+	for (i = 0; i < D_ROOM_GRP; ++i) {
+		x = i % side;
+		z = i / side;
+		pRmd->pGrp[i].mtl_id = (i * 7) % D_ROOM_MTL;
+		pRmd->pGrp[i].start = i * D_GRP_TRI * 3;
+		pRmd->pGrp[i].count = D_GRP_TRI;
+		pRmd->pGrp_bbox[i].min.qv = V4_set_pnt((float)(x - side/2) * 4.0f, 0.0f, (float)z * -4.0f);
+		pRmd->pGrp_bbox[i].max.qv = V4_add(pRmd->pGrp_bbox[i].min.qv, V4_set_vec(4.0f, 3.0f, 4.0f));
+	}
+	pRmd->pMtl_lst = Mtl_create(D_ROOM_MTL);
+	pRmd->pVtx = RDR_vtx_create(E_RDR_VTXTYPE_SOLID, D_ROOM_GRP * D_GRP_TRI);
+	pRmd->pIdx = RDR_idx_create(E_RDR_IDXTYPE_32BIT, D_ROOM_GRP * D_GRP_TRI * 3);
+}
+
+static void Room_destroy(ROOM_MODEL* pRmd) {
+	RDR_vtx_release(pRmd->pVtx);
+	RDR_idx_release(pRmd->pIdx);
+	MTL_lst_destroy(pRmd->pMtl_lst);
+	SYS_free(pRmd->pCull);
+	SYS_free(pRmd->pGrp_bbox);
+	SYS_free(pRmd->pGrp);
+}
+
+static void Scene_create(BENCH_SCENE* pScene, int nb_mdl, int nb_prop) {
+	int i, x, z;
+	int side = 32;
+
+	memset(pScene, 0, sizeof(BENCH_SCENE));
+	for (i = 0; i < D_OMD_KIND; ++i) {
+		pScene->pOmd[i] = Omd_create(i);
+	}
+	pScene->nb_mdl = nb_mdl;
+	pScene->ppMdl = (MODEL**)SYS_malloc(D_MAX(nb_mdl, 1) * sizeof(MODEL*));
+	for (i = 0; i < nb_mdl; ++i) {
+		x = i % side;
+		z = i / side;
+		pScene->ppMdl[i] = MDL_create(pScene->pOmd[i % D_OMD_KIND]);
+		pScene->ppMdl[i]->pos.qv = V4_set_pnt((float)(x - side/2) * 2.0f, 0.0f, (float)z * -2.0f);
+		pScene->ppMdl[i]->rot.y = (float)i;
+	}
+	Room_create(&pScene->rmd);
+	g_room.pRmd[0] = &pScene->rmd;
+
+	pScene->nb_prop = nb_prop;
+	pScene->pProp_mtl = Mtl_create(D_PROP_KIND);
+	pScene->pProp_vtx = RDR_vtx_create(E_RDR_VTXTYPE_SOLID, D_PROP_KIND * 24);
+	pScene->pProp_idx = RDR_idx_create(E_RDR_IDXTYPE_16BIT, D_PROP_KIND * 36);
+	pScene->pProp_pos = (UVEC*)SYS_malloc(D_MAX(nb_prop, 1) * sizeof(UVEC));
+	for (i = 0; i < nb_prop; ++i) {
+		pScene->pProp_pos[i].qv = V4_set_pnt(UTL_frand_11() * 40.0f, 0.0f, UTL_frand01() * -80.0f);
+	}
+}
+
+static void Scene_destroy(BENCH_SCENE* pScene) {
+	int i;
+	for (i = 0; i < pScene->nb_mdl; ++i) {
+		MDL_destroy(pScene->ppMdl[i]);
+	}
+	SYS_free(pScene->ppMdl);
+	for (i = 0; i < D_OMD_KIND; ++i) {
+		Omd_destroy(pScene->pOmd[i]);
+	}
+	g_room.pRmd[0] = NULL;
+	Room_destroy(&pScene->rmd);
+	RDR_vtx_release(pScene->pProp_vtx);
+	RDR_idx_release(pScene->pProp_idx);
+	MTL_lst_destroy(pScene->pProp_mtl);
+	SYS_free(pScene->pProp_pos);
+}
+
+static void Crowd_job(void* pData) {
+	int i;
+	MODEL* pMdl;
+	BENCH_CROWD* pCrowd = (BENCH_CROWD*)pData;
+	BENCH_SCENE* pScene = pCrowd->pScene;
+
+	for (i = 0; i < pCrowd->count; ++i) {
+		pMdl = pScene->ppMdl[pCrowd->start + i];
+		pMdl->rot.y += 0.01f;
+		pMdl->pJnt[1 + (pScene->frame % (D_OMD_JNT - 1))].rot.x += 0.02f;
+		MDL_calc_local(pMdl);
+		MDL_calc_world(pMdl);
+		MDL_disp(pMdl);
+	}
+}
+
+/* what a room prop does: ZBUF and MTL0 solid batches, only the world matrix differs within a kind */
+static void Prop_disp(BENCH_SCENE* pScene) {
+	int i, kind;
+	QMTX m;
+	UVEC* pWorld;
+	MATERIAL* pMtl;
+	RDR_BATCH* pBatch;
+	RDR_BATCH_PARAM* pParam;
+
+	for (i = 0; i < pScene->nb_prop; ++i) {
+		kind = i % D_PROP_KIND;
+		MTX_rot_y(m, (float)i);
+		V4_store(m[3], pScene->pProp_pos[i].qv);
+		MTX_transpose(m, m);
+		pWorld = RDR_get_val_v(3);
+		if (!pWorld) return;
+		pWorld[0].qv = V4_load(m[0]);
+		pWorld[1].qv = V4_load(m[1]);
+		pWorld[2].qv = V4_load(m[2]);
+
+		pBatch = RDR_get_batch();
+		if (!pBatch) return;
+		pBatch->vtx_prog = D_RDRPROG_vtx_solid_zbuf;
+		pBatch->pix_prog = D_RDRPROG_pix_zbuf;
+		pBatch->type = E_RDR_PRIMTYPE_TRILIST;
+		pBatch->pVtx = pScene->pProp_vtx;
+		pBatch->pIdx = pScene->pProp_idx;
+		pBatch->start = kind * 36;
+		pBatch->count = 12;
+		pBatch->depth = RDR_calc_depth(pScene->pProp_pos[i].qv);
+		pBatch->nb_param = 1;
+		pParam = RDR_get_param(pBatch->nb_param);
+		if (!pParam) return;
+		pBatch->pParam = pParam;
+		pParam->count = 3;
+		pParam->id.type = E_RDR_PARAMTYPE_FVEC;
+		pParam->id.offs = D_RDR_GP_world;
+		pParam->pVec = pWorld;
+		RDR_put_batch(pBatch, 0, E_RDR_LAYER_ZBUF);
+
+		pBatch = RDR_get_batch();
+		if (!pBatch) return;
+		pBatch->vtx_prog = D_RDRPROG_vtx_solid;
+		pBatch->pix_prog = D_RDRPROG_pix_toon;
+		pBatch->type = E_RDR_PRIMTYPE_TRILIST;
+		pBatch->pVtx = pScene->pProp_vtx;
+		pBatch->pIdx = pScene->pProp_idx;
+		pBatch->start = kind * 36;
+		pBatch->count = 12;
+		pMtl = &pScene->pProp_mtl->pMtl[kind];
+		pBatch->mtl_id = pMtl->sort_id;
+		pBatch->depth = RDR_calc_depth(pScene->pProp_pos[i].qv);
+		pBatch->draw_state.zwrite = 0;
+		pBatch->nb_param = 7;
+		pParam = RDR_get_param(pBatch->nb_param);
+		if (!pParam) return;
+		pBatch->pParam = pParam;
+		pParam->count = 3;
+		pParam->id.type = E_RDR_PARAMTYPE_FVEC;
+		pParam->id.offs = D_RDR_GP_world;
+		pParam->pVec = pWorld;
+		++pParam;
+		pParam->count = 1;
+		pParam->id.type = E_RDR_PARAMTYPE_FVEC;
+		pParam->id.offs = D_RDR_GP_base_color;
+		pParam->pVec = &pScene->rmd.base_color;
+		++pParam;
+		MTL_apply(pMtl, pParam);
+		RDR_put_batch(pBatch, 0, E_RDR_LAYER_MTL0);
+	}
+}
+
+static double Usec(sys_i64 ticks) {
+	return (double)ticks * 1.0e6 / (double)SYS_get_timestamp_freq();
+}
+
+int main(int argc, char* argv[]) {
+	int i, j, nb_mdl, nb_prop, nb_frame, nb_buf, nb_wrk, nb_job, nb_stat, sort_flg;
+	sys_i64 t0, t_rec, t_exec;
+	JOB job;
+	JOB_QUEUE* pQue;
+	BENCH_CROWD crowd[D_CROWD_JOB];
+	RDR_STATS sum;
+	const char* pCap_name;
+
+	nb_mdl = D_CROWD_DEF;
+	nb_prop = D_PROP_DEF;
+	nb_frame = D_FRAME_DEF;
+	nb_buf = 0;
+	nb_wrk = D_MAX_WORKERS;
+	sort_flg = 1;
+	pCap_name = NULL;
+	for (i = 1; i < argc; ++i) {
+		if (i + 1 < argc && !strcmp(argv[i], "-c")) {
+			nb_mdl = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-p")) {
+			nb_prop = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-f")) {
+			nb_frame = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-l")) {
+			nb_buf = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-w")) {
+			nb_wrk = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-o")) {
+			pCap_name = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "-s") && !strcmp(argv[i + 1], "none")) {
+			sort_flg = 0;
+			++i;
+		} else {
+			Usage();
+			return 1;
+		}
+	}
+	nb_mdl = D_MAX(nb_mdl, 0);
+	nb_prop = D_MAX(nb_prop, 0);
+	nb_frame = D_MAX(nb_frame, 2);
+
+	RDR_init(NULL, 1280, 720, 0);
+	if (nb_buf) {
+		RDR_set_nb_frame(nb_buf);
+	}
+	nb_buf = RDR_get_nb_frame();
+	nb_frame = D_MAX(nb_frame, nb_buf);
+	MTL_sys_init();
+	MDL_sys_init();
+	if (!sort_flg) {
+		for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			RDR_set_lyr_sort(i, E_RDR_SORT_NONE);
+		}
+	}
+	Scene_create(&s_scene, nb_mdl, nb_prop);
+
+	pQue = JOB_que_alloc(D_CROWD_JOB);
+	nb_job = 0;
+	for (i = 0; i < D_CROWD_JOB && nb_mdl > 0; ++i) {
+		crowd[i].pScene = &s_scene;
+		crowd[i].start = i * nb_mdl / D_CROWD_JOB;
+		crowd[i].count = (i + 1) * nb_mdl / D_CROWD_JOB - crowd[i].start;
+		if (crowd[i].count > 0) {
+			crowd[nb_job++] = crowd[i];
+		}
+	}
+
+	memset(&sum, 0, sizeof(sum));
+	nb_stat = 0;
+	t_rec = 0;
+	t_exec = 0;
+	for (i = 0; i < nb_frame; ++i) {
+		s_scene.frame = i;
+		if (pCap_name && i == nb_frame - 1) {
+			RDR_capture(pCap_name);
+		}
+		RDR_begin();
+		t0 = SYS_get_timestamp();
+		for (j = 0; j < nb_job; ++j) {
+			job.pData = &crowd[j];
+			job.func = Crowd_job;
+			JOB_put(pQue, &job);
+		}
+		JOB_schedule(pQue, nb_wrk);
+		ROOM_disp();
+		Prop_disp(&s_scene);
+		t_rec += SYS_get_timestamp() - t0;
+		t0 = SYS_get_timestamp();
+		RDR_exec();
+		t_exec += SYS_get_timestamp() - t0;
+		/* nothing is drawn until all the work buffers are taken */
+		if (i < nb_buf - 1) continue;
+		STAT_add(&sum);
+		++nb_stat;
+	}
+
+	SYS_log("%d characters, %d props, %d frames, %d in flight, %d workers, %s\n", nb_mdl, nb_prop, nb_frame, nb_buf, nb_wrk, sort_flg ? "sorted" : "unsorted");
+	SYS_log("record %.1f us/frame, exec %.1f us/frame\n", Usec(t_rec) / nb_frame, Usec(t_exec) / nb_frame);
+	STAT_print(&sum, nb_stat);
+
+	JOB_que_free(pQue);
+	Scene_destroy(&s_scene);
+	MDL_sys_reset();
+	MTL_sys_reset();
+	RDR_reset();
+	return 0;
+}
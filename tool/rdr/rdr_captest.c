@@ -0,0 +1,130 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/*
+ * Feeds RDR_replay_load a good capture and damaged copies of it, the copies must be refused.
+ *   rdr_captest <capture>
+ * Exits with 1 if the good one is refused or any damaged one is loaded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "calc.h"
+#include "render.h"
+#include "rdrcap.h"
+
+typedef enum _E_CAPTEST {
+	E_CAPTEST_PARAM_OFFS,
+	E_CAPTEST_PARAM_TYPE,
+	E_CAPTEST_PARAM_VAL,
+	E_CAPTEST_SORT,
+	E_CAPTEST_BATCH_PARAM,
+	E_CAPTEST_TRUNC,
+	E_CAPTEST_MAX
+} E_CAPTEST;
+
+static const char* s_test_name[E_CAPTEST_MAX] = {
+	"param offset", "param type", "param value", "layer sort", "batch params", "truncated"
+};
+
+/* returns the damaged size */
+static int Damage(RDR_CAP_HEAD* pHead, int size, E_CAPTEST test) {
+	RDR_CAP_PARAM* pPrm = (RDR_CAP_PARAM*)D_INCR_PTR(pHead, pHead->offs_param);
+	RDR_CAP_BATCH* pBatch = (RDR_CAP_BATCH*)D_INCR_PTR(pHead, pHead->offs_batch);
+
+	switch (test) {
+		case E_CAPTEST_PARAM_OFFS:
+			pPrm->id.offs = (1 << 13) - 1;
+			break;
+		case E_CAPTEST_PARAM_TYPE:
+			pPrm->id.type = 7;
+			break;
+		case E_CAPTEST_PARAM_VAL:
+			pPrm->val = pHead->nb_vec;
+			break;
+		case E_CAPTEST_SORT:
+			pHead->sort[0] = E_RDR_SORT_DEPTH + 1;
+			break;
+		case E_CAPTEST_BATCH_PARAM:
+			pBatch->param = pHead->nb_param;
+			pBatch->nb_param = 1;
+			break;
+		case E_CAPTEST_TRUNC:
+			size = pHead->offs_ent;
+			break;
+		default:
+			break;
+	}
+	return size;
+}
+
+int main(int argc, char* argv[]) {
+	int i, size, dmg_size, nb_fail;
+	char tmp_name[256];
+	RDR_CAP_HEAD* pHead;
+	RDR_CAP_HEAD* pWk;
+	RDR_REPLAY* pRep;
+
+	if (argc < 2) {
+		SYS_log("rdr_captest <capture>\n");
+		return 1;
+	}
+	RDR_init(NULL, 1280, 720, 0);
+	pHead = (RDR_CAP_HEAD*)SYS_load_ex(argv[1], &size);
+	pRep = RDR_replay_load(argv[1]);
+	if (!pHead || !pRep || !pHead->nb_batch || !pHead->nb_param) {
+		SYS_log("%s: no usable capture\n", argv[1]);
+		RDR_replay_free(pRep);
+		SYS_free(pHead);
+		RDR_reset();
+		return 1;
+	}
+	RDR_replay_free(pRep);
+
+	snprintf(tmp_name, sizeof(tmp_name), "%s.bad", argv[1]);
+	pWk = (RDR_CAP_HEAD*)SYS_malloc(size);
+	nb_fail = 0;
+	for (i = 0; i < E_CAPTEST_MAX; ++i) {
+		memcpy(pWk, pHead, size);
+		dmg_size = Damage(pWk, size, (E_CAPTEST)i);
+		if (!SYS_save(tmp_name, pWk, dmg_size)) {
+			SYS_log("Can't write %s\n", tmp_name);
+			++nb_fail;
+			break;
+		}
+		pRep = RDR_replay_load(tmp_name);
+		SYS_log("%-14s %s\n", s_test_name[i], pRep ? "LOADED" : "refused");
+		if (pRep) {
+			RDR_replay_free(pRep);
+			++nb_fail;
+		}
+	}
+	remove(tmp_name);
+	SYS_free(pWk);
+	SYS_free(pHead);
+	RDR_reset();
+	if (nb_fail) {
+		SYS_log("%d damaged captures loaded\n", nb_fail);
+	}
+	return nb_fail ? 1 : 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/*
+ * Replays a captured frame (RDR_capture, rdr_bench -o) on the headless backend.
+ * The frame is recorded again every iteration, then merged, sorted, instanced and executed;
+ * prints the times and per-frame counts as rdr_bench does.
+ *   rdr_replay <capture> [-f frames] [-l frames in flight] [-s none] [-k]
+ * -s none drops the captured sort modes, -k makes the keys again instead of using the captured ones.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "calc.h"
+#include "render.h"
+#include "rdrstat.h"
+
+#define D_FRAME_DEF (200)
+
+static void Usage() {
+	SYS_log("rdr_replay <capture> [-f frames] [-l frames in flight] [-s none] [-k]\n");
+}
+
+static double Usec(sys_i64 ticks) {
+	return (double)ticks * 1.0e6 / (double)SYS_get_timestamp_freq();
+}
+
+int main(int argc, char* argv[]) {
+	int i, nb_frame, nb_buf, nb_stat, sort_flg, rekey;
+	sys_i64 t0, t_rec, t_exec;
+	const char* pName;
+	RDR_REPLAY* pRep;
+	RDR_STATS sum;
+
+	pName = NULL;
+	nb_frame = D_FRAME_DEF;
+	nb_buf = 0;
+	sort_flg = 1;
+	rekey = 0;
+	for (i = 1; i < argc; ++i) {
+		if (i + 1 < argc && !strcmp(argv[i], "-f")) {
+			nb_frame = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-l")) {
+			nb_buf = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "-s") && !strcmp(argv[i + 1], "none")) {
+			sort_flg = 0;
+			++i;
+		} else if (!strcmp(argv[i], "-k")) {
+			rekey = 1;
+		} else if (argv[i][0] != '-' && !pName) {
+			pName = argv[i];
+		} else {
+			Usage();
+			return 1;
+		}
+	}
+	if (!pName) {
+		Usage();
+		return 1;
+	}
+	nb_frame = D_MAX(nb_frame, 2);
+
+	RDR_init(NULL, 1280, 720, 0);
+	if (nb_buf) {
+		RDR_set_nb_frame(nb_buf);
+	}
+	nb_buf = RDR_get_nb_frame();
+	nb_frame = D_MAX(nb_frame, nb_buf);
+	pRep = RDR_replay_load(pName);
+	if (!pRep) {
+		SYS_log("Can't load %s\n", pName);
+		RDR_reset();
+		return 1;
+	}
+	if (!sort_flg) {
+		for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+			RDR_set_lyr_sort(i, E_RDR_SORT_NONE);
+		}
+	}
+
+	memset(&sum, 0, sizeof(sum));
+	nb_stat = 0;
+	t_rec = 0;
+	t_exec = 0;
+	for (i = 0; i < nb_frame; ++i) {
+		RDR_begin();
+		t0 = SYS_get_timestamp();
+		RDR_replay_put(pRep, rekey);
+		t_rec += SYS_get_timestamp() - t0;
+		t0 = SYS_get_timestamp();
+		RDR_exec();
+		t_exec += SYS_get_timestamp() - t0;
+		/* nothing is drawn until all the work buffers are taken */
+		if (i < nb_buf - 1) continue;
+		STAT_add(&sum);
+		++nb_stat;
+	}
+
+	SYS_log("%s, %d frames, %d in flight, %s%s\n", pName, nb_frame, nb_buf, sort_flg ? "sorted" : "unsorted", rekey ? ", new keys" : "");
+	SYS_log("record %.1f us/frame, exec %.1f us/frame\n", Usec(t_rec) / nb_frame, Usec(t_exec) / nb_frame);
+	STAT_print(&sum, nb_stat);
+
+	RDR_replay_free(pRep);
+	RDR_reset();
+	return 0;
+}
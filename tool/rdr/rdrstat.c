@@ -0,0 +1,97 @@
+/*
+ * Kinnabari
+ * Copyright 2011 Sergey Chaban
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Sergey Chaban <sergey.chaban@gmail.com>
+ */
+
+/* per-frame averages of g_rdr_stats, shared by the bench and the replay */
+
+#include <string.h>
+
+#include "system.h"
+#include "calc.h"
+#include "render.h"
+#include "rdrstat.h"
+
+void STAT_add(RDR_STATS* pSum) {
+	int i;
+	RDR_LYR_STATS* pLyr;
+
+	for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+		pLyr = &pSum->lyr[i];
+		pLyr->nb_batch += g_rdr_stats.lyr[i].nb_batch;
+		pLyr->nb_pix_prog += g_rdr_stats.lyr[i].nb_pix_prog;
+		pLyr->nb_vtx_prog += g_rdr_stats.lyr[i].nb_vtx_prog;
+		pLyr->nb_vtx_buf += g_rdr_stats.lyr[i].nb_vtx_buf;
+		pLyr->nb_mtl += g_rdr_stats.lyr[i].nb_mtl;
+		pLyr->nb_inst_draw += g_rdr_stats.lyr[i].nb_inst_draw;
+		pLyr->nb_inst += g_rdr_stats.lyr[i].nb_inst;
+	}
+	for (i = 0; i < E_RDR_CALL_MAX; ++i) {
+		pSum->call.issued[i] += g_rdr_stats.call.issued[i];
+		pSum->call.skipped[i] += g_rdr_stats.call.skipped[i];
+	}
+	pSum->call.nb_const_vec += g_rdr_stats.call.nb_const_vec;
+	pSum->frame.latency += g_rdr_stats.frame.latency;
+	pSum->frame.wait += g_rdr_stats.frame.wait;
+	pSum->frame.nb_in_flight += g_rdr_stats.frame.nb_in_flight;
+	for (i = 0; i < E_RDR_POOL_MAX; ++i) {
+		pSum->pool.peak[i] = D_MAX(pSum->pool.peak[i], g_rdr_stats.pool.peak[i]);
+		pSum->pool.size[i] = D_MAX(pSum->pool.size[i], g_rdr_stats.pool.size[i]);
+		pSum->pool.nb_fail[i] += g_rdr_stats.pool.nb_fail[i];
+	}
+	pSum->cull.nb_cast += g_rdr_stats.cull.nb_cast;
+	pSum->cull.nb_cast_culled += g_rdr_stats.cull.nb_cast_culled;
+	pSum->cull.nb_recv += g_rdr_stats.cull.nb_recv;
+	pSum->cull.nb_recv_culled += g_rdr_stats.cull.nb_recv_culled;
+}
+
+void STAT_print(RDR_STATS* pSum, int nb_frame) {
+	static const char* call_name[E_RDR_CALL_MAX] = {"rs", "prog", "vb", "ib", "smp", "tex", "const_f", "const_i", "const_b"};
+	static const char* lyr_name[E_RDR_LAYER_MAX] = {"ZBUF", "CAST", "MTL0", "MTL1", "RECV", "MTL2", "PTCL"};
+	static const char* pool_name[E_RDR_POOL_MAX] = {"batch", "param", "value", "bin", "layer"};
+	int i;
+	sys_ui32 nb_issued, nb_skipped;
+	RDR_LYR_STATS* pLyr;
+
+	if (nb_frame <= 0) return;
+	SYS_log("per frame   draws  pix prog  vtx prog   VB  mtl  inst draws  inst\n");
+	for (i = 0; i < E_RDR_LAYER_MAX; ++i) {
+		pLyr = &pSum->lyr[i];
+		if (!pLyr->nb_batch) continue;
+		SYS_log("  %-6s %8u %9u %9u %4u %4u %11u %5u\n", lyr_name[i],
+		        pLyr->nb_batch / nb_frame, pLyr->nb_pix_prog / nb_frame, pLyr->nb_vtx_prog / nb_frame,
+		        pLyr->nb_vtx_buf / nb_frame, pLyr->nb_mtl / nb_frame, pLyr->nb_inst_draw / nb_frame, pLyr->nb_inst / nb_frame);
+	}
+	nb_issued = 0;
+	nb_skipped = 0;
+	for (i = 0; i < E_RDR_CALL_MAX; ++i) {
+		SYS_log("  %-8s issued %7u skipped %7u\n", call_name[i], pSum->call.issued[i] / nb_frame, pSum->call.skipped[i] / nb_frame);
+		nb_issued += pSum->call.issued[i];
+		nb_skipped += pSum->call.skipped[i];
+	}
+	SYS_log("calls issued %u, skipped %u, constant registers sent %u per frame\n",
+	        nb_issued / nb_frame, nb_skipped / nb_frame, pSum->call.nb_const_vec / nb_frame);
+	SYS_log("latency %.3f ms, wait %.3f ms, %.2f frames in flight\n",
+	        pSum->frame.latency / nb_frame, pSum->frame.wait / nb_frame, (float)pSum->frame.nb_in_flight / nb_frame);
+	SYS_log("shadow casters %u put, %u culled, receivers %u put, %u culled per frame\n",
+	        pSum->cull.nb_cast / nb_frame, pSum->cull.nb_cast_culled / nb_frame, pSum->cull.nb_recv / nb_frame, pSum->cull.nb_recv_culled / nb_frame);
+	SYS_log("work pools   peak  reserved  dropped\n");
+	for (i = 0; i < E_RDR_POOL_MAX; ++i) {
+		SYS_log("  %-6s %7u %9u %8u\n", pool_name[i], pSum->pool.peak[i], pSum->pool.size[i], pSum->pool.nb_fail[i]);
+	}
+}